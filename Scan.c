@@ -0,0 +1,1040 @@
+/*
+ * This file was generated automatically by ExtUtils::ParseXS version 3.45 from the
+ * contents of Scan.xs. Do not edit this file, edit Scan.xs instead.
+ *
+ *    ANY CHANGES MADE HERE WILL BE LOST!
+ *
+ */
+
+#line 1 "Scan.xs"
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+#include "ppport.h"
+
+// If we are on MSVC, disable some stupid MSVC warnings
+#ifdef _MSC_VER
+# pragma warning( disable: 4996 )
+# pragma warning( disable: 4127 )
+# pragma warning( disable: 4711 )
+#endif
+
+// Headers for stat support
+#ifdef _MSC_VER
+# include <windows.h>
+#else
+# include <sys/stat.h>
+#endif
+
+#include "common.c"
+#include "ape.c"
+#include "id3.c"
+
+#include "aac.c"
+#include "asf.c"
+#include "mac.c"
+#include "mp3.c"
+#include "mp4.c"
+#include "mpc.c"
+#include "ogg.c"
+#include "opus.c"
+#include "wav.c"
+#include "flac.c"
+#include "wavpack.c"
+#include "dsf.c"
+#include "dsdiff.c"
+
+#include "md5.c"
+#include "jenkins_hash.c"
+
+#define FILTER_TYPE_INFO 0x01
+#define FILTER_TYPE_TAGS 0x02
+
+#define MD5_BUFFER_SIZE 4096
+
+#define MAX_PATH_STR_LEN 1024
+
+struct _types {
+  char *type;
+  char *suffix[15];
+};
+
+typedef struct {
+  char*	type;
+  int (*get_tags)(PerlIO *infile, char *file, HV *info, HV *tags);
+  int (*get_fileinfo)(PerlIO *infile, char *file, HV *tags);
+  int (*find_frame)(PerlIO *infile, char *file, int offset);
+  int (*find_frame_return_info)(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+  int (*write_tags)(PerlIO *infile, char *file, HV *tags, HV *opts, HV *result);
+} taghandler;
+
+struct _types audio_types[] = {
+  {"mp4", {"mp4", "m4a", "m4b", "m4p", "m4v", "m4r", "k3g", "skm", "3gp", "3g2", "mov", 0}},
+  {"aac", {"aac", "adts", 0}},
+  {"mp3", {"mp3", "mp2", 0}},
+  {"ogg", {"ogg", "oga", 0}},
+  {"opus", {"opus", 0}},
+  {"mpc", {"mpc", "mp+", "mpp", 0}},
+  {"ape", {"ape", "apl", 0}},
+  {"flc", {"flc", "flac", "fla", 0}},
+  {"asf", {"wma", "asf", "wmv", 0}},
+  {"wav", {"wav", "aif", "aiff", "w64", "rf64", "bw64", 0}},
+  {"wvp", {"wv", 0}},
+  {"dsf", {"dsf", 0}},
+  {"dff", {"dff", 0}},
+  {0, {0, 0}}
+};
+
+static taghandler taghandlers[] = {
+  { "mp4", get_mp4tags, 0, mp4_find_frame, mp4_find_frame_return_info, mp4_write_tags },
+  { "aac", get_aacinfo, 0, 0, 0 },
+  { "mp3", get_mp3tags, get_mp3fileinfo, mp3_find_frame, 0, id3_write_tags },
+  { "ogg", get_ogg_metadata, 0, ogg_find_frame, 0 },
+  { "opus", get_opus_metadata, 0, opus_find_frame, 0 },
+  { "mpc", get_ape_metadata, get_mpcfileinfo, mpc_find_frame, mpc_find_frame_return_info },
+  { "ape", get_ape_metadata, get_macfileinfo, mac_find_frame, mac_find_frame_return_info },
+  { "flc", get_flac_metadata, 0, flac_find_frame, flac_find_frame_return_info, flac_write_tags },
+  { "asf", get_asf_metadata, 0, asf_find_frame, asf_find_frame_return_info },
+  { "wav", get_wav_metadata, 0, wav_find_frame, wav_find_frame_return_info },
+  { "wvp", get_ape_metadata, get_wavpack_info, wavpack_find_frame, wavpack_find_frame_return_info },
+  { "dsf", get_dsf_metadata, 0, dsf_find_frame, dsf_find_frame_return_info },
+  { "dff", get_dsdiff_metadata, 0, dsdiff_find_frame, dsdiff_find_frame_return_info },
+  { NULL, 0, 0, 0 }
+};
+
+static taghandler *
+_get_taghandler(char *suffix)
+{
+  int typeindex = -1;
+  int i, j;
+  taghandler *hdl = NULL;
+  
+  for (i=0; typeindex==-1 && audio_types[i].type; i++) {
+    for (j=0; typeindex==-1 && audio_types[i].suffix[j]; j++) {
+#ifdef _MSC_VER
+      if (!stricmp(audio_types[i].suffix[j], suffix)) {
+#else
+      if (!strcasecmp(audio_types[i].suffix[j], suffix)) {
+#endif
+        typeindex = i;
+        break;
+      }
+    }
+  }
+    
+  if (typeindex > -1) {
+    for (hdl = taghandlers; hdl->type; ++hdl)
+      if (!strcmp(hdl->type, audio_types[typeindex].type))
+        break;
+  }
+  
+  return hdl;
+}
+
+static void
+_generate_md5(PerlIO *infile, const char *file, int size, int start_offset, HV *info)
+{
+  md5_state_t md5;
+  md5_byte_t digest[16];
+  char hexdigest[33];
+  Buffer buf;
+  int audio_offset, audio_size, di;
+  
+  buffer_init(&buf, MD5_BUFFER_SIZE);
+  md5_init(&md5);
+  
+  audio_offset = SvIV(*(my_hv_fetch(info, "audio_offset")));
+  audio_size = SvIV(*(my_hv_fetch(info, "audio_size")));
+  
+  if (!start_offset) {
+    // Read bytes from middle of file to reduce chance of silence generating false matches
+    start_offset = audio_offset;
+    start_offset += (audio_size / 2) - (size / 2);
+    if (start_offset < audio_offset)
+      start_offset = audio_offset;
+  }
+  
+  if (size >= audio_size) {
+    size = audio_size;
+  }
+  
+  DEBUG_TRACE("Using %d bytes for audio MD5, starting at %d\n", size, start_offset);
+  
+  if (PerlIO_seek(infile, start_offset, SEEK_SET) < 0) {
+    warn("Audio::Scan unable to determine MD5 for %s\n", file);
+    goto out;
+  }
+  
+  while (size > 0) {
+    if ( !_check_buf(infile, &buf, 1, MIN(size, MD5_BUFFER_SIZE)) ) {
+      warn("Audio::Scan unable to determine MD5 for %s\n", file);
+      goto out;
+    }
+    
+    md5_append(&md5, buffer_ptr(&buf), buffer_len(&buf));
+    
+    size -= buffer_len(&buf);
+    buffer_consume(&buf, buffer_len(&buf));
+    DEBUG_TRACE("%d bytes left\n", size);
+  }
+  
+  md5_finish(&md5, digest);
+  
+  for (di = 0; di < 16; ++di)
+    sprintf(hexdigest + di * 2, "%02x", digest[di]);
+  
+  my_hv_store(info, "audio_md5", newSVpvn(hexdigest, 32));
+  
+out:
+  buffer_free(&buf);
+}
+
+static uint32_t
+_generate_hash(const char *file)
+{
+  char hashstr[MAX_PATH_STR_LEN];
+  int mtime = 0;
+  uint64_t size = 0;
+  uint32_t hash;
+
+#ifdef _MSC_VER
+  BOOL fOk;
+  WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+
+  fOk = GetFileAttributesEx(file, GetFileExInfoStandard, (void *)&fileInfo);
+  mtime = fileInfo.ftLastWriteTime.dwLowDateTime;
+  size = (uint64_t)fileInfo.nFileSizeLow;
+#else
+  struct stat buf;
+
+  if (stat(file, &buf) != -1) {
+    mtime = (int)buf.st_mtime;
+    size = (uint64_t)buf.st_size;
+  }
+#endif
+
+  memset(hashstr, 0, sizeof(hashstr));
+  snprintf(hashstr, sizeof(hashstr) - 1, "%s%d%llu", file, mtime, size);
+  hash = hashlittle(hashstr, strlen(hashstr), 0);
+  
+  return hash;
+}
+
+#line 225 "Scan.c"
+#ifndef PERL_UNUSED_VAR
+#  define PERL_UNUSED_VAR(var) if (0) var = var
+#endif
+
+#ifndef dVAR
+#  define dVAR		dNOOP
+#endif
+
+
+/* This stuff is not part of the API! You have been warned. */
+#ifndef PERL_VERSION_DECIMAL
+#  define PERL_VERSION_DECIMAL(r,v,s) (r*1000000 + v*1000 + s)
+#endif
+#ifndef PERL_DECIMAL_VERSION
+#  define PERL_DECIMAL_VERSION \
+	  PERL_VERSION_DECIMAL(PERL_REVISION,PERL_VERSION,PERL_SUBVERSION)
+#endif
+#ifndef PERL_VERSION_GE
+#  define PERL_VERSION_GE(r,v,s) \
+	  (PERL_DECIMAL_VERSION >= PERL_VERSION_DECIMAL(r,v,s))
+#endif
+#ifndef PERL_VERSION_LE
+#  define PERL_VERSION_LE(r,v,s) \
+	  (PERL_DECIMAL_VERSION <= PERL_VERSION_DECIMAL(r,v,s))
+#endif
+
+/* XS_INTERNAL is the explicit static-linkage variant of the default
+ * XS macro.
+ *
+ * XS_EXTERNAL is the same as XS_INTERNAL except it does not include
+ * "STATIC", ie. it exports XSUB symbols. You probably don't want that
+ * for anything but the BOOT XSUB.
+ *
+ * See XSUB.h in core!
+ */
+
+
+/* TODO: This might be compatible further back than 5.10.0. */
+#if PERL_VERSION_GE(5, 10, 0) && PERL_VERSION_LE(5, 15, 1)
+#  undef XS_EXTERNAL
+#  undef XS_INTERNAL
+#  if defined(__CYGWIN__) && defined(USE_DYNAMIC_LOADING)
+#    define XS_EXTERNAL(name) __declspec(dllexport) XSPROTO(name)
+#    define XS_INTERNAL(name) STATIC XSPROTO(name)
+#  endif
+#  if defined(__SYMBIAN32__)
+#    define XS_EXTERNAL(name) EXPORT_C XSPROTO(name)
+#    define XS_INTERNAL(name) EXPORT_C STATIC XSPROTO(name)
+#  endif
+#  ifndef XS_EXTERNAL
+#    if defined(HASATTRIBUTE_UNUSED) && !defined(__cplusplus)
+#      define XS_EXTERNAL(name) void name(pTHX_ CV* cv __attribute__unused__)
+#      define XS_INTERNAL(name) STATIC void name(pTHX_ CV* cv __attribute__unused__)
+#    else
+#      ifdef __cplusplus
+#        define XS_EXTERNAL(name) extern "C" XSPROTO(name)
+#        define XS_INTERNAL(name) static XSPROTO(name)
+#      else
+#        define XS_EXTERNAL(name) XSPROTO(name)
+#        define XS_INTERNAL(name) STATIC XSPROTO(name)
+#      endif
+#    endif
+#  endif
+#endif
+
+/* perl >= 5.10.0 && perl <= 5.15.1 */
+
+
+/* The XS_EXTERNAL macro is used for functions that must not be static
+ * like the boot XSUB of a module. If perl didn't have an XS_EXTERNAL
+ * macro defined, the best we can do is assume XS is the same.
+ * Dito for XS_INTERNAL.
+ */
+#ifndef XS_EXTERNAL
+#  define XS_EXTERNAL(name) XS(name)
+#endif
+#ifndef XS_INTERNAL
+#  define XS_INTERNAL(name) XS(name)
+#endif
+
+/* Now, finally, after all this mess, we want an ExtUtils::ParseXS
+ * internal macro that we're free to redefine for varying linkage due
+ * to the EXPORT_XSUB_SYMBOLS XS keyword. This is internal, use
+ * XS_EXTERNAL(name) or XS_INTERNAL(name) in your code if you need to!
+ */
+
+#undef XS_EUPXS
+#if defined(PERL_EUPXS_ALWAYS_EXPORT)
+#  define XS_EUPXS(name) XS_EXTERNAL(name)
+#else
+   /* default to internal */
+#  define XS_EUPXS(name) XS_INTERNAL(name)
+#endif
+
+#ifndef PERL_ARGS_ASSERT_CROAK_XS_USAGE
+#define PERL_ARGS_ASSERT_CROAK_XS_USAGE assert(cv); assert(params)
+
+/* prototype to pass -Wmissing-prototypes */
+STATIC void
+S_croak_xs_usage(const CV *const cv, const char *const params);
+
+STATIC void
+S_croak_xs_usage(const CV *const cv, const char *const params)
+{
+    const GV *const gv = CvGV(cv);
+
+    PERL_ARGS_ASSERT_CROAK_XS_USAGE;
+
+    if (gv) {
+        const char *const gvname = GvNAME(gv);
+        const HV *const stash = GvSTASH(gv);
+        const char *const hvname = stash ? HvNAME(stash) : NULL;
+
+        if (hvname)
+	    Perl_croak_nocontext("Usage: %s::%s(%s)", hvname, gvname, params);
+        else
+	    Perl_croak_nocontext("Usage: %s(%s)", gvname, params);
+    } else {
+        /* Pants. I don't think that it should be possible to get here. */
+	Perl_croak_nocontext("Usage: CODE(0x%" UVxf ")(%s)", PTR2UV(cv), params);
+    }
+}
+#undef  PERL_ARGS_ASSERT_CROAK_XS_USAGE
+
+#define croak_xs_usage        S_croak_xs_usage
+
+#endif
+
+/* NOTE: the prototype of newXSproto() is different in versions of perls,
+ * so we define a portable version of newXSproto()
+ */
+#ifdef newXS_flags
+#define newXSproto_portable(name, c_impl, file, proto) newXS_flags(name, c_impl, file, proto, 0)
+#else
+#define newXSproto_portable(name, c_impl, file, proto) (PL_Sv=(SV*)newXS(name, c_impl, file), sv_setpv(PL_Sv, proto), (CV*)PL_Sv)
+#endif /* !defined(newXS_flags) */
+
+#if PERL_VERSION_LE(5, 21, 5)
+#  define newXS_deffile(a,b) Perl_newXS(aTHX_ a,b,file)
+#else
+#  define newXS_deffile(a,b) Perl_newXS_deffile(aTHX_ a,b)
+#endif
+
+#line 369 "Scan.c"
+
+XS_EUPXS(XS_Audio__Scan__scan); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__scan)
+{
+    dVAR; dXSARGS;
+    if (items != 7)
+       croak_xs_usage(cv,  "char *, suffix, infile, path, filter, md5_size, md5_offset");
+    {
+	HV *	RETVAL;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+	int	filter = (int)SvIV(ST(4))
+;
+	int	md5_size = (int)SvIV(ST(5))
+;
+	int	md5_offset = (int)SvIV(ST(6))
+;
+#line 220 "Scan.xs"
+{
+  taghandler *hdl;
+  RETVAL = newHV();
+
+  // don't leak
+  sv_2mortal( (SV*)RETVAL );
+
+  hdl = _get_taghandler(suffix);
+
+  if (hdl) {
+    HV *info = newHV();
+
+    // Ignore filter if a file type has only one function (FLAC/Ogg)
+    if ( !hdl->get_fileinfo ) {
+      filter = FILTER_TYPE_INFO | FILTER_TYPE_TAGS;
+    }
+
+    if ( hdl->get_fileinfo && (filter & FILTER_TYPE_INFO) ) {
+      hdl->get_fileinfo(infile, SvPVX(path), info);
+    }
+
+    if ( hdl->get_tags && (filter & FILTER_TYPE_TAGS) ) {
+      HV *tags = newHV();
+      hdl->get_tags(infile, SvPVX(path), info, tags);
+      hv_store( RETVAL, "tags", 4, newRV_noinc( (SV *)tags ), 0 );
+    }
+
+    // Generate audio MD5 value
+    if ( md5_size > 0
+      && my_hv_exists(info, "audio_offset")
+      && my_hv_exists(info, "audio_size")
+      && !my_hv_exists(info, "audio_md5")
+    ) {
+      _generate_md5(infile, SvPVX(path), md5_size, md5_offset, info);
+    }
+
+    // Generate hash value
+    my_hv_store(info, "jenkins_hash", newSVuv( _generate_hash(SvPVX(path)) ));
+
+    // Info may be used in tag function, i.e. to find tag version
+    hv_store( RETVAL, "info", 4, newRV_noinc( (SV *)info ), 0 );
+  }
+  else {
+    croak("Audio::Scan unsupported file type: %s (%s)", suffix, SvPVX(path));
+  }
+}
+#line 438 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan__find_frame); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__find_frame)
+{
+    dVAR; dXSARGS;
+    if (items != 5)
+       croak_xs_usage(cv,  "char *, suffix, infile, path, offset");
+    {
+	int	RETVAL;
+	dXSTARG;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+	int	offset = (int)SvIV(ST(4))
+;
+#line 272 "Scan.xs"
+{
+  taghandler *hdl;
+
+  RETVAL = -1;
+  hdl = _get_taghandler(suffix);
+
+  if (hdl && hdl->find_frame) {
+    RETVAL = hdl->find_frame(infile, SvPVX(path), offset);
+  }
+}
+#line 478 "Scan.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan__find_frame_return_info); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__find_frame_return_info)
+{
+    dVAR; dXSARGS;
+    if (items < 5 || items > 6)
+       croak_xs_usage(cv,  "char *, suffix, infile, path, offset, opts= NULL");
+    {
+	HV *	RETVAL;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+	int	offset = (int)SvIV(ST(4))
+;
+	SV *	opts;
+
+	if (items < 6)
+	    opts = NULL;
+	else {
+	    opts = ST(5)
+;
+	}
+#line 288 "Scan.xs"
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+
+  if (hdl && hdl->find_frame_return_info) {
+    hdl->find_frame_return_info(infile, SvPVX(path), offset, RETVAL, opts_hv);
+  }
+}
+#line 525 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan__write_tags); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__write_tags)
+{
+    dVAR; dXSARGS;
+    if (items < 5 || items > 6)
+       croak_xs_usage(cv,  "char *, suffix, infile, path, tags, opts= NULL");
+    {
+	HV *	RETVAL;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+	SV *	tags = ST(4)
+;
+	SV *	opts;
+
+	if (items < 6)
+	    opts = NULL;
+	else {
+	    opts = ST(5)
+;
+	}
+#line 308 "Scan.xs"
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+
+  if ( hdl && hdl->write_tags && SvROK(tags) && SvTYPE(SvRV(tags)) == SVt_PVHV ) {
+    hdl->write_tags(infile, SvPVX(path), (HV *)SvRV(tags), opts_hv, RETVAL);
+  }
+}
+#line 576 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan__box_tree); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__box_tree)
+{
+    dVAR; dXSARGS;
+    if (items != 4)
+       croak_xs_usage(cv,  "char *, suffix, infile, path");
+    {
+	HV *	RETVAL;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+#line 328 "Scan.xs"
+{
+  taghandler *hdl = _get_taghandler(suffix);
+
+  if ( !hdl || strcmp(hdl->type, "mp4") ) {
+    XSRETURN_UNDEF;
+  }
+
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+
+  mp4_box_tree(infile, SvPVX(path), RETVAL);
+}
+#line 615 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan__frame_index); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__frame_index)
+{
+    dVAR; dXSARGS;
+    if (items < 4 || items > 5)
+       croak_xs_usage(cv,  "char *, suffix, infile, path, opts= NULL");
+    {
+	HV *	RETVAL;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+	SV *	opts;
+
+	if (items < 5)
+	    opts = NULL;
+	else {
+	    opts = ST(4)
+;
+	}
+#line 346 "Scan.xs"
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+
+  if ( !hdl || strcmp(hdl->type, "flc") ) {
+    XSRETURN_UNDEF;
+  }
+
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+
+  flac_frame_index(infile, SvPVX(path), RETVAL, opts_hv);
+}
+#line 667 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan__dop); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__dop)
+{
+    dVAR; dXSARGS;
+    if (items < 5 || items > 6)
+       croak_xs_usage(cv,  "char *, suffix, infile, path, offset, opts= NULL");
+    {
+	HV *	RETVAL;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+	int	offset = (int)SvIV(ST(4))
+;
+	SV *	opts;
+
+	if (items < 6)
+	    opts = NULL;
+	else {
+	    opts = ST(5)
+;
+	}
+#line 369 "Scan.xs"
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+  int err = -1;
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+
+  if ( hdl && !strcmp(hdl->type, "dsf") ) {
+    err = dsf_dop(infile, SvPVX(path), offset, RETVAL, opts_hv);
+  }
+  else if ( hdl && !strcmp(hdl->type, "dff") ) {
+    err = dsdiff_dop(infile, SvPVX(path), offset, RETVAL, opts_hv);
+  }
+
+  if (err) {
+    XSRETURN_UNDEF;
+  }
+}
+#line 726 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan__block_index); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__block_index)
+{
+    dVAR; dXSARGS;
+    if (items < 4 || items > 5)
+       croak_xs_usage(cv,  "char *, suffix, infile, path, opts= NULL");
+    {
+	HV *	RETVAL;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+	SV *	opts;
+
+	if (items < 5)
+	    opts = NULL;
+	else {
+	    opts = ST(4)
+;
+	}
+#line 397 "Scan.xs"
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+
+  if ( !hdl || strcmp(hdl->type, "wvp") ) {
+    XSRETURN_UNDEF;
+  }
+
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+
+  wavpack_block_index(infile, SvPVX(path), RETVAL, opts_hv);
+}
+#line 778 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan__pcm_analysis); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan__pcm_analysis)
+{
+    dVAR; dXSARGS;
+    if (items != 4)
+       croak_xs_usage(cv,  "char *, suffix, infile, path");
+    {
+	HV *	RETVAL;
+	char *	suffix = (char *)SvPV_nolen(ST(1))
+;
+	PerlIO *	infile = IoIFP(sv_2io(ST(2)))
+;
+	SV *	path = ST(3)
+;
+#line 420 "Scan.xs"
+{
+  taghandler *hdl = _get_taghandler(suffix);
+
+  if ( !hdl || strcmp(hdl->type, "wav") ) {
+    XSRETURN_UNDEF;
+  }
+
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+
+  wav_pcm_analysis(infile, SvPVX(path), RETVAL);
+}
+#line 817 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan_has_flac); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan_has_flac)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "void");
+    {
+	int	RETVAL;
+	dXSTARG;
+#line 438 "Scan.xs"
+{
+  RETVAL = 1;
+}
+#line 842 "Scan.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan_is_supported); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan_is_supported)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "char *, path");
+    {
+	int	RETVAL;
+	dXSTARG;
+	SV *	path = ST(1)
+;
+#line 447 "Scan.xs"
+{
+  char *suffix = strrchr( SvPVX(path), '.' );
+
+  if (suffix != NULL && *suffix == '.' && _get_taghandler(suffix + 1)) {
+    RETVAL = 1;
+  }
+  else {
+    RETVAL = 0;
+  }
+}
+#line 872 "Scan.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan_type_for); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan_type_for)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "char *, suffix");
+    {
+	SV *	RETVAL;
+	SV *	suffix = ST(1)
+;
+#line 463 "Scan.xs"
+{
+  taghandler *hdl = NULL;
+  char *suff = SvPVX(suffix);
+
+  if (suff == NULL || *suff == '\0') {
+    RETVAL = newSV(0);
+  }
+  else {
+    hdl = _get_taghandler(suff);
+    if (hdl == NULL) {
+      RETVAL = newSV(0);
+    }
+    else {
+      RETVAL = newSVpv(hdl->type, 0);
+    }
+  }
+}
+#line 908 "Scan.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan_get_types); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan_get_types)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "void");
+    {
+	AV *	RETVAL;
+#line 486 "Scan.xs"
+{
+  int i;
+
+  RETVAL = newAV();
+  sv_2mortal((SV*)RETVAL);
+  for (i = 0; audio_types[i].type; i++) {
+    av_push(RETVAL, newSVpv(audio_types[i].type, 0));
+  }
+}
+#line 934 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Audio__Scan_extensions_for); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Audio__Scan_extensions_for)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "char *, type");
+    {
+	AV *	RETVAL;
+	SV *	type = ST(1)
+;
+#line 501 "Scan.xs"
+{
+  int i, j;
+  char *t = SvPVX(type);
+
+  RETVAL = newAV();
+  sv_2mortal((SV*)RETVAL);
+  for (i = 0; audio_types[i].type; i++) {
+#ifdef _MSC_VER
+    if (!stricmp(audio_types[i].type, t)) {
+#else
+    if (!strcasecmp(audio_types[i].type, t)) {
+#endif
+
+      for (j = 0; audio_types[i].suffix[j]; j++) {
+        av_push(RETVAL, newSVpv(audio_types[i].suffix[j], 0));
+      }
+      break;
+
+    }
+  }
+}
+#line 978 "Scan.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+#ifdef __cplusplus
+extern "C"
+#endif
+XS_EXTERNAL(boot_Audio__Scan); /* prototype to pass -Wmissing-prototypes */
+XS_EXTERNAL(boot_Audio__Scan)
+{
+#if PERL_VERSION_LE(5, 21, 5)
+    dVAR; dXSARGS;
+#else
+    dVAR; dXSBOOTARGSXSAPIVERCHK;
+#endif
+#if PERL_VERSION_LE(5, 8, 999) /* PERL_VERSION_LT is 5.33+ */
+    char* file = __FILE__;
+#else
+    const char* file = __FILE__;
+#endif
+
+    PERL_UNUSED_VAR(file);
+
+    PERL_UNUSED_VAR(cv); /* -W */
+    PERL_UNUSED_VAR(items); /* -W */
+#if PERL_VERSION_LE(5, 21, 5)
+    XS_VERSION_BOOTCHECK;
+#  ifdef XS_APIVERSION_BOOTCHECK
+    XS_APIVERSION_BOOTCHECK;
+#  endif
+#endif
+
+        newXS_deffile("Audio::Scan::_scan", XS_Audio__Scan__scan);
+        newXS_deffile("Audio::Scan::_find_frame", XS_Audio__Scan__find_frame);
+        newXS_deffile("Audio::Scan::_find_frame_return_info", XS_Audio__Scan__find_frame_return_info);
+        newXS_deffile("Audio::Scan::_write_tags", XS_Audio__Scan__write_tags);
+        newXS_deffile("Audio::Scan::_box_tree", XS_Audio__Scan__box_tree);
+        newXS_deffile("Audio::Scan::_frame_index", XS_Audio__Scan__frame_index);
+        newXS_deffile("Audio::Scan::_dop", XS_Audio__Scan__dop);
+        newXS_deffile("Audio::Scan::_block_index", XS_Audio__Scan__block_index);
+        newXS_deffile("Audio::Scan::_pcm_analysis", XS_Audio__Scan__pcm_analysis);
+        newXS_deffile("Audio::Scan::has_flac", XS_Audio__Scan_has_flac);
+        newXS_deffile("Audio::Scan::is_supported", XS_Audio__Scan_is_supported);
+        newXS_deffile("Audio::Scan::type_for", XS_Audio__Scan_type_for);
+        newXS_deffile("Audio::Scan::get_types", XS_Audio__Scan_get_types);
+        newXS_deffile("Audio::Scan::extensions_for", XS_Audio__Scan_extensions_for);
+#if PERL_VERSION_LE(5, 21, 5)
+#  if PERL_VERSION_GE(5, 9, 0)
+    if (PL_unitcheckav)
+        call_list(PL_scopestack_ix, PL_unitcheckav);
+#  endif
+    XSRETURN_YES;
+#else
+    Perl_xs_boot_epilog(aTHX_ ax);
+#endif
+}
+
@@ -56,7 +56,8 @@ typedef struct {
   int (*get_tags)(PerlIO *infile, char *file, HV *info, HV *tags);
   int (*get_fileinfo)(PerlIO *infile, char *file, HV *tags);
   int (*find_frame)(PerlIO *infile, char *file, int offset);
-  int (*find_frame_return_info)(PerlIO *infile, char *file, int offset, HV *info);
+  int (*find_frame_return_info)(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+  int (*write_tags)(PerlIO *infile, char *file, HV *tags, HV *opts, HV *result);
 } taghandler;
 
 struct _types audio_types[] = {
@@ -69,7 +70,7 @@ struct _types audio_types[] = {
   {"ape", {"ape", "apl", 0}},
   {"flc", {"flc", "flac", "fla", 0}},
   {"asf", {"wma", "asf", "wmv", 0}},
-  {"wav", {"wav", "aif", "aiff", 0}},
+  {"wav", {"wav", "aif", "aiff", "w64", "rf64", "bw64", 0}},
   {"wvp", {"wv", 0}},
   {"dsf", {"dsf", 0}},
   {"dff", {"dff", 0}},
@@ -77,19 +78,19 @@ struct _types audio_types[] = {
 };
 
 static taghandler taghandlers[] = {
-  { "mp4", get_mp4tags, 0, mp4_find_frame, mp4_find_frame_return_info },
+  { "mp4", get_mp4tags, 0, mp4_find_frame, mp4_find_frame_return_info, mp4_write_tags },
   { "aac", get_aacinfo, 0, 0, 0 },
-  { "mp3", get_mp3tags, get_mp3fileinfo, mp3_find_frame, 0 },
+  { "mp3", get_mp3tags, get_mp3fileinfo, mp3_find_frame, 0, id3_write_tags },
   { "ogg", get_ogg_metadata, 0, ogg_find_frame, 0 },
   { "opus", get_opus_metadata, 0, opus_find_frame, 0 },
-  { "mpc", get_ape_metadata, get_mpcfileinfo, 0, 0 },
-  { "ape", get_ape_metadata, get_macfileinfo, 0, 0 },
-  { "flc", get_flac_metadata, 0, flac_find_frame, 0 },
-  { "asf", get_asf_metadata, 0, asf_find_frame, 0 },
-  { "wav", get_wav_metadata, 0, 0, 0 },
-  { "wvp", get_ape_metadata, get_wavpack_info, 0 },
-  { "dsf", get_dsf_metadata, 0, 0, 0 },
-  { "dff", get_dsdiff_metadata, 0, 0, 0 },
+  { "mpc", get_ape_metadata, get_mpcfileinfo, mpc_find_frame, mpc_find_frame_return_info },
+  { "ape", get_ape_metadata, get_macfileinfo, mac_find_frame, mac_find_frame_return_info },
+  { "flc", get_flac_metadata, 0, flac_find_frame, flac_find_frame_return_info, flac_write_tags },
+  { "asf", get_asf_metadata, 0, asf_find_frame, asf_find_frame_return_info },
+  { "wav", get_wav_metadata, 0, wav_find_frame, wav_find_frame_return_info },
+  { "wvp", get_ape_metadata, get_wavpack_info, wavpack_find_frame, wavpack_find_frame_return_info },
+  { "dsf", get_dsf_metadata, 0, dsf_find_frame, dsf_find_frame_return_info },
+  { "dff", get_dsdiff_metadata, 0, dsdiff_find_frame, dsdiff_find_frame_return_info },
   { NULL, 0, 0, 0 }
 };
 
@@ -282,20 +283,155 @@ OUTPUT:
   RETVAL
 
 HV *
-_find_frame_return_info( char *, char *suffix, PerlIO *infile, SV *path, int offset )
+_find_frame_return_info( char *, char *suffix, PerlIO *infile, SV *path, int offset, SV *opts = NULL )
 CODE:
 {
   taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
   RETVAL = newHV();
   sv_2mortal((SV*)RETVAL);
   
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+  
   if (hdl && hdl->find_frame_return_info) {
-    hdl->find_frame_return_info(infile, SvPVX(path), offset, RETVAL);
+    hdl->find_frame_return_info(infile, SvPVX(path), offset, RETVAL, opts_hv);
+  }
+}
+OUTPUT:
+  RETVAL
+
+HV *
+_write_tags( char *, char *suffix, PerlIO *infile, SV *path, SV *tags, SV *opts = NULL )
+CODE:
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+  
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+  
+  if ( hdl && hdl->write_tags && SvROK(tags) && SvTYPE(SvRV(tags)) == SVt_PVHV ) {
+    hdl->write_tags(infile, SvPVX(path), (HV *)SvRV(tags), opts_hv, RETVAL);
   }
 }
 OUTPUT:
   RETVAL
 
+HV *
+_box_tree( char *, char *suffix, PerlIO *infile, SV *path )
+CODE:
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  
+  if ( !hdl || strcmp(hdl->type, "mp4") ) {
+    XSRETURN_UNDEF;
+  }
+  
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+  
+  mp4_box_tree(infile, SvPVX(path), RETVAL);
+}
+OUTPUT:
+  RETVAL
+
+HV *
+_frame_index( char *, char *suffix, PerlIO *infile, SV *path, SV *opts = NULL )
+CODE:
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+  
+  if ( !hdl || strcmp(hdl->type, "flc") ) {
+    XSRETURN_UNDEF;
+  }
+  
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+  
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+  
+  flac_frame_index(infile, SvPVX(path), RETVAL, opts_hv);
+}
+OUTPUT:
+  RETVAL
+
+HV *
+_dop( char *, char *suffix, PerlIO *infile, SV *path, int offset, SV *opts = NULL )
+CODE:
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+  int err = -1;
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+  
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+  
+  if ( hdl && !strcmp(hdl->type, "dsf") ) {
+    err = dsf_dop(infile, SvPVX(path), offset, RETVAL, opts_hv);
+  }
+  else if ( hdl && !strcmp(hdl->type, "dff") ) {
+    err = dsdiff_dop(infile, SvPVX(path), offset, RETVAL, opts_hv);
+  }
+  
+  if (err) {
+    XSRETURN_UNDEF;
+  }
+}
+OUTPUT:
+  RETVAL
+
+HV *
+_block_index( char *, char *suffix, PerlIO *infile, SV *path, SV *opts = NULL )
+CODE:
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  HV *opts_hv = NULL;
+  
+  if ( !hdl || strcmp(hdl->type, "wvp") ) {
+    XSRETURN_UNDEF;
+  }
+  
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+  
+  if ( opts && SvROK(opts) && SvTYPE(SvRV(opts)) == SVt_PVHV ) {
+    opts_hv = (HV *)SvRV(opts);
+  }
+  
+  wavpack_block_index(infile, SvPVX(path), RETVAL, opts_hv);
+}
+OUTPUT:
+  RETVAL
+
+HV *
+_pcm_analysis( char *, char *suffix, PerlIO *infile, SV *path )
+CODE:
+{
+  taghandler *hdl = _get_taghandler(suffix);
+  
+  if ( !hdl || strcmp(hdl->type, "wav") ) {
+    XSRETURN_UNDEF;
+  }
+  
+  RETVAL = newHV();
+  sv_2mortal((SV*)RETVAL);
+  
+  wav_pcm_analysis(infile, SvPVX(path), RETVAL);
+}
+OUTPUT:
+  RETVAL
+
 int
 has_flac(void)
 CODE:
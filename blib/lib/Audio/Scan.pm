@@ -0,0 +1,1592 @@
+package Audio::Scan;
+
+use strict;
+
+our $VERSION = '1.02';
+
+require XSLoader;
+XSLoader::load('Audio::Scan', $VERSION);
+
+use constant FILTER_INFO_ONLY => 1;
+use constant FILTER_TAGS_ONLY => 2;
+
+sub scan_info {
+    my ( $class, $path, $opts ) = @_;
+
+    $opts ||= {};
+    $opts->{filter} = FILTER_INFO_ONLY;
+
+    $class->scan( $path, $opts );
+}
+
+sub scan_tags {
+    my ( $class, $path, $opts ) = @_;
+
+    $opts ||= {};
+    $opts->{filter} = FILTER_TAGS_ONLY;
+
+    $class->scan( $path, $opts );
+}
+
+sub scan {
+    my ( $class, $path, $opts ) = @_;
+
+    my ($filter, $md5_size, $md5_offset);
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    if ( defined $opts ) {
+        if ( !ref $opts ) {
+            # Back-compat to support filter as normal argument
+            warn "The Audio::Scan::scan() filter passing method is deprecated, please pass a hashref instead.\n";
+            $filter = $opts;
+        }
+        else {
+            $filter     = $opts->{filter} || FILTER_INFO_ONLY | FILTER_TAGS_ONLY;
+            $md5_size   = $opts->{md5_size};
+            $md5_offset = $opts->{md5_offset};
+        }
+    }
+
+    if ( !defined $filter ) {
+        $filter = FILTER_INFO_ONLY | FILTER_TAGS_ONLY;
+    }
+
+    my $ret = $class->_scan( $suffix, $fh, $path, $filter, $md5_size || 0, $md5_offset || 0 );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub scan_fh {
+    my ( $class, $suffix, $fh, $opts ) = @_;
+
+    my ($filter, $md5_size, $md5_offset);
+
+    binmode $fh;
+
+    if ( defined $opts ) {
+        if ( !ref $opts ) {
+            # Back-compat to support filter as normal argument
+            warn "The Audio::Scan::scan_fh() filter passing method is deprecated, please pass a hashref instead.\n";
+            $filter = $opts;
+        }
+        else {
+            $filter     = $opts->{filter} || FILTER_INFO_ONLY | FILTER_TAGS_ONLY;
+            $md5_size   = $opts->{md5_size};
+            $md5_offset = $opts->{md5_offset};
+        }
+    }
+
+    if ( !defined $filter ) {
+        $filter = FILTER_INFO_ONLY | FILTER_TAGS_ONLY;
+    }
+
+    return $class->_scan( $suffix, $fh, '(filehandle)', $filter, $md5_size || 0, $md5_offset || 0 );
+}
+
+sub find_frame {
+    my ( $class, $path, $offset ) = @_;
+
+    if ( ref $offset eq 'HASH' ) {
+        my $info = $class->find_frame_return_info( $path, $offset->{offset} || 0, _track_opts($offset) );
+        return $info && defined $info->{seek_offset} ? $info->{seek_offset} : -1;
+    }
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return -1 if !$suffix;
+
+    my $ret = $class->_find_frame( $suffix, $fh, $path, $offset );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub find_frame_fh {
+    my ( $class, $suffix, $fh, $offset ) = @_;
+
+    if ( ref $offset eq 'HASH' ) {
+        my $info = $class->find_frame_fh_return_info( $suffix, $fh, $offset->{offset} || 0, _track_opts($offset) );
+        return $info && defined $info->{seek_offset} ? $info->{seek_offset} : -1;
+    }
+
+    binmode $fh;
+
+    return $class->_find_frame( $suffix, $fh, '(filehandle)', $offset );
+}
+
+sub _track_opts {
+    my $target = shift;
+
+    return {
+        track => $target->{track},
+        ( defined $target->{index} ? ( index => $target->{index} ) : () ),
+    };
+}
+
+sub find_frame_return_info {
+    my ( $class, $path, $offset, $opts ) = @_;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    my $ret = $class->_find_frame_return_info( $suffix, $fh, $path, $offset, $opts );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub find_frame_fh_return_info {
+    my ( $class, $suffix, $fh, $offset, $opts ) = @_;
+
+    binmode $fh;
+
+    return $class->_find_frame_return_info( $suffix, $fh, '(filehandle)', $offset, $opts );
+}
+
+sub find_frame_range {
+    my ( $class, $path, $start, $end, $opts ) = @_;
+
+    return $class->find_frame_return_info( $path, $start, { %{ $opts || {} }, end_offset => $end } );
+}
+
+sub find_frame_fh_range {
+    my ( $class, $suffix, $fh, $start, $end, $opts ) = @_;
+
+    return $class->find_frame_fh_return_info( $suffix, $fh, $start, { %{ $opts || {} }, end_offset => $end } );
+}
+
+sub box_tree {
+    my ( $class, $path ) = @_;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my $ret = $class->_box_tree( $suffix, $fh, $path );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub box_tree_fh {
+    my ( $class, $suffix, $fh ) = @_;
+
+    binmode $fh;
+
+    return $class->_box_tree( $suffix, $fh, '(filehandle)' );
+}
+
+sub frame_index {
+    my ( $class, $path, $opts ) = @_;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my $ret = $class->_frame_index( $suffix, $fh, $path, $opts );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub frame_index_fh {
+    my ( $class, $suffix, $fh, $opts ) = @_;
+
+    binmode $fh;
+
+    return $class->_frame_index( $suffix, $fh, '(filehandle)', $opts );
+}
+
+sub block_index {
+    my ( $class, $path, $opts ) = @_;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my $ret = $class->_block_index( $suffix, $fh, $path, $opts );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub block_index_fh {
+    my ( $class, $suffix, $fh, $opts ) = @_;
+
+    binmode $fh;
+
+    return $class->_block_index( $suffix, $fh, '(filehandle)', $opts );
+}
+
+sub dop {
+    my ( $class, $path, $offset, $opts ) = @_;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    my $ret = $class->_dop( $suffix, $fh, $path, $offset, $opts );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub dop_fh {
+    my ( $class, $suffix, $fh, $offset, $opts ) = @_;
+
+    binmode $fh;
+
+    return $class->_dop( $suffix, $fh, '(filehandle)', $offset, $opts );
+}
+
+sub pcm_analysis {
+    my ( $class, $path ) = @_;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my $ret = $class->_pcm_analysis( $suffix, $fh, $path );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub pcm_analysis_fh {
+    my ( $class, $suffix, $fh ) = @_;
+
+    binmode $fh;
+
+    return $class->_pcm_analysis( $suffix, $fh, '(filehandle)' );
+}
+
+sub write_tags {
+    my ( $class, $path, $tags, $opts ) = @_;
+
+    open my $fh, '+<', $path or do {
+        warn "Could not open $path for writing: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    my $ret = $suffix ? $class->_write_tags( $suffix, $fh, $path, $tags, $opts ) : {};
+
+    if ( !exists $ret->{in_place} ) {
+        close $fh;
+        return;
+    }
+
+    if ( !$ret->{in_place} ) {
+        # The new tags don't fit, copy the audio after the new header into a new file
+        my $header = delete $ret->{header};
+        my $offset = delete $ret->{source_offset};
+        my $tmp    = "$path.tmp$$";
+        my $mode   = ( stat $fh )[2];
+
+        my $ok = open my $out, '>', $tmp;
+        if ($ok) {
+            binmode $out;
+            $ok = print {$out} $header;
+            $ok &&= seek $fh, $offset, 0;
+
+            while ($ok) {
+                my $read = read $fh, my $buf, 1024 * 1024;
+
+                # undef is a read error, not the end of the file
+                if ( !defined $read ) {
+                    $ok = 0;
+                    last;
+                }
+
+                last if !$read;
+
+                $ok = print {$out} $buf;
+            }
+
+            $ok = close($out) && $ok;
+
+            # Keep the permissions of the original file
+            $ok &&= chmod $mode & 07777, $tmp if defined $mode;
+        }
+
+        close $fh;
+
+        if ( !$ok || !rename $tmp, $path ) {
+            warn "Could not rewrite $path: $!\n";
+            unlink $tmp;
+            return;
+        }
+
+        return $ret;
+    }
+
+    close $fh;
+
+    return $ret;
+}
+
+1;
+__END__
+
+=head1 NAME
+
+Audio::Scan - Fast C metadata and tag reader for all common audio file formats
+
+=head1 SYNOPSIS
+
+    use Audio::Scan;
+
+    my $data = Audio::Scan->scan('/path/to/file.mp3');
+
+    # Just file info
+    my $info = Audio::Scan->scan_info('/path/to/file.mp3');
+
+    # Just tags
+    my $tags = Audio::Scan->scan_tags('/path/to/file.mp3');
+
+    # Scan without reading (possibly large) artwork into memory.
+    # Instead of binary artwork data, the size of the artwork will be returned instead.
+    {
+        local $ENV{AUDIO_SCAN_NO_ARTWORK} = 1;
+        my $data = Audio::Scan->scan('/path/to/file.mp3');
+    }
+
+    # Scan a filehandle
+    open my $fh, '<', 'my.mp3';
+    my $data = Audio::Scan->scan_fh( mp3 => $fh );
+    close $fh;
+
+    # Scan and compute an audio MD5 checksum
+    my $data = Audio::Scan->scan( '/path/to/file.mp3', { md5_size => 100 * 1024 } );
+    my $md5 = $data->{info}->{audio_md5};
+
+=head1 DESCRIPTION
+
+Audio::Scan is a C-based scanner for audio file metadata and tag information. It currently
+supports MP3, MP4, Ogg Vorbis, FLAC, ASF, WAV, AIFF, Musepack, Monkey's Audio, and WavPack.
+
+See below for specific details about each file format.
+
+=head1 METHODS
+
+=head2 scan( $path, [ \%OPTIONS ] )
+
+Scans $path for both metadata and tag information.  The type of scan performed is
+determined by the file's extension.  Supported extensions are:
+
+    MP3:  mp3, mp2
+    MP4:  mp4, m4a, m4b, m4p, m4v, m4r, k3g, skm, 3gp, 3g2, mov
+    AAC (ADTS): aac
+    Ogg:  ogg, oga
+    FLAC: flc, flac, fla
+    ASF:  wma, wmv, asf
+    Musepack:  mpc, mpp, mp+
+    Monkey's Audio:  ape, apl
+    WAV: wav, w64, rf64, bw64
+    AIFF: aiff, aif
+    WavPack: wv
+
+This method returns a hashref containing two other hashrefs: info and tags.  The
+contents of the info and tag hashes vary depending on file format, see below for details.
+
+An optional hashref may be provided with the following values:
+
+    md5_size => $audio_bytes_to_checksum
+
+An MD5 will be computed of the first N audio bytes. Any tags in the file are automatically
+skipped, so this is a useful way of determining if a file's audio content is the same even
+if tags may have been changed.  The hex MD5 value is returned in the $info->{audio_md5}
+key.  This option will reduce performance, so choose a small enough size that works for you,
+you should probably avoid using more than 64K for example.
+
+For FLAC files that already contain an MD5 checksum, this value will be used instead
+of calculating a new one.
+
+    md5_offset => $offset
+
+Begin computing the audio_md5 value starting at $offset.  If this value is not specified,
+$offset defaults to a point in the middle of the file.
+
+=head2 scan_info( $path, [ \%OPTIONS ] )
+
+If you only need file metadata and don't care about tags, you can use this method.
+
+=head2 scan_tags( $path, [ \%OPTIONS ] )
+
+If you only need the tags and don't care about the metadata, use this method.
+
+=head2 scan_fh( $type => $fh, [ \%OPTIONS ] )
+
+Scans a filehandle. $type is the type of file to scan as, i.e. "mp3" or "ogg".
+Note that FLAC does not support reading from a filehandle.
+
+=head2 find_frame( $path, $timestamp_in_ms )
+
+Returns the byte offset to the first audio frame starting from the given timestamp
+(in milliseconds).
+
+For FLAC files with a CUESHEET, the timestamp may instead be a hashref naming a
+track, with an optional index (1 by default) and offset in milliseconds from it:
+
+    my $offset = Audio::Scan->find_frame( $file, { track => 2, offset => 30000 } );
+
+-1 is returned if the file has no such track or index.
+
+=over 4
+
+=item MP3, Ogg, FLAC, ASF, MP4
+
+The byte offset to the data packet containing this timestamp will be returned. For
+file formats that don't provide timestamp information such as MP3, the best estimate for
+the location of the timestamp will be returned.  This will be more accurate if the
+file has a Xing header or is CBR for example.
+
+=item WAV, AIFF, DSF, DSDIFF
+
+The offset is calculated from the bitrate without reading any audio. WAV and AIFF
+offsets are rounded down to block_align, DSF offsets to the start of a block for each
+channel, and DSDIFF offsets to a byte for each channel. Offsets past 2GB are only
+returned by C<find_frame_return_info>.
+
+=item WavPack
+
+The offset of the block containing the timestamp. The position is guessed from the
+file size and narrowed down by reading the block headers found there, then the last
+few blocks are walked using their sizes. For multichannel files the first block of
+the group is returned. Files older than WavPack 4 are not supported.
+
+=item Musepack
+
+For SV8 files, the offset of the audio packet containing the timestamp. The packet is
+found from the closest point in the seek table, or by hopping over the packets from the
+first one if the file has no seek table. For SV7 files the frame lengths are walked
+from the start of the file, and the offset is the 32-bit word the frame starts in.
+
+=item Monkey's Audio
+
+The offset of the frame containing the timestamp, from the seek table after the header.
+Frames don't have to start on a 32-bit word, so the offset is rounded down to the word
+the frame starts in.
+
+=back
+
+=head2 find_frame_return_info( $mp4_path, $timestamp_in_ms, [ \%OPTIONS ] )
+
+The header of an MP4 file contains various metadata that refers to the structure of
+the audio data, making seeking more difficult to perform. This method will return
+the usual $info hash with 2 additional keys:
+
+    seek_offset - The seek offset in bytes
+    seek_header - A rewritten MP4 header that can be prepended to the audio data
+                  found at seek_offset to construct a valid bitstream. Specifically,
+                  the following boxes are rewritten: stts, stsc, stsz, stco
+
+For example, to seek 30 seconds into a file and write out a new MP4 file seeked to
+this point:
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30000 );
+
+    open my $f, '<', $file;
+    sysseek $f, $info->{seek_offset}, 1;
+
+    open my $fh, '>', 'seeked.m4a';
+    print $fh $info->{seek_header};
+
+    while ( sysread( $f, my $buf, 65536 ) ) {
+        print $fh $buf;
+    }
+
+    close $f;
+    close $fh;
+
+An optional hashref may be provided with the following values:
+
+    scatter => 1
+
+Instead of seek_header, return the rewritten header as a scatter list. Boxes that
+are unchanged (including the remaining stsz entries) are not read into memory but
+are returned as ranges of the original file, which is much cheaper for long files.
+
+    seek_header_parts - An array of header fragments, each element is either a
+                        string of bytes to write, or an arrayref of
+                        [ $file_offset, $length ] to copy from the original file.
+    seek_header_size  - The total length of the header described by seek_header_parts.
+
+For example, to write the header with writev/sendfile-style I/O:
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30000, { scatter => 1 } );
+
+    for my $part ( @{ $info->{seek_header_parts} } ) {
+        if ( ref $part ) {
+            my ( $offset, $length ) = @{$part};
+            # sendfile( $socket, $f, $offset, $length )
+        }
+        else {
+            # syswrite( $socket, $part )
+        }
+    }
+
+    # followed by the audio data from $info->{seek_offset}
+
+    track_id => $id
+
+For files with more than one track, such as HD-AAC or files with a chapter track,
+seek in the audio track with the given ID (see the tracks array in the scan result).
+By default the first audio track is used. The rewritten header contains only this
+track, and the ID of the track is returned as seek_track_id. If the track doesn't
+exist or isn't an audio track, seek_offset will be -1.
+
+    adts => 1
+
+For AAC audio, return the audio starting at the seek point as an ADTS stream instead
+of a rewritten header, for players that can only handle raw ADTS. No header is
+rewritten and no audio is read, the stream is returned as a scatter list of 7-byte
+ADTS headers and [ $file_offset, $length ] ranges of raw AAC frames:
+
+    adts_parts       - The ADTS stream, in the same format as seek_header_parts.
+    adts_size        - The total length of the ADTS stream.
+    adts_frames      - The number of frames in adts_parts.
+    adts_next_sample - If max_frames was reached, the sample number to pass as
+                       start_sample to get the following frames.
+
+The following options may be used together with adts:
+
+    max_frames => $count
+
+Return at most $count frames, to send a long file in smaller pieces.
+
+    start_sample => $sample
+
+Start at the given sample (frame) number instead of the timestamp.
+
+When used with C<find_frame_range>, the ADTS stream ends at the end of the clip.
+Only AAC Main, LC, SSR and LTP (including HE-AAC with an LC core) can be framed
+as ADTS, for other files seek_offset will be -1.
+
+For FLAC files, seek_header contains the fLaC marker and a STREAMINFO block to send
+before the frames at seek_offset. total_samples is reduced by the number of samples
+skipped and the MD5 is cleared, since it no longer applies. If the file has a
+SEEKTABLE, it follows with the points before the seek point removed and the rest
+made relative to it. One option is supported:
+
+    seektable => $seektable
+
+Seek using the given SEEKTABLE block instead of the one in the file, such as the
+seektable_block returned by C<frame_index>.
+
+    track => $track_number, index => $index_number
+
+Seek relative to a CUESHEET track instead of the start of the file. The timestamp
+is added to the position of the track's index (INDEX 01 if index is not given).
+seek_offset is -1 if the cuesheet has no such track or index.
+
+For ASF (WMA) files, seek_offset is the offset of the data packet containing the
+timestamp and seek_packet is its number. seek_header contains the Header object and
+the start of the Data object to send before the packets from seek_offset. In File
+Properties, the file size and data packets count only cover the remaining packets
+and the play and send durations are reduced by the send time of the seek packet.
+The Data object size and packet count are set the same way. The packets themselves
+are not changed, and no index objects follow the data. seek_offset is -1 if the
+header is truncated or too damaged to be rewritten.
+
+For WAV and AIFF files, seek_header contains the file up to the start of the audio,
+with the RIFF/FORM and data/SSND chunk sizes reduced to the remaining audio. The sample
+count in a fact or COMM chunk is reduced the same way, and for RF64, BW64 and Wave64
+files the sizes in the ds64 chunk or the 64-bit chunk headers are rewritten.
+
+For DSF files, seek_header contains the DSD, fmt and data chunks with the file size,
+sample count and data size reduced to the remaining blocks. The metadata pointer is
+cleared since the ID3 tag is not part of the seeked stream. For DSDIFF files,
+seek_header contains the chunks before the sound data with the FRM8 and DSD chunk sizes
+reduced to the remaining data.
+
+For WavPack files, seek_sample is the first sample of the block at seek_offset. Each
+block can be decoded on its own, so there is no seek_header. The following option is
+available:
+
+    seektable => $seektable
+
+Start from the closest points of a seektable returned by C<block_index>, so only a few
+blocks around the timestamp are read.
+
+For Musepack files, seek_frame is the first frame at seek_offset. SV7 frames are not
+byte-aligned and are stored in 32-bit little-endian words, so seek_offset is the word
+containing the frame and seek_bit is the bit in that word, counted from the most
+significant bit, where the frame starts.
+
+For Monkey's Audio files, seek_frame is the frame at seek_offset and seek_skip_samples
+is the number of samples to drop from the start of the frame to reach the timestamp.
+Frames are read as 32-bit words counted from the first frame, so seek_offset is the
+word containing the frame and seek_bit is where the frame starts in that word. Files
+older than 3.81 also store the bit offset of each frame, which is included in seek_bit.
+
+=head2 find_frame_range( $mp4_path, $start_in_ms, $end_in_ms, [ \%OPTIONS ] )
+
+Like C<find_frame_return_info>, but the rewritten header only describes the samples
+between $start_in_ms and $end_in_ms, and the durations in the mvhd, tkhd and mdhd
+boxes and the size of mdat are set to match. One additional key is returned:
+
+    seek_length - The number of bytes of audio data to copy starting at seek_offset
+
+The header followed by these bytes is a complete file containing only the clip,
+for example a 30-second preview:
+
+    my $info = Audio::Scan->find_frame_range( $file, 60000, 90000 );
+
+    open my $f, '<', $file;
+    sysseek $f, $info->{seek_offset}, 0;
+    sysread $f, my $audio, $info->{seek_length};
+
+    open my $fh, '>', 'preview.m4a';
+    print $fh $info->{seek_header} . $audio;
+
+The same options as C<find_frame_return_info> are supported.
+
+=head2 find_frame_fh( $type => $fh, $offset )
+
+Same as C<find_frame>, but with a filehandle.
+
+=head2 find_frame_fh_return_info( $type => $fh, $offset, [ \%OPTIONS ] )
+
+Same as C<find_frame_return_info>, but with a filehandle.
+
+=head2 find_frame_fh_range( $type => $fh, $start_in_ms, $end_in_ms, [ \%OPTIONS ] )
+
+Same as C<find_frame_range>, but with a filehandle.
+
+=head2 box_tree( $mp4_path )
+
+Returns the layout of the boxes (atoms) in an MP4 file, for indexing or validating
+files without parsing them. Only box headers and the entry counts of sample tables
+are read, so this is fast even for large files. The returned hashref contains:
+
+    boxes        - An arrayref of every box in file order, each a hashref with:
+        type         - The 4-character box type
+        offset       - File offset of the box
+        header_size  - 8, or 16 for boxes with a 64-bit size
+        payload_size - Size of the box minus its header
+        depth        - Nesting level, 0 for top-level boxes
+        entries      - Number of entries (stts, stsc, stsz, stco, co64, stss, ctts only)
+        sample_size  - The fixed sample size, or 0 if samples vary (stsz only)
+        truncated    - Present if the box extends past its parent or the end of the file
+    file_size    - Size of the file
+    moov_offset  - Offset and size of the moov box
+    moov_size
+    audio_offset - Offset and size of the first mdat box
+    audio_size
+    leading_mdat - Present if mdat comes before moov, such files must be read to
+                   the end before they can be played
+    fragmented   - Present if the file contains movie fragments (mvex or moof)
+    free_size    - Total size of free and skip boxes
+
+Returns undef if the file is not an MP4 file.
+
+=head2 box_tree_fh( $type => $fh )
+
+Same as C<box_tree>, but with a filehandle.
+
+=head2 frame_index( $flac_path, [ \%OPTIONS ] )
+
+Reads every frame header of a FLAC file once and returns a seek index, for files
+without a SEEKTABLE. Seeking in such files has to search for frames by guessing, which
+is slow for high resolution files. The index can be saved and passed back to
+C<find_frame_return_info> in the seektable option, or written into the file as a
+metadata block. The returned hashref contains the usual FLAC info and:
+
+    frames          - The number of frames
+    indexed_samples - The number of samples, counted from the frame headers
+                      (total_samples is still the STREAMINFO value)
+    seekpoints      - The number of seek points in seektable_block
+    seektable_block - A SEEKTABLE metadata block (including its 4-byte block header)
+    tracks          - Only present if the file has a CUESHEET, an arrayref of
+                      hashrefs for each track with:
+        track        - The track number
+        start_sample - The sample at INDEX 01 (or the track's first index)
+        end_sample   - The start of the next track, or the lead-out
+        offset       - File offset of the frame containing start_sample
+        size         - Number of bytes from offset to the next track's frame,
+                       or the end of the audio data
+
+An optional hashref may be provided with the following values:
+
+    interval_ms => $ms
+
+The distance between seek points, 10 seconds by default. Use 0 for a point at every frame.
+
+Returns undef if the file is not a FLAC file.
+
+For example:
+
+    my $index = Audio::Scan->frame_index( $file );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30000, {
+        seektable => $index->{seektable_block},
+    } );
+
+    # $info->{seek_offset}
+
+=head2 frame_index_fh( $type => $fh, [ \%OPTIONS ] )
+
+Same as C<frame_index>, but with a filehandle.
+
+=head2 block_index( $wavpack_path, [ \%OPTIONS ] )
+
+Reads every block header of a WavPack file once and returns a seek index, for
+repeated seeks in the same file. The returned hashref contains the usual WavPack info
+and:
+
+    blocks        - The number of blocks, counting each multichannel group once
+    total_samples - The number of samples, counted from the block headers
+    seekpoints    - The number of seek points in seektable
+    seektable     - The seek points, each a 64-bit big-endian sample number followed
+                    by the 64-bit big-endian offset of its block, as read by
+                    unpack('(Q>Q>)*', ...)
+
+An optional hashref may be provided with the following values:
+
+    interval_ms => $ms
+
+The distance between seek points, 10 seconds by default. Use 0 for a point at every block.
+
+Returns undef if the file is not a WavPack file.
+
+For example:
+
+    my $index = Audio::Scan->block_index( $file );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30000, {
+        seektable => $index->{seektable},
+    } );
+
+=head2 block_index_fh( $type => $fh, [ \%OPTIONS ] )
+
+Same as C<block_index>, but with a filehandle.
+
+=head2 dop( $path, $timestamp_in_ms, [ \%OPTIONS ] )
+
+Reads the DSD audio of a DSF or DSDIFF file from the given timestamp and returns it
+as DoP (DSD over PCM) frames, ready to send to a DAC as 24-bit PCM at 1/16 of the DSD
+sample rate. Each PCM sample holds 16 DSD bits of one channel, oldest first from the
+MSB, under a marker byte that alternates between 0x05 and 0xFA on each frame. The bits
+of LSB-first DSF files are reversed. Returns the usual info with these additional keys:
+
+    dop_data        - The packed frames, interleaved by channel, each sample 3 bytes
+                      little-endian
+    dop_frames      - The number of frames in dop_data
+    dop_samplerate  - The PCM sample rate
+    dop_start_frame - The number of the first frame
+    dop_next_frame  - If max_frames was reached, the frame number to pass as
+                      start_frame to get the following frames
+
+The marker follows the frame number, so frames from consecutive calls can be sent one
+after the other. Returns undef if the file is not a DSF or DSDIFF file or its audio
+can't be read. An optional hashref may be provided with the following values:
+
+    max_frames => $count
+
+Return at most $count frames, 176400 (one second of DSD64) by default. Pass
+dop_next_frame back as start_frame to read the rest of the file.
+
+    start_frame => $frame
+
+Start at the given frame instead of the timestamp.
+
+    container => 4
+
+Return each sample as 4 bytes little-endian with a zero low byte, for devices
+that take 24-bit audio in 32-bit samples.
+
+=head2 dop_fh( $type => $fh, $timestamp_in_ms, [ \%OPTIONS ] )
+
+Same as C<dop>, but with a filehandle.
+
+=head2 pcm_analysis( $path )
+
+Reads the audio of an uncompressed WAV or AIFF file once and returns the usual info
+with the following additional keys:
+
+    sample_peak     - An arrayref with a hashref for each channel, in the same form
+                      as the PEAK chunk: value is the largest absolute sample value
+                      (1.0 is full scale) and position is its sample frame
+    rms             - An arrayref of the RMS level of each channel (1.0 is full scale)
+    loudness        - The EBU R128 integrated loudness in LUFS, not present if the
+                      file is shorter than 400ms or silent
+    analyzed_frames - The number of sample frames read
+
+8, 16, 24 and 32-bit integer and 32 and 64-bit float samples are supported, including
+WAVE_FORMAT_EXTENSIBLE files and little-endian (sowt) and float AIFC files. Loudness
+uses the BS.1770 channel weights for 5 and 6+ channel files, assuming the usual
+L, R, C, LFE, Ls, Rs order. For other sample formats the info is returned without these
+keys. Returns undef if the file is not a WAV or AIFF file.
+
+=head2 pcm_analysis_fh( $type => $fh )
+
+Same as C<pcm_analysis>, but with a filehandle.
+
+=head2 write_tags( $path, \%TAGS, [ \%OPTIONS ] )
+
+Writes tags to a FLAC, MP3 or MP4 file. The tags hashref has the same form as the tags
+returned by C<scan>.
+
+When the new tags fit in the space used by the old ones and their padding, only the
+tags are written and the audio data is untouched. Otherwise the file is rewritten
+with new padding after the tags. Returns undef on failure, or a hashref with:
+
+    in_place     - 1 if the tags were written in place, 0 if the file was rewritten
+    audio_offset - The offset of the end of the new tags
+    padding      - The amount of padding after the new tags
+
+An optional hashref may be provided with the following values:
+
+    padding => $bytes
+
+The amount of padding to add when the file has to be rewritten, 8192 bytes for FLAC
+and 2048 bytes for MP3 and MP4 by default.
+
+=over 4
+
+=item FLAC
+
+All existing Vorbis comments are replaced. Values may be strings or arrayrefs of
+strings. VENDOR sets the vendor string, the existing one is kept if it isn't given.
+If ALLPICTURES is present it replaces the PICTURE blocks, otherwise they are kept.
+Pictures scanned with AUDIO_SCAN_NO_ARTWORK are copied from the file at their offset.
+Other metadata blocks are kept as they are.
+
+=item MP3
+
+The ID3v2.3 or ID3v2.4 tag is updated, and a file without one gets a new ID3v2.4
+tag. Only the frames named in the tags hashref are replaced, and a value of undef
+removes them. Text (T*) and URL (W*) frames, COMM, USLT and APIC can be written,
+other frame IDs can only be removed. Any other key is written as a TXXX frame with
+the key as its description, replacing TXXX frames with the same description in any
+case. Strings are written as ISO-8859-1 when possible, otherwise as UTF-8 in v2.4
+tags and UTF-16 in v2.3 tags. In v2.3 tags, TDRC is written as TYER, TDAT and TIME.
+APIC frames scanned with AUDIO_SCAN_NO_ARTWORK are copied from the file at their
+offset. ID3v1 and APE tags are not changed, and ID3v2.2 tags are not supported.
+
+=item MP4
+
+The ilst atoms named in the tags hashref are replaced, a value of undef removes them
+and other atoms are kept. Known keys such as NAM, ART, TRKN, DISK, TMPO and COVR are
+written as their iTunes atoms, GNRE is written as a genre number when it is an ID3
+genre and as text (GEN) otherwise, and any other key is written as a custom atom.
+Arrayref values of COVR and custom keys are stored in one atom. COVR values scanned
+with AUDIO_SCAN_NO_ARTWORK are copied from the file using COVR_offset.
+
+The moov box is written in place when it fits in the old moov and the free boxes
+after it, and a free box inside meta holds the remaining space. Otherwise the old
+moov is turned into a free box and the new one, with padding, is written at the end
+of the file. The audio data never moves, so the file is never rewritten and
+in_place is always 1. The result also has C<moov_relocated>, set to 1 when moov was
+moved. Fragmented and truncated files can only be written in place.
+
+=back
+
+=head2 has_flac()
+
+Deprecated.  Always returns 1 now that FLAC is always enabled.
+
+=head2 is_supported( $path )
+
+Returns 1 if the given path can be scanned by Audio::Scan, or 0 if not.
+
+=head2 get_types()
+
+Returns an array of strings of the file types supported by Audio::Scan.
+
+=head2 extensions_for( $type )
+
+Returns an array of strings of the file extensions that are considered to
+be the file type I<$type>.
+
+=head2 type_for( $extension )
+
+Returns file type for a given extension. Returns I<undef> for unsupported
+extensions.
+
+=head1 SKIPPING ARTWORK
+
+To save memory while reading tags, you can opt to skip potentially large
+embedded artwork.  To do this, set the environment variable AUDIO_SCAN_NO_ARTWORK:
+
+    local $ENV{AUDIO_SCAN_NO_ARTWORK} = 1;
+    my $tags = Audio::Scan->scan_tags($file);
+
+This will return the length of the embedded artwork instead of the actual image data.
+In some cases it will also return a byte offset to the image data, which can be used
+to extract the image using more efficient means.  Note that the offset is not always
+returned so if you want to use this data make sure to check for offset.  If offset
+is not present, the only way to get the image data is to perform a normal tag scan
+without the environment variable set.
+
+One limitation that currently exists is that memory for embedded images is still
+allocated for ASF and Ogg Vorbis files.
+
+This information is returned in different ways depending on the format:
+
+ID3 (MP3, AAC, WAV, AIFF):
+
+    $tags->{APIC}->[3]: image length
+    $tags->{APIC}->[4]: image offset (unless APIC would need unsynchronization)
+
+MP4:
+
+    $tags->{COVR}: image length
+    $tags->{COVR_offset}: image offset (always available)
+
+Ogg Vorbis:
+
+    $tags->{ALLPICTURES}->[0]->{image_data}: image length
+    Image offset is not supported with Vorbis because the data is always base64-encoded.
+
+FLAC:
+
+    $tags->{ALLPICTURES}->[0]->{image_data}: image length
+    $tags->{ALLPICTURES}->[0]->{offset}: image offset (always available)
+
+ASF:
+
+    $tags->{'WM/Picture'}->{image}: image length
+    $tags->{'WM/Picture'}->{offset}: image offset (always available)
+
+APE, Musepack, WavPack, MP3 with APEv2:
+
+    $tags->{'COVER ART (FRONT)'}: image length
+    $tags->{'COVER ART (FRONT)_offset'}: image offset (always available)
+
+=head1 MP3
+
+=head2 INFO
+
+The following metadata about a file may be returned:
+
+    id3_version (i.e. "ID3v2.4.0")
+    id3_was_unsynced (if a v2.2/v2.3 file needed whole-tag unsynchronization)
+    song_length_ms (duration in milliseconds)
+    layer (i.e. 3)
+    stereo
+    samples_per_frame
+    padding
+    audio_size (size of all audio frames)
+    audio_offset (byte offset to first audio frame)
+    bitrate (in bps, determined using Xing/LAME/VBRI if possible, or average in the worst case)
+    samplerate (in kHz)
+    vbr (1 if file is VBR)
+    dlna_profile (if file is compliant)
+
+    If a Xing header is found:
+    xing_frames
+    xing_bytes
+    xing_quality
+
+    If a VBRI header is found:
+    vbri_delay
+    vbri_frames
+    vbri_bytes
+    vbri_quality
+
+    If a LAME header is found:
+    lame_encoder_version
+    lame_tag_revision
+    lame_vbr_method
+    lame_lowpass
+    lame_replay_gain_radio
+    lame_replay_gain_audiophile
+    lame_encoder_delay
+    lame_encoder_padding
+    lame_noise_shaping
+    lame_stereo_mode
+    lame_unwise_settings
+    lame_source_freq
+    lame_surround
+    lame_preset
+
+=head2 TAGS
+
+Raw tags are returned as found.  This means older tags such as ID3v1 and ID3v2.2/v2.3
+are converted to ID3v2.4 tag names.  Multiple instances of a tag in a file will be returned
+as arrays.  Complex tags such as APIC and COMM are returned as arrays.  All tag fields are
+converted to upper-case.  All text is converted to UTF-8.
+
+Sample tag data:
+
+    tags => {
+          ALBUMARTISTSORT => "Solar Fields",
+          APIC => [ "image/jpeg", 3, "", <binary data snipped> ],
+          CATALOGNUMBER => "INRE 017",
+          COMM => ["eng", "", "Amazon.com Song ID: 202981429"],
+          "MUSICBRAINZ ALBUM ARTIST ID" => "a2af1f31-c9eb-4fff-990c-c4f547a11b75",
+          "MUSICBRAINZ ALBUM ID" => "282143c9-6191-474d-a31a-1117b8c88cc0",
+          "MUSICBRAINZ ALBUM RELEASE COUNTRY" => "FR",
+          "MUSICBRAINZ ALBUM STATUS" => "official",
+          "MUSICBRAINZ ALBUM TYPE" => "album",
+          "MUSICBRAINZ ARTIST ID" => "a2af1f31-c9eb-4fff-990c-c4f547a11b75",
+          "REPLAYGAIN_ALBUM_GAIN" => "-2.96 dB",
+          "REPLAYGAIN_ALBUM_PEAK" => "1.045736",
+          "REPLAYGAIN_TRACK_GAIN" => "+3.60 dB",
+          "REPLAYGAIN_TRACK_PEAK" => "0.892606",
+          TALB => "Leaving Home",
+          TCOM => "Magnus Birgersson",
+          TCON => "Ambient",
+          TCOP => "2005 ULTIMAE RECORDS",
+          TDRC => "2004-10",
+          TIT2 => "Home",
+          TPE1 => "Solar Fields",
+          TPE2 => "Solar Fields",
+          TPOS => "1/1",
+          TPUB => "Ultimae Records",
+          TRCK => "1/11",
+          TSOP => "Solar Fields",
+          UFID => [
+                "http://musicbrainz.org",
+                "1084278a-2254-4613-a03c-9fed7a8937ca",
+          ],
+    },
+
+
+=head1 MP4
+
+=head2 INFO
+
+The following metadata about a file may be returned:
+
+    audio_offset (byte offset to start of mdat)
+    audio_size
+    compatible_brands
+    file_size
+    leading_mdat (if file has mdat before moov)
+    major_brand
+    minor_version
+    song_length_ms
+    timescale
+    dlna_profile (if file is compliant)
+    tracks (array of tracks in the file)
+        Each track may contain:
+
+        audio_type
+        avg_bitrate
+        bits_per_sample
+        channels
+        duration
+        encoding
+        handler_name
+        handler_type
+        id
+        max_bitrate
+        samplerate
+
+=head2 TAGS
+
+Tags are returned in a hash with all keys converted to upper-case.  Keys starting with
+0xA9 (copyright symbol) will have this character stripped out.  Sample tag data:
+
+    tags => {
+       AART              => "Album Artist",
+       ALB               => "Album",
+       ART               => "Artist",
+       CMT               => "Comments",
+       COVR              => <binary data snipped>,
+       CPIL              => 1,
+       DAY               => 2009,
+       DESC              => "Video Description",
+       DISK              => "1/2",
+       "ENCODING PARAMS" => "vers\0\0\0\1acbf\0\0\0\2brat\0\1w\0cdcv\0\1\6\5",
+       GNRE              => "Jazz",
+       GRP               => "Grouping",
+       ITUNNORM          => " 00000000 00000000 00000000 00000000 00000000 00000000 00000000 00000000 00000000 00000000",
+       ITUNSMPB          => " 00000000 00000840 000001E4 00000000000001DC 00000000 00000000 00000000 00000000 00000000 00000000 00000000 00000000",
+       LYR               => "Lyrics",
+       NAM               => "Name",
+       PGAP              => 1,
+       SOAA              => "Sort Album Artist",
+       SOAL              => "Sort Album",
+       SOAR              => "Sort Artist",
+       SOCO              => "Sort Composer",
+       SONM              => "Sort Name",
+       SOSN              => "Sort Show",
+       TMPO              => 120,
+       TOO               => "iTunes 8.1.1, QuickTime 7.6",
+       TRKN              => "1/10",
+       TVEN              => "Episode ID",
+       TVES              => 12,
+       TVSH              => "Show",
+       TVSN              => 12,
+       WRT               => "Composer",
+    },
+
+=head1 AAC (ADTS)
+
+=head2 INFO
+
+The following metadata about a file is returned:
+
+    audio_offset
+    audio_size
+    bitrate (in bps)
+    channels
+    file_size
+    profile (Main, LC, or SSR)
+    samplerate (in kHz)
+    song_length_ms (duration in milliseconds)
+    dlna_profile (if file is compliant)
+
+=head1 OGG VORBIS
+
+=head2 INFO
+
+The following metadata about a file is returned:
+
+    version
+    channels
+    stereo
+    samplerate (in kHz)
+    bitrate_average (in bps)
+    bitrate_upper
+    bitrate_nominal
+    bitrate_lower
+    blocksize_0
+    blocksize_1
+    audio_offset (byte offset to audio)
+    audio_size
+    song_length_ms (duration in milliseconds)
+
+=head2 TAGS
+
+Raw Vorbis comments are returned.  All comment keys are capitalized.
+
+=head1 FLAC
+
+=head2 INFO
+
+The following metadata about a file is returned:
+
+    channels
+    samplerate (in kHz)
+    bitrate (in bps)
+    file_size
+    audio_offset (byte offset to first audio frame)
+    audio_size
+    song_length_ms (duration in milliseconds)
+    bits_per_sample
+    frames
+    minimum_blocksize
+    maximum_blocksize
+    minimum_framesize
+    maximum_framesize
+    audio_md5
+    total_samples
+
+=head2 TAGS
+
+Raw FLAC comments are returned.  All comment keys are capitalized.  Some data returned is special:
+
+APPLICATION
+
+    Each application block is returned in the APPLICATION tag keyed by application ID.
+
+CUESHEET_BLOCK
+
+    The CUESHEET_BLOCK tag is an array containing each line of the cue sheet.
+
+ALLPICTURES
+
+    Embedded pictures are returned in an ALLPICTURES array.  Each picture has the following metadata:
+
+        mime_type
+        description
+        width
+        height
+        depth
+        color_index
+        image_data
+        picture_type
+
+=head1 ASF (Windows Media Audio/Video)
+
+=head2 INFO
+
+The following metadata about a file may be returned.  Reading the ASF spec is encouraged if you
+want to find out more about any of these values.
+
+    audio_offset (byte offset to first data packet)
+    audio_size
+    broadcast (boolean, whether the file is a live broadcast or not)
+    codec_list (array of information about codecs used in the file)
+    creation_date (UNIX timestamp when file was created)
+    data_packets
+    drm_key
+    drm_license_url
+    drm_protection_type
+    drm_data
+    file_id (unique file ID)
+    file_size
+    index_blocks
+    index_entry_interval (in milliseconds)
+    index_offsets (byte offsets for each second of audio, per stream. Useful for seeking)
+    index_specifiers (indicates which stream a given index_offset points to)
+    language_list (array of languages referenced by the file's metadata)
+    lossless (boolean)
+    max_bitrate
+    max_packet_size
+    min_packet_size
+    mutex_list (mutually exclusive stream information)
+    play_duration_ms
+    preroll
+    script_commands
+    script_types
+    seekable (boolean, whether the file is seekable or not)
+    send_duration_ms
+    song_length_ms (the actual length of the audio, in milliseconds)
+    dlna_profile (if file is compliant)
+
+STREAMS
+
+The streams array contains metadata related to an individul stream within the file.
+The following metadata may be returned:
+
+    DeviceConformanceTemplate
+    IsVBR
+    alt_bitrate
+    alt_buffer_fullness
+    alt_buffer_size
+    avg_bitrate (most accurate bitrate for this stream)
+    avg_bytes_per_sec (audio only)
+    bitrate
+    bits_per_sample (audio only)
+    block_alignment (audio only)
+    bpp (video only)
+    buffer_fullness
+    buffer_size
+    channels (audio only)
+    codec_id (audio only)
+    compression_id (video only)
+    encode_options
+    encrypted (boolean)
+    error_correction_type
+    flag_seekable (boolean)
+    height (video only)
+    index_type
+    language_index (offset into language_list array)
+    max_object_size
+    samplerate (in kHz) (audio only)
+    samples_per_block
+    stream_number
+    stream_type
+    super_block_align
+    time_offset
+    width (video only)
+
+=head2 TAGS
+
+Raw tags are returned.  Tags that occur more than once are returned as arrays.
+In contrast to the other formats, tag keys are NOT capitalized. There is one special key:
+
+WM/Picture
+
+Pictures are returned as a hash with the following keys:
+
+    image_type (numeric type, same as ID3v2 APIC)
+    mime_type
+    description
+    image
+
+=head1 WAV
+
+=head2 INFO
+
+The following metadata about a file may be returned.
+
+    audio_offset
+    audio_size
+    bitrate (in bps)
+    bits_per_sample
+    block_align
+    channels
+    dlna_profile (if file is compliant)
+    file_size
+    format (WAV format code, 1 == PCM)
+    subformat (format code of the SubFormat GUID, if format is 65534)
+    id3_version (if an ID3v2 tag is found)
+    samplerate (in kHz)
+    song_length_ms
+
+=head2 TAGS
+
+WAV files can contain several different types of tags.  "Native" WAV tags
+found in a LIST block may include these and others:
+
+    IARL - Archival Location
+    IART - Artist
+    ICMS - Commissioned
+    ICMT - Comment
+    ICOP - Copyright
+    ICRD - Creation Date
+    ICRP - Cropped
+    IENG - Engineer
+    IGNR - Genre
+    IKEY - Keywords
+    IMED - Medium
+    INAM - Name (Title)
+    IPRD - Product (Album)
+    ISBJ - Subject
+    ISFT - Software
+    ISRC - Source
+    ISRF - Source Form
+    TORG - Label
+    LOCA - Location
+    TVER - Version
+    TURL - URL
+    TLEN - Length
+    ITCH - Technician
+    TRCK - Track
+    ITRK - Track
+
+ID3v2 tags can also be embedded within WAV files.  These are returned exactly as for MP3 files.
+
+RF64 and BW64 files are read using the 64-bit sizes in their ds64 chunk, and Sony Wave64
+files are also supported, so audio_size and song_length_ms are correct for files over 4GB.
+
+=head1 AIFF
+
+=head2 INFO
+
+The following metadata about a file may be returned.
+
+    audio_offset
+    audio_size
+    bitrate (in bps)
+    bits_per_sample
+    block_align
+    channels
+    compression_name (if AIFC)
+    compression_type (if AIFC)
+    dlna_profile (if file is compliant)
+    file_size
+    id3_version (if an ID3v2 tag is found)
+    samplerate (in kHz)
+    song_length_ms
+
+=head2 TAGS
+
+ID3v2 tags can be embedded within AIFF files.  These are returned exactly as for MP3 files.
+
+=head1 MONKEY'S AUDIO (APE)
+
+=head2 INFO
+
+The following metadata about a file may be returned.
+
+    audio_offset
+    audio_size
+    bitrate (in bps)
+    channels
+    compression
+    file_size
+    samplerate (in kHz)
+    song_length_ms
+    version
+
+=head2 TAGS
+
+APEv2 tags are returned as a hash of key/value pairs.
+
+=head1 MUSEPACK
+
+=head2 INFO
+
+The following metadata about a file may be returned.
+
+    audio_offset
+    audio_size
+    bitrate (in bps)
+    channels
+    encoder
+    file_size
+    profile
+    samplerate (in kHz)
+    song_length_ms
+
+=head2 TAGS
+
+Musepack uses APEv2 tags.  They are returned as a hash of key/value pairs.
+
+=head1 WAVPACK
+
+=head2 INFO
+
+The following metadata about a file may be returned.
+
+    audio_offset
+    audio_size
+    bitrate (in bps)
+    bits_per_sample
+    channels
+    encoder_version
+    file_size
+    hybrid (1 if file is lossy) (v4 only)
+    lossless (1 if file is lossless) (v4 only)
+    samplerate
+    song_length_ms
+    total_samples
+
+=head2 TAGS
+
+WavPack uses APEv2 tags.  They are returned as a hash of key/value pairs.
+
+=head1 DSF
+
+=head2 INFO
+
+The following metadata about a file may be returned.
+
+    audio_offset
+    audio_size
+    bits_per_sample
+    channels
+    song_length_ms
+    samplerate
+    block_size_per_channel
+
+=head2 TAGS
+
+ID3v2 tags can be embedded within DSF files.  These are returned exactly as for MP3 files.
+
+=head1 DSDIFF (DFF)
+
+=head2 INFO
+
+The following metadata about a file may be returned.
+
+    audio_offset
+    audio_size
+    bits_per_sample
+    channels
+    song_length_ms
+    samplerate
+    tag_diti_title
+    tag_diar_artist
+
+=head2 TAGS
+
+No separate tags are supported by the DSDIFF format.
+
+=head1
+
+=head1 THANKS
+
+Logitech & Slim Devices, for letting us release so much of our code to the world.
+Long live Squeezebox!
+
+Kimmo Taskinen, Adrian Smith, Clive Messer, and Jurgen Kramer for
+DSF/DSDIFF support and various other fixes.
+
+Some code from the Rockbox project was very helpful in implementing ASF and
+MP4 seeking.
+
+Some of the file format parsing code was derived from the mt-daapd project,
+and adapted by Netgear.  It has been heavily rewritten to fix bugs and add
+more features.
+
+The source to the original Netgear C scanner for SqueezeCenter is located
+at L<http://svn.slimdevices.com/repos/slim/7.3/trunk/platforms/readynas/contrib/scanner>
+
+The audio MD5 feature uses an MD5 implementation by L. Peter Deutsch,
+E<lt>ghost@aladdin.comE<gt>.
+
+=head1 SEE ALSO
+
+ASF Spec L<http://www.microsoft.com/windows/windowsmedia/forpros/format/asfspec.aspx>
+
+MP4 Info:
+L<http://standards.iso.org/ittf/PubliclyAvailableStandards/c051533_ISO_IEC_14496-12_2008.zip>
+L<http://www.geocities.com/xhelmboyx/quicktime/formats/mp4-layout.txt>
+
+=head1 AUTHORS
+
+Andy Grundman, E<lt>andy@hybridized.orgE<gt>
+
+Dan Sully, E<lt>daniel@cpan.orgE<gt>
+
+=head1 COPYRIGHT AND LICENSE
+
+Copyright (C) 2010-2011 Logitech, Inc.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+=cut
@@ -163,6 +163,15 @@ typedef struct asf_index_specs {
   uint32_t *offsets;
 } asf_index_specs;
 
+// Data packet send times read while seeking
+#define ASF_SEEK_CACHE_SIZE 64
+
+typedef struct asf_packet_time {
+  uint32_t packet;
+  int time;
+  int duration;
+} asf_packet_time;
+
 typedef struct asfinfo {
   PerlIO *infile;
   char *file;
@@ -172,6 +181,7 @@ typedef struct asfinfo {
   uint64_t audio_offset;
   uint64_t audio_size;
   uint32_t object_offset;
+  uint32_t file_properties_offset; // offset of the File Properties object data
   HV *info;
   HV *tags;
 
@@ -183,6 +193,10 @@ typedef struct asfinfo {
 
   uint16_t spec_count;
   struct asf_index_specs *specs;
+
+  asf_packet_time *seek_cache;
+  uint8_t seek_cache_count;
+  uint8_t seek_cache_next;  // oldest entry, replaced next when the cache is full
 } asfinfo;
 
 enum types {
@@ -198,7 +212,7 @@ enum types {
 int get_asf_metadata(PerlIO *infile, char *file, HV *info, HV *tags);
 asfinfo * _asf_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking);
 void _parse_content_description(asfinfo *asf);
-void _parse_extended_content_description(asfinfo *asf);
+int _parse_extended_content_description(asfinfo *asf);
 void _parse_file_properties(asfinfo *asf);
 void _parse_stream_properties(asfinfo *asf);
 void _store_stream_info(int stream_number, HV *info, SV *key, SV *value);
@@ -210,13 +224,22 @@ void _parse_language_list(asfinfo *asf);
 void _parse_advanced_mutual_exclusion(asfinfo *asf);
 void _parse_codec_list(asfinfo *asf);
 void _parse_stream_bitrate_properties(asfinfo *asf);
-void _parse_metadata_library(asfinfo *asf);
+int _parse_metadata_library(asfinfo *asf);
 void _parse_index_parameters(asfinfo *asf);
 int _parse_index_objects(asfinfo *asf, int index_size);
 void _parse_index(asfinfo *asf, uint64_t size);
 void _parse_content_encryption(asfinfo *asf);
 void _parse_extended_content_encryption(asfinfo *asf);
 void _parse_script_command(asfinfo *asf);
-SV *_parse_picture(asfinfo *asf, uint32_t picture_offset);
+SV *_parse_picture(asfinfo *asf, uint32_t picture_offset, uint32_t value_len);
+uint64_t _asf_tell(asfinfo *asf);
+void _asf_skip(asfinfo *asf, uint32_t size);
+int _asf_seek_to(asfinfo *asf, uint64_t offset);
 int asf_find_frame(PerlIO *infile, char *file, int offset);
+int asf_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+int _asf_find_frame(asfinfo *asf, HV *info, int time_offset);
+void _asf_free_seek(asfinfo *asf);
+SV * _asf_seek_header(asfinfo *asf, HV *info, int frame_offset);
 int _timestamp(asfinfo *asf, int offset, int *duration);
+int _asf_search_packets(asfinfo *asf, int time_offset, int frame_offset, uint32_t packet_size, uint32_t song_length_ms);
+int _asf_packet_time(asfinfo *asf, uint32_t packet, uint32_t packet_size, int *duration);
@@ -114,6 +114,9 @@ float get_f32(const void *vp);
 double buffer_get_ieee_float(Buffer *buffer);
 void put_u16(void *vp, uint16_t v);
 void put_u32(void *vp, uint32_t v);
+void put_u32le(void *vp, uint32_t v);
+void put_u64(void *vp, uint64_t v);
+void put_u64le(void *vp, uint64_t v);
 uint32_t buffer_get_bits(Buffer *buffer, uint32_t bits);
 uint32_t buffer_get_syncsafe(Buffer *buffer, uint8_t bytes);
 
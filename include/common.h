@@ -79,5 +79,10 @@ int32_t skip_id3v2(PerlIO *infile);
 uint32_t _bitrate(uint32_t audio_size, uint32_t song_length_ms);
 off_t _file_size(PerlIO *infile);
 int _env_true(const char *name);
+uint32_t _sorted_keys(HV *hv, const char ***keys);
+IV _opt_iv(HV *opts, const char *name, IV def);
+SV *_read_header(PerlIO *infile, uint32_t len);
+uint32_t _decode_base64_block(const unsigned char *src, uint32_t len, unsigned char *dst);
 int _decode_base64(char *s);
 HV * _decode_flac_picture(PerlIO *infile, Buffer *buf, uint32_t *pic_length);
+HV * _decode_flac_picture_header(PerlIO *infile, Buffer *buf, uint32_t *pic_length);
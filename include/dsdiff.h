@@ -16,4 +16,11 @@
 
 #define DSDIFF_BLOCK_SIZE 4096
 
+// Don't rewrite headers with more than this before the sound data
+#define DSDIFF_MAX_SEEK_HEADER 0x1000000
+
 int get_dsdiff_metadata(PerlIO *infile, char *file, HV *info, HV *tags);
+int dsdiff_find_frame(PerlIO *infile, char *file, int offset);
+int dsdiff_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+int64_t _dsdiff_find_frame(HV *info, int offset);
+int dsdiff_dop(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
@@ -16,4 +16,24 @@
 
 #define DSF_BLOCK_SIZE 4096
 
+// DSD, fmt and data chunk headers
+#define DSF_HEADER_SIZE (28 + 52 + 12)
+
+// DoP markers, alternating on each frame
+#define DOP_MARKER_1 0x05
+#define DOP_MARKER_2 0xFA
+
+// Frames of DSDIFF data read at a time by dop()
+#define DOP_READ_FRAMES 4096
+
+// Default limit on the frames returned by dop(), one second of DSD64
+#define DOP_MAX_FRAMES 176400
+
 int get_dsf_metadata(PerlIO *infile, char *file, HV *info, HV *tags);
+int dsf_find_frame(PerlIO *infile, char *file, int offset);
+int dsf_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+int64_t _dsf_find_frame(HV *info, int offset);
+int dsf_dop(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+int _dop_range(HV *info, int offset, HV *opts, uint64_t total_frames, uint64_t *start, uint64_t *frames);
+void _dop_pack(unsigned char *out, unsigned char **src, uint32_t stride, uint16_t channels, uint32_t frames, uint64_t first_frame, uint8_t reverse, uint8_t container);
+void _dop_finish(HV *info, SV *data, uint8_t container, uint64_t start, uint64_t frames, uint64_t total_frames);
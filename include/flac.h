@@ -15,12 +15,18 @@
  */
 
 #define FLAC_BLOCK_SIZE 4096
+
+// Amount of audio read at a time when indexing frames
+#define FLAC_INDEX_BLOCK_SIZE 65536
 #define FLAC_FRAME_MAX_HEADER 22
 
 /* frame header size (16 bytes) + 4608 stereo 16-bit samples (higher than 4608 is possible, but not done) */
 #define FLAC_MAX_FRAMESIZE 18448
 #define FLAC_HEADER_LEN 16
 
+// PADDING added when tags are written and no longer fit
+#define FLAC_DEFAULT_PADDING 8192
+
 enum flac_types {
   FLAC_TYPE_STREAMINFO,
   FLAC_TYPE_PADDING,
@@ -37,6 +43,12 @@ typedef struct seekpoint {
   uint16_t frame_samples;
 } seekpoint;
 
+typedef struct cuepoint {
+  uint8_t track;
+  uint8_t index;
+  uint64_t sample;        // track offset + index offset
+} cuepoint;
+
 typedef struct flacinfo {
   PerlIO *infile;
   char *file;
@@ -55,15 +67,37 @@ typedef struct flacinfo {
   uint32_t samplerate;
   uint32_t bits_per_sample;
   uint64_t total_samples;
+  unsigned char streaminfo[34]; // raw STREAMINFO block
 
   uint8_t seeking; // flag if we're seeking
 
   uint32_t num_seekpoints;
   struct seekpoint *seekpoints;
+
+  uint32_t num_cue_points; // CUESHEET indexes
+  struct cuepoint *cue_points;
+  uint64_t cue_leadout;
 } flacinfo;
 
 int get_flac_metadata(PerlIO *infile, char *file, HV *info, HV *tags);
 flacinfo * _flac_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking);
+static int flac_find_frame(PerlIO *infile, char *file, int offset);
+static int flac_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+int _flac_find_frame(flacinfo *flac, int offset, uint64_t *frame_sample);
+int _flac_find_sample(flacinfo *flac, uint64_t target_sample, uint64_t *frame_sample);
+int64_t _flac_cue_sample(flacinfo *flac, uint8_t track, uint8_t index);
+uint32_t _flac_cue_track_starts(flacinfo *flac, struct cuepoint *starts);
+SV * _flac_seek_header(flacinfo *flac, off_t frame_offset, uint64_t frame_sample);
+void _flac_load_seektable(flacinfo *flac, SV *seektable);
+void flac_frame_index(PerlIO *infile, char *file, HV *info, HV *opts);
+int flac_write_tags(PerlIO *infile, char *file, HV *tags, HV *opts, HV *result);
+int _flac_read_at(PerlIO *infile, off_t offset, Buffer *buf, uint32_t len);
+void _flac_put_int_le(Buffer *out, uint32_t value);
+int _flac_end_block(Buffer *out, uint32_t header, uint8_t type);
+int _flac_put_comment(Buffer *out, HV *tags, SV *vendor);
+int _flac_put_pictures(Buffer *out, HV *tags, PerlIO *infile, off_t file_size, uint32_t *last_header);
+void _flac_put_padding(Buffer *out, uint32_t size, uint8_t last);
+uint32_t _flac_find_sync(unsigned char *bptr, uint32_t i, uint32_t end);
 void _flac_parse_streaminfo(flacinfo *flac);
 void _flac_parse_application(flacinfo *flac, int len);
 void _flac_parse_seektable(flacinfo *flac, int len);
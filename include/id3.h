@@ -22,6 +22,9 @@
 
 #define ID3_BLOCK_SIZE 4096
 
+// Padding added when a tag no longer fits
+#define ID3_DEFAULT_PADDING 2048
+
 // ID3v1 field frames
 
 #define ID3_FRAME_TITLE    "TIT2"
@@ -118,6 +121,7 @@ extern struct id3_frametype const id3_frametype_unknown;
 extern struct id3_frametype const id3_frametype_obsolete;
 
 int parse_id3(PerlIO *infile, char *file, HV *info, HV *tags, off_t seek, off_t file_size);
+int id3_write_tags(PerlIO *infile, char *file, HV *tags, HV *opts, HV *result);
 int _id3_parse_v1(id3info *id3);
 int _id3_parse_v2(id3info *id3);
 int _id3_parse_v2_frame(id3info *id3);
@@ -133,6 +137,16 @@ uint32_t _id3_parse_etco(id3info *id3, uint32_t len, AV *framedata);
 void _id3_convert_tdrc(id3info *id3);
 uint32_t _id3_deunsync(unsigned char *data, uint32_t length);
 void _id3_skip(id3info *id3, uint32_t size);
+uint8_t _id3_write_key_type(const char *key);
+void _id3_frame_key(unsigned char *bptr, uint8_t version, char *id);
+int _id3_frame_replaced(char *id, unsigned char *data, uint32_t size, uint8_t version, uint16_t frame_flags, HV *tags, HV *txxx);
+AV * _id3_tag_values(SV *value);
+uint8_t _id3_text_encoding(SV **strings, int count, uint8_t version);
+void _id3_put_string(Buffer *out, SV *sv, uint8_t encoding, uint8_t terminate);
+void _id3_put_header(unsigned char *bptr, uint8_t version, uint32_t size);
+void _id3_put_frame(Buffer *out, const char *id, Buffer *data, uint8_t version);
+void _id3_put_text(Buffer *out, const char *id, SV *value, SV *desc, uint8_t version, Buffer *data);
+int _id3_put_tag(Buffer *out, const char *key, SV *value, uint8_t version, PerlIO *infile, off_t file_size);
 char const * _id3_genre_index(unsigned int index);
 char const * _id3_genre_name(char const *string);
 static id3_compat const * _id3_compat_lookup(register char const *, register unsigned int);
@@ -5,6 +5,13 @@
 #define MAC_397_HEADER_LEN          24
 #define MAC_398_HEADER_LEN          70
 
+#define MAC_FORMAT_FLAG_8_BIT              1
+#define MAC_FORMAT_FLAG_CRC                2
+#define MAC_FORMAT_FLAG_HAS_PEAK_LEVEL     4
+#define MAC_FORMAT_FLAG_24_BIT             8
+#define MAC_FORMAT_FLAG_HAS_SEEK_ELEMENTS  16
+#define MAC_FORMAT_FLAG_CREATE_WAV_HEADER  32
+
 /* 1000 base. */
 const char *mac_profile_names[] = {
   "",
@@ -28,8 +35,19 @@ typedef struct mac_streaminfo {
   uint32_t sample_rate;
   uint32_t bitrate;
   uint32_t version;
+  uint32_t flags;
+  uint32_t wav_header_bytes;
+  uint32_t descriptor_bytes;
+  uint32_t header_bytes;
+  uint32_t seek_table_bytes;
+  off_t header_offset;
 } mac_streaminfo;
 
 static int get_macfileinfo(PerlIO *infile, char *file, HV *info);
+static int _mac_parse(PerlIO *infile, char *file, HV *info, mac_streaminfo *si);
+static int mac_find_frame(PerlIO *infile, char *file, int offset);
+static int mac_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+static int64_t _mac_find_frame(PerlIO *infile, char *file, int offset, HV *info, uint32_t *frame, uint32_t *skip_samples, uint32_t *bit);
+static int _mac_get_u32le(PerlIO *infile, Buffer *buf, off_t offset, uint32_t *value);
 
 #endif
@@ -16,6 +16,9 @@
 
 #define MP4_BLOCK_SIZE 4096
 
+// Padding added after the ilst box when moov has to grow
+#define MP4_DEFAULT_PADDING 2048
+
 #define FOURCC_EQ(a, b) ((a)[0] == (b)[0] && (a)[1] == (b)[1] && (a)[2] && (b)[2] && (a)[3] == (b)[3])
 
 typedef enum {
@@ -59,6 +62,67 @@ const uint8_t bps_table[4] = {
   8, 16, 20, 24
 };
 
+// ilst atoms written for tag keys, keys are stored without the copyright symbol
+typedef struct mp4_ilst_atom {
+  const char *key;
+  const char *name;
+  uint8_t int_size; // size of an integer value, 0 for text
+} mp4_ilst_atom;
+
+const mp4_ilst_atom mp4_ilst_atoms[] = {
+  { "NAM",  "\xA9nam", 0 },
+  { "ART",  "\xA9""ART", 0 },
+  { "ALB",  "\xA9""alb", 0 },
+  { "DAY",  "\xA9""day", 0 },
+  { "WRT",  "\xA9wrt", 0 },
+  { "CMT",  "\xA9""cmt", 0 },
+  { "GEN",  "\xA9gen", 0 },
+  { "TOO",  "\xA9too", 0 },
+  { "GRP",  "\xA9grp", 0 },
+  { "LYR",  "\xA9lyr", 0 },
+  { "ENC",  "\xA9""enc", 0 },
+  { "WRK",  "\xA9wrk", 0 },
+  { "MVN",  "\xA9mvn", 0 },
+  { "AART", "aART", 0 },
+  { "CPRT", "cprt", 0 },
+  { "DESC", "desc", 0 },
+  { "LDES", "ldes", 0 },
+  { "TVSH", "tvsh", 0 },
+  { "TVEN", "tven", 0 },
+  { "TVNN", "tvnn", 0 },
+  { "SONM", "sonm", 0 },
+  { "SOAR", "soar", 0 },
+  { "SOAA", "soaa", 0 },
+  { "SOAL", "soal", 0 },
+  { "SOCO", "soco", 0 },
+  { "SOSN", "sosn", 0 },
+  { "CATG", "catg", 0 },
+  { "KEYW", "keyw", 0 },
+  { "PURD", "purd", 0 },
+  { "APID", "apID", 0 },
+  { "TRKN", "trkn", 0 },
+  { "DISK", "disk", 0 },
+  { "GNRE", "gnre", 0 },
+  { "COVR", "covr", 0 },
+  { "CPIL", "cpil", 1 },
+  { "PGAP", "pgap", 1 },
+  { "HDVD", "hdvd", 1 },
+  { "STIK", "stik", 1 },
+  { "RTNG", "rtng", 1 },
+  { "PCST", "pcst", 1 },
+  { "AKID", "akID", 1 },
+  { "TMPO", "tmpo", 2 },
+  { "TVES", "tves", 4 },
+  { "TVSN", "tvsn", 4 },
+  { "CNID", "cnID", 4 },
+  { "ATID", "atID", 4 },
+  { "GEID", "geID", 4 },
+  { "SFID", "sfID", 4 },
+  { "CMID", "cmID", 4 },
+  { "PLID", "plID", 8 },
+  { NULL, NULL, 0 }
+};
+
 typedef struct tts {
   uint32_t sample_count;
   uint32_t sample_duration;
@@ -85,6 +149,7 @@ typedef struct mp4info {
   uint32_t track_count;
   uint8_t seen_moov;
   uint8_t dlna_invalid;
+  uint64_t buf_offset;  // file offset of the data in buf, used when walking the box tree
 
   // Things needed for DLNA detection
   uint8_t audio_object_type;
@@ -92,14 +157,28 @@ typedef struct mp4info {
   uint32_t samplerate;
   uint32_t bitrate;
 
+  // AudioSpecificConfig values needed for ADTS framing
+  uint8_t core_object_type;   // object type of the core decoder, differs from audio_object_type for HE-AAC
+  uint8_t samplerate_index;   // core samplerate index
+  uint8_t channel_config;
+
   // Data structures used to support seeking
   // Based on code from Rockbox
 
   uint8_t seeking;      // flag if we're seeking
+  uint32_t seek_track;  // ID of the track to seek in, defaults to the first audio track
+  uint32_t seek_trak;   // position of the seek track's trak box among all trak boxes
+  uint32_t seek_timescale; // media timescale of the seek track
+  uint64_t trak_size;    // size of the current trak box
+  uint64_t dropped_size; // size of the trak boxes left out of the rewritten header
   uint32_t old_st_size; // size of original st* boxes
   uint32_t new_st_size; // size of rewritten st* boxes
   uint32_t meta_size;   // size of variable meta box
+  uint64_t clip_duration; // duration of a clip in media timescale units, if clipping
+  uint64_t clip_size;     // size of the audio data for a clip
   SV *seekhdr;          // rewritten header during second seek pass
+  AV *seekparts;        // rewritten header as a scatter list, if requested
+  uint32_t seekparts_size; // total length of the scatter list
 
   // stsc
   uint32_t num_sample_to_chunks;
@@ -119,15 +198,25 @@ typedef struct mp4info {
   // stsz
   uint16_t *sample_byte_size;
   uint32_t num_sample_byte_sizes;
+  uint64_t sample_byte_size_offset; // file offset of the first stsz entry
   SV *new_stsz;
 } mp4info;
 
 static int get_mp4tags(PerlIO *infile, char *file, HV *info, HV *tags);
 int mp4_find_frame(PerlIO *infile, char *file, int offset);
-int mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info);
+int mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+int mp4_box_tree(PerlIO *infile, char *file, HV *info);
+int mp4_write_tags(PerlIO *infile, char *file, HV *tags, HV *opts, HV *result);
 
-mp4info * _mp4_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking);
+mp4info * _mp4_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking, uint32_t seek_track);
 int _mp4_read_box(mp4info *mp4);
+uint32_t _mp4_seekhdr_box(mp4info *mp4, char *type, uint64_t size);
+uint8_t _mp4_is_seek_track(mp4info *mp4);
+int _mp4_box_tree_walk(mp4info *mp4, AV *boxes, uint64_t offset, uint64_t end, uint8_t depth);
+int _mp4_box_tree_seek(mp4info *mp4, uint64_t offset, uint32_t len);
+uint32_t _mp4_seekhdr_duration_box(mp4info *mp4, char *type, uint64_t size);
+void _mp4_seekhdr_append(mp4info *mp4, const char *data, uint32_t len);
+void _mp4_seekhdr_append_range(mp4info *mp4, uint64_t offset, uint64_t len);
 uint8_t _mp4_parse_ftyp(mp4info *mp4);
 uint8_t _mp4_parse_mvhd(mp4info *mp4);
 uint8_t _mp4_parse_tkhd(mp4info *mp4);
@@ -151,3 +240,14 @@ void _mp4_skip(mp4info *mp4, uint32_t size);
 uint32_t _mp4_samples_in_chunk(mp4info *mp4, uint32_t chunk);
 uint32_t _mp4_total_samples(mp4info *mp4);
 uint32_t _mp4_get_sample_duration(mp4info *mp4, uint32_t sample);
+uint32_t _mp4_sample_for_time(mp4info *mp4, uint32_t sound_sample_loc, uint32_t *sound_sample);
+uint32_t _mp4_chunk_for_sample(mp4info *mp4, uint32_t sample, uint32_t *chunk_sample);
+int _mp4_read_at(PerlIO *infile, uint64_t offset, Buffer *buf, uint32_t len);
+int64_t _mp4_find_box(unsigned char *bptr, uint64_t start, uint64_t end, const char *type, uint64_t *size, uint8_t *hsize);
+void _mp4_put_box_size(unsigned char *bptr, uint8_t hsize, uint64_t size);
+SV * _mp4_ilst_key(unsigned char *atom, uint32_t size, Buffer *custom);
+int _mp4_put_ilst(PerlIO *infile, off_t file_size, unsigned char *old, uint32_t old_len, HV *tags, Buffer *out);
+int _mp4_put_ilst_value(PerlIO *infile, off_t file_size, Buffer *out, const char *name, uint8_t int_size, SV *value, HV *tags);
+void _mp4_put_ilst_data(Buffer *out, uint32_t flags, const void *data, uint32_t len);
+uint16_t _mp4_genre_number(const char *genre);
+uint8_t _mp4_adts_frames(mp4info *mp4, uint32_t sample, uint32_t end_sample, uint32_t chunk, uint32_t chunk_sample, uint32_t file_offset, uint32_t max_frames);
@@ -77,4 +77,24 @@ typedef struct mpc_streaminfo {
   PerlIO *infile;
 } mpc_streaminfo;
 
+// Bit reader for SV8 seek tables, most significant bit first
+typedef struct mpc_bits {
+  unsigned char *ptr;
+  unsigned char *end;
+  uint32_t bit;
+} mpc_bits;
+
+static int get_mpcfileinfo(PerlIO *infile, char *file, HV *info);
+static int _mpc_parse(PerlIO *infile, char *file, HV *info, mpc_streaminfo *si);
+static int mpc_find_frame(PerlIO *infile, char *file, int offset);
+static int mpc_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+static int64_t _mpc_find_frame(PerlIO *infile, char *file, int offset, HV *info, uint64_t *frame, uint32_t *bit);
+static uint64_t _mpc_sv8_packet(mpc_streaminfo *si, off_t offset, unsigned char *key, uint32_t *header_size);
+static int64_t _mpc_sv8_find_frame(mpc_streaminfo *si, uint64_t sample, uint64_t *frame);
+static int _mpc_sv8_seek_table(mpc_streaminfo *si, off_t offset, uint64_t frame, off_t *point_offset, uint64_t *point_frame);
+static uint32_t _mpc_bits_read(mpc_bits *bits, uint32_t n);
+static uint64_t _mpc_bits_read_size(mpc_bits *bits);
+static uint32_t _mpc_bits_golomb(mpc_bits *bits, uint32_t k);
+static int64_t _mpc_sv7_find_frame(mpc_streaminfo *si, uint64_t sample, uint64_t *frame, uint32_t *bit);
+
 #endif
@@ -16,8 +16,89 @@
 
 #define OGG_BLOCK_SIZE 4500
 
+// Size of an Ogg page header without the segment table
+#define OGG_HEADER_SIZE 27
+
+// Size of the first window used when searching backwards for the last page,
+// the window doubles up to the max while no page is found
+#define OGG_LAST_PAGE_WINDOW 8500
+#define OGG_LAST_PAGE_MAX_WINDOW (1 << 19)
+
+// Number of page headers remembered during a seek
+#define OGG_PAGE_CACHE_SIZE 16
+
+// Header type flags
+#define OGG_CONTINUED 0x01
+#define OGG_BOS       0x02
+#define OGG_EOS       0x04
+
+typedef struct ogg_page {
+  off_t offset;           // file offset of the page
+  uint8_t header_type;
+  uint64_t granule_pos;
+  uint32_t serialno;
+  uint32_t pagenum;
+  uint8_t num_segments;
+  uint8_t lacing[255];    // segment table
+  uint32_t size;          // size of the page including the header
+} ogg_page;
+
+typedef struct ogg_page_hdr {
+  off_t offset;           // file offset of the page
+  off_t probe;            // offset the search started from, no page starts between probe and offset
+  uint32_t size;          // size of the page including the header
+  uint64_t granule_pos;
+} ogg_page_hdr;
+
+// Reads pages and packets of one logical bitstream, pages of any other
+// multiplexed streams are skipped
+typedef struct ogg_reader {
+  PerlIO *infile;
+  char *file;
+  Buffer buf;             // file data starting at buf_offset
+  off_t buf_offset;
+  off_t file_size;
+  off_t offset;           // offset of the next page
+  uint32_t serialno;      // stream being read
+  ogg_page page;          // current page
+  uint8_t segment;        // next segment of the current page
+  off_t body_offset;      // file offset of the next segment
+  uint32_t seg_remaining; // bytes of the current segment not read yet
+  uint8_t seg_last;       // current segment ends the packet
+  uint8_t packet_started;
+  uint8_t orphan;         // skipping the rest of a packet we don't have the start of
+  uint8_t truncated;      // packet runs past the end of the file
+  ogg_page_hdr cache[OGG_PAGE_CACHE_SIZE]; // pages found while seeking
+  uint32_t cache_len;
+  uint32_t cache_next;
+} ogg_reader;
+
 int get_ogg_metadata(PerlIO *infile, char *file, HV *info, HV *tags);
 int _ogg_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking);
 static int ogg_find_frame(PerlIO *infile, char *file, int offset);
 void _parse_vorbis_comments(PerlIO *infile, Buffer *vorbis_buf, HV *tags, int has_framing);
-int _ogg_binary_search_sample(PerlIO *infile, char *file, HV *info, uint64_t target_sample);
+int _ogg_search_sample(PerlIO *infile, char *file, HV *info, uint64_t target_sample);
+int _ogg_seek_page(ogg_reader *r, off_t offset, off_t limit, ogg_page_hdr *page);
+off_t _ogg_skip_id3(ogg_reader *r);
+void _ogg_reader_init(ogg_reader *r, PerlIO *infile, char *file);
+void _ogg_reader_free(ogg_reader *r);
+int _ogg_reader_fill(ogg_reader *r, off_t offset, uint32_t len);
+int _ogg_parse_page(ogg_reader *r, off_t offset, ogg_page *page);
+void _ogg_page_header(unsigned char *bptr, ogg_page *page);
+int _ogg_check_page(unsigned char *p, off_t len, ogg_page *page);
+int _ogg_sync_page(ogg_reader *r, off_t offset, off_t limit, ogg_page *page);
+int _ogg_next_page(ogg_reader *r);
+void _ogg_packet_begin(ogg_reader *r);
+void _ogg_packet_end(ogg_reader *r);
+static int _ogg_next_segment(ogg_reader *r);
+uint32_t _ogg_packet_read(ogg_reader *r, Buffer *out, uint32_t len);
+int _ogg_packet_complete(ogg_reader *r);
+int _ogg_read_packet(ogg_reader *r, Buffer *packet);
+void _ogg_parse_comments(ogg_reader *r, HV *tags);
+static void _ogg_parse_picture(ogg_reader *r, uint32_t chars, HV *tags);
+static uint32_t _ogg_read_base64(ogg_reader *r, Buffer *tmp, uint32_t *chars, unsigned char *dst, uint32_t max);
+static uint32_t _ogg_read_base64_sv(ogg_reader *r, Buffer *tmp, uint32_t *chars, SV *data, uint32_t limit);
+static void _vorbis_add_picture(HV *tags, HV *picture);
+static HV *_vorbis_coverart_picture(void);
+int _ogg_last_page(ogg_reader *r, off_t min_offset, ogg_page *page);
+int _ogg_last_page_in(ogg_reader *r, unsigned char *bptr, off_t start, off_t pos, off_t end, ogg_page *page);
@@ -16,11 +16,66 @@
 
 #define WAV_BLOCK_SIZE 4096
 
+// Sony Wave64 chunk GUIDs, most are the FOURCC followed by the same suffix
+#define W64_SUFFIX    "\xF3\xAC\xD3\x11\x8C\xD1\x00\xC0\x4F\x8E\xDB\x8A"
+#define W64_RIFF_GUID "riff" "\x2E\x91\xCF\x11\xA5\xD6\x28\xDB\x04\xC1\x00\x00"
+#define W64_LIST_GUID "list" "\x2F\x91\xCF\x11\xA5\xD6\x28\xDB\x04\xC1\x00\x00"
+#define W64_WAVE_GUID "wave" W64_SUFFIX
+#define W64_FMT_GUID  "fmt " W64_SUFFIX
+#define W64_FACT_GUID "fact" W64_SUFFIX
+#define W64_DATA_GUID "data" W64_SUFFIX
+#define W64_LEVL_GUID "levl" W64_SUFFIX
+#define W64_BEXT_GUID "bext" W64_SUFFIX
+#define W64_JUNK_GUID "knuj" W64_SUFFIX
+#define W64_HEADER_SIZE 24
+
+// Don't rewrite headers with more than this before the audio
+#define WAV_MAX_SEEK_HEADER 0x1000000
+
+// Frames decoded at a time by pcm_analysis
+#define PCM_ANALYSIS_FRAMES 16384
+
+enum pcm_formats {
+  PCM_UNSUPPORTED,
+  PCM_U8,
+  PCM_S8,
+  PCM_S16LE,
+  PCM_S16BE,
+  PCM_S24LE,
+  PCM_S24BE,
+  PCM_S32LE,
+  PCM_S32BE,
+  PCM_F32LE,
+  PCM_F32BE,
+  PCM_F64LE,
+  PCM_F64BE
+};
+
+// Biquad filter coefficients and state, for K-weighting
+typedef struct biquad {
+  double b0, b1, b2, a1, a2;
+  double z1, z2;
+} biquad;
+
+// RF64/BW64 use this value for a chunk size stored in the ds64 chunk
+#define RF64_SIZE_IN_DS64 0xFFFFFFFF
+
 static int get_wav_metadata(PerlIO *infile, char *file, HV *info, HV *tags);
-void _parse_wav(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *info, HV *tags);
+void _parse_wav(PerlIO *infile, Buffer *buf, char *file, off_t file_size, off_t offset, uint8_t w64, HV *info, HV *tags);
 void _parse_wav_fmt(Buffer *buf, uint32_t chunk_size, HV *info);
 void _parse_wav_list(Buffer *buf, uint32_t chunk_size, HV *tags);
 void _parse_wav_peak(Buffer *buf, uint32_t chunk_size, HV *info, uint8_t big_endian);
+static int wav_find_frame(PerlIO *infile, char *file, int offset);
+static int wav_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+uint64_t _wav_audio_size(HV *info);
+int64_t _wav_find_frame(HV *info, int offset);
+SV * _wav_seek_header(PerlIO *infile, HV *info, uint64_t frame_offset);
+int wav_pcm_analysis(PerlIO *infile, char *file, HV *info);
+int _pcm_format(HV *info);
+void _pcm_decode(const unsigned char *bptr, uint32_t frames, uint16_t channels, int format, double **planes);
+void _pcm_k_filter(double *x, uint32_t frames, biquad *shelf, biquad *highpass);
+void _pcm_k_weighting(uint32_t samplerate, biquad *shelf, biquad *highpass);
+double _pcm_gated_loudness(double *segments, uint64_t count, uint32_t segment_frames);
 
-void _parse_aiff(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *info, HV *tags);
+void _parse_aiff(PerlIO *infile, Buffer *buf, char *file, off_t file_size, HV *info, HV *tags);
 void _parse_aiff_comm(Buffer *buf, uint32_t chunk_size, HV *info);
@@ -15,6 +15,11 @@
  */
 
 #define WAVPACK_BLOCK_SIZE 4096
+#define WAVPACK_MAX_BLOCK_SIZE 0x1000000
+#define WAVPACK_MAX_GUESSES 32
+
+#define WAVPACK_INITIAL_BLOCK 0x800
+#define WAVPACK_DSD_FLAG 0x80000000
 
 typedef struct {
 //  char ckID [4];              // "wvpk"
@@ -101,6 +106,12 @@ const int wavpack_sample_rates[] = {
 #define ID_BLOCK_CHECKSUM       (ID_OPTIONAL_DATA | 0xf)
 
 static int get_wavpack_info(PerlIO *infile, char *file, HV *info);
+int wavpack_find_frame(PerlIO *infile, char *file, int offset);
+int wavpack_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts);
+off_t _wavpack_find_frame(PerlIO *infile, char *file, int offset, HV *info, HV *opts, uint64_t *sample);
+off_t _wavpack_find_sample(wvpinfo *wvp, uint64_t sample, SV *seektable, uint32_t scale, WavpackHeader *hdr);
+off_t _wavpack_next_block(wvpinfo *wvp, off_t offset, off_t end, WavpackHeader *hdr);
+void wavpack_block_index(PerlIO *infile, char *file, HV *info, HV *opts);
 wvpinfo * _wavpack_parse(PerlIO *infile, char *file, HV *info, uint8_t seeking);
 int _wavpack_parse_block(wvpinfo *wvp);
 int _wavpack_parse_sample_rate(wvpinfo *wvp, uint32_t size);
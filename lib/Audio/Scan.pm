@@ -98,6 +98,11 @@ sub scan_fh {
 sub find_frame {
     my ( $class, $path, $offset ) = @_;
 
+    if ( ref $offset eq 'HASH' ) {
+        my $info = $class->find_frame_return_info( $path, $offset->{offset} || 0, _track_opts($offset) );
+        return $info && defined $info->{seek_offset} ? $info->{seek_offset} : -1;
+    }
+
     open my $fh, '<', $path or do {
         warn "Could not open $path for reading: $!\n";
         return;
@@ -119,13 +124,27 @@ sub find_frame {
 sub find_frame_fh {
     my ( $class, $suffix, $fh, $offset ) = @_;
 
+    if ( ref $offset eq 'HASH' ) {
+        my $info = $class->find_frame_fh_return_info( $suffix, $fh, $offset->{offset} || 0, _track_opts($offset) );
+        return $info && defined $info->{seek_offset} ? $info->{seek_offset} : -1;
+    }
+
     binmode $fh;
 
     return $class->_find_frame( $suffix, $fh, '(filehandle)', $offset );
 }
 
+sub _track_opts {
+    my $target = shift;
+
+    return {
+        track => $target->{track},
+        ( defined $target->{index} ? ( index => $target->{index} ) : () ),
+    };
+}
+
 sub find_frame_return_info {
-    my ( $class, $path, $offset ) = @_;
+    my ( $class, $path, $offset, $opts ) = @_;
 
     open my $fh, '<', $path or do {
         warn "Could not open $path for reading: $!\n";
@@ -138,7 +157,7 @@ sub find_frame_return_info {
 
     return if !$suffix;
 
-    my $ret = $class->_find_frame_return_info( $suffix, $fh, $path, $offset );
+    my $ret = $class->_find_frame_return_info( $suffix, $fh, $path, $offset, $opts );
 
     close $fh;
 
@@ -146,11 +165,236 @@ sub find_frame_return_info {
 }
 
 sub find_frame_fh_return_info {
-    my ( $class, $suffix, $fh, $offset ) = @_;
+    my ( $class, $suffix, $fh, $offset, $opts ) = @_;
+
+    binmode $fh;
+
+    return $class->_find_frame_return_info( $suffix, $fh, '(filehandle)', $offset, $opts );
+}
+
+sub find_frame_range {
+    my ( $class, $path, $start, $end, $opts ) = @_;
+
+    return $class->find_frame_return_info( $path, $start, { %{ $opts || {} }, end_offset => $end } );
+}
+
+sub find_frame_fh_range {
+    my ( $class, $suffix, $fh, $start, $end, $opts ) = @_;
+
+    return $class->find_frame_fh_return_info( $suffix, $fh, $start, { %{ $opts || {} }, end_offset => $end } );
+}
+
+sub box_tree {
+    my ( $class, $path ) = @_;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my $ret = $class->_box_tree( $suffix, $fh, $path );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub box_tree_fh {
+    my ( $class, $suffix, $fh ) = @_;
+
+    binmode $fh;
+
+    return $class->_box_tree( $suffix, $fh, '(filehandle)' );
+}
+
+sub frame_index {
+    my ( $class, $path, $opts ) = @_;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my $ret = $class->_frame_index( $suffix, $fh, $path, $opts );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub frame_index_fh {
+    my ( $class, $suffix, $fh, $opts ) = @_;
+
+    binmode $fh;
+
+    return $class->_frame_index( $suffix, $fh, '(filehandle)', $opts );
+}
+
+sub block_index {
+    my ( $class, $path, $opts ) = @_;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my $ret = $class->_block_index( $suffix, $fh, $path, $opts );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub block_index_fh {
+    my ( $class, $suffix, $fh, $opts ) = @_;
+
+    binmode $fh;
+
+    return $class->_block_index( $suffix, $fh, '(filehandle)', $opts );
+}
+
+sub dop {
+    my ( $class, $path, $offset, $opts ) = @_;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    my $ret = $class->_dop( $suffix, $fh, $path, $offset, $opts );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub dop_fh {
+    my ( $class, $suffix, $fh, $offset, $opts ) = @_;
 
     binmode $fh;
 
-    return $class->_find_frame_return_info( $suffix, $fh, '(filehandle)', $offset );
+    return $class->_dop( $suffix, $fh, '(filehandle)', $offset, $opts );
+}
+
+sub pcm_analysis {
+    my ( $class, $path ) = @_;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    return if !$suffix;
+
+    open my $fh, '<', $path or do {
+        warn "Could not open $path for reading: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my $ret = $class->_pcm_analysis( $suffix, $fh, $path );
+
+    close $fh;
+
+    return $ret;
+}
+
+sub pcm_analysis_fh {
+    my ( $class, $suffix, $fh ) = @_;
+
+    binmode $fh;
+
+    return $class->_pcm_analysis( $suffix, $fh, '(filehandle)' );
+}
+
+sub write_tags {
+    my ( $class, $path, $tags, $opts ) = @_;
+
+    open my $fh, '+<', $path or do {
+        warn "Could not open $path for writing: $!\n";
+        return;
+    };
+
+    binmode $fh;
+
+    my ($suffix) = $path =~ /\.(\w+)$/;
+
+    my $ret = $suffix ? $class->_write_tags( $suffix, $fh, $path, $tags, $opts ) : {};
+
+    if ( !exists $ret->{in_place} ) {
+        close $fh;
+        return;
+    }
+
+    if ( !$ret->{in_place} ) {
+        # The new tags don't fit, copy the audio after the new header into a new file
+        my $header = delete $ret->{header};
+        my $offset = delete $ret->{source_offset};
+        my $tmp    = "$path.tmp$$";
+        my $mode   = ( stat $fh )[2];
+
+        my $ok = open my $out, '>', $tmp;
+        if ($ok) {
+            binmode $out;
+            $ok = print {$out} $header;
+            $ok &&= seek $fh, $offset, 0;
+
+            while ($ok) {
+                my $read = read $fh, my $buf, 1024 * 1024;
+
+                # undef is a read error, not the end of the file
+                if ( !defined $read ) {
+                    $ok = 0;
+                    last;
+                }
+
+                last if !$read;
+
+                $ok = print {$out} $buf;
+            }
+
+            $ok = close($out) && $ok;
+
+            # Keep the permissions of the original file
+            $ok &&= chmod $mode & 07777, $tmp if defined $mode;
+        }
+
+        close $fh;
+
+        if ( !$ok || !rename $tmp, $path ) {
+            warn "Could not rewrite $path: $!\n";
+            unlink $tmp;
+            return;
+        }
+
+        return $ret;
+    }
+
+    close $fh;
+
+    return $ret;
 }
 
 1;
@@ -210,7 +454,7 @@ determined by the file's extension.  Supported extensions are:
     ASF:  wma, wmv, asf
     Musepack:  mpc, mpp, mp+
     Monkey's Audio:  ape, apl
-    WAV: wav
+    WAV: wav, w64, rf64, bw64
     AIFF: aiff, aif
     WavPack: wv
 
@@ -253,6 +497,13 @@ Note that FLAC does not support reading from a filehandle.
 Returns the byte offset to the first audio frame starting from the given timestamp
 (in milliseconds).
 
+For FLAC files with a CUESHEET, the timestamp may instead be a hashref naming a
+track, with an optional index (1 by default) and offset in milliseconds from it:
+
+    my $offset = Audio::Scan->find_frame( $file, { track => 2, offset => 30000 } );
+
+-1 is returned if the file has no such track or index.
+
 =over 4
 
 =item MP3, Ogg, FLAC, ASF, MP4
@@ -262,13 +513,36 @@ file formats that don't provide timestamp information such as MP3, the best esti
 the location of the timestamp will be returned.  This will be more accurate if the
 file has a Xing header or is CBR for example.
 
-=item WAV, AIFF, Musepack, Monkey's Audio, WavPack
+=item WAV, AIFF, DSF, DSDIFF
+
+The offset is calculated from the bitrate without reading any audio. WAV and AIFF
+offsets are rounded down to block_align, DSF offsets to the start of a block for each
+channel, and DSDIFF offsets to a byte for each channel. Offsets past 2GB are only
+returned by C<find_frame_return_info>.
+
+=item WavPack
+
+The offset of the block containing the timestamp. The position is guessed from the
+file size and narrowed down by reading the block headers found there, then the last
+few blocks are walked using their sizes. For multichannel files the first block of
+the group is returned. Files older than WavPack 4 are not supported.
+
+=item Musepack
+
+For SV8 files, the offset of the audio packet containing the timestamp. The packet is
+found from the closest point in the seek table, or by hopping over the packets from the
+first one if the file has no seek table. For SV7 files the frame lengths are walked
+from the start of the file, and the offset is the 32-bit word the frame starts in.
+
+=item Monkey's Audio
 
-Not yet supported by find_frame.
+The offset of the frame containing the timestamp, from the seek table after the header.
+Frames don't have to start on a 32-bit word, so the offset is rounded down to the word
+the frame starts in.
 
 =back
 
-=head2 find_frame_return_info( $mp4_path, $timestamp_in_ms )
+=head2 find_frame_return_info( $mp4_path, $timestamp_in_ms, [ \%OPTIONS ] )
 
 The header of an MP4 file contains various metadata that refers to the structure of
 the audio data, making seeking more difficult to perform. This method will return
@@ -297,14 +571,390 @@ this point:
     close $f;
     close $fh;
 
+An optional hashref may be provided with the following values:
+
+    scatter => 1
+
+Instead of seek_header, return the rewritten header as a scatter list. Boxes that
+are unchanged (including the remaining stsz entries) are not read into memory but
+are returned as ranges of the original file, which is much cheaper for long files.
+
+    seek_header_parts - An array of header fragments, each element is either a
+                        string of bytes to write, or an arrayref of
+                        [ $file_offset, $length ] to copy from the original file.
+    seek_header_size  - The total length of the header described by seek_header_parts.
+
+For example, to write the header with writev/sendfile-style I/O:
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30000, { scatter => 1 } );
+
+    for my $part ( @{ $info->{seek_header_parts} } ) {
+        if ( ref $part ) {
+            my ( $offset, $length ) = @{$part};
+            # sendfile( $socket, $f, $offset, $length )
+        }
+        else {
+            # syswrite( $socket, $part )
+        }
+    }
+
+    # followed by the audio data from $info->{seek_offset}
+
+    track_id => $id
+
+For files with more than one track, such as HD-AAC or files with a chapter track,
+seek in the audio track with the given ID (see the tracks array in the scan result).
+By default the first audio track is used. The rewritten header contains only this
+track, and the ID of the track is returned as seek_track_id. If the track doesn't
+exist or isn't an audio track, seek_offset will be -1.
+
+    adts => 1
+
+For AAC audio, return the audio starting at the seek point as an ADTS stream instead
+of a rewritten header, for players that can only handle raw ADTS. No header is
+rewritten and no audio is read, the stream is returned as a scatter list of 7-byte
+ADTS headers and [ $file_offset, $length ] ranges of raw AAC frames:
+
+    adts_parts       - The ADTS stream, in the same format as seek_header_parts.
+    adts_size        - The total length of the ADTS stream.
+    adts_frames      - The number of frames in adts_parts.
+    adts_next_sample - If max_frames was reached, the sample number to pass as
+                       start_sample to get the following frames.
+
+The following options may be used together with adts:
+
+    max_frames => $count
+
+Return at most $count frames, to send a long file in smaller pieces.
+
+    start_sample => $sample
+
+Start at the given sample (frame) number instead of the timestamp.
+
+When used with C<find_frame_range>, the ADTS stream ends at the end of the clip.
+Only AAC Main, LC, SSR and LTP (including HE-AAC with an LC core) can be framed
+as ADTS, for other files seek_offset will be -1.
+
+For FLAC files, seek_header contains the fLaC marker and a STREAMINFO block to send
+before the frames at seek_offset. total_samples is reduced by the number of samples
+skipped and the MD5 is cleared, since it no longer applies. If the file has a
+SEEKTABLE, it follows with the points before the seek point removed and the rest
+made relative to it. One option is supported:
+
+    seektable => $seektable
+
+Seek using the given SEEKTABLE block instead of the one in the file, such as the
+seektable_block returned by C<frame_index>.
+
+    track => $track_number, index => $index_number
+
+Seek relative to a CUESHEET track instead of the start of the file. The timestamp
+is added to the position of the track's index (INDEX 01 if index is not given).
+seek_offset is -1 if the cuesheet has no such track or index.
+
+For ASF (WMA) files, seek_offset is the offset of the data packet containing the
+timestamp and seek_packet is its number. seek_header contains the Header object and
+the start of the Data object to send before the packets from seek_offset. In File
+Properties, the file size and data packets count only cover the remaining packets
+and the play and send durations are reduced by the send time of the seek packet.
+The Data object size and packet count are set the same way. The packets themselves
+are not changed, and no index objects follow the data. seek_offset is -1 if the
+header is truncated or too damaged to be rewritten.
+
+For WAV and AIFF files, seek_header contains the file up to the start of the audio,
+with the RIFF/FORM and data/SSND chunk sizes reduced to the remaining audio. The sample
+count in a fact or COMM chunk is reduced the same way, and for RF64, BW64 and Wave64
+files the sizes in the ds64 chunk or the 64-bit chunk headers are rewritten.
+
+For DSF files, seek_header contains the DSD, fmt and data chunks with the file size,
+sample count and data size reduced to the remaining blocks. The metadata pointer is
+cleared since the ID3 tag is not part of the seeked stream. For DSDIFF files,
+seek_header contains the chunks before the sound data with the FRM8 and DSD chunk sizes
+reduced to the remaining data.
+
+For WavPack files, seek_sample is the first sample of the block at seek_offset. Each
+block can be decoded on its own, so there is no seek_header. The following option is
+available:
+
+    seektable => $seektable
+
+Start from the closest points of a seektable returned by C<block_index>, so only a few
+blocks around the timestamp are read.
+
+For Musepack files, seek_frame is the first frame at seek_offset. SV7 frames are not
+byte-aligned and are stored in 32-bit little-endian words, so seek_offset is the word
+containing the frame and seek_bit is the bit in that word, counted from the most
+significant bit, where the frame starts.
+
+For Monkey's Audio files, seek_frame is the frame at seek_offset and seek_skip_samples
+is the number of samples to drop from the start of the frame to reach the timestamp.
+Frames are read as 32-bit words counted from the first frame, so seek_offset is the
+word containing the frame and seek_bit is where the frame starts in that word. Files
+older than 3.81 also store the bit offset of each frame, which is included in seek_bit.
+
+=head2 find_frame_range( $mp4_path, $start_in_ms, $end_in_ms, [ \%OPTIONS ] )
+
+Like C<find_frame_return_info>, but the rewritten header only describes the samples
+between $start_in_ms and $end_in_ms, and the durations in the mvhd, tkhd and mdhd
+boxes and the size of mdat are set to match. One additional key is returned:
+
+    seek_length - The number of bytes of audio data to copy starting at seek_offset
+
+The header followed by these bytes is a complete file containing only the clip,
+for example a 30-second preview:
+
+    my $info = Audio::Scan->find_frame_range( $file, 60000, 90000 );
+
+    open my $f, '<', $file;
+    sysseek $f, $info->{seek_offset}, 0;
+    sysread $f, my $audio, $info->{seek_length};
+
+    open my $fh, '>', 'preview.m4a';
+    print $fh $info->{seek_header} . $audio;
+
+The same options as C<find_frame_return_info> are supported.
+
 =head2 find_frame_fh( $type => $fh, $offset )
 
 Same as C<find_frame>, but with a filehandle.
 
-=head2 find_frame_fh_return_info( $type => $fh, $offset )
+=head2 find_frame_fh_return_info( $type => $fh, $offset, [ \%OPTIONS ] )
 
 Same as C<find_frame_return_info>, but with a filehandle.
 
+=head2 find_frame_fh_range( $type => $fh, $start_in_ms, $end_in_ms, [ \%OPTIONS ] )
+
+Same as C<find_frame_range>, but with a filehandle.
+
+=head2 box_tree( $mp4_path )
+
+Returns the layout of the boxes (atoms) in an MP4 file, for indexing or validating
+files without parsing them. Only box headers and the entry counts of sample tables
+are read, so this is fast even for large files. The returned hashref contains:
+
+    boxes        - An arrayref of every box in file order, each a hashref with:
+        type         - The 4-character box type
+        offset       - File offset of the box
+        header_size  - 8, or 16 for boxes with a 64-bit size
+        payload_size - Size of the box minus its header
+        depth        - Nesting level, 0 for top-level boxes
+        entries      - Number of entries (stts, stsc, stsz, stco, co64, stss, ctts only)
+        sample_size  - The fixed sample size, or 0 if samples vary (stsz only)
+        truncated    - Present if the box extends past its parent or the end of the file
+    file_size    - Size of the file
+    moov_offset  - Offset and size of the moov box
+    moov_size
+    audio_offset - Offset and size of the first mdat box
+    audio_size
+    leading_mdat - Present if mdat comes before moov, such files must be read to
+                   the end before they can be played
+    fragmented   - Present if the file contains movie fragments (mvex or moof)
+    free_size    - Total size of free and skip boxes
+
+Returns undef if the file is not an MP4 file.
+
+=head2 box_tree_fh( $type => $fh )
+
+Same as C<box_tree>, but with a filehandle.
+
+=head2 frame_index( $flac_path, [ \%OPTIONS ] )
+
+Reads every frame header of a FLAC file once and returns a seek index, for files
+without a SEEKTABLE. Seeking in such files has to search for frames by guessing, which
+is slow for high resolution files. The index can be saved and passed back to
+C<find_frame_return_info> in the seektable option, or written into the file as a
+metadata block. The returned hashref contains the usual FLAC info and:
+
+    frames          - The number of frames
+    indexed_samples - The number of samples, counted from the frame headers
+                      (total_samples is still the STREAMINFO value)
+    seekpoints      - The number of seek points in seektable_block
+    seektable_block - A SEEKTABLE metadata block (including its 4-byte block header)
+    tracks          - Only present if the file has a CUESHEET, an arrayref of
+                      hashrefs for each track with:
+        track        - The track number
+        start_sample - The sample at INDEX 01 (or the track's first index)
+        end_sample   - The start of the next track, or the lead-out
+        offset       - File offset of the frame containing start_sample
+        size         - Number of bytes from offset to the next track's frame,
+                       or the end of the audio data
+
+An optional hashref may be provided with the following values:
+
+    interval_ms => $ms
+
+The distance between seek points, 10 seconds by default. Use 0 for a point at every frame.
+
+Returns undef if the file is not a FLAC file.
+
+For example:
+
+    my $index = Audio::Scan->frame_index( $file );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30000, {
+        seektable => $index->{seektable_block},
+    } );
+
+    # $info->{seek_offset}
+
+=head2 frame_index_fh( $type => $fh, [ \%OPTIONS ] )
+
+Same as C<frame_index>, but with a filehandle.
+
+=head2 block_index( $wavpack_path, [ \%OPTIONS ] )
+
+Reads every block header of a WavPack file once and returns a seek index, for
+repeated seeks in the same file. The returned hashref contains the usual WavPack info
+and:
+
+    blocks        - The number of blocks, counting each multichannel group once
+    total_samples - The number of samples, counted from the block headers
+    seekpoints    - The number of seek points in seektable
+    seektable     - The seek points, each a 64-bit big-endian sample number followed
+                    by the 64-bit big-endian offset of its block, as read by
+                    unpack('(Q>Q>)*', ...)
+
+An optional hashref may be provided with the following values:
+
+    interval_ms => $ms
+
+The distance between seek points, 10 seconds by default. Use 0 for a point at every block.
+
+Returns undef if the file is not a WavPack file.
+
+For example:
+
+    my $index = Audio::Scan->block_index( $file );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30000, {
+        seektable => $index->{seektable},
+    } );
+
+=head2 block_index_fh( $type => $fh, [ \%OPTIONS ] )
+
+Same as C<block_index>, but with a filehandle.
+
+=head2 dop( $path, $timestamp_in_ms, [ \%OPTIONS ] )
+
+Reads the DSD audio of a DSF or DSDIFF file from the given timestamp and returns it
+as DoP (DSD over PCM) frames, ready to send to a DAC as 24-bit PCM at 1/16 of the DSD
+sample rate. Each PCM sample holds 16 DSD bits of one channel, oldest first from the
+MSB, under a marker byte that alternates between 0x05 and 0xFA on each frame. The bits
+of LSB-first DSF files are reversed. Returns the usual info with these additional keys:
+
+    dop_data        - The packed frames, interleaved by channel, each sample 3 bytes
+                      little-endian
+    dop_frames      - The number of frames in dop_data
+    dop_samplerate  - The PCM sample rate
+    dop_start_frame - The number of the first frame
+    dop_next_frame  - If max_frames was reached, the frame number to pass as
+                      start_frame to get the following frames
+
+The marker follows the frame number, so frames from consecutive calls can be sent one
+after the other. Returns undef if the file is not a DSF or DSDIFF file or its audio
+can't be read. An optional hashref may be provided with the following values:
+
+    max_frames => $count
+
+Return at most $count frames, 176400 (one second of DSD64) by default. Pass
+dop_next_frame back as start_frame to read the rest of the file.
+
+    start_frame => $frame
+
+Start at the given frame instead of the timestamp.
+
+    container => 4
+
+Return each sample as 4 bytes little-endian with a zero low byte, for devices
+that take 24-bit audio in 32-bit samples.
+
+=head2 dop_fh( $type => $fh, $timestamp_in_ms, [ \%OPTIONS ] )
+
+Same as C<dop>, but with a filehandle.
+
+=head2 pcm_analysis( $path )
+
+Reads the audio of an uncompressed WAV or AIFF file once and returns the usual info
+with the following additional keys:
+
+    sample_peak     - An arrayref with a hashref for each channel, in the same form
+                      as the PEAK chunk: value is the largest absolute sample value
+                      (1.0 is full scale) and position is its sample frame
+    rms             - An arrayref of the RMS level of each channel (1.0 is full scale)
+    loudness        - The EBU R128 integrated loudness in LUFS, not present if the
+                      file is shorter than 400ms or silent
+    analyzed_frames - The number of sample frames read
+
+8, 16, 24 and 32-bit integer and 32 and 64-bit float samples are supported, including
+WAVE_FORMAT_EXTENSIBLE files and little-endian (sowt) and float AIFC files. Loudness
+uses the BS.1770 channel weights for 5 and 6+ channel files, assuming the usual
+L, R, C, LFE, Ls, Rs order. For other sample formats the info is returned without these
+keys. Returns undef if the file is not a WAV or AIFF file.
+
+=head2 pcm_analysis_fh( $type => $fh )
+
+Same as C<pcm_analysis>, but with a filehandle.
+
+=head2 write_tags( $path, \%TAGS, [ \%OPTIONS ] )
+
+Writes tags to a FLAC, MP3 or MP4 file. The tags hashref has the same form as the tags
+returned by C<scan>.
+
+When the new tags fit in the space used by the old ones and their padding, only the
+tags are written and the audio data is untouched. Otherwise the file is rewritten
+with new padding after the tags. Returns undef on failure, or a hashref with:
+
+    in_place     - 1 if the tags were written in place, 0 if the file was rewritten
+    audio_offset - The offset of the end of the new tags
+    padding      - The amount of padding after the new tags
+
+An optional hashref may be provided with the following values:
+
+    padding => $bytes
+
+The amount of padding to add when the file has to be rewritten, 8192 bytes for FLAC
+and 2048 bytes for MP3 and MP4 by default.
+
+=over 4
+
+=item FLAC
+
+All existing Vorbis comments are replaced. Values may be strings or arrayrefs of
+strings. VENDOR sets the vendor string, the existing one is kept if it isn't given.
+If ALLPICTURES is present it replaces the PICTURE blocks, otherwise they are kept.
+Pictures scanned with AUDIO_SCAN_NO_ARTWORK are copied from the file at their offset.
+Other metadata blocks are kept as they are.
+
+=item MP3
+
+The ID3v2.3 or ID3v2.4 tag is updated, and a file without one gets a new ID3v2.4
+tag. Only the frames named in the tags hashref are replaced, and a value of undef
+removes them. Text (T*) and URL (W*) frames, COMM, USLT and APIC can be written,
+other frame IDs can only be removed. Any other key is written as a TXXX frame with
+the key as its description, replacing TXXX frames with the same description in any
+case. Strings are written as ISO-8859-1 when possible, otherwise as UTF-8 in v2.4
+tags and UTF-16 in v2.3 tags. In v2.3 tags, TDRC is written as TYER, TDAT and TIME.
+APIC frames scanned with AUDIO_SCAN_NO_ARTWORK are copied from the file at their
+offset. ID3v1 and APE tags are not changed, and ID3v2.2 tags are not supported.
+
+=item MP4
+
+The ilst atoms named in the tags hashref are replaced, a value of undef removes them
+and other atoms are kept. Known keys such as NAM, ART, TRKN, DISK, TMPO and COVR are
+written as their iTunes atoms, GNRE is written as a genre number when it is an ID3
+genre and as text (GEN) otherwise, and any other key is written as a custom atom.
+Arrayref values of COVR and custom keys are stored in one atom. COVR values scanned
+with AUDIO_SCAN_NO_ARTWORK are copied from the file using COVR_offset.
+
+The moov box is written in place when it fits in the old moov and the free boxes
+after it, and a free box inside meta holds the remaining space. Otherwise the old
+moov is turned into a free box and the new one, with padding, is written at the end
+of the file. The audio data never moves, so the file is never rewritten and
+in_place is always 1. The result also has C<moov_relocated>, set to 1 when moov was
+moved. Fragmented and truncated files can only be written in place.
+
+=back
+
 =head2 has_flac()
 
 Deprecated.  Always returns 1 now that FLAC is always enabled.
@@ -728,6 +1378,7 @@ The following metadata about a file may be returned.
     dlna_profile (if file is compliant)
     file_size
     format (WAV format code, 1 == PCM)
+    subformat (format code of the SubFormat GUID, if format is 65534)
     id3_version (if an ID3v2 tag is found)
     samplerate (in kHz)
     song_length_ms
@@ -765,6 +1416,9 @@ found in a LIST block may include these and others:
 
 ID3v2 tags can also be embedded within WAV files.  These are returned exactly as for MP3 files.
 
+RF64 and BW64 files are read using the 64-bit sizes in their ds64 chunk, and Sony Wave64
+files are also supported, so audio_size and song_length_ms are correct for files over 4GB.
+
 =head1 AIFF
 
 =head2 INFO
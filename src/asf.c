@@ -68,6 +68,7 @@ _asf_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
   ASF_Object hdr;
   ASF_Object data;
   ASF_Object tmp;
+  uint64_t object_end;
   asfinfo *asf;
 
   Newz(0, asf, sizeof(asfinfo), asfinfo);
@@ -121,10 +122,22 @@ _asf_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
     buffer_get_guid(asf->buf, &tmp.ID);
     tmp.size = buffer_get_int64_le(asf->buf);
 
-    if ( !_check_buf(infile, asf->buf, tmp.size - 24, ASF_BLOCK_SIZE) ) {
+    if ( tmp.size < 24 ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid ASF file: %s (invalid object size)\n", file);
       goto out;
     }
 
+    // Objects that may hold artwork are read a descriptor at a time, others are buffered whole
+    if (
+         !IsEqualGUID(&tmp.ID, &ASF_Extended_Content_Description)
+      && !IsEqualGUID(&tmp.ID, &ASF_Header_Extension)
+      && !_check_buf(infile, asf->buf, tmp.size - 24, ASF_BLOCK_SIZE)
+    ) {
+      goto out;
+    }
+
+    object_end = _asf_tell(asf) + tmp.size - 24;
+
     asf->object_offset += 24;
 
     DEBUG_TRACE("object_offset %d\n", asf->object_offset);
@@ -135,6 +148,7 @@ _asf_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
     }
     else if ( IsEqualGUID(&tmp.ID, &ASF_File_Properties) ) {
       DEBUG_TRACE("File_Properties\n");
+      asf->file_properties_offset = asf->object_offset;
       _parse_file_properties(asf);
     }
     else if ( IsEqualGUID(&tmp.ID, &ASF_Stream_Properties) ) {
@@ -143,7 +157,10 @@ _asf_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
     }
     else if ( IsEqualGUID(&tmp.ID, &ASF_Extended_Content_Description) ) {
       DEBUG_TRACE("Extended_Content_Description\n");
-      _parse_extended_content_description(asf);
+      if ( !_parse_extended_content_description(asf) ) {
+        PerlIO_printf(PerlIO_stderr(), "Invalid ASF file: %s (invalid extended content description object)\n", file);
+        goto out;
+      }
     }
     else if ( IsEqualGUID(&tmp.ID, &ASF_Codec_List) ) {
       DEBUG_TRACE("Codec_List\n");
@@ -189,6 +206,12 @@ _asf_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
       buffer_consume(asf->buf, tmp.size - 24);
     }
 
+    // Make sure the next object is read from the right place
+    if ( !_asf_seek_to(asf, object_end) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid ASF file: %s (object overruns its size)\n", file);
+      goto out;
+    }
+
     asf->object_offset += tmp.size - 24;
   }
 
@@ -285,12 +308,18 @@ _parse_content_description(asfinfo *asf)
   }
 }
 
-void
+int
 _parse_extended_content_description(asfinfo *asf)
 {
-  uint16_t count = buffer_get_short_le(asf->buf);
+  uint16_t count;
   uint32_t picture_offset = 0;
 
+  if ( !_check_buf(asf->infile, asf->buf, 2, ASF_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  count = buffer_get_short_le(asf->buf);
+
   buffer_init_or_clear(asf->scratch, 32);
 
   while ( count-- ) {
@@ -300,8 +329,16 @@ _parse_extended_content_description(asfinfo *asf)
     SV *key = NULL;
     SV *value = NULL;
 
+    if ( !_check_buf(asf->infile, asf->buf, 2, ASF_BLOCK_SIZE) ) {
+      return 0;
+    }
+
     name_len = buffer_get_short_le(asf->buf);
 
+    if ( !_check_buf(asf->infile, asf->buf, name_len + 4, ASF_BLOCK_SIZE) ) {
+      return 0;
+    }
+
     buffer_clear(asf->scratch);
     buffer_get_utf16_as_utf8(asf->buf, asf->scratch, name_len, UTF16_BYTEORDER_LE);
     key = newSVpv( buffer_ptr(asf->scratch), 0 );
@@ -312,6 +349,14 @@ _parse_extended_content_description(asfinfo *asf)
 
     picture_offset += 2 + name_len + 4;
 
+    // Pictures are read in parts so artwork can be skipped, other values are small
+    if ( !(data_type == TYPE_BYTE && !strcmp( SvPVX(key), "WM/Picture" ))
+      && !_check_buf(asf->infile, asf->buf, value_len, ASF_BLOCK_SIZE)
+    ) {
+      SvREFCNT_dec(key);
+      return 0;
+    }
+
     if (data_type == TYPE_UNICODE) {
       buffer_clear(asf->scratch);
       buffer_get_utf16_as_utf8(asf->buf, asf->scratch, value_len, UTF16_BYTEORDER_LE);
@@ -321,7 +366,11 @@ _parse_extended_content_description(asfinfo *asf)
     else if (data_type == TYPE_BYTE) {
       // handle picture data, interestingly it is compatible with the ID3v2 APIC frame
       if ( !strcmp( SvPVX(key), "WM/Picture" ) ) {
-        value = _parse_picture(asf, picture_offset);
+        value = _parse_picture(asf, picture_offset, value_len);
+        if (value == NULL) {
+          SvREFCNT_dec(key);
+          return 0;
+        }
       }
       else {
         value = newSVpvn( buffer_ptr(asf->buf), value_len );
@@ -362,7 +411,12 @@ _parse_extended_content_description(asfinfo *asf)
 
       _store_tag( asf->tags, key, value );
     }
+    else {
+      SvREFCNT_dec(key);
+    }
   }
+
+  return 1;
 }
 
 void
@@ -626,6 +680,11 @@ _parse_header_extension(asfinfo *asf, uint64_t len)
   uint64_t hdr_size;
   uint32_t tmp_offset = asf->object_offset;
 
+  // The extension objects are buffered one at a time, Metadata_Library is read incrementally
+  if ( !_check_buf(asf->infile, asf->buf, 22, ASF_BLOCK_SIZE) ) {
+    return 0;
+  }
+
   // Skip reserved fields
   buffer_consume(asf->buf, 18);
 
@@ -648,9 +707,27 @@ _parse_header_extension(asfinfo *asf, uint64_t len)
   asf->object_offset += 46 - 24;
 
   while (ext_size > 0) {
+    uint64_t hdr_end;
+
+    if ( !_check_buf(asf->infile, asf->buf, 24, ASF_BLOCK_SIZE) ) {
+      return 0;
+    }
+
     buffer_get_guid(asf->buf, &hdr);
     hdr_size = buffer_get_int64_le(asf->buf);
+
+    if ( hdr_size < 24 || hdr_size > ext_size ) {
+      return 0;
+    }
+
     ext_size -= hdr_size;
+    hdr_end = _asf_tell(asf) + hdr_size - 24;
+
+    if ( !IsEqualGUID(&hdr, &ASF_Metadata_Library)
+      && !_check_buf(asf->infile, asf->buf, hdr_size - 24, ASF_BLOCK_SIZE)
+    ) {
+      return 0;
+    }
 
     asf->object_offset += 24;
 
@@ -674,7 +751,9 @@ _parse_header_extension(asfinfo *asf, uint64_t len)
     }
     else if ( IsEqualGUID(&hdr, &ASF_Metadata_Library) ) {
       DEBUG_TRACE("  Metadata_Library\n");
-      _parse_metadata_library(asf);
+      if ( !_parse_metadata_library(asf) ) {
+        return 0;
+      }
     }
     else if ( IsEqualGUID(&hdr, &ASF_Index_Parameters) ) {
       DEBUG_TRACE("  Index_Parameters\n");
@@ -704,6 +783,10 @@ _parse_header_extension(asfinfo *asf, uint64_t len)
       buffer_consume(asf->buf, hdr_size - 24);
     }
 
+    if ( !_asf_seek_to(asf, hdr_end) ) {
+      return 0;
+    }
+
     asf->object_offset += hdr_size - 24;
   }
 
@@ -1027,12 +1110,18 @@ _parse_stream_bitrate_properties(asfinfo *asf)
   }
 }
 
-void
+int
 _parse_metadata_library(asfinfo *asf)
 {
-  uint16_t count = buffer_get_short_le(asf->buf);
+  uint16_t count;
   uint32_t picture_offset = 0;
 
+  if ( !_check_buf(asf->infile, asf->buf, 2, ASF_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  count = buffer_get_short_le(asf->buf);
+
   buffer_init_or_clear(asf->scratch, 32);
 
   while ( count-- ) {
@@ -1041,6 +1130,10 @@ _parse_metadata_library(asfinfo *asf)
     uint16_t stream_number, name_len, data_type;
     uint32_t data_len;
 
+    if ( !_check_buf(asf->infile, asf->buf, 12, ASF_BLOCK_SIZE) ) {
+      return 0;
+    }
+
 #ifdef AUDIO_SCAN_DEBUG
     uint16_t lang_index    = buffer_get_short_le(asf->buf);
 #else
@@ -1052,6 +1145,10 @@ _parse_metadata_library(asfinfo *asf)
     data_type     = buffer_get_short_le(asf->buf);
     data_len      = buffer_get_int_le(asf->buf);
 
+    if ( !_check_buf(asf->infile, asf->buf, name_len, ASF_BLOCK_SIZE) ) {
+      return 0;
+    }
+
     buffer_clear(asf->scratch);
     buffer_get_utf16_as_utf8(asf->buf, asf->scratch, name_len, UTF16_BYTEORDER_LE);
     key = newSVpv( buffer_ptr(asf->scratch), 0 );
@@ -1059,6 +1156,14 @@ _parse_metadata_library(asfinfo *asf)
 
     picture_offset += 12 + name_len;
 
+    // Pictures are read in parts so artwork can be skipped
+    if ( !(data_type == TYPE_BYTE && !strcmp( SvPVX(key), "WM/Picture" ))
+      && !_check_buf(asf->infile, asf->buf, data_len, ASF_BLOCK_SIZE)
+    ) {
+      SvREFCNT_dec(key);
+      return 0;
+    }
+
     if (data_type == TYPE_UNICODE) {
       buffer_clear(asf->scratch);
       buffer_get_utf16_as_utf8(asf->buf, asf->scratch, data_len, UTF16_BYTEORDER_LE);
@@ -1068,7 +1173,11 @@ _parse_metadata_library(asfinfo *asf)
     else if (data_type == TYPE_BYTE) {
       // handle picture data
       if ( !strcmp( SvPVX(key), "WM/Picture" ) ) {
-        value = _parse_picture(asf, picture_offset);
+        value = _parse_picture(asf, picture_offset, data_len);
+        if (value == NULL) {
+          SvREFCNT_dec(key);
+          return 0;
+        }
       }
       else {
         value = newSVpvn( buffer_ptr(asf->buf), data_len );
@@ -1123,7 +1232,12 @@ _parse_metadata_library(asfinfo *asf)
         _store_tag( asf->tags, key, value );
       }
     }
+    else {
+      SvREFCNT_dec(key);
+    }
   }
+
+  return 1;
 }
 
 void
@@ -1437,26 +1551,43 @@ _parse_script_command(asfinfo *asf)
   my_hv_store( asf->info, "script_commands", newRV_noinc( (SV *)commands ) );
 }
 
+// Parse a WM/Picture value of value_len bytes. The header is buffered first,
+// the image is only read if artwork is wanted and skipped by length otherwise.
 SV *
-_parse_picture(asfinfo *asf, uint32_t picture_offset)
+_parse_picture(asfinfo *asf, uint32_t picture_offset, uint32_t value_len)
 {
   char *tmp_ptr;
+  char *end;
   uint16_t mime_len = 2; // to handle double-null
   uint16_t desc_len = 2;
   uint32_t image_len;
   SV *mime;
   SV *desc;
-  HV *picture = newHV();
+  HV *picture;
+
+  if ( value_len < 9 || !_check_buf(asf->infile, asf->buf, 5, ASF_BLOCK_SIZE) ) {
+    return NULL;
+  }
+
+  image_len = get_u32le( (unsigned char *)buffer_ptr(asf->buf) + 1 );
+
+  // Type, length, MIME type and description come before the image
+  if ( image_len > value_len - 9 || !_check_buf(asf->infile, asf->buf, value_len - image_len, ASF_BLOCK_SIZE) ) {
+    return NULL;
+  }
+
+  picture = newHV();
 
   buffer_init_or_clear(asf->scratch, 32);
 
   my_hv_store( picture, "image_type", newSVuv( buffer_get_char(asf->buf) ) );
 
-  image_len = buffer_get_int_le(asf->buf);
+  buffer_consume(asf->buf, 4);
 
   // MIME type is a double-null-terminated UTF-16 string
   tmp_ptr = buffer_ptr(asf->buf);
-  while ( tmp_ptr[0] != '\0' || tmp_ptr[1] != '\0' ) {
+  end = tmp_ptr + value_len - image_len - 5;
+  while ( tmp_ptr + 2 < end && (tmp_ptr[0] != '\0' || tmp_ptr[1] != '\0') ) {
     mime_len += 2;
     tmp_ptr += 2;
   }
@@ -1468,7 +1599,7 @@ _parse_picture(asfinfo *asf, uint32_t picture_offset)
 
   // Description is a double-null-terminated UTF-16 string
   tmp_ptr = buffer_ptr(asf->buf);
-  while ( tmp_ptr[0] != '\0' || tmp_ptr[1] != '\0' ) {
+  while ( tmp_ptr + 2 < end && (tmp_ptr[0] != '\0' || tmp_ptr[1] != '\0') ) {
     desc_len += 2;
     tmp_ptr += 2;
   }
@@ -1483,49 +1614,150 @@ _parse_picture(asfinfo *asf, uint32_t picture_offset)
     my_hv_store( picture, "image", newSVuv(image_len) );
     picture_offset += 5 + mime_len + desc_len + 2;
     my_hv_store( picture, "offset", newSVuv(asf->object_offset + picture_offset) );
+
+    _asf_skip(asf, image_len);
   }
   else {
+    if ( !_check_buf(asf->infile, asf->buf, image_len, ASF_BLOCK_SIZE) ) {
+      SvREFCNT_dec( (SV *)picture );
+      return NULL;
+    }
+
     my_hv_store( picture, "image", newSVpvn( buffer_ptr(asf->buf), image_len ) );
+    buffer_consume(asf->buf, image_len);
   }
 
-  buffer_consume(asf->buf, image_len);
+  // Skip anything left in the value after the image
+  _asf_skip(asf, value_len - 5 - mime_len - desc_len - image_len);
 
   return newRV_noinc( (SV *)picture );
 }
 
+// Return the file offset of the next unread byte
+uint64_t
+_asf_tell(asfinfo *asf)
+{
+  return PerlIO_tell(asf->infile) - buffer_len(asf->buf);
+}
+
+void
+_asf_skip(asfinfo *asf, uint32_t size)
+{
+  if ( buffer_len(asf->buf) >= size ) {
+    buffer_consume(asf->buf, size);
+  }
+  else {
+    PerlIO_seek(asf->infile, size - buffer_len(asf->buf), SEEK_CUR);
+    buffer_clear(asf->buf);
+
+    DEBUG_TRACE("  seeked past %d bytes to %d\n", size, (int)PerlIO_tell(asf->infile));
+  }
+}
+
+// Skip forward to offset, fails if it was already read past
+int
+_asf_seek_to(asfinfo *asf, uint64_t offset)
+{
+  uint64_t pos = _asf_tell(asf);
+
+  if (offset < pos) {
+    return 0;
+  }
+
+  if (offset > pos) {
+    DEBUG_TRACE("  skipping %" PRIu64 " unread bytes\n", offset - pos);
+    _asf_skip(asf, offset - pos);
+  }
+
+  return 1;
+}
+
 // offset is in ms
-// Based on some code from Rockbox
 int
 asf_find_frame(PerlIO *infile, char *file, int time_offset)
 {
-  int frame_offset = -1;
-  uint32_t song_length_ms;
-  int32_t offset_index = 0;
-  uint32_t min_packet_size, max_packet_size;
-  uint8_t found = 0;
+  int frame_offset;
 
   // We need to read all info first to get some data we need to calculate
   HV *info = newHV();
   HV *tags = newHV();
   asfinfo *asf = _asf_parse(infile, file, info, tags, 1);
 
+  frame_offset = _asf_find_frame(asf, info, time_offset);
+
+  // Don't leak
+  SvREFCNT_dec(info);
+  SvREFCNT_dec(tags);
+
+  _asf_free_seek(asf);
+
+  return frame_offset;
+}
+
+// Return the offset of the seek packet, its packet number, and an ASF header
+// for the remaining packets, with File Properties and the Data object rebased
+int
+asf_find_frame_return_info(PerlIO *infile, char *file, int time_offset, HV *info, HV *opts)
+{
+  int frame_offset;
+  HV *tags = newHV();
+  asfinfo *asf = _asf_parse(infile, file, info, tags, 1);
+
+  frame_offset = _asf_find_frame(asf, info, time_offset);
+
+  my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+
+  if (frame_offset >= 0) {
+    SV *header = _asf_seek_header(asf, info, frame_offset);
+
+    if (header != NULL) {
+      my_hv_store( info, "seek_header", header );
+    }
+    else {
+      // Without a valid header the packets can't be played
+      frame_offset = -1;
+      my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+    }
+  }
+
+  SvREFCNT_dec(tags);
+
+  _asf_free_seek(asf);
+
+  return frame_offset;
+}
+
+// Based on some code from Rockbox
+int
+_asf_find_frame(asfinfo *asf, HV *info, int time_offset)
+{
+  int frame_offset = -1;
+  uint32_t song_length_ms;
+  int32_t offset_index = 0;
+  uint32_t min_packet_size, max_packet_size;
+
   // We'll need to reuse the scratch buffer
   Newz(0, asf->scratch, sizeof(Buffer), Buffer);
 
   // No seeking without at least 1 stream
   if ( !my_hv_exists(info, "streams") ) {
     DEBUG_TRACE("No streams found in file, not seeking\n");
-    goto out;
+    return -1;
+  }
+
+  // Broadcast files have no packet sizes or duration
+  if ( !my_hv_exists(info, "max_packet_size") || !my_hv_exists(info, "song_length_ms") ) {
+    DEBUG_TRACE("No packet size or duration, cannot seek\n");
+    return -1;
   }
 
   min_packet_size = SvIV( *(my_hv_fetch(info, "min_packet_size")) );
   max_packet_size = SvIV( *(my_hv_fetch(info, "max_packet_size")) );
-
   // No seeking if min != max, according to the ASF spec these must be the same
   // and without this value we can't find the data packets properly
   if (min_packet_size != max_packet_size) {
     DEBUG_TRACE("min_packet_size != max_packet_size, cannot seek\n");
-    goto out;
+    return -1;
   }
 
   song_length_ms = SvIV( *(my_hv_fetch( info, "song_length_ms" )) );
@@ -1569,83 +1801,253 @@ asf_find_frame(PerlIO *infile, char *file, int time_offset)
   }
   else {
     // No ASF_Index, no max_bitrate, probably an invalid file
-    goto out;
+    return -1;
   }
 
   // Double-check above frame, make sure we have the right one
   // with a timestamp within our desired range
-  while ( !found && frame_offset >= 0 ) {
-    int time, duration;
+  frame_offset = _asf_search_packets(asf, time_offset, frame_offset, max_packet_size, song_length_ms);
 
-    DEBUG_TRACE("Checking for frame with timestamp %d at %d\n", time_offset, frame_offset);
+  return frame_offset;
+}
 
-    if ( frame_offset > asf->file_size - 64 ) {
-      DEBUG_TRACE("  Offset too large: %d\n", frame_offset);
-      break;
+void
+_asf_free_seek(asfinfo *asf)
+{
+  if (asf->spec_count) {
+    int i;
+    for (i = 0; i < asf->spec_count; i++) {
+      DEBUG_TRACE("Freeing specs[%d] offsets\n", i);
+      Safefree(asf->specs[i].offsets);
     }
 
-    time = _timestamp(asf, frame_offset, &duration);
+    DEBUG_TRACE("Freeing specs\n");
+    Safefree(asf->specs);
+  }
+
+  if (asf->scratch->alloc)
+    buffer_free(asf->scratch);
+  Safefree(asf->scratch);
+
+  if (asf->seek_cache)
+    Safefree(asf->seek_cache);
+
+  Safefree(asf);
+}
+
+// Build a header for the packets from frame_offset on: the header object and the
+// start of the Data object, with the file size, packet counts and durations rebased
+SV *
+_asf_seek_header(asfinfo *asf, HV *info, int frame_offset)
+{
+  Buffer buf;
+  SV *header = NULL;
+  unsigned char *bptr;
+  uint32_t packet_size;
+  uint64_t packet;
+  uint64_t packets;
+  uint64_t elapsed;
+  uint64_t duration;
+  int time, packet_duration;
+
+  if ( !asf->file_properties_offset || !my_hv_exists(info, "data_packets") || !my_hv_exists(info, "max_packet_size") ) {
+    return NULL;
+  }
+
+  // Both File Properties and the start of the Data object must be in the header
+  if ( asf->audio_offset < 50 || asf->file_properties_offset + 56 > asf->audio_offset - 50 ) {
+    return NULL;
+  }
+
+  packet_size = SvIV( *(my_hv_fetch(info, "max_packet_size")) );
+  if (!packet_size) {
+    return NULL;
+  }
+
+  packets     = SvIV( *(my_hv_fetch(info, "data_packets")) );
+  packet      = (frame_offset - asf->audio_offset) / packet_size;
+
+  packets = packets > packet ? packets - packet : 0;
+
+  my_hv_store( info, "seek_packet", newSVuv(packet) );
+
+  // Send time of the seek packet, or the estimate if it can't be read
+  time = frame_offset <= asf->file_size - 64 ? _asf_packet_time(asf, packet, packet_size, &packet_duration) : -1;
+  elapsed = time > 0 ? (uint64_t)time * 10000 : 0;
+
+  buffer_init(&buf, asf->audio_offset);
+
+  if ( PerlIO_seek(asf->infile, 0, SEEK_SET) != 0 || !_check_buf(asf->infile, &buf, asf->audio_offset, asf->audio_offset) ) {
+    goto out;
+  }
+
+  if ( buffer_len(&buf) < asf->audio_offset ) {
+    goto out;
+  }
+
+  header = newSVpvn( buffer_ptr(&buf), asf->audio_offset );
+  bptr = (unsigned char *)SvPVX(header);
+
+  // File Properties: file size, data packets count, play and send durations in 100ns units
+  bptr += asf->file_properties_offset;
+  put_u64le( bptr + 16, asf->audio_offset + packets * packet_size );
+  put_u64le( bptr + 32, packets );
+
+  duration = get_u64le(bptr + 40);
+  put_u64le( bptr + 40, duration > elapsed ? duration - elapsed : 0 );
+
+  duration = get_u64le(bptr + 48);
+  put_u64le( bptr + 48, duration > elapsed ? duration - elapsed : 0 );
 
-    DEBUG_TRACE("  Timestamp for frame at %d: %d, duration: %d\n", frame_offset, time, duration);
+  // Data object size and total data packets
+  bptr = (unsigned char *)SvPVX(header) + asf->audio_offset - 50;
+  put_u64le( bptr + 16, 50 + packets * packet_size );
+  put_u64le( bptr + 40, packets );
+
+  DEBUG_TRACE("Seek header for packet %" PRIu64 ", %" PRIu64 " packets left, %" PRIu64 " ms elapsed\n", packet, packets, elapsed / 10000);
+
+out:
+  buffer_free(&buf);
+
+  return header;
+}
+
+// Find the data packet containing time_offset, starting from the packet at frame_offset.
+// Packets are numbered from audio_offset, and each probe narrows the range of packet
+// numbers by interpolating between the send times of the packets on either side.
+int
+_asf_search_packets(asfinfo *asf, int time_offset, int frame_offset, uint32_t packet_size, uint32_t song_length_ms)
+{
+  int32_t lo = 0;
+  int32_t hi;
+  int32_t packet;
+  int32_t best = -1;
+  int lo_time = -1; // send time of packet lo - 1
+  int hi_time = -1; // send time of packet hi + 1
+  float ms_per_packet;
+  uint8_t bisect = 0;
+
+  if (frame_offset < 0) {
+    return -1;
+  }
+
+  if ( frame_offset > asf->file_size - 64 ) {
+    // Can't verify a packet past the end of a truncated file, use the estimate
+    DEBUG_TRACE("  Offset too large: %d\n", frame_offset);
+    return frame_offset;
+  }
+
+  if ( !packet_size || asf->audio_size < 64 || frame_offset < asf->audio_offset ) {
+    return -1;
+  }
+
+  // Last packet with a full 64 bytes for _timestamp to read
+  hi = (asf->audio_size - 64) / packet_size;
+  if ( asf->audio_offset + hi * packet_size > asf->file_size - 64 ) {
+    hi = (asf->file_size - 64 - asf->audio_offset) / packet_size;
+  }
+
+  ms_per_packet = (float)song_length_ms / (hi + 1);
+
+  packet = (frame_offset - asf->audio_offset) / packet_size;
+
+  while (lo <= hi) {
+    int time, duration;
+    int32_t width = hi - lo;
+
+    if (packet < lo) packet = lo;
+    if (packet > hi) packet = hi;
+
+    time = _asf_packet_time(asf, packet, packet_size, &duration);
+
+    DEBUG_TRACE("  Timestamp for packet %d (%d-%d): %d, duration: %d\n", packet, lo, hi, time, duration);
 
     if (time < 0) {
       DEBUG_TRACE("  Invalid timestamp, giving up\n");
-      break;
+      return -1;
     }
 
     if ( time + duration >= time_offset && time <= time_offset ) {
-      DEBUG_TRACE("  Found frame at offset %d\n", frame_offset);
-      found = 1;
+      DEBUG_TRACE("  Found frame at packet %d\n", packet);
+      best = packet;
+      break;
     }
-    else {
-      int delta = time_offset - time;
 
-      DEBUG_TRACE("  Wrong frame, delta: %d\n", delta);
+    if (time < time_offset) {
+      best    = packet;
+      lo      = packet + 1;
+      lo_time = time;
+    }
+    else {
+      hi      = packet - 1;
+      hi_time = time;
+    }
 
-      if (
-        (delta < 0 && (frame_offset - max_packet_size) < asf->audio_offset)
-        ||
-        (delta > 0 && (frame_offset + max_packet_size) > (asf->audio_offset + asf->audio_size - 64))
-      ) {
-        // Reached the first/last audio packet, break out
-        DEBUG_TRACE("  Giving up, reached the beginning or end of audio\n");
-        break;
-      }
+    if (lo > hi) {
+      break;
+    }
 
-      // XXX probably could be more efficient using a binary search,
-      // but with the use of an index we should already be very close to the right place
-      if (delta > 0) {
-        frame_offset += max_packet_size;
-      }
-      else {
-        frame_offset -= max_packet_size;
+    if (bisect) {
+      packet = lo + (hi - lo) / 2;
+    }
+    else if (lo_time >= 0 && hi_time > lo_time) {
+      // Interpolate between the send times on both sides of the range
+      packet = lo + (int32_t)( (float)(time_offset - lo_time) * (hi - lo + 2) / (hi_time - lo_time) ) - 1;
+    }
+    else {
+      // Only one side is known, step by the average packet duration
+      packet += (int32_t)( (time_offset - time) / (ms_per_packet > 0 ? ms_per_packet : 1) );
+      if (packet == lo - 1 || packet == hi + 1) {
+        packet = time < time_offset ? lo : hi;
       }
     }
+
+    // Fall back to bisection for the next probe if this one didn't halve the range
+    bisect = !bisect && (hi - lo) > width / 2;
   }
 
-out:
-  // Don't leak
-  SvREFCNT_dec(info);
-  SvREFCNT_dec(tags);
+  if (best < 0) {
+    // time_offset is before the first packet
+    best = 0;
+  }
 
-  if (asf->spec_count) {
-    int i;
-    for (i = 0; i < asf->spec_count; i++) {
-      DEBUG_TRACE("Freeing specs[%d] offsets\n", i);
-      Safefree(asf->specs[i].offsets);
+  return asf->audio_offset + best * packet_size;
+}
+
+// Return the send time of a data packet, caching the times read during this seek
+int
+_asf_packet_time(asfinfo *asf, uint32_t packet, uint32_t packet_size, int *duration)
+{
+  int i;
+  int time;
+
+  for (i = 0; i < asf->seek_cache_count; i++) {
+    if (asf->seek_cache[i].packet == packet) {
+      *duration = asf->seek_cache[i].duration;
+      return asf->seek_cache[i].time;
     }
+  }
 
-    DEBUG_TRACE("Freeing specs\n");
-    Safefree(asf->specs);
+  time = _timestamp(asf, asf->audio_offset + packet * packet_size, duration);
+
+  if ( !asf->seek_cache ) {
+    New(0, asf->seek_cache, ASF_SEEK_CACHE_SIZE, asf_packet_time);
   }
 
-  if (asf->scratch->alloc)
-    buffer_free(asf->scratch);
-  Safefree(asf->scratch);
+  // Replace the oldest entry when the cache is full
+  if (asf->seek_cache_count < ASF_SEEK_CACHE_SIZE) {
+    i = asf->seek_cache_count++;
+  }
+  else {
+    i = asf->seek_cache_next;
+    asf->seek_cache_next = (asf->seek_cache_next + 1) % ASF_SEEK_CACHE_SIZE;
+  }
 
-  Safefree(asf);
+  asf->seek_cache[i].packet   = packet;
+  asf->seek_cache[i].time     = time;
+  asf->seek_cache[i].duration = *duration;
 
-  return frame_offset;
+  return time;
 }
 
 // Return the timestamp of the data packet at offset
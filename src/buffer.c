@@ -982,6 +982,35 @@ put_u32(void *vp, uint32_t v)
 	p[3] = (u_char)v & 0xff;
 }
 
+void
+put_u32le(void *vp, uint32_t v)
+{
+	u_char *p = (u_char *)vp;
+
+	p[0] = (u_char)v & 0xff;
+	p[1] = (u_char)(v >> 8) & 0xff;
+	p[2] = (u_char)(v >> 16) & 0xff;
+	p[3] = (u_char)(v >> 24) & 0xff;
+}
+
+void
+put_u64(void *vp, uint64_t v)
+{
+	u_char *p = (u_char *)vp;
+
+	put_u32(p, (uint32_t)(v >> 32));
+	put_u32(p + 4, (uint32_t)v);
+}
+
+void
+put_u64le(void *vp, uint64_t v)
+{
+	u_char *p = (u_char *)vp;
+
+	put_u32le(p, (uint32_t)v);
+	put_u32le(p + 4, (uint32_t)(v >> 32));
+}
+
 void
 buffer_put_int(Buffer *buffer, u_int value)
 {
@@ -241,45 +241,178 @@ _env_true(const char *name)
   return 1;
 }
 
-// from http://jeremie.com/frolic/base64/
-int
-_decode_base64(char *s)
+static int
+_cmp_keys(const void *a, const void *b)
+{
+  return strcmp( *(const char **)a, *(const char **)b );
+}
+
+// Sets keys to the keys of a hash in sorted order, the caller frees it
+uint32_t
+_sorted_keys(HV *hv, const char ***keys)
+{
+  uint32_t count = 0;
+  STRLEN len;
+  HE *he;
+
+  New(0, *keys, HvUSEDKEYS(hv) + 1, const char *);
+
+  hv_iterinit(hv);
+  while ( (he = hv_iternext(hv)) ) {
+    (*keys)[count++] = HePV(he, len);
+  }
+
+  qsort(*keys, count, sizeof(char *), _cmp_keys);
+
+  return count;
+}
+
+// Fetch an integer value from an options hash passed in from Perl
+IV
+_opt_iv(HV *opts, const char *name, IV def)
+{
+  SV **value;
+
+  if ( opts == NULL ) {
+    return def;
+  }
+
+  value = my_hv_fetch(opts, name);
+
+  if ( value == NULL || !SvOK(*value) ) {
+    return def;
+  }
+
+  return SvIV(*value);
+}
+
+// Read the first len bytes of the file into a new SV, to be rewritten
+// as a seek header. Returns NULL if the file is shorter than len.
+SV *
+_read_header(PerlIO *infile, uint32_t len)
+{
+  Buffer buf;
+  SV *header = NULL;
+
+  buffer_init(&buf, len);
+
+  if ( PerlIO_seek(infile, 0, SEEK_SET) == 0 && _check_buf(infile, &buf, len, len) ) {
+    header = newSVpvn( buffer_ptr(&buf), len );
+  }
+
+  buffer_free(&buf);
+
+  return header;
+}
+
+// Value of each base64 character, -1 for anything else
+static const signed char base64_index[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+  52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+  -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+  15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+  -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+  41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// Decode len characters of base64 into dst, which needs room for len * 3 / 4 bytes.
+// Decoding stops at padding or any other character outside the base64 alphabet.
+// Returns the number of bytes written, dst may be the same as src.
+uint32_t
+_decode_base64_block(const unsigned char *src, uint32_t len, unsigned char *dst)
 {
-  char *b64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-  int bit_offset, byte_offset, idx, i, n;
-  unsigned char *d = (unsigned char *)s;
-  char *p;
-
-  n = i = 0;
-
-  while (*s && (p=strchr(b64,*s))) {
-    idx = (int)(p - b64);
-    byte_offset = (i*6)/8;
-    bit_offset = (i*6)%8;
-    d[byte_offset] &= ~((1<<(8-bit_offset))-1);
-
-    if (bit_offset < 3) {
-      d[byte_offset] |= (idx << (2-bit_offset));
-      n = byte_offset+1;
+  unsigned char *d = dst;
+  int a, b, c, e;
+
+  while (len >= 4) {
+    a = base64_index[ src[0] ];
+    b = base64_index[ src[1] ];
+    c = base64_index[ src[2] ];
+    e = base64_index[ src[3] ];
+
+    if ( (a | b | c | e) < 0 ) {
+      break;
     }
-    else {
-      d[byte_offset] |= (idx >> (bit_offset-2));
-      d[byte_offset+1] = 0;
-      d[byte_offset+1] |= (idx << (8-(bit_offset-2))) & 0xFF;
-      n = byte_offset+2;
+
+    *d++ = (a << 2) | (b >> 4);
+    *d++ = (b << 4) | (c >> 2);
+    *d++ = (c << 6) | e;
+
+    src += 4;
+    len -= 4;
+  }
+
+  // Last group, cut short by padding or the end of the data
+  a = len > 0 ? base64_index[ src[0] ] : -1;
+  b = len > 1 ? base64_index[ src[1] ] : -1;
+
+  if (a >= 0 && b >= 0) {
+    *d++ = (a << 2) | (b >> 4);
+
+    c = len > 2 ? base64_index[ src[2] ] : -1;
+    if (c >= 0) {
+      *d++ = (b << 4) | (c >> 2);
     }
-    s++;
-    i++;
   }
 
+  return d - dst;
+}
+
+// Decode a NUL-terminated base64 string in place
+int
+_decode_base64(char *s)
+{
+  uint32_t len = 0;
+  int n;
+
+  while ( base64_index[ (unsigned char)s[len] ] >= 0 ) {
+    len++;
+  }
+
+  n = _decode_base64_block( (unsigned char *)s, len, (unsigned char *)s );
+
   /* null terminate */
-  d[n] = 0;
+  s[n] = 0;
 
   return n;
 }
 
 HV *
 _decode_flac_picture(PerlIO *infile, Buffer *buf, uint32_t *pic_length)
+{
+  HV *picture = _decode_flac_picture_header(infile, buf, pic_length);
+
+  if ( !picture ) {
+    return NULL;
+  }
+
+  if ( _env_true("AUDIO_SCAN_NO_ARTWORK") ) {
+    my_hv_store( picture, "image_data", newSVuv(*pic_length) );
+  }
+  else {
+    if ( !_check_buf(infile, buf, *pic_length, *pic_length) ) {
+      return NULL;
+    }
+
+    my_hv_store( picture, "image_data", newSVpvn( buffer_ptr(buf), *pic_length ) );
+  }
+
+  return picture;
+}
+
+// Everything in a FLAC picture block up to the image data
+HV *
+_decode_flac_picture_header(PerlIO *infile, Buffer *buf, uint32_t *pic_length)
 {
   uint32_t mime_length;
   uint32_t desc_length;
@@ -325,16 +458,5 @@ _decode_flac_picture(PerlIO *infile, Buffer *buf, uint32_t *pic_length)
   *pic_length = buffer_get_int(buf);
   DEBUG_TRACE("  pic_length: %d\n", *pic_length);
 
-  if ( _env_true("AUDIO_SCAN_NO_ARTWORK") ) {
-    my_hv_store( picture, "image_data", newSVuv(*pic_length) );
-  }
-  else {
-    if ( !_check_buf(infile, buf, *pic_length, *pic_length) ) {
-      return NULL;
-    }
-
-    my_hv_store( picture, "image_data", newSVpvn( buffer_ptr(buf), *pic_length ) );
-  }
-
   return picture;
 }
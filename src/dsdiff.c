@@ -275,3 +275,159 @@ get_dsdiff_metadata(PerlIO *infile, char *file, HV *info, HV *tags)
   return 0;
 }
 
+
+int
+dsdiff_find_frame(PerlIO *infile, char *file, int offset)
+{
+  int64_t frame_offset = -1;
+
+  // We need to read all metadata first to get some data we need to calculate
+  HV *info = newHV();
+  HV *tags = newHV();
+
+  if ( get_dsdiff_metadata(infile, file, info, tags) == 0 ) {
+    frame_offset = _dsdiff_find_frame(info, offset);
+  }
+
+  // Don't leak
+  SvREFCNT_dec(info);
+  SvREFCNT_dec(tags);
+
+  // Offsets past 2GB only fit in seek_offset from find_frame_return_info
+  return frame_offset > 0x7FFFFFFF ? -1 : frame_offset;
+}
+
+// Returns seek_offset and seek_header, the chunks before the sound data
+// with the FRM8 and DSD chunk sizes reduced to the remaining data
+int
+dsdiff_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  int64_t frame_offset = -1;
+  HV *tags = newHV();
+
+  if ( get_dsdiff_metadata(infile, file, info, tags) == 0 ) {
+    frame_offset = _dsdiff_find_frame(info, offset);
+  }
+
+  my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+
+  if (frame_offset >= 0) {
+    uint64_t audio_offset = SvIV( *(my_hv_fetch(info, "audio_offset")) );
+    SV *header = audio_offset <= DSDIFF_MAX_SEEK_HEADER ? _read_header(infile, audio_offset) : NULL;
+
+    if (header != NULL) {
+      unsigned char *bptr = (unsigned char *)SvPVX(header);
+      uint64_t remaining = SvIV( *(my_hv_fetch(info, "audio_size")) ) - (frame_offset - audio_offset);
+
+      put_u64( bptr + 4, audio_offset - 12 + remaining );
+      put_u64( bptr + audio_offset - 8, remaining );
+
+      my_hv_store( info, "seek_header", header );
+    }
+  }
+
+  SvREFCNT_dec(tags);
+
+  return frame_offset;
+}
+
+// Sound data is one byte of 8 samples for each channel in turn, so seek
+// to the start of the group of bytes with the sample
+int64_t
+_dsdiff_find_frame(HV *info, int offset)
+{
+  uint64_t samplerate, channels, audio_size, pos;
+
+  if (offset < 0) {
+    return -1;
+  }
+
+  samplerate = SvIV( *(my_hv_fetch(info, "samplerate")) );
+  channels   = SvIV( *(my_hv_fetch(info, "channels")) );
+  audio_size = SvIV( *(my_hv_fetch(info, "audio_size")) );
+
+  pos = (uint64_t)offset * samplerate / 1000 / 8 * channels;
+
+  DEBUG_TRACE("dsdiff_find_frame: %d ms -> audio byte %" PRIu64 " of %" PRIu64 "\n", offset, pos, audio_size);
+
+  if (pos >= audio_size) {
+    return -1;
+  }
+
+  return SvIV( *(my_hv_fetch(info, "audio_offset")) ) + pos;
+}
+
+// Returns DSD audio from the time offset as DoP frames, see dsf_dop. The sound
+// data is already one byte per channel in turn with the oldest sample in the MSB.
+int
+dsdiff_dop(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  Buffer buf;
+  HV *tags = newHV();
+  SV *data;
+  unsigned char **src = NULL;
+  uint8_t container = _opt_iv(opts, "container", 3) == 4 ? 4 : 3;
+  uint16_t channels, c;
+  uint64_t total_frames, start, frames, done = 0;
+  int err = -1;
+
+  buffer_init(&buf, 0);
+
+  if ( get_dsdiff_metadata(infile, file, info, tags) != 0 ) {
+    goto out;
+  }
+
+  channels = SvIV( *(my_hv_fetch(info, "channels")) );
+
+  if ( !channels ) {
+    PerlIO_printf(PerlIO_stderr(), "Unsupported DSDIFF audio for DoP: %s\n", file);
+    goto out;
+  }
+
+  total_frames = SvIV( *(my_hv_fetch(info, "audio_size")) ) / channels / 2;
+
+  if ( (err = _dop_range(info, offset, opts, total_frames, &start, &frames)) <= 0 ) {
+    goto out;
+  }
+
+  data = newSV( frames * channels * container + 1 );
+  SvPOK_only(data);
+
+  buffer_free(&buf);
+  buffer_init(&buf, DOP_READ_FRAMES * 2 * channels);
+  Newx(src, channels, unsigned char *);
+
+  PerlIO_seek(infile, SvIV( *(my_hv_fetch(info, "audio_offset")) ) + start * 2 * channels, SEEK_SET);
+
+  while (done < frames) {
+    uint32_t count = frames - done > DOP_READ_FRAMES ? DOP_READ_FRAMES : frames - done;
+    unsigned char *bptr;
+
+    if ( !_check_buf(infile, &buf, count * 2 * channels, count * 2 * channels) ) {
+      break;
+    }
+
+    bptr = buffer_ptr(&buf);
+
+    for (c = 0; c < channels; c++) {
+      src[c] = bptr + c;
+    }
+
+    _dop_pack( (unsigned char *)SvPVX(data) + done * channels * container, src, channels, channels, count, start + done, 0, container );
+
+    buffer_consume(&buf, count * 2 * channels);
+    done += count;
+  }
+
+  _dop_finish(info, data, container, start, done, total_frames);
+
+  err = 0;
+
+out:
+  buffer_free(&buf);
+  SvREFCNT_dec(tags);
+
+  if (src) Safefree(src);
+
+  return err;
+}
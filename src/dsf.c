@@ -93,14 +93,14 @@ get_dsf_metadata(PerlIO *infile, char *file, HV *info, HV *tags)
 
     song_length_ms = ((sample_count * 1.0) / sampling_frequency) * 1000;
 
-    my_hv_store( info, "audio_offset", newSVuv( 28 + 52 + 12 ) );
+    my_hv_store( info, "audio_offset", newSVuv( DSF_HEADER_SIZE ) );
     my_hv_store( info, "audio_size", newSVuv(sample_bytes) );
     my_hv_store( info, "samplerate", newSVuv(sampling_frequency) );
     my_hv_store( info, "song_length_ms", newSVuv(song_length_ms) );
     my_hv_store( info, "channels", newSVuv(channel_num) );
     my_hv_store( info, "bits_per_sample", newSVuv(1) );
     my_hv_store( info, "block_size_per_channel", newSVuv(block_size_per_channel) );
-    my_hv_store( info, "bitrate", newSVuv( _bitrate(file_size - (28 + 52 + 12), song_length_ms) ) );
+    my_hv_store( info, "bitrate", newSVuv( _bitrate(file_size - DSF_HEADER_SIZE, song_length_ms) ) );
 
     if (metadata_offset) {
       PerlIO_seek(infile, metadata_offset, SEEK_SET);
@@ -132,3 +132,294 @@ get_dsf_metadata(PerlIO *infile, char *file, HV *info, HV *tags)
 
   return 0;
 }
+
+int
+dsf_find_frame(PerlIO *infile, char *file, int offset)
+{
+  int64_t frame_offset = -1;
+
+  // We need to read all metadata first to get some data we need to calculate
+  HV *info = newHV();
+  HV *tags = newHV();
+
+  if ( get_dsf_metadata(infile, file, info, tags) == 0 ) {
+    frame_offset = _dsf_find_frame(info, offset);
+  }
+
+  // Don't leak
+  SvREFCNT_dec(info);
+  SvREFCNT_dec(tags);
+
+  // Offsets past 2GB only fit in seek_offset from find_frame_return_info
+  return frame_offset > 0x7FFFFFFF ? -1 : frame_offset;
+}
+
+// Returns seek_offset and seek_header, the DSD, fmt and data chunk headers
+// for the remaining blocks, without the metadata chunk
+int
+dsf_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  int64_t frame_offset = -1;
+  HV *tags = newHV();
+
+  if ( get_dsf_metadata(infile, file, info, tags) == 0 ) {
+    frame_offset = _dsf_find_frame(info, offset);
+  }
+
+  my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+
+  if (frame_offset >= 0) {
+    SV *header = _read_header(infile, DSF_HEADER_SIZE);
+
+    if (header != NULL) {
+      unsigned char *bptr = (unsigned char *)SvPVX(header);
+      uint64_t remaining = SvIV( *(my_hv_fetch(info, "audio_size")) ) - (frame_offset - DSF_HEADER_SIZE);
+      uint64_t sample_count = get_u64le(bptr + 64);
+      uint32_t channels = SvIV( *(my_hv_fetch(info, "channels")) );
+      uint32_t block_size = SvIV( *(my_hv_fetch(info, "block_size_per_channel")) );
+      uint64_t skipped = (frame_offset - DSF_HEADER_SIZE) / (channels * block_size) * block_size * 8;
+
+      put_u64le( bptr + 12, DSF_HEADER_SIZE + remaining );
+      put_u64le( bptr + 20, 0 );
+      put_u64le( bptr + 64, sample_count > skipped ? sample_count - skipped : 0 );
+      put_u64le( bptr + 84, 12 + remaining );
+
+      my_hv_store( info, "seek_header", header );
+    }
+  }
+
+  SvREFCNT_dec(tags);
+
+  return frame_offset;
+}
+
+// Each channel is stored in 4096-byte blocks of 1-bit samples, one block per
+// channel in turn, so seek to the start of the group of blocks with the sample
+int64_t
+_dsf_find_frame(HV *info, int offset)
+{
+  uint64_t samplerate, channels, block_size, audio_size, group, pos;
+
+  if (offset < 0) {
+    return -1;
+  }
+
+  samplerate = SvIV( *(my_hv_fetch(info, "samplerate")) );
+  channels   = SvIV( *(my_hv_fetch(info, "channels")) );
+  block_size = SvIV( *(my_hv_fetch(info, "block_size_per_channel")) );
+  audio_size = SvIV( *(my_hv_fetch(info, "audio_size")) );
+
+  group = (uint64_t)offset * samplerate / 1000 / (block_size * 8);
+  pos = group * block_size * channels;
+
+  DEBUG_TRACE("dsf_find_frame: %d ms -> block group %" PRIu64 ", audio byte %" PRIu64 " of %" PRIu64 "\n", offset, group, pos, audio_size);
+
+  if (pos >= audio_size) {
+    return -1;
+  }
+
+  return DSF_HEADER_SIZE + pos;
+}
+
+// Bit-reversed value of each byte, DSF stores the oldest sample in the LSB
+#define R2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n) R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n) R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+static const unsigned char dsd_bit_reverse[256] = { R6(0), R6(2), R6(1), R6(3) };
+#undef R2
+#undef R4
+#undef R6
+
+// Returns DSD audio from the time offset as DoP (DSD over PCM) frames. Each
+// channel sample holds a marker and 16 DSD bits, oldest first from the MSB.
+int
+dsf_dop(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  Buffer buf;
+  HV *tags = newHV();
+  SV *header, *data;
+  unsigned char **src = NULL;
+  uint8_t container = _opt_iv(opts, "container", 3) == 4 ? 4 : 3;
+  uint16_t channels, c;
+  uint32_t block_size, group_frames, bits_per_sample;
+  uint64_t total_frames, start, frames, done = 0;
+  int err = -1;
+
+  buffer_init(&buf, 0);
+
+  if ( get_dsf_metadata(infile, file, info, tags) != 0 || (header = _read_header(infile, DSF_HEADER_SIZE)) == NULL ) {
+    goto out;
+  }
+
+  channels        = SvIV( *(my_hv_fetch(info, "channels")) );
+  block_size      = SvIV( *(my_hv_fetch(info, "block_size_per_channel")) );
+  group_frames    = block_size / 2;
+  bits_per_sample = get_u32le( SvPVX(header) + 60 );
+  total_frames    = get_u64le( SvPVX(header) + 64 ) / 16;
+
+  SvREFCNT_dec(header);
+
+  // 1 is LSB first and has to be reversed, 8 is already MSB first
+  if ( !channels || (bits_per_sample != 1 && bits_per_sample != 8) ) {
+    PerlIO_printf(PerlIO_stderr(), "Unsupported DSF audio for DoP: %s\n", file);
+    goto out;
+  }
+
+  // Don't trust the sample count past the end of the data
+  if ( total_frames > SvIV( *(my_hv_fetch(info, "audio_size")) ) / channels / 2 ) {
+    total_frames = SvIV( *(my_hv_fetch(info, "audio_size")) ) / channels / 2;
+  }
+
+  if ( (err = _dop_range(info, offset, opts, total_frames, &start, &frames)) <= 0 ) {
+    goto out;
+  }
+
+  data = newSV( frames * channels * container + 1 );
+  SvPOK_only(data);
+
+  buffer_free(&buf);
+  buffer_init(&buf, block_size * channels);
+  Newx(src, channels, unsigned char *);
+
+  // Blocks for each channel follow each other, read a group at a time
+  PerlIO_seek(infile, DSF_HEADER_SIZE + (start / group_frames) * block_size * channels, SEEK_SET);
+
+  while (done < frames) {
+    uint32_t pos = (start + done) % group_frames;
+    uint32_t count = group_frames - pos;
+    unsigned char *bptr;
+
+    if (count > frames - done) {
+      count = frames - done;
+    }
+
+    if ( !_check_buf(infile, &buf, block_size * channels, block_size * channels) ) {
+      break;
+    }
+
+    bptr = buffer_ptr(&buf);
+
+    for (c = 0; c < channels; c++) {
+      src[c] = bptr + c * block_size + pos * 2;
+    }
+
+    _dop_pack( (unsigned char *)SvPVX(data) + done * channels * container, src, 1, channels, count, start + done, bits_per_sample == 1, container );
+
+    buffer_consume(&buf, block_size * channels);
+    done += count;
+  }
+
+  _dop_finish(info, data, container, start, done, total_frames);
+
+  err = 0;
+
+out:
+  buffer_free(&buf);
+  SvREFCNT_dec(tags);
+
+  if (src) Safefree(src);
+
+  return err;
+}
+
+// Find the first DoP frame from the start_frame option or the time offset,
+// and how many to return. Returns 0 if the start is past the end, -1 if
+// there is no start.
+int
+_dop_range(HV *info, int offset, HV *opts, uint64_t total_frames, uint64_t *start, uint64_t *frames)
+{
+  IV start_frame = _opt_iv(opts, "start_frame", -1);
+  IV max_frames = _opt_iv(opts, "max_frames", DOP_MAX_FRAMES);
+  uint32_t samplerate = SvIV( *(my_hv_fetch(info, "samplerate")) );
+
+  my_hv_store( info, "dop_samplerate", newSVuv(samplerate / 16) );
+
+  if (start_frame >= 0) {
+    *start = start_frame;
+  }
+  else if (offset >= 0) {
+    *start = (uint64_t)offset * samplerate / 1000 / 16;
+  }
+  else {
+    return -1;
+  }
+
+  if (*start >= total_frames) {
+    my_hv_store( info, "dop_frames", newSVuv(0) );
+    return 0;
+  }
+
+  *frames = total_frames - *start;
+
+  if (max_frames <= 0) {
+    max_frames = DOP_MAX_FRAMES;
+  }
+
+  if (*frames > (uint64_t)max_frames) {
+    *frames = max_frames;
+  }
+
+  DEBUG_TRACE("DoP frames %" PRIu64 " - %" PRIu64 " of %" PRIu64 "\n", *start, *start + *frames, total_frames);
+
+  return 1;
+}
+
+// Pack 2 DSD bytes per channel into each little-endian DoP sample, 3 bytes
+// or 4 with a zero low byte. The marker alternates with the absolute frame
+// number so consecutive calls continue the sequence.
+void
+_dop_pack(unsigned char *out, unsigned char **src, uint32_t stride, uint16_t channels, uint32_t frames, uint64_t first_frame, uint8_t reverse, uint8_t container)
+{
+  uint32_t i, step = channels * container;
+  uint16_t c;
+
+  for (c = 0; c < channels; c++) {
+    unsigned char *in = src[c];
+    unsigned char *o = out + c * container + (container - 3);
+    unsigned char marker = first_frame % 2 ? DOP_MARKER_2 : DOP_MARKER_1;
+
+    if (container == 4) {
+      for (i = 0; i < frames; i++) {
+        out[c * container + i * step] = 0;
+      }
+    }
+
+    if (reverse) {
+      for (i = 0; i < frames; i++) {
+        o[0] = dsd_bit_reverse[ in[stride] ];
+        o[1] = dsd_bit_reverse[ in[0] ];
+        o[2] = marker;
+        marker ^= DOP_MARKER_1 ^ DOP_MARKER_2;
+        in += 2 * stride;
+        o += step;
+      }
+    }
+    else {
+      for (i = 0; i < frames; i++) {
+        o[0] = in[stride];
+        o[1] = in[0];
+        o[2] = marker;
+        marker ^= DOP_MARKER_1 ^ DOP_MARKER_2;
+        in += 2 * stride;
+        o += step;
+      }
+    }
+  }
+}
+
+// Store the packed frames and where the next call should start
+void
+_dop_finish(HV *info, SV *data, uint8_t container, uint64_t start, uint64_t frames, uint64_t total_frames)
+{
+  uint32_t channels = SvIV( *(my_hv_fetch(info, "channels")) );
+
+  SvCUR_set(data, frames * channels * container);
+
+  my_hv_store( info, "dop_data", data );
+  my_hv_store( info, "dop_frames", newSVuv(frames) );
+  my_hv_store( info, "dop_start_frame", newSVuv(start) );
+
+  if (start + frames < total_frames) {
+    my_hv_store( info, "dop_next_frame", newSVuv(start + frames) );
+  }
+}
@@ -21,6 +21,7 @@ get_flac_metadata(PerlIO *infile, char *file, HV *info, HV *tags)
 {
   flacinfo *flac = _flac_parse(infile, file, info, tags, 0);
 
+  Safefree(flac->cue_points);
   Safefree(flac);
 
   return 0;
@@ -183,13 +184,8 @@ _flac_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
         break;
 
       case FLAC_TYPE_CUESHEET:
-        if ( !flac->seeking ) {
-          _flac_parse_cuesheet(flac);
-        }
-        else {
-          DEBUG_TRACE("  seeking, skipping cuesheet\n");
-          buffer_consume(flac->buf, len);
-        }
+        // Also needed when seeking to a track
+        _flac_parse_cuesheet(flac);
         break;
 
       case FLAC_TYPE_PICTURE:
@@ -268,23 +264,242 @@ out:
   return flac;
 }
 
-// offset is in ms, does sample-accurate seeking, using seektable if available
-// based on libFLAC seek_to_absolute_sample_
 static int
 flac_find_frame(PerlIO *infile, char *file, int offset)
 {
-  off_t frame_offset = -1;
-  uint64_t target_sample;
-  uint32_t approx_bytes_per_frame;
-  uint64_t lower_bound, upper_bound, lower_bound_sample, upper_bound_sample;
-  int64_t pos = -1;
-  int8_t max_tries = 100;
+  int frame_offset;
+  uint64_t frame_sample;
 
   // We need to read all metadata first to get some data we need to calculate
   HV *info = newHV();
   HV *tags = newHV();
   flacinfo *flac = _flac_parse(infile, file, info, tags, 1);
 
+  frame_offset = _flac_find_frame(flac, offset, &frame_sample);
+
+  // Don't leak
+  SvREFCNT_dec(info);
+  SvREFCNT_dec(tags);
+
+  // free seek struct
+  Safefree(flac->seekpoints);
+  Safefree(flac->cue_points);
+  Safefree(flac);
+
+  return frame_offset;
+}
+
+// Returns seek_offset and seek_header, the fLaC marker, STREAMINFO and SEEKTABLE to
+// put in front of the frames at seek_offset. A seektable from frame_index() can be
+// passed in the seektable option for files that don't have one.
+static int
+flac_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  int frame_offset;
+  uint64_t frame_sample;
+  SV **seektable = NULL;
+  HV *tags = newHV();
+  flacinfo *flac = _flac_parse(infile, file, info, tags, 1);
+
+  if ( opts && my_hv_exists(opts, "seektable") ) {
+    seektable = my_hv_fetch(opts, "seektable");
+  }
+
+  if ( seektable != NULL && SvPOK(*seektable) ) {
+    _flac_load_seektable(flac, *seektable);
+  }
+
+  if ( opts && my_hv_exists(opts, "track") ) {
+    // offset is from an index of a cuesheet track
+    int64_t target_sample = _flac_cue_sample(
+      flac, (uint8_t)_opt_iv(opts, "track", 0), (uint8_t)_opt_iv(opts, "index", 1)
+    );
+
+    frame_offset = -1;
+
+    if (target_sample >= 0) {
+      target_sample += (uint64_t)offset * flac->samplerate / 1000;
+      frame_offset = _flac_find_sample(flac, target_sample, &frame_sample);
+    }
+  }
+  else {
+    frame_offset = _flac_find_frame(flac, offset, &frame_sample);
+  }
+
+  my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+
+  if (frame_offset >= 0) {
+    my_hv_store( info, "seek_header", _flac_seek_header(flac, frame_offset, frame_sample) );
+  }
+
+  SvREFCNT_dec(tags);
+  Safefree(flac->seekpoints);
+  Safefree(flac->cue_points);
+  Safefree(flac);
+
+  return frame_offset;
+}
+
+// Sample number of an index of a cuesheet track, -1 if there isn't one
+int64_t
+_flac_cue_sample(flacinfo *flac, uint8_t track, uint8_t index)
+{
+  uint32_t i;
+
+  for (i = 0; i < flac->num_cue_points; i++) {
+    if (flac->cue_points[i].track == track && flac->cue_points[i].index == index) {
+      return (int64_t)flac->cue_points[i].sample;
+    }
+  }
+
+  return -1;
+}
+
+// Start of each track: its INDEX 01, or its first index if it doesn't have one.
+// Returns the number of tracks, starts must have room for num_cue_points entries.
+uint32_t
+_flac_cue_track_starts(flacinfo *flac, struct cuepoint *starts)
+{
+  uint32_t i;
+  uint32_t count = 0;
+
+  for (i = 0; i < flac->num_cue_points; i++) {
+    struct cuepoint *cp = &flac->cue_points[i];
+
+    if ( count && starts[count - 1].track == cp->track ) {
+      if (cp->index == 1) {
+        starts[count - 1] = *cp;
+      }
+      continue;
+    }
+
+    starts[count++] = *cp;
+  }
+
+  return count;
+}
+
+// Build a header for a stream starting with the frame at frame_offset. total_samples is
+// reduced by the samples skipped, the MD5 is cleared as it no longer matches, and seek
+// points at or after the frame are kept relative to it.
+SV *
+_flac_seek_header(flacinfo *flac, off_t frame_offset, uint64_t frame_sample)
+{
+  unsigned char streaminfo[34];
+  unsigned char block[4];
+  uint64_t total_samples = flac->total_samples > frame_sample ? flac->total_samples - frame_sample : 0;
+  uint64_t skipped = frame_offset - flac->audio_offset;
+  uint32_t num_points = 0;
+  uint32_t i;
+  Buffer points;
+  SV *header = newSVpvn("fLaC", 4);
+
+  Copy(flac->streaminfo, streaminfo, 34, unsigned char);
+
+  // 36-bit total samples
+  streaminfo[13] = (streaminfo[13] & 0xF0) | ((total_samples >> 32) & 0x0F);
+  put_u32(streaminfo + 14, (uint32_t)total_samples);
+
+  // All zeros means the MD5 is unknown
+  Zero(streaminfo + 18, 16, unsigned char);
+
+  buffer_init(&points, FLAC_BLOCK_SIZE);
+
+  for (i = 0; i < flac->num_seekpoints; i++) {
+    struct seekpoint *sp = &flac->seekpoints[i];
+    unsigned char *p;
+
+    // Skip placeholders and points before the seek frame
+    if ( sp->sample_number == 0xFFFFFFFFFFFFFFFFLL || sp->sample_number < frame_sample || sp->stream_offset < skipped ) {
+      continue;
+    }
+
+    p = (unsigned char *)buffer_append_space(&points, 18);
+    put_u32(p,      (uint32_t)((sp->sample_number - frame_sample) >> 32));
+    put_u32(p + 4,  (uint32_t)(sp->sample_number - frame_sample));
+    put_u32(p + 8,  (uint32_t)((sp->stream_offset - skipped) >> 32));
+    put_u32(p + 12, (uint32_t)(sp->stream_offset - skipped));
+    put_u16(p + 16, sp->frame_samples);
+    num_points++;
+  }
+
+  // STREAMINFO, the last block if there are no seek points
+  block[0] = FLAC_TYPE_STREAMINFO | (num_points ? 0 : 0x80);
+  block[1] = 0;
+  block[2] = 0;
+  block[3] = 34;
+  sv_catpvn( header, (char *)block, 4 );
+  sv_catpvn( header, (char *)streaminfo, 34 );
+
+  if (num_points) {
+    block[0] = FLAC_TYPE_SEEKTABLE | 0x80;
+    block[1] = ((num_points * 18) >> 16) & 0xFF;
+    block[2] = ((num_points * 18) >> 8) & 0xFF;
+    block[3] = (num_points * 18) & 0xFF;
+    sv_catpvn( header, (char *)block, 4 );
+    sv_catpvn( header, buffer_ptr(&points), buffer_len(&points) );
+  }
+
+  buffer_free(&points);
+
+  return header;
+}
+
+// Replace the file's seekpoints with a SEEKTABLE block, with or without its metadata block header
+void
+_flac_load_seektable(flacinfo *flac, SV *seektable)
+{
+  Buffer *buf = flac->buf;
+  Buffer tmp;
+  STRLEN len;
+  unsigned char *bptr = (unsigned char *)SvPV(seektable, len);
+
+  if ( len % 18 == 4 && (bptr[0] & 0x7f) == FLAC_TYPE_SEEKTABLE ) {
+    bptr += 4;
+    len  -= 4;
+  }
+
+  if ( flac->num_seekpoints ) {
+    Safefree(flac->seekpoints);
+    flac->seekpoints     = NULL;
+    flac->num_seekpoints = 0;
+  }
+
+  if (len < 18) {
+    return;
+  }
+
+  buffer_init(&tmp, len);
+  buffer_append(&tmp, bptr, len);
+
+  flac->buf = &tmp;
+  _flac_parse_seektable(flac, len);
+  flac->buf = buf;
+
+  buffer_free(&tmp);
+}
+
+// offset is in ms
+int
+_flac_find_frame(flacinfo *flac, int offset, uint64_t *frame_sample)
+{
+  // Determine target sample we're looking for
+  uint64_t target_sample = ((offset - 1) / 10) * (flac->samplerate / 100);
+
+  return _flac_find_sample(flac, target_sample, frame_sample);
+}
+
+// Does sample-accurate seeking, using seektable if available
+// based on libFLAC seek_to_absolute_sample_
+int
+_flac_find_sample(flacinfo *flac, uint64_t target_sample, uint64_t *frame_sample)
+{
+  off_t frame_offset = -1;
+  uint32_t approx_bytes_per_frame;
+  uint64_t lower_bound, upper_bound, lower_bound_sample, upper_bound_sample;
+  int64_t pos = -1;
+  int8_t max_tries = 100;
+
   // Allocate scratch buffer
   Newz(0, flac->scratch, sizeof(Buffer), Buffer);
 
@@ -293,10 +508,12 @@ flac_find_frame(PerlIO *infile, char *file, int offset)
     goto out;
   }
 
-  // Determine target sample we're looking for
-  target_sample = ((offset - 1) / 10) * (flac->samplerate / 100);
   DEBUG_TRACE("Looking for target sample %llu\n", target_sample);
 
+  if (target_sample >= flac->total_samples) {
+    goto out;
+  }
+
   if (flac->min_blocksize == flac->max_blocksize && flac->min_blocksize > 0)
     approx_bytes_per_frame = flac->min_blocksize * flac->channels * flac->bits_per_sample/8 + 64;
   else if (flac->max_framesize > 0)
@@ -423,12 +640,15 @@ flac_find_frame(PerlIO *infile, char *file, int offset)
       DEBUG_TRACE("  Frame at %d, this_frame_sample %llu, < lower_bound_sample %llu, aborting\n",
         (int)frame_offset, this_frame_sample, lower_bound_sample);
 
+      frame_offset = -1;
       goto out;
     }
 
     DEBUG_TRACE("    Frame at %d, this_frame_sample %llu, last_sample %llu (target %llu)\n",
       (int)frame_offset, this_frame_sample, last_sample, target_sample);
 
+    *frame_sample = this_frame_sample;
+
     if (target_sample >= this_frame_sample && target_sample < last_sample) {
       DEBUG_TRACE("    Found target frame\n");
       break;
@@ -456,19 +676,11 @@ flac_find_frame(PerlIO *infile, char *file, int offset)
   DEBUG_TRACE("max_tries: %d\n", max_tries);
 
 out:
-  // Don't leak
-  SvREFCNT_dec(info);
-  SvREFCNT_dec(tags);
-
-  // free seek struct
-  Safefree(flac->seekpoints);
-
   // free scratch buffer
   if (flac->scratch->alloc)
     buffer_free(flac->scratch);
   Safefree(flac->scratch);
-
-  Safefree(flac);
+  flac->scratch = NULL;
 
   return frame_offset;
 }
@@ -485,7 +697,10 @@ _flac_first_last_sample(flacinfo *flac, off_t seek_offset, off_t *frame_offset,
   int ret = 0;
   uint32_t i;
 
-  buffer_init_or_clear(flac->scratch, flac->max_framesize);
+  // Enough to find the next frame header from anywhere in a frame
+  uint32_t window = (flac->max_framesize ? flac->max_framesize : FLAC_MAX_FRAMESIZE) + FLAC_FRAME_MAX_HEADER;
+
+  buffer_init_or_clear(flac->scratch, window);
 
   if (seek_offset > flac->file_size - FLAC_FRAME_MAX_HEADER) {
     DEBUG_TRACE("  Error: seek_offset > file_size - header size\n");
@@ -499,7 +714,7 @@ _flac_first_last_sample(flacinfo *flac, off_t seek_offset, off_t *frame_offset,
     goto out;
   }
 
-  if ( !_check_buf(flac->infile, flac->scratch, FLAC_FRAME_MAX_HEADER, flac->max_framesize) ) {
+  if ( !_check_buf(flac->infile, flac->scratch, FLAC_FRAME_MAX_HEADER, window) ) {
     DEBUG_TRACE("  Error: read failed\n");
     ret = -1;
     goto out;
@@ -508,14 +723,10 @@ _flac_first_last_sample(flacinfo *flac, off_t seek_offset, off_t *frame_offset,
   bptr = buffer_ptr(flac->scratch);
   buf_size = buffer_len(flac->scratch);
 
-  for (i = 0; i != buf_size - FLAC_HEADER_LEN; i++) {
-    // Verify sync and various reserved bits
-    if ( bptr[i] != 0xFF
-      || (bptr[i+1] >> 2) != 0x3E
-      || bptr[i+1] & 0x02
-      || bptr[i+3] & 0x01
-    ) {
-      continue;
+  for (i = 0; i < buf_size - FLAC_HEADER_LEN; i++) {
+    i = _flac_find_sync(bptr, i, buf_size - FLAC_HEADER_LEN);
+    if (i >= buf_size - FLAC_HEADER_LEN) {
+      break;
     }
 
     DEBUG_TRACE("Checking frame header @ %d: %0x %0x %0x %0x\n", (int)seek_offset + i, bptr[i], bptr[i+1], bptr[i+2], bptr[i+3]);
@@ -655,19 +866,704 @@ _flac_read_frame_header(flacinfo *flac, unsigned char *buf, uint64_t *first_samp
   }
 
   // Calculate sample number from frame number if needed
-  if (frame_number) {
+  if ( !(buf[1] & 0x01 || flac->min_blocksize != flac->max_blocksize) ) {
     // Fixed blocksize, use min_blocksize value as blocksize above may be different if last frame
-    *first_sample = frame_number * flac->min_blocksize;
+    *first_sample = (uint64_t)frame_number * flac->min_blocksize;
+  }
+
+  *last_sample = *first_sample + blocksize;
+
+  return 1;
+}
+
+// Returns the offset of the first possible frame header in bptr between i and end,
+// or end if there isn't one. memchr finds the 0xFF sync bytes much faster than a byte loop.
+uint32_t
+_flac_find_sync(unsigned char *bptr, uint32_t i, uint32_t end)
+{
+  while (i < end) {
+    unsigned char *p = memchr(bptr + i, 0xFF, end - i);
+
+    if (p == NULL) {
+      return end;
+    }
+
+    i = p - bptr;
+
+    // Verify sync and various reserved bits
+    if ( (bptr[i+1] >> 2) == 0x3E
+      && !(bptr[i+1] & 0x02)
+      && !(bptr[i+3] & 0x01)
+    ) {
+      return i;
+    }
+
+    i++;
+  }
+
+  return end;
+}
+
+// Walk every frame of the file once and build a seek index. After each frame the search for
+// the next header starts min_framesize bytes on, and a header is only accepted if its first
+// sample follows on from the previous frame. Stores frames, indexed_samples, seekpoints and
+// seektable_block, a SEEKTABLE metadata block with a point every interval_ms (0 for every
+// frame), under their own keys so they don't replace the STREAMINFO values.
+void
+flac_frame_index(PerlIO *infile, char *file, HV *info, HV *opts)
+{
+  HV *tags = newHV();
+  flacinfo *flac = _flac_parse(infile, file, info, tags, 1);
+  Buffer points;
+  off_t base;               // file offset of the start of the scratch buffer
+  off_t pos;
+  off_t frame_offset = -1;
+  uint64_t first_sample;
+  uint64_t last_sample;
+  uint64_t next_sample = 0; // first sample of the next frame
+  uint64_t next_point = 0;
+  uint64_t interval;
+  uint32_t frames = 0;
+  uint32_t num_points = 0;
+  uint32_t skip;
+  SV *seektable;
+  struct cuepoint *tracks = NULL; // start of each cuesheet track
+  off_t *track_offsets = NULL;
+  uint32_t num_tracks = 0;
+  uint32_t t = 0;
+
+  buffer_init(&points, FLAC_BLOCK_SIZE);
+
+  if ( !flac->samplerate || !flac->audio_offset ) {
+    goto out;
+  }
+
+  if (flac->num_cue_points) {
+    New(0, tracks, flac->num_cue_points, struct cuepoint);
+    New(0, track_offsets, flac->num_cue_points, off_t);
+    num_tracks = _flac_cue_track_starts(flac, tracks);
+  }
+
+  interval = (uint64_t)_opt_iv(opts, "interval_ms", 10000) * flac->samplerate / 1000;
+
+  // Smallest possible distance between two frame headers
+  skip = flac->min_framesize > FLAC_HEADER_LEN ? flac->min_framesize : 1;
+
+  Newz(0, flac->scratch, sizeof(Buffer), Buffer);
+  buffer_init(flac->scratch, FLAC_INDEX_BLOCK_SIZE);
+
+  base = pos = flac->audio_offset;
+
+  if ( PerlIO_seek(infile, pos, SEEK_SET) == -1 ) {
+    goto out;
+  }
+
+  while (pos < flac->file_size - FLAC_HEADER_LEN) {
+    unsigned char *bptr;
+    uint32_t len;
+    uint32_t i;
+
+    // Keep a block of data from pos in the buffer, the file is read sequentially
+    // and only needs a seek when a frame is skipped past the buffered data
+    if ( pos - base < buffer_len(flac->scratch) ) {
+      buffer_consume(flac->scratch, pos - base);
+    }
+    else {
+      off_t buffered_end = base + buffer_len(flac->scratch);
+
+      buffer_clear(flac->scratch);
+      if ( pos > buffered_end && PerlIO_seek(infile, pos, SEEK_SET) == -1 ) {
+        break;
+      }
+    }
+    base = pos;
+
+    if ( buffer_len(flac->scratch) < FLAC_INDEX_BLOCK_SIZE / 2 ) {
+      off_t left = flac->file_size - (base + buffer_len(flac->scratch));
+      uint32_t wanted = left < FLAC_INDEX_BLOCK_SIZE ? (uint32_t)left : FLAC_INDEX_BLOCK_SIZE;
+
+      if ( wanted && !_check_buf(infile, flac->scratch, buffer_len(flac->scratch) + wanted, buffer_len(flac->scratch) + wanted) ) {
+        break;
+      }
+    }
+
+    bptr = buffer_ptr(flac->scratch);
+    len  = buffer_len(flac->scratch);
+
+    if (len <= FLAC_HEADER_LEN) {
+      break;
+    }
+
+    i = _flac_find_sync(bptr, 0, len - FLAC_HEADER_LEN);
+
+    if ( i >= len - FLAC_HEADER_LEN ) {
+      // Keep the tail, a header may start there
+      pos += i;
+      continue;
+    }
+
+    if (
+         !_flac_read_frame_header(flac, &bptr[i], &first_sample, &last_sample)
+      || (frames && first_sample != next_sample)
+    ) {
+      pos += i + 1;
+      continue;
+    }
+
+    frame_offset = pos + i;
+
+    DEBUG_TRACE("Frame %d at %" PRIu64 ", samples %" PRIu64 "-%" PRIu64 "\n", frames, (uint64_t)frame_offset, first_sample, last_sample);
+
+    if (!frames) {
+      next_point = first_sample;
+    }
+
+    // Frame containing the first sample of a track
+    while (t < num_tracks && tracks[t].sample < last_sample) {
+      track_offsets[t++] = frame_offset;
+    }
+
+    // Add a point for the frame containing the next point's sample
+    if (next_point < last_sample) {
+      unsigned char *p = (unsigned char *)buffer_append_space(&points, 18);
+
+      put_u32(p,      (uint32_t)(first_sample >> 32));
+      put_u32(p + 4,  (uint32_t)first_sample);
+      put_u32(p + 8,  (uint32_t)((uint64_t)(frame_offset - flac->audio_offset) >> 32));
+      put_u32(p + 12, (uint32_t)(frame_offset - flac->audio_offset));
+      put_u16(p + 16, (uint16_t)(last_sample - first_sample));
+      num_points++;
+
+      do {
+        next_point += interval ? interval : 1;
+      } while (next_point < last_sample);
+    }
+
+    frames++;
+    next_sample = last_sample;
+    pos = frame_offset + skip;
+  }
+
+  if (frames) {
+    unsigned char header[4];
+
+    // SEEKTABLE metadata block, not flagged as the last block
+    header[0] = FLAC_TYPE_SEEKTABLE;
+    header[1] = ((num_points * 18) >> 16) & 0xFF;
+    header[2] = ((num_points * 18) >> 8) & 0xFF;
+    header[3] = (num_points * 18) & 0xFF;
+
+    seektable = newSVpvn( (char *)header, 4 );
+    sv_catpvn( seektable, buffer_ptr(&points), buffer_len(&points) );
+
+    my_hv_store( info, "frames", newSVuv(frames) );
+    my_hv_store( info, "indexed_samples", newSVuv(next_sample) );
+    my_hv_store( info, "seekpoints", newSVuv(num_points) );
+    my_hv_store( info, "seektable_block", seektable );
+  }
+
+  if (num_tracks) {
+    AV *list = newAV();
+    uint32_t i;
+
+    for (i = 0; i < num_tracks; i++) {
+      HV *track = newHV();
+      uint64_t end_sample = i + 1 < num_tracks ? tracks[i + 1].sample
+        : flac->cue_leadout ? flac->cue_leadout : next_sample;
+
+      my_hv_store( track, "track", newSVuv(tracks[i].track) );
+      my_hv_store( track, "start_sample", newSVuv(tracks[i].sample) );
+      my_hv_store( track, "end_sample", newSVuv(end_sample) );
+
+      // Byte range from the frame containing the first sample up to the next track's frame
+      if (i < t) {
+        off_t end = i + 1 < t ? track_offsets[i + 1] : flac->file_size;
+
+        my_hv_store( track, "offset", newSVuv(track_offsets[i]) );
+        my_hv_store( track, "size", newSVuv(end - track_offsets[i]) );
+      }
+
+      av_push( list, newRV_noinc( (SV *)track ) );
+    }
+
+    my_hv_store( info, "tracks", newRV_noinc( (SV *)list ) );
+  }
+
+out:
+  if (flac->scratch) {
+    buffer_free(flac->scratch);
+    Safefree(flac->scratch);
+  }
+
+  buffer_free(&points);
+  SvREFCNT_dec(tags);
+  Safefree(tracks);
+  Safefree(track_offsets);
+  Safefree(flac->seekpoints);
+  Safefree(flac->cue_points);
+  Safefree(flac);
+}
+
+// Rewrite the VORBIS_COMMENT block, and the PICTURE blocks if tags contains ALLPICTURES,
+// keeping every other metadata block. If the new blocks fit in the space used by the
+// old metadata, only that region is written and what is left over becomes PADDING.
+// Otherwise nothing is written, and result gets the complete new header (including any
+// ID3v2 tag) and source_offset, the offset of the audio data to copy after it.
+// Returns 1 if written in place, 0 if the file must be rewritten, or -1 on error.
+int
+flac_write_tags(PerlIO *infile, char *file, HV *tags, HV *opts, HV *result)
+{
+  Buffer buf;
+  Buffer out;
+  unsigned char *bptr;
+  off_t file_size = _file_size(infile);
+  off_t offset;
+  off_t region;
+  uint32_t id3_size = 0;
+  uint32_t last_header = 0;
+  uint32_t padding;
+  uint8_t done = 0;
+  uint8_t have_comment = 0;
+  uint8_t have_pictures = 0;
+  uint8_t replace_pictures = my_hv_exists(tags, "ALLPICTURES") ? 1 : 0;
+  SV *vendor = NULL;
+  int ret = -1;
+
+  buffer_init(&buf, FLAC_BLOCK_SIZE);
+  buffer_init(&out, FLAC_BLOCK_SIZE);
+
+  if ( !_check_buf(infile, &buf, 10, 10) ) {
+    goto out;
+  }
+
+  bptr = buffer_ptr(&buf);
+  if (
+    (bptr[0] == 'I' && bptr[1] == 'D' && bptr[2] == '3') &&
+    bptr[3] < 0xff && bptr[4] < 0xff &&
+    bptr[6] < 0x80 && bptr[7] < 0x80 && bptr[8] < 0x80 && bptr[9] < 0x80
+  ) {
+    id3_size = 10 + (bptr[6]<<21) + (bptr[7]<<14) + (bptr[8]<<7) + bptr[9];
+
+    if (bptr[5] & 0x10) {
+      id3_size += 10;
+    }
+  }
+
+  offset = id3_size;
+
+  if ( !_flac_read_at(infile, offset, &buf, 4) || memcmp(buffer_ptr(&buf), "fLaC", 4) != 0 ) {
+    PerlIO_printf(PerlIO_stderr(), "Not a valid FLAC file: %s\n", file);
+    goto out;
+  }
+
+  offset += 4;
+
+  while ( !done ) {
+    uint8_t type;
+    uint32_t len;
+
+    if ( !_flac_read_at(infile, offset, &buf, 4) ) {
+      goto out;
+    }
+
+    bptr = buffer_ptr(&buf);
+    done = bptr[0] & 0x80 ? 1 : 0;
+    type = bptr[0] & 0x7f;
+    len  = (bptr[1] << 16) | (bptr[2] << 8) | bptr[3];
+
+    if ( len > file_size - offset - 4 ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid FLAC file: %s, bad metadata block\n", file);
+      goto out;
+    }
+
+    DEBUG_TRACE("Writing tags, block type %d at %" PRIu64 ", len %d\n", type, (uint64_t)offset, len);
+
+    switch (type) {
+      case FLAC_TYPE_VORBIS_COMMENT:
+        if (!have_comment) {
+          // Keep the vendor string unless a new one was given
+          if ( !my_hv_exists(tags, "VENDOR") && len >= 4 && _flac_read_at(infile, offset + 4, &buf, 4) ) {
+            uint32_t vendor_len = buffer_get_int_le(&buf);
+
+            if ( vendor_len <= len - 4 && _flac_read_at(infile, offset + 8, &buf, vendor_len) ) {
+              vendor = newSVpvn( buffer_ptr(&buf), vendor_len );
+            }
+          }
+
+          last_header = buffer_len(&out);
+          if ( !_flac_put_comment(&out, tags, vendor) ) {
+            goto out;
+          }
+          have_comment = 1;
+        }
+        break;
+
+      case FLAC_TYPE_PICTURE:
+        if (replace_pictures) {
+          if (!have_pictures) {
+            if ( !_flac_put_pictures(&out, tags, infile, file_size, &last_header) ) {
+              goto out;
+            }
+            have_pictures = 1;
+          }
+          break;
+        }
+        // Otherwise keep the existing picture, fall through
+
+      default:
+        if (type != FLAC_TYPE_PADDING) {
+          last_header = buffer_len(&out);
+          if ( !_flac_read_at(infile, offset, &buf, 4 + len) ) {
+            goto out;
+          }
+          buffer_append(&out, buffer_ptr(&buf), 4 + len);
+          ((unsigned char *)buffer_ptr(&out))[last_header] &= 0x7f;
+        }
+    }
+
+    offset += 4 + len;
+  }
+
+  if (!have_comment) {
+    last_header = buffer_len(&out);
+    if ( !_flac_put_comment(&out, tags, NULL) ) {
+      goto out;
+    }
+  }
+
+  if (replace_pictures && !have_pictures) {
+    if ( !_flac_put_pictures(&out, tags, infile, file_size, &last_header) ) {
+      goto out;
+    }
+  }
+
+  // Space taken by the old metadata blocks, after fLaC
+  region = offset - id3_size - 4;
+
+  if ( buffer_len(&out) == region || buffer_len(&out) + 4 <= region ) {
+    off_t left = region - buffer_len(&out);
+
+    DEBUG_TRACE("Writing %d bytes of metadata in place, %" PRIu64 " bytes left\n", buffer_len(&out), (uint64_t)left);
+
+    if (!left) {
+      ((unsigned char *)buffer_ptr(&out))[last_header] |= 0x80;
+    }
+
+    padding = 0;
+    while (left) {
+      // A padding block holds at most 16M, fill any more with several blocks
+      uint32_t size = left - 4 > 0xFFFFFF ? 0xFFFFFF : (uint32_t)(left - 4);
+      if ( left - 4 - size > 0 && left - 4 - size < 4 ) {
+        size -= 4;
+      }
+      _flac_put_padding(&out, size, left - 4 - size == 0);
+      padding += size;
+      left -= 4 + size;
+    }
+
+    if ( PerlIO_seek(infile, id3_size + 4, SEEK_SET) == -1
+      || PerlIO_write(infile, buffer_ptr(&out), buffer_len(&out)) != buffer_len(&out)
+      || PerlIO_flush(infile) != 0
+    ) {
+      PerlIO_printf(PerlIO_stderr(), "Unable to write tags to FLAC file: %s\n", file);
+      goto out;
+    }
+
+    my_hv_store( result, "in_place", newSVuv(1) );
+    ret = 1;
   }
   else {
-    *first_sample = 0;
+    SV *header = newSVpvn("", 0);
+
+    padding = _opt_iv(opts, "padding", FLAC_DEFAULT_PADDING);
+    if (padding > 0xFFFFFF) {
+      padding = 0xFFFFFF;
+    }
+
+    if (padding) {
+      _flac_put_padding(&out, padding, 1);
+    }
+    else {
+      ((unsigned char *)buffer_ptr(&out))[last_header] |= 0x80;
+    }
+
+    DEBUG_TRACE("Metadata does not fit (%d > %" PRIu64 "), rewriting file\n", buffer_len(&out), (uint64_t)region);
+
+    if (id3_size) {
+      if ( !_flac_read_at(infile, 0, &buf, id3_size) ) {
+        SvREFCNT_dec(header);
+        goto out;
+      }
+      sv_catpvn( header, (char *)buffer_ptr(&buf), id3_size );
+    }
+
+    sv_catpvn( header, "fLaC", 4 );
+    sv_catpvn( header, (char *)buffer_ptr(&out), buffer_len(&out) );
+
+    my_hv_store( result, "in_place", newSVuv(0) );
+    my_hv_store( result, "header", header );
+    my_hv_store( result, "source_offset", newSVuv(offset) );
+    ret = 0;
   }
 
-  *last_sample = *first_sample + blocksize;
+  my_hv_store( result, "audio_offset", newSVuv(id3_size + 4 + buffer_len(&out)) );
+  my_hv_store( result, "padding", newSVuv(padding) );
+
+out:
+  if (vendor) {
+    SvREFCNT_dec(vendor);
+  }
+  buffer_free(&buf);
+  buffer_free(&out);
+
+  return ret;
+}
+
+int
+_flac_read_at(PerlIO *infile, off_t offset, Buffer *buf, uint32_t len)
+{
+  buffer_clear(buf);
+
+  if ( PerlIO_seek(infile, offset, SEEK_SET) == -1 ) {
+    return 0;
+  }
+
+  return len ? _check_buf(infile, buf, len, len) : 1;
+}
+
+void
+_flac_put_int_le(Buffer *out, uint32_t value)
+{
+  unsigned char le[4];
+
+  le[0] = value & 0xff;
+  le[1] = (value >> 8) & 0xff;
+  le[2] = (value >> 16) & 0xff;
+  le[3] = (value >> 24) & 0xff;
+
+  buffer_append(out, le, 4);
+}
+
+// Set the type and length of a block started at header, the last flag is set later
+int
+_flac_end_block(Buffer *out, uint32_t header, uint8_t type)
+{
+  unsigned char *bptr = (unsigned char *)buffer_ptr(out) + header;
+  uint32_t len = buffer_len(out) - header - 4;
+
+  if (len > 0xFFFFFF) {
+    PerlIO_printf(PerlIO_stderr(), "FLAC metadata block too large (%u bytes)\n", len);
+    return 0;
+  }
+
+  bptr[0] = type;
+  bptr[1] = (len >> 16) & 0xff;
+  bptr[2] = (len >> 8) & 0xff;
+  bptr[3] = len & 0xff;
 
   return 1;
 }
 
+// Append a VORBIS_COMMENT block with every scalar or arrayref value in tags, in key order
+int
+_flac_put_comment(Buffer *out, HV *tags, SV *vendor)
+{
+  uint32_t header = buffer_len(out);
+  uint32_t count = 0;
+  Buffer comments;
+  uint32_t num_keys;
+  uint32_t i;
+  const char **keys;
+  STRLEN len;
+  char *str;
+
+  buffer_append_space(out, 4);
+
+  if ( my_hv_exists(tags, "VENDOR") ) {
+    str = SvPVutf8( *(my_hv_fetch(tags, "VENDOR")), len );
+  }
+  else if (vendor) {
+    str = SvPV(vendor, len);
+  }
+  else {
+    str = "Audio::Scan";
+    len = strlen(str);
+  }
+
+  _flac_put_int_le(out, len);
+  buffer_append(out, str, len);
+
+  buffer_init(&comments, FLAC_BLOCK_SIZE);
+
+  num_keys = _sorted_keys(tags, &keys);
+
+  for (i = 0; i < num_keys; i++) {
+    SV **entry = my_hv_fetch(tags, keys[i]);
+    AV *values = NULL;
+    const char *k;
+    int32_t n = 0;
+    int32_t j;
+
+    // Not Vorbis comments, or read from other blocks
+    if ( !strcmp(keys[i], "VENDOR") || !strcmp(keys[i], "ALLPICTURES")
+      || !strcmp(keys[i], "CUESHEET_BLOCK") || !strcmp(keys[i], "APPLICATION")
+    ) {
+      continue;
+    }
+
+    // Field names are printable ASCII other than =
+    for (k = keys[i]; *k; k++) {
+      if (*k < 0x20 || *k > 0x7d || *k == '=') {
+        break;
+      }
+    }
+
+    if (*k || !*keys[i] || entry == NULL) {
+      PerlIO_printf(PerlIO_stderr(), "Skipping invalid Vorbis comment name: %s\n", keys[i]);
+      continue;
+    }
+
+    if ( SvROK(*entry) ) {
+      if ( SvTYPE(SvRV(*entry)) != SVt_PVAV ) {
+        continue;
+      }
+      values = (AV *)SvRV(*entry);
+      n = av_len(values) + 1;
+    }
+    else if ( SvOK(*entry) ) {
+      n = 1;
+    }
+
+    for (j = 0; j < n; j++) {
+      SV **value = values ? av_fetch(values, j, 0) : entry;
+      uint32_t klen = strlen(keys[i]);
+
+      if ( value == NULL || !SvOK(*value) || SvROK(*value) ) {
+        continue;
+      }
+
+      str = SvPVutf8(*value, len);
+
+      _flac_put_int_le(&comments, klen + 1 + len);
+      buffer_append(&comments, keys[i], klen);
+      buffer_append(&comments, "=", 1);
+      buffer_append(&comments, str, len);
+      count++;
+    }
+  }
+
+  Safefree(keys);
+
+  _flac_put_int_le(out, count);
+  buffer_append(out, buffer_ptr(&comments), buffer_len(&comments));
+  buffer_free(&comments);
+
+  return _flac_end_block(out, header, FLAC_TYPE_VORBIS_COMMENT);
+}
+
+// Append a PICTURE block for each hashref in ALLPICTURES, in the same form as they are
+// returned by scan. Pictures read with AUDIO_SCAN_NO_ARTWORK have the image length in
+// image_data and its file offset in offset, and are copied from the file.
+int
+_flac_put_pictures(Buffer *out, HV *tags, PerlIO *infile, off_t file_size, uint32_t *last_header)
+{
+  SV **entry = my_hv_fetch(tags, "ALLPICTURES");
+  AV *pictures;
+  Buffer image;
+  int32_t i;
+  int ret = 0;
+
+  if ( entry == NULL || !SvROK(*entry) || SvTYPE(SvRV(*entry)) != SVt_PVAV ) {
+    return 1;
+  }
+
+  pictures = (AV *)SvRV(*entry);
+
+  buffer_init(&image, 0);
+
+  for (i = 0; i <= av_len(pictures); i++) {
+    SV **pic = av_fetch(pictures, i, 0);
+    SV **image_data;
+    HV *picture;
+    uint32_t header = buffer_len(out);
+    STRLEN len;
+    char *str;
+
+    if ( pic == NULL || !SvROK(*pic) || SvTYPE(SvRV(*pic)) != SVt_PVHV ) {
+      continue;
+    }
+
+    picture = (HV *)SvRV(*pic);
+    image_data = my_hv_fetch(picture, "image_data");
+
+    if ( image_data == NULL ) {
+      continue;
+    }
+
+    buffer_append_space(out, 4);
+    buffer_put_int( out, _opt_iv(picture, "picture_type", 3) );
+
+    entry = my_hv_fetch(picture, "mime_type");
+    str = entry != NULL ? SvPV(*entry, len) : (len = 0, "");
+    buffer_put_int(out, len);
+    buffer_append(out, str, len);
+
+    entry = my_hv_fetch(picture, "description");
+    str = entry != NULL ? SvPVutf8(*entry, len) : (len = 0, "");
+    buffer_put_int(out, len);
+    buffer_append(out, str, len);
+
+    buffer_put_int( out, _opt_iv(picture, "width", 0) );
+    buffer_put_int( out, _opt_iv(picture, "height", 0) );
+    buffer_put_int( out, _opt_iv(picture, "depth", 0) );
+    buffer_put_int( out, _opt_iv(picture, "color_index", 0) );
+
+    if ( !SvPOK(*image_data) && my_hv_exists(picture, "offset") ) {
+      off_t offset = _opt_iv(picture, "offset", 0);
+      uint32_t length = SvUV(*image_data);
+
+      if ( offset < 0 || offset + length > file_size || !_flac_read_at(infile, offset, &image, length) ) {
+        PerlIO_printf(PerlIO_stderr(), "Unable to read picture at offset %" PRIu64 "\n", (uint64_t)offset);
+        goto out;
+      }
+
+      buffer_put_int(out, length);
+      buffer_append(out, buffer_ptr(&image), length);
+    }
+    else {
+      str = SvPV(*image_data, len);
+      buffer_put_int(out, len);
+      buffer_append(out, str, len);
+    }
+
+    if ( !_flac_end_block(out, header, FLAC_TYPE_PICTURE) ) {
+      goto out;
+    }
+
+    *last_header = header;
+  }
+
+  ret = 1;
+
+out:
+  buffer_free(&image);
+
+  return ret;
+}
+
+void
+_flac_put_padding(Buffer *out, uint32_t size, uint8_t last)
+{
+  unsigned char *bptr = (unsigned char *)buffer_append_space(out, 4 + size);
+
+  Zero(bptr, 4 + size, unsigned char);
+
+  bptr[0] = FLAC_TYPE_PADDING | (last ? 0x80 : 0);
+  bptr[1] = (size >> 16) & 0xff;
+  bptr[2] = (size >> 8) & 0xff;
+  bptr[3] = size & 0xff;
+}
+
 void
 _flac_parse_streaminfo(flacinfo *flac)
 {
@@ -677,6 +1573,9 @@ _flac_parse_streaminfo(flacinfo *flac)
   int i;
   uint32_t song_length_ms;
 
+  // Keep the raw block for seek headers
+  Copy(buffer_ptr(flac->buf), flac->streaminfo, 34, unsigned char);
+
   flac->min_blocksize = buffer_get_short(flac->buf);
   my_hv_store( flac->info, "minimum_blocksize", newSVuv(flac->min_blocksize) );
 
@@ -846,6 +1745,12 @@ _flac_parse_cuesheet(flacinfo *flac)
 
       DEBUG_TRACE("      index %d, offset %llu\n", index_num, index_offset);
 
+      Renew(flac->cue_points, flac->num_cue_points + 1, struct cuepoint);
+      flac->cue_points[flac->num_cue_points].track  = tracknum;
+      flac->cue_points[flac->num_cue_points].index  = index_num;
+      flac->cue_points[flac->num_cue_points].sample = track_offset + index_offset;
+      flac->num_cue_points++;
+
       index = newSVpvf("    INDEX %02u ", index_num);
 
       if (is_cd) {
@@ -869,6 +1774,11 @@ _flac_parse_cuesheet(flacinfo *flac)
       av_push( cue, index );
     }
 
+    if (tracknum == 170 || tracknum == 255) {
+      // Lead-out, the end of the last track
+      flac->cue_leadout = track_offset;
+    }
+
     if (tracknum == 170) {
       // Add lead-in and lead-out
       sprintf(decimal, "%"PRIu64, leadin);
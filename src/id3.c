@@ -100,6 +100,211 @@ out:
   return err;
 }
 
+// Update the ID3v2.3 or v2.4 tag at the start of the file. Frames are replaced by the
+// entries in tags with the same frame ID (or TXXX description for other keys), or
+// removed if the value is undef, and all other frames are kept. A file without a tag
+// gets a new v2.4 tag. If the frames fit in the existing tag the rest of it is zeroed
+// as padding, otherwise nothing is written and result gets the new tag as header and
+// source_offset, the end of the old tag, to copy the rest of the file after it.
+// Returns 1 if written in place, 0 if the file must be rewritten, or -1 on error.
+int
+id3_write_tags(PerlIO *infile, char *file, HV *tags, HV *opts, HV *result)
+{
+  Buffer buf;
+  Buffer out;
+  unsigned char *bptr;
+  off_t file_size = _file_size(infile);
+  uint32_t tag_size = 0;    // existing tag including header and footer
+  uint32_t body_len = 0;
+  uint32_t padding;
+  uint8_t in_place = 0;
+  uint8_t version = 4;
+  uint8_t flags = 0;
+  HV *txxx = newHV();       // upper case TXXX descriptions found in tags
+  const char **keys = NULL;
+  uint32_t num_keys;
+  uint32_t i;
+  int ret = -1;
+
+  buffer_init(&buf, ID3_BLOCK_SIZE);
+  buffer_init(&out, ID3_BLOCK_SIZE);
+
+  num_keys = _sorted_keys(tags, &keys);
+
+  for (i = 0; i < num_keys; i++) {
+    if ( !_id3_write_key_type(keys[i]) ) {
+      SV *desc = newSVpv(keys[i], 0);
+      upcase(SvPVX(desc));
+      my_hv_store_ent( txxx, desc, newSVuv(1) );
+      SvREFCNT_dec(desc);
+    }
+  }
+
+  PerlIO_seek(infile, 0, SEEK_SET);
+  if ( file_size >= 10 && !_check_buf(infile, &buf, 10, 10) ) {
+    goto out;
+  }
+
+  bptr = buffer_ptr(&buf);
+  if ( buffer_len(&buf) >= 10 && bptr[0] == 'I' && bptr[1] == 'D' && bptr[2] == '3'
+    && bptr[3] < 0xff && bptr[4] < 0xff
+    && bptr[6] < 0x80 && bptr[7] < 0x80 && bptr[8] < 0x80 && bptr[9] < 0x80
+  ) {
+    version  = bptr[3];
+    flags    = bptr[5];
+    tag_size = 10 + ( (bptr[6] << 21) | (bptr[7] << 14) | (bptr[8] << 7) | bptr[9] );
+    body_len = tag_size - 10;
+
+    if (flags & ID3_TAG_FLAG_FOOTERPRESENT) {
+      tag_size += 10;
+    }
+
+    if (version != 3 && version != 4) {
+      PerlIO_printf(PerlIO_stderr(), "Unable to write ID3v2.%d tag in %s\n", version, file);
+      goto out;
+    }
+
+    if (tag_size > file_size) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid ID3v2 tag in %s\n", file);
+      goto out;
+    }
+
+    buffer_clear(&buf);
+    if ( body_len && !_check_buf(infile, &buf, body_len, body_len) ) {
+      goto out;
+    }
+
+    if ( version == 3 && flags & ID3_TAG_FLAG_UNSYNCHRONISATION ) {
+      // The tag is written back without unsynchronisation
+      body_len = _id3_deunsync( buffer_ptr(&buf), body_len );
+    }
+
+    bptr = buffer_ptr(&buf);
+
+    if ( flags & ID3_TAG_FLAG_EXTENDEDHEADER && body_len >= 4 ) {
+      // The extended header is dropped, v2.3 doesn't count the size field itself
+      uint32_t ehsize = version == 3
+        ? get_u32(bptr) + 4
+        : (bptr[0] << 21) | (bptr[1] << 14) | (bptr[2] << 7) | bptr[3];
+
+      if (ehsize > body_len) {
+        PerlIO_printf(PerlIO_stderr(), "Invalid ID3 extended header size in %s\n", file);
+        goto out;
+      }
+
+      bptr += ehsize;
+      body_len -= ehsize;
+    }
+
+    // Keep each frame that isn't being replaced
+    while (body_len >= 10 && bptr[0]) {
+      char id[5];
+      uint32_t size;
+      uint16_t frame_flags = (bptr[8] << 8) | bptr[9];
+
+      if (version == 3 || _varint(bptr + 4, 4) & 0x80) {
+        size = get_u32(bptr + 4);
+      }
+      else {
+        size = (bptr[4] << 21) | (bptr[5] << 14) | (bptr[6] << 7) | bptr[7];
+      }
+
+      if (size > body_len - 10) {
+        DEBUG_TRACE("  frame size too big, dropping the rest of the tag\n");
+        break;
+      }
+
+      _id3_frame_key(bptr, version, id);
+
+      if ( !_id3_frame_replaced(id, bptr + 10, size, version, frame_flags, tags, txxx) ) {
+        buffer_append(&out, bptr, 10 + size);
+      }
+      else {
+        DEBUG_TRACE("  replacing %c%c%c%c frame (%s)\n", bptr[0], bptr[1], bptr[2], bptr[3], id);
+      }
+
+      bptr += 10 + size;
+      body_len -= 10 + size;
+    }
+  }
+
+  // Append the new frames
+  for (i = 0; i < num_keys; i++) {
+    SV **entry = my_hv_fetch(tags, keys[i]);
+
+    if ( entry == NULL || !SvOK(*entry) ) {
+      continue;
+    }
+
+    if ( !_id3_put_tag(&out, keys[i], *entry, version, infile, file_size) ) {
+      goto out;
+    }
+  }
+
+  if ( !tag_size && !buffer_len(&out) ) {
+    // Nothing to write
+    my_hv_store( result, "in_place", newSVuv(1) );
+    my_hv_store( result, "audio_offset", newSVuv(0) );
+    my_hv_store( result, "padding", newSVuv(0) );
+    ret = 1;
+    goto out;
+  }
+
+  if ( tag_size && 10 + buffer_len(&out) <= tag_size ) {
+    padding = tag_size - 10 - buffer_len(&out);
+    in_place = 1;
+  }
+  else {
+    padding = _opt_iv(opts, "padding", ID3_DEFAULT_PADDING);
+  }
+
+  if ( 10 + buffer_len(&out) + padding > 0x0FFFFFFF ) {
+    PerlIO_printf(PerlIO_stderr(), "ID3v2 tag too large for %s\n", file);
+    goto out;
+  }
+
+  // Header and padding around the frames
+  buffer_clear(&buf);
+  bptr = buffer_append_space(&buf, 10);
+  _id3_put_header(bptr, version, buffer_len(&out) + padding);
+  buffer_append(&buf, buffer_ptr(&out), buffer_len(&out));
+  Zero(buffer_append_space(&buf, padding), padding, unsigned char);
+
+  if (in_place) {
+    DEBUG_TRACE("Writing ID3v2.%d tag in place, %d bytes of padding\n", version, padding);
+
+    if ( PerlIO_seek(infile, 0, SEEK_SET) == -1
+      || PerlIO_write(infile, buffer_ptr(&buf), buffer_len(&buf)) != buffer_len(&buf)
+      || PerlIO_flush(infile) != 0
+    ) {
+      PerlIO_printf(PerlIO_stderr(), "Unable to write ID3v2 tag to %s\n", file);
+      goto out;
+    }
+
+    my_hv_store( result, "in_place", newSVuv(1) );
+    ret = 1;
+  }
+  else {
+    DEBUG_TRACE("ID3v2 tag does not fit, rewriting file\n");
+
+    my_hv_store( result, "in_place", newSVuv(0) );
+    my_hv_store( result, "header", newSVpvn( buffer_ptr(&buf), buffer_len(&buf) ) );
+    my_hv_store( result, "source_offset", newSVuv(tag_size) );
+    ret = 0;
+  }
+
+  my_hv_store( result, "audio_offset", newSVuv( buffer_len(&buf) ) );
+  my_hv_store( result, "padding", newSVuv(padding) );
+
+out:
+  Safefree(keys);
+  SvREFCNT_dec(txxx);
+  buffer_free(&buf);
+  buffer_free(&out);
+
+  return ret;
+}
+
 int
 _id3_parse_v1(id3info *id3)
 {
@@ -1727,3 +1932,418 @@ _id3_genre_name(char const *string)
 
   return (number < NGENRES) ? genre_table[number] : string;
 }
+
+// 0 for keys written as TXXX descriptions, 1 for frame IDs that can only be removed,
+// 2 for frames that can be written
+uint8_t
+_id3_write_key_type(const char *key)
+{
+  int i;
+
+  if ( strlen(key) != 4 || !isupper((unsigned char)key[0]) ) {
+    return 0;
+  }
+
+  for (i = 1; i < 4; i++) {
+    if ( !isupper((unsigned char)key[i]) && !isdigit((unsigned char)key[i]) ) {
+      return 0;
+    }
+  }
+
+  // Known and obsolete frames, plus text, URL and experimental frames. Anything
+  // else is most likely a TXXX description such as DATE
+  if ( !strchr("TWXYZ", key[0]) && !_id3_frametype_lookup(key, 4)
+    && !_id3_compat_lookup(key, 4) && strcmp(key, "RGAD") != 0
+  ) {
+    return 0;
+  }
+
+  if ( !strcmp(key, "TXXX") || !strcmp(key, "WXXX") ) {
+    return 1;
+  }
+
+  if ( key[0] == 'T' || key[0] == 'W' || !strcmp(key, "COMM") || !strcmp(key, "USLT") || !strcmp(key, "APIC") ) {
+    return 2;
+  }
+
+  return 1;
+}
+
+// The v2.4 ID a frame is returned as by scan, v2.3 year, date and time all map to TDRC
+void
+_id3_frame_key(unsigned char *bptr, uint8_t version, char *id)
+{
+  id3_compat const *compat = NULL;
+
+  Copy(bptr, id, 4, char);
+  id[4] = 0;
+
+  if (id[3] == ' ') {
+    compat = _id3_compat_lookup(id, 3);
+  }
+  else if (version == 3) {
+    compat = _id3_compat_lookup(id, 4);
+  }
+
+  if (compat && compat->equiv) {
+    strncpy(id, compat->equiv, 4);
+    id[4] = 0;
+  }
+
+  if ( version == 3 && (!strcmp(id, "TYER") || !strcmp(id, "TDAT") || !strcmp(id, "TIME")) ) {
+    strcpy(id, "TDRC");
+  }
+}
+
+int
+_id3_frame_replaced(char *id, unsigned char *data, uint32_t size, uint8_t version, uint16_t frame_flags, HV *tags, HV *txxx)
+{
+  SV **entry;
+
+  if ( !strcmp(id, "TXXX") ) {
+    id3info id3;
+    Buffer buf;
+    Buffer utf8;
+    SV *desc = NULL;
+    int found = 0;
+
+    // Only plain frames can be matched by description
+    if ( !size || data[0] > UTF_8 || frame_flags & (version == 3 ? 0x00E0 : 0x004F) ) {
+      return 0;
+    }
+
+    Zero(&id3, 1, id3info);
+    Zero(&utf8, 1, Buffer);
+    buffer_init(&buf, size);
+    buffer_append(&buf, data + 1, size - 1);
+    id3.buf  = &buf;
+    id3.utf8 = &utf8;
+
+    _id3_get_utf8_string(&id3, &desc, size - 1, data[0]);
+
+    if (desc != NULL) {
+      upcase(SvPVX(desc));
+      found = my_hv_exists_ent(txxx, desc);
+      SvREFCNT_dec(desc);
+    }
+
+    buffer_free(&buf);
+    if (utf8.alloc) {
+      buffer_free(&utf8);
+    }
+
+    return found;
+  }
+
+  entry = my_hv_fetch(tags, id);
+
+  return entry != NULL && ( _id3_write_key_type(id) == 2 || !SvOK(*entry) );
+}
+
+// A list of the values of a tag, for scalars a list of one
+AV *
+_id3_tag_values(SV *value)
+{
+  AV *values;
+
+  if ( SvROK(value) && SvTYPE(SvRV(value)) == SVt_PVAV ) {
+    return (AV *)SvRV(value);
+  }
+
+  values = (AV *)sv_2mortal( (SV *)newAV() );
+  av_push( values, SvREFCNT_inc(value) );
+
+  return values;
+}
+
+// Latin-1 if every string fits, otherwise UTF-8 in v2.4 and UTF-16 in v2.3
+uint8_t
+_id3_text_encoding(SV **strings, int count, uint8_t version)
+{
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if ( strings[i] && SvOK(strings[i]) && SvUTF8(strings[i]) && !sv_utf8_downgrade(sv_mortalcopy(strings[i]), TRUE) ) {
+      return version == 4 ? UTF_8 : UTF_16;
+    }
+  }
+
+  return ISO_8859_1;
+}
+
+void
+_id3_put_string(Buffer *out, SV *sv, uint8_t encoding, uint8_t terminate)
+{
+  SV *copy;
+  STRLEN len = 0;
+  unsigned char *str = (unsigned char *)"";
+
+  if ( sv && SvOK(sv) ) {
+    copy = sv_mortalcopy(sv);
+
+    if (encoding == ISO_8859_1) {
+      sv_utf8_downgrade(copy, TRUE);
+      str = (unsigned char *)SvPV(copy, len);
+    }
+    else {
+      str = (unsigned char *)SvPVutf8(copy, len);
+    }
+  }
+
+  if (encoding == UTF_16) {
+    unsigned char *end = str + len;
+    unsigned char le[4];
+
+    // Little-endian with a BOM
+    buffer_append(out, "\xff\xfe", 2);
+
+    while (str < end) {
+      uint32_t c = *str++;
+      int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+
+      c &= extra ? 0x3f >> extra : 0x7f;
+      while (extra-- && str < end) {
+        c = (c << 6) | (*str++ & 0x3f);
+      }
+
+      if (c > 0xffff) {
+        c -= 0x10000;
+        le[0] = (0xd800 | (c >> 10)) & 0xff;
+        le[1] = (0xd800 | (c >> 10)) >> 8;
+        le[2] = (0xdc00 | (c & 0x3ff)) & 0xff;
+        le[3] = (0xdc00 | (c & 0x3ff)) >> 8;
+        buffer_append(out, le, 4);
+      }
+      else {
+        le[0] = c & 0xff;
+        le[1] = c >> 8;
+        buffer_append(out, le, 2);
+      }
+    }
+
+    if (terminate) {
+      buffer_append(out, "\0\0", 2);
+    }
+  }
+  else {
+    buffer_append(out, str, len);
+
+    if (terminate) {
+      buffer_append(out, "\0", 1);
+    }
+  }
+}
+
+void
+_id3_put_header(unsigned char *bptr, uint8_t version, uint32_t size)
+{
+  bptr[0] = 'I';
+  bptr[1] = 'D';
+  bptr[2] = '3';
+  bptr[3] = version;
+  bptr[4] = 0;
+  bptr[5] = 0;
+  bptr[6] = (size >> 21) & 0x7f;
+  bptr[7] = (size >> 14) & 0x7f;
+  bptr[8] = (size >> 7) & 0x7f;
+  bptr[9] = size & 0x7f;
+}
+
+void
+_id3_put_frame(Buffer *out, const char *id, Buffer *data, uint8_t version)
+{
+  uint32_t size = buffer_len(data);
+  unsigned char *bptr = buffer_append_space(out, 10);
+
+  Copy(id, bptr, 4, char);
+
+  if (version == 3) {
+    put_u32(bptr + 4, size);
+  }
+  else {
+    bptr[4] = (size >> 21) & 0x7f;
+    bptr[5] = (size >> 14) & 0x7f;
+    bptr[6] = (size >> 7) & 0x7f;
+    bptr[7] = size & 0x7f;
+  }
+
+  bptr[8] = bptr[9] = 0;
+
+  buffer_append(out, buffer_ptr(data), size);
+  buffer_clear(data);
+}
+
+// Append a text frame, or a TXXX frame if desc is given, with one or more strings
+void
+_id3_put_text(Buffer *out, const char *id, SV *value, SV *desc, uint8_t version, Buffer *data)
+{
+  AV *values = _id3_tag_values(value);
+  int32_t count = av_len(values) + 1;
+  int32_t i;
+  uint8_t encoding;
+  SV **strings;
+
+  New(0, strings, count + 1, SV *);
+
+  for (i = 0; i < count; i++) {
+    SV **entry = av_fetch(values, i, 0);
+    strings[i] = entry && !SvROK(*entry) ? *entry : NULL;
+  }
+  strings[count] = desc;
+
+  encoding = _id3_text_encoding(strings, count + 1, version);
+  buffer_put_char(data, encoding);
+
+  if (desc) {
+    _id3_put_string(data, desc, encoding, 1);
+  }
+
+  for (i = 0; i < count; i++) {
+    _id3_put_string(data, strings[i], encoding, i < count - 1);
+  }
+
+  Safefree(strings);
+
+  _id3_put_frame(out, id, data, version);
+}
+
+// Append the frames for one entry of the tags hash
+int
+_id3_put_tag(Buffer *out, const char *key, SV *value, uint8_t version, PerlIO *infile, off_t file_size)
+{
+  Buffer data;
+  AV *values = _id3_tag_values(value);
+  uint8_t type = _id3_write_key_type(key);
+  uint8_t encoding;
+  int32_t i;
+  int ret = 1;
+
+  if (type == 1) {
+    // Other frames are kept as they are
+    return 1;
+  }
+
+  buffer_init(&data, ID3_BLOCK_SIZE);
+
+  if ( version == 3 && !strcmp(key, "TDRC") ) {
+    // v2.3 splits the timestamp into year, date (DDMM) and time (HHMM) frames
+    SV **entry = av_fetch(values, 0, 0);
+    STRLEN len = 0;
+    char *ts = entry && SvOK(*entry) && !SvROK(*entry) ? SvPV(*entry, len) : "";
+    char part[4];
+
+    if (len >= 4) {
+      _id3_put_text(out, "TYER", sv_2mortal( newSVpvn(ts, 4) ), NULL, version, &data);
+    }
+    if (len >= 10) {
+      part[0] = ts[8]; part[1] = ts[9]; part[2] = ts[5]; part[3] = ts[6];
+      _id3_put_text(out, "TDAT", sv_2mortal( newSVpvn(part, 4) ), NULL, version, &data);
+    }
+    if (len >= 16) {
+      part[0] = ts[11]; part[1] = ts[12]; part[2] = ts[14]; part[3] = ts[15];
+      _id3_put_text(out, "TIME", sv_2mortal( newSVpvn(part, 4) ), NULL, version, &data);
+    }
+  }
+  else if ( type == 0 ) {
+    _id3_put_text(out, "TXXX", value, sv_2mortal( newSVpv(key, 0) ), version, &data);
+  }
+  else if ( key[0] == 'T' ) {
+    // v2.3 names for frames that were renamed in v2.4
+    const char *id = key;
+
+    if (version == 3) {
+      if ( !strcmp(key, "TDOR") ) id = "TORY";
+      if ( !strcmp(key, "TIPL") ) id = "IPLS";
+    }
+
+    _id3_put_text(out, id, value, NULL, version, &data);
+  }
+  else if ( key[0] == 'W' ) {
+    SV **url = av_fetch(values, 0, 0);
+
+    if ( url && !SvROK(*url) ) {
+      _id3_put_string(&data, *url, ISO_8859_1, 0);
+      _id3_put_frame(out, key, &data, version);
+    }
+  }
+  else {
+    // COMM, USLT, APIC: an arrayref of fields, or an arrayref of them for several frames
+    SV **first = av_fetch(values, 0, 0);
+    AV *entries = values;
+
+    if ( !first || !SvROK(*first) ) {
+      entries = (AV *)sv_2mortal( (SV *)newAV() );
+      av_push( entries, newRV_inc( (SV *)values ) );
+    }
+
+    for (i = 0; i <= av_len(entries); i++) {
+      SV **entry = av_fetch(entries, i, 0);
+      AV *fields;
+      SV *f[5] = { NULL, NULL, NULL, NULL, NULL };
+      int32_t j;
+
+      if ( !entry || !SvROK(*entry) || SvTYPE(SvRV(*entry)) != SVt_PVAV ) {
+        continue;
+      }
+
+      fields = (AV *)SvRV(*entry);
+      for (j = 0; j < 5 && j <= av_len(fields); j++) {
+        SV **field = av_fetch(fields, j, 0);
+        f[j] = field ? *field : NULL;
+      }
+
+      if ( !strcmp(key, "APIC") ) {
+        // mime type, picture type, description, image data
+        // or with AUDIO_SCAN_NO_ARTWORK, the image length and offset
+        encoding = _id3_text_encoding(&f[2], 1, version);
+        buffer_put_char(&data, encoding);
+        _id3_put_string(&data, f[0], ISO_8859_1, 1);
+        buffer_put_char(&data, f[1] && SvOK(f[1]) ? SvIV(f[1]) : 3);
+        _id3_put_string(&data, f[2], encoding, 1);
+
+        if ( f[4] && SvOK(f[4]) ) {
+          off_t offset = SvIV(f[4]);
+          uint32_t length = f[3] ? SvUV(f[3]) : 0;
+          unsigned char *bptr = buffer_append_space(&data, length);
+
+          if ( offset < 0 || offset + length > file_size
+            || PerlIO_seek(infile, offset, SEEK_SET) == -1
+            || PerlIO_read(infile, bptr, length) != length
+          ) {
+            PerlIO_printf(PerlIO_stderr(), "Unable to read APIC image data at offset %" PRIu64 "\n", (uint64_t)offset);
+            ret = 0;
+            break;
+          }
+        }
+        else if ( f[3] && SvPOK(f[3]) ) {
+          STRLEN len;
+          char *str = SvPV(f[3], len);
+          buffer_append(&data, str, len);
+        }
+        else {
+          // The image data was skipped and its offset is not known
+          PerlIO_printf(PerlIO_stderr(), "Unable to write APIC frame without image data\n");
+          ret = 0;
+          break;
+        }
+      }
+      else {
+        // language, description, text
+        STRLEN len = 0;
+        char *lang = f[0] && SvOK(f[0]) ? SvPV(f[0], len) : "";
+
+        encoding = _id3_text_encoding(&f[1], 2, version);
+        buffer_put_char(&data, encoding);
+        buffer_append(&data, len >= 3 ? lang : "XXX", 3);
+        _id3_put_string(&data, f[1], encoding, 1);
+        _id3_put_string(&data, f[2], encoding, 0);
+      }
+
+      _id3_put_frame(out, key, &data, version);
+    }
+  }
+
+  buffer_free(&data);
+
+  return ret;
+}
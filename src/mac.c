@@ -2,15 +2,27 @@
 
 static int
 get_macfileinfo(PerlIO *infile, char *file, HV *info)
+{
+  int ret;
+  mac_streaminfo *si;
+
+  Newz(0, si, sizeof(mac_streaminfo), mac_streaminfo);
+
+  ret = _mac_parse(infile, file, info, si);
+
+  Safefree(si);
+
+  return ret;
+}
+
+static int
+_mac_parse(PerlIO *infile, char *file, HV *info, mac_streaminfo *si)
 {
   Buffer header;
   char *bptr;
   int32_t ret = 0;
   int32_t header_end;
 
-  mac_streaminfo *si;
-  Newz(0, si, sizeof(mac_streaminfo), mac_streaminfo);
-
   /*
     There are two possible variations here.
     1.  There's an ID3V2 tag present at the beginning of the file
@@ -21,14 +33,12 @@ get_macfileinfo(PerlIO *infile, char *file, HV *info)
   */
   if ((header_end = skip_id3v2(infile)) < 0) {
     PerlIO_printf(PerlIO_stderr(), "MAC: [Couldn't skip ID3v2]: %s\n", file);
-    Safefree(si);
     return -1;
   }
 
   // seek to first byte of MAC data
   if (PerlIO_seek(infile, header_end, SEEK_SET) < 0) {
     PerlIO_printf(PerlIO_stderr(), "MAC: [Couldn't seek to offset %d]: %s\n", header_end, file);
-    Safefree(si);
     return -1;
   }
 
@@ -58,6 +68,9 @@ get_macfileinfo(PerlIO *infile, char *file, HV *info)
 
   buffer_clear(&header);
 
+  // Seek table offsets are relative to the stream header
+  si->header_offset = PerlIO_tell(infile);
+
   if (!_check_buf(infile, &header, 32, 32)) {
     PerlIO_printf(PerlIO_stderr(), "MAC: [Couldn't read stream header]: %s\n", file);
     goto out;
@@ -87,18 +100,27 @@ get_macfileinfo(PerlIO *infile, char *file, HV *info)
       goto out;
     }
 
-    buffer_consume(&header, 2); // flags
+    si->flags = buffer_get_short_le(&header);
 
     si->channels = buffer_get_short_le(&header);
 
     si->sample_rate = buffer_get_int_le(&header);
 
-    buffer_consume(&header, 4); // header size
+    si->wav_header_bytes = buffer_get_int_le(&header);
     buffer_consume(&header, 4); // terminating data bytes
 
     si->total_frames      = buffer_get_int_le(&header);
     si->final_frame       = buffer_get_int_le(&header);
-    si->blocks_per_frame  = si->version >= 3950 ? (73728 * 4) : 73728;
+
+    if (si->version >= 3950) {
+      si->blocks_per_frame = 73728 * 4;
+    }
+    else if (si->version >= 3900 || (si->version >= 3800 && compression_id >= 4000)) {
+      si->blocks_per_frame = 73728;
+    }
+    else {
+      si->blocks_per_frame = 9216;
+    }
 
   } else {
     unsigned char md5[16];
@@ -112,9 +134,9 @@ get_macfileinfo(PerlIO *infile, char *file, HV *info)
     buffer_consume(&header, 2);
 
     // unused.
-    buffer_get_int_le(&header); // desc bytes
-    buffer_get_int_le(&header); // header bytes
-    buffer_get_int_le(&header); // seek table bytes
+    si->descriptor_bytes  = buffer_get_int_le(&header);
+    si->header_bytes      = buffer_get_int_le(&header);
+    si->seek_table_bytes  = buffer_get_int_le(&header);
     buffer_get_int_le(&header); // header data bytes
     buffer_get_int_le(&header); // ape frame data bytes
     buffer_get_int_le(&header); // ape frame data bytes high
@@ -160,7 +182,156 @@ get_macfileinfo(PerlIO *infile, char *file, HV *info)
 
 out:
   buffer_free(&header);
-  Safefree(si);
 
   return ret;
 }
+
+static int
+mac_find_frame(PerlIO *infile, char *file, int offset)
+{
+  int64_t frame_offset;
+  uint32_t frame, skip_samples, bit;
+
+  HV *info = newHV();
+
+  frame_offset = _mac_find_frame(infile, file, offset, info, &frame, &skip_samples, &bit);
+
+  // Don't leak
+  SvREFCNT_dec(info);
+
+  return frame_offset > 0x7FFFFFFF ? -1 : frame_offset;
+}
+
+// Returns seek_offset, seek_frame and seek_skip_samples, the number of samples to
+// drop from the start of the frame. Frames are read as 32-bit words counted from
+// the first frame and don't have to start on a word, so seek_offset is the word
+// containing the frame and seek_bit is the bit in that word where it starts.
+static int
+mac_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  int64_t frame_offset;
+  uint32_t frame = 0, skip_samples = 0, bit = 0;
+
+  frame_offset = _mac_find_frame(infile, file, offset, info, &frame, &skip_samples, &bit);
+
+  my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+
+  if (frame_offset >= 0) {
+    my_hv_store( info, "seek_frame", newSVuv(frame) );
+    my_hv_store( info, "seek_skip_samples", newSVuv(skip_samples) );
+    my_hv_store( info, "seek_bit", newSVuv(bit) );
+  }
+
+  return frame_offset;
+}
+
+static int64_t
+_mac_find_frame(PerlIO *infile, char *file, int offset, HV *info, uint32_t *frame, uint32_t *skip_samples, uint32_t *bit)
+{
+  int64_t frame_offset = -1;
+  uint64_t sample;
+  off_t seek_table;
+  uint32_t entries;
+  uint32_t first_frame, frame_pos, skip_bytes;
+  Buffer buf;
+
+  mac_streaminfo *si;
+  Newz(0, si, sizeof(mac_streaminfo), mac_streaminfo);
+
+  _mac_parse(infile, file, info, si);
+
+  if ( offset < 0 || !si->sample_rate || !si->total_frames || !si->blocks_per_frame ) {
+    goto out;
+  }
+
+  sample        = (uint64_t)offset * si->sample_rate / 1000;
+  *frame        = sample / si->blocks_per_frame;
+  *skip_samples = sample % si->blocks_per_frame;
+
+  if ( *frame >= si->total_frames || (*frame == si->total_frames - 1 && *skip_samples >= si->final_frame) ) {
+    goto out;
+  }
+
+  buffer_init(&buf, APE_HEADER_LEN);
+
+  // Find the seek table
+  if (si->version >= 3980) {
+    seek_table = si->header_offset + si->descriptor_bytes + si->header_bytes;
+    entries    = si->seek_table_bytes / 4;
+  }
+  else {
+    seek_table = si->header_offset + APE_HEADER_LEN;
+    entries    = si->total_frames;
+
+    if (si->flags & MAC_FORMAT_FLAG_HAS_PEAK_LEVEL) {
+      seek_table += 4;
+    }
+
+    if (si->flags & MAC_FORMAT_FLAG_HAS_SEEK_ELEMENTS) {
+      if ( !_mac_get_u32le(infile, &buf, seek_table, &entries) ) {
+        goto done;
+      }
+
+      seek_table += 4;
+    }
+
+    // The original WAV header is stored before the seek table
+    if ( !(si->flags & MAC_FORMAT_FLAG_CREATE_WAV_HEADER) ) {
+      seek_table += si->wav_header_bytes;
+    }
+  }
+
+  DEBUG_TRACE("Seek table @ %" PRIu64 ", %u entries, frame %u\n", (uint64_t)seek_table, entries, *frame);
+
+  if ( *frame >= entries
+    || !_mac_get_u32le(infile, &buf, seek_table, &first_frame)
+    || !_mac_get_u32le(infile, &buf, seek_table + *frame * 4, &frame_pos)
+  ) {
+    goto done;
+  }
+
+  if ( frame_pos < first_frame || si->header_offset + frame_pos >= si->file_size ) {
+    goto done;
+  }
+
+  skip_bytes = (frame_pos - first_frame) & 3;
+  *bit = skip_bytes * 8;
+
+  // Before 3.81 frames don't start on a byte, a table after the seek table has the
+  // bit offset of each frame
+  if (si->version < 3810) {
+    buffer_clear(&buf);
+    PerlIO_seek(infile, seek_table + entries * 4 + *frame, SEEK_SET);
+
+    if ( !_check_buf(infile, &buf, 1, 1) ) {
+      goto done;
+    }
+
+    *bit += buffer_get_char(&buf);
+  }
+
+  frame_offset = si->header_offset + frame_pos - skip_bytes;
+
+done:
+  buffer_free(&buf);
+
+out:
+  Safefree(si);
+
+  return frame_offset;
+}
+
+static int
+_mac_get_u32le(PerlIO *infile, Buffer *buf, off_t offset, uint32_t *value)
+{
+  buffer_clear(buf);
+  PerlIO_seek(infile, offset, SEEK_SET);
+
+  if ( !_check_buf(infile, buf, 4, 4) ) {
+    return 0;
+  }
+
+  *value = buffer_get_int_le(buf);
+
+  return 1;
+}
@@ -19,7 +19,7 @@
 static int
 get_mp4tags(PerlIO *infile, char *file, HV *info, HV *tags)
 {
-  mp4info *mp4 = _mp4_parse(infile, file, info, tags, 0);
+  mp4info *mp4 = _mp4_parse(infile, file, info, tags, 0, 0);
 
   Safefree(mp4);
 
@@ -33,7 +33,7 @@ mp4_find_frame(PerlIO *infile, char *file, int offset)
   HV *info = newHV();
   int frame_offset = -1;
 
-  mp4_find_frame_return_info(infile, file, offset, info);
+  mp4_find_frame_return_info(infile, file, offset, info, NULL);
 
   if ( my_hv_exists(info, "seek_offset") ) {
     frame_offset = SvIV( *(my_hv_fetch(info, "seek_offset") ) );
@@ -46,53 +46,75 @@ mp4_find_frame(PerlIO *infile, char *file, int offset)
 
 // offset is in ms
 // This is based on code from Rockbox
+//
+// Supported options:
+//   scatter    - return the rewritten header as a list of strings and
+//                [ offset, length ] file ranges instead of one scalar
+//   end_offset - end of a clip in ms, the header will only cover the
+//                samples up to this point
+//   adts       - return AAC frames with ADTS headers instead of a header
+//   start_sample - start at this sample instead of the time offset (adts only)
+//   max_frames - maximum number of ADTS frames to return (adts only)
 int
-mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
+mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
 {
   int ret = 1;
+  uint8_t scatter = _opt_iv(opts, "scatter", 0) ? 1 : 0;
+  int end_offset = _opt_iv(opts, "end_offset", -1);
+  uint8_t adts = _opt_iv(opts, "adts", 0) ? 1 : 0;
+  IV start_sample = _opt_iv(opts, "start_sample", -1);
+  uint32_t max_frames = _opt_iv(opts, "max_frames", 0);
+  uint32_t track_id = _opt_iv(opts, "track_id", 0);
   uint32_t samplerate = 0;
   uint32_t sound_sample_loc;
   uint32_t i = 0;
   uint32_t j = 0;
   uint32_t new_sample = 0;
   uint32_t new_sound_sample = 0;
+  uint32_t end_sample;
 
   uint32_t chunk = 1;
-  uint32_t range_samples = 0;
-  uint32_t total_samples = 0;
   uint32_t skipped_samples = 0;
   uint32_t chunk_sample;
-  uint32_t prev_chunk;
-  uint32_t prev_chunk_samples;
+  uint32_t last_chunk;
+  uint32_t last_chunk_sample;
   uint32_t file_offset;
+  uint32_t end_file_offset = 0;
   uint32_t chunk_offset;
 
   uint32_t box_size = 0;
+  uint32_t new_stsz_size;
   Buffer tmp_buf;
   char tmp_size[4];
 
   // We need to read all info first to get some data we need to calculate
   HV *tags = newHV();
-  mp4info *mp4 = _mp4_parse(infile, file, info, tags, 1);
+  mp4info *mp4 = _mp4_parse(infile, file, info, tags, 1, track_id);
 
   // Init seek buffer
   //  Newz(0, &tmp_buf, sizeof(Buffer), Buffer);
   buffer_init(&tmp_buf, MP4_BLOCK_SIZE);
 
-  // Seeking not yet supported for files with multiple tracks
-  if (mp4->track_count > 1) {
+  // Only the sample tables of one audio track are read, other tracks are
+  // left out of the rewritten header
+  if ( !mp4->seek_trak ) {
+    if (track_id) {
+      PerlIO_printf(PerlIO_stderr(), "find_frame: No audio track with ID %d: %s\n", track_id, file);
+    }
     ret = -1;
     goto out;
   }
 
-  if ( !my_hv_exists(info, "samplerate") ) {
+  my_hv_store( info, "seek_track_id", newSVuv(mp4->seek_track) );
+
+  if ( !mp4->seek_timescale ) {
     PerlIO_printf(PerlIO_stderr(), "find_frame: unknown sample rate\n");
     ret = -1;
     goto out;
   }
 
   // Pull out the samplerate
-  samplerate = SvIV( *( my_hv_fetch( info, "samplerate" ) ) );
+  samplerate = mp4->seek_timescale;
 
   // convert offset to sound_sample_loc
   sound_sample_loc = (offset / 10) * (samplerate / 100);
@@ -111,30 +133,11 @@ mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
   }
 
   // Find the destination block from time_to_sample array
-  while ( (i < mp4->num_time_to_samples) &&
-      (new_sound_sample < sound_sample_loc)
-  ) {
-      j = (sound_sample_loc - new_sound_sample) / mp4->time_to_sample[i].sample_duration;
-
-      DEBUG_TRACE(
-        "i = %d / j = %d, sample_count[i]: %d, sample_duration[i]: %d\n",
-        i, j,
-        mp4->time_to_sample[i].sample_count,
-        mp4->time_to_sample[i].sample_duration
-      );
-
-      if (j <= mp4->time_to_sample[i].sample_count) {
-        new_sample += j;
-        new_sound_sample += j * mp4->time_to_sample[i].sample_duration;
-        break;
-      }
-      else {
-        // XXX need test for this bit of code (variable stts)
-        new_sound_sample += (mp4->time_to_sample[i].sample_duration
-            * mp4->time_to_sample[i].sample_count);
-        new_sample += mp4->time_to_sample[i].sample_count;
-        i++;
-      }
+  if (adts && start_sample >= 0) {
+    new_sample = start_sample;
+  }
+  else {
+    new_sample = _mp4_sample_for_time(mp4, sound_sample_loc, &new_sound_sample);
   }
 
   if ( new_sample >= mp4->num_sample_byte_sizes ) {
@@ -145,89 +148,41 @@ mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
 
   DEBUG_TRACE("new_sample: %d, new_sound_sample: %d\n", new_sample, new_sound_sample);
 
-  // Write new stts box
-  {
-    int i;
-    uint32_t total_sample_count = _mp4_total_samples(mp4);
-    uint32_t stts_entries = total_sample_count - new_sample;
-    uint32_t cur_duration = 0;
-    struct tts *stts;
-    int32_t stts_index = -1;
-
-    Newz(0, stts, stts_entries * sizeof(*stts), struct tts);
+  // Find the end of a clip, the first sample starting at or after end_offset
+  end_sample = _mp4_total_samples(mp4);
 
-    for (i = new_sample; i < total_sample_count; i++) {
-      uint32_t duration = _mp4_get_sample_duration(mp4, i);
+  if (end_offset >= 0) {
+    uint32_t end_sound_sample = 0;
+    uint32_t end_sound_sample_loc = (end_offset / 10) * (samplerate / 100);
 
-      if (cur_duration && cur_duration == duration) {
-        // same as previous entry, combine together
-        stts_entries--;
-        stts[stts_index].sample_count++;
-      }
-      else {
-        stts_index++;
-        stts[stts_index].sample_count = 1;
-        stts[stts_index].sample_duration = duration;
-        cur_duration = duration;
-      }
+    j = _mp4_sample_for_time(mp4, end_sound_sample_loc, &end_sound_sample);
+    if (end_sound_sample < end_sound_sample_loc) {
+      j++;
     }
 
-    DEBUG_TRACE("Writing new stts (entries: %d)\n", stts_entries);
-    buffer_put_int(&tmp_buf, stts_entries);
+    if (j < end_sample) {
+      end_sample = j;
+    }
 
-    for (i = 0; i < stts_entries; i++) {
-      DEBUG_TRACE("  sample_count %d, sample_duration %d\n", stts[i].sample_count, stts[i].sample_duration);
-      buffer_put_int(&tmp_buf, stts[i].sample_count);
-      buffer_put_int(&tmp_buf, stts[i].sample_duration);
+    if (end_sample > mp4->num_sample_byte_sizes) {
+      end_sample = mp4->num_sample_byte_sizes;
     }
 
-    mp4->new_stts = newSVpv("", 0);
-    put_u32( tmp_size, buffer_len(&tmp_buf) + 12 );
-    sv_catpvn( mp4->new_stts, tmp_size, 4 );
-    sv_catpvn( mp4->new_stts, "stts", 4 );
-    sv_catpvn( mp4->new_stts, "\0\0\0\0", 4 );
-    sv_catpvn( mp4->new_stts, (char *)buffer_ptr(&tmp_buf), buffer_len(&tmp_buf) );
-    //buffer_dump(&tmp_buf, 0);
-    buffer_clear(&tmp_buf);
+    if (end_sample <= new_sample) {
+      PerlIO_printf(PerlIO_stderr(), "find_frame: End offset out of range (%d <= %d)\n", end_sample, new_sample);
+      ret = -1;
+      goto out;
+    }
 
-    Safefree(stts);
+    DEBUG_TRACE("end_sample: %d\n", end_sample);
   }
 
   // We know the new block, now calculate the file position
 
   /* Locate the chunk containing the sample */
-  prev_chunk         = mp4->sample_to_chunk[0].first_chunk;
-  prev_chunk_samples = mp4->sample_to_chunk[0].samples_per_chunk;
-
-  for (i = 1; i < mp4->num_sample_to_chunks; i++) {
-    chunk = mp4->sample_to_chunk[i].first_chunk;
-    range_samples = (chunk - prev_chunk) * prev_chunk_samples;
-
-    DEBUG_TRACE("prev_chunk: %d, prev_chunk_samples: %d, chunk: %d, range_samples: %d\n",
-      prev_chunk, prev_chunk_samples, chunk, range_samples);
-
-    if (new_sample < total_samples + range_samples)
-      break;
-
-    total_samples += range_samples;
-    prev_chunk = mp4->sample_to_chunk[i].first_chunk;
-    prev_chunk_samples = mp4->sample_to_chunk[i].samples_per_chunk;
-  }
-
-  DEBUG_TRACE("prev_chunk: %d, prev_chunk_samples: %d, total_samples: %d\n", prev_chunk, prev_chunk_samples, total_samples);
-
-  if (new_sample >= mp4->sample_to_chunk[0].samples_per_chunk) {
-    chunk = prev_chunk + (new_sample - total_samples) / prev_chunk_samples;
-  }
-  else {
-    chunk = 1;
-  }
+  chunk = _mp4_chunk_for_sample(mp4, new_sample, &chunk_sample);
 
   DEBUG_TRACE("chunk: %d\n", chunk);
-
-  /* Get sample of the first sample in the chunk */
-  chunk_sample = total_samples + (chunk - prev_chunk) * prev_chunk_samples;
-
   DEBUG_TRACE("chunk_sample: %d\n", chunk_sample);
 
   /* Get offset in file */
@@ -241,6 +196,27 @@ mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
 
   DEBUG_TRACE("file_offset: %d\n", file_offset);
 
+  /* Locate the last chunk of a clip and the end of its last sample */
+  last_chunk = mp4->num_chunk_offsets;
+  last_chunk_sample = 0;
+
+  if (end_offset >= 0) {
+    last_chunk = _mp4_chunk_for_sample(mp4, end_sample - 1, &last_chunk_sample);
+
+    if (last_chunk > mp4->num_chunk_offsets || last_chunk < chunk) {
+      PerlIO_printf(PerlIO_stderr(), "find_frame: end chunk out of range (%d)\n", last_chunk);
+      ret = -1;
+      goto out;
+    }
+
+    end_file_offset = mp4->chunk_offset[last_chunk - 1];
+    for (i = last_chunk_sample; i < end_sample; i++) {
+      end_file_offset += mp4->sample_byte_size[i];
+    }
+
+    DEBUG_TRACE("last_chunk: %d, last_chunk_sample: %d, end_file_offset: %d\n", last_chunk, last_chunk_sample, end_file_offset);
+  }
+
   if (chunk_sample > new_sample) {
     PerlIO_printf(PerlIO_stderr(), "find_frame: sample out of range (%d > %d)\n", chunk_sample, new_sample);
     ret = -1;
@@ -260,22 +236,96 @@ mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
     goto out;
   }
 
+  if (adts) {
+    // Return ADTS frames instead of a rewritten header
+    if ( !_mp4_adts_frames(mp4, new_sample, end_sample, chunk, chunk_sample, file_offset, max_frames) ) {
+      ret = -1;
+      goto out;
+    }
+
+    my_hv_store( info, "seek_offset", newSVuv(file_offset) );
+    my_hv_store( info, "adts_size", newSVuv(mp4->seekparts_size) );
+    my_hv_store( info, "adts_parts", newRV_inc( (SV *)mp4->seekparts ) );
+
+    goto out;
+  }
+
+  // Write new stts box
+  {
+    int i;
+    uint32_t stts_entries = end_sample - new_sample;
+    uint32_t cur_duration = 0;
+    struct tts *stts;
+    int32_t stts_index = -1;
+
+    Newz(0, stts, stts_entries * sizeof(*stts), struct tts);
+
+    for (i = new_sample; i < end_sample; i++) {
+      uint32_t duration = _mp4_get_sample_duration(mp4, i);
+
+      if (end_offset >= 0) {
+        mp4->clip_duration += duration;
+      }
+
+      if (cur_duration && cur_duration == duration) {
+        // same as previous entry, combine together
+        stts_entries--;
+        stts[stts_index].sample_count++;
+      }
+      else {
+        stts_index++;
+        stts[stts_index].sample_count = 1;
+        stts[stts_index].sample_duration = duration;
+        cur_duration = duration;
+      }
+    }
+
+    DEBUG_TRACE("Writing new stts (entries: %d)\n", stts_entries);
+    buffer_put_int(&tmp_buf, stts_entries);
+
+    for (i = 0; i < stts_entries; i++) {
+      DEBUG_TRACE("  sample_count %d, sample_duration %d\n", stts[i].sample_count, stts[i].sample_duration);
+      buffer_put_int(&tmp_buf, stts[i].sample_count);
+      buffer_put_int(&tmp_buf, stts[i].sample_duration);
+    }
+
+    mp4->new_stts = newSVpv("", 0);
+    put_u32( tmp_size, buffer_len(&tmp_buf) + 12 );
+    sv_catpvn( mp4->new_stts, tmp_size, 4 );
+    sv_catpvn( mp4->new_stts, "stts", 4 );
+    sv_catpvn( mp4->new_stts, "\0\0\0\0", 4 );
+    sv_catpvn( mp4->new_stts, (char *)buffer_ptr(&tmp_buf), buffer_len(&tmp_buf) );
+    //buffer_dump(&tmp_buf, 0);
+    buffer_clear(&tmp_buf);
+
+    Safefree(stts);
+  }
+
   // Write new stsc box
   {
     int i;
-    uint32_t stsc_entries = mp4->num_chunk_offsets - chunk + 1;
+    uint32_t stsc_entries = last_chunk - chunk + 1;
     uint32_t cur_samples_per_chunk = 0;
     struct stc *stsc;
     int32_t stsc_index = -1;
     uint32_t chunk_delta = 1;
-    j = 1;
 
     Newz(0, stsc, stsc_entries * sizeof(*stsc), struct stc);
 
-    for (i = chunk; i <= mp4->num_chunk_offsets; i++) {
+    for (i = chunk; i <= last_chunk; i++) {
       // Find the number of samples in chunk i
       uint32_t samples_in_chunk = _mp4_samples_in_chunk(mp4, i);
 
+      // The last chunk of a clip may end before the end of the chunk
+      if (end_offset >= 0 && i == last_chunk) {
+        samples_in_chunk = end_sample - last_chunk_sample;
+      }
+
+      // The first chunk may have less samples in it due to seeking within a chunk
+      if (i == chunk) {
+        samples_in_chunk -= skipped_samples;
+      }
+
       if (cur_samples_per_chunk && cur_samples_per_chunk == samples_in_chunk) {
         // same as previous entry, combine together
         stsc_entries--;
@@ -284,17 +334,8 @@ mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
         stsc_index++;
 
         stsc[stsc_index].first_chunk = chunk_delta;
-
-        if (j == 1) {
-          // The first chunk may have less samples in it due to seeking within a chunk
-          stsc[stsc_index].samples_per_chunk = samples_in_chunk - skipped_samples;
-          cur_samples_per_chunk = samples_in_chunk - skipped_samples;
-          j++;
-        }
-        else {
-          stsc[stsc_index].samples_per_chunk = samples_in_chunk;
-          cur_samples_per_chunk = samples_in_chunk;
-        }
+        stsc[stsc_index].samples_per_chunk = samples_in_chunk;
+        cur_samples_per_chunk = samples_in_chunk;
       }
 
       chunk_delta++;
@@ -323,47 +364,70 @@ mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
     Safefree(stsc);
   }
 
-  // Write new stsz box, num_sample_byte_sizes -= $new_sample, skip $new_sample items
-  buffer_put_int(&tmp_buf, 0);
-  buffer_put_int(&tmp_buf, mp4->num_sample_byte_sizes - new_sample);
-  DEBUG_TRACE("Writing new stsz: %d items\n", mp4->num_sample_byte_sizes - new_sample);
-  j = 1;
-  for (i = new_sample; i < mp4->num_sample_byte_sizes; i++) {
-    DEBUG_TRACE("  sample %d sample_byte_size %d\n", j++, mp4->sample_byte_size[i]);
-    buffer_put_int(&tmp_buf, mp4->sample_byte_size[i]);
+  // New stsz box, num_sample_byte_sizes -= $new_sample, skip $new_sample items
+  // When clipping, num_sample_byte_sizes is reduced to end_sample
+  if (end_sample < mp4->num_sample_byte_sizes) {
+    mp4->num_sample_byte_sizes = end_sample;
   }
 
-  mp4->new_stsz = newSVpv("", 0);
-  put_u32( tmp_size, buffer_len(&tmp_buf) + 12 );
-  sv_catpvn( mp4->new_stsz, tmp_size, 4 );
-  sv_catpvn( mp4->new_stsz, "stsz", 4 );
-  sv_catpvn( mp4->new_stsz, "\0\0\0\0", 4 );
-  sv_catpvn( mp4->new_stsz, (char *)buffer_ptr(&tmp_buf), buffer_len(&tmp_buf) );
-  DEBUG_TRACE("Created new stsz\n");
-  //buffer_dump(&tmp_buf, 0);
-  buffer_clear(&tmp_buf);
+  new_stsz_size = 20 + ( 4 * (mp4->num_sample_byte_sizes - new_sample) );
+
+  // The remaining stsz entries are unchanged, so when returning a scatter list
+  // they are referenced in the original file instead of being copied
+  if (!scatter) {
+    buffer_put_int(&tmp_buf, 0);
+    buffer_put_int(&tmp_buf, mp4->num_sample_byte_sizes - new_sample);
+    DEBUG_TRACE("Writing new stsz: %d items\n", mp4->num_sample_byte_sizes - new_sample);
+    j = 1;
+    for (i = new_sample; i < mp4->num_sample_byte_sizes; i++) {
+      DEBUG_TRACE("  sample %d sample_byte_size %d\n", j++, mp4->sample_byte_size[i]);
+      buffer_put_int(&tmp_buf, mp4->sample_byte_size[i]);
+    }
+
+    mp4->new_stsz = newSVpv("", 0);
+    put_u32( tmp_size, buffer_len(&tmp_buf) + 12 );
+    sv_catpvn( mp4->new_stsz, tmp_size, 4 );
+    sv_catpvn( mp4->new_stsz, "stsz", 4 );
+    sv_catpvn( mp4->new_stsz, "\0\0\0\0", 4 );
+    sv_catpvn( mp4->new_stsz, (char *)buffer_ptr(&tmp_buf), buffer_len(&tmp_buf) );
+    DEBUG_TRACE("Created new stsz\n");
+    //buffer_dump(&tmp_buf, 0);
+    buffer_clear(&tmp_buf);
+  }
+  else {
+    // Only the header of the new stsz is written
+    put_u32( tmp_size, new_stsz_size );
+    mp4->new_stsz = newSVpvn(tmp_size, 4);
+    sv_catpvn( mp4->new_stsz, "stsz", 4 );
+    sv_catpvn( mp4->new_stsz, "\0\0\0\0", 4 );
+    sv_catpvn( mp4->new_stsz, "\0\0\0\0", 4 );
+    put_u32( tmp_size, mp4->num_sample_byte_sizes - new_sample );
+    sv_catpvn( mp4->new_stsz, tmp_size, 4 );
+    mp4->sample_byte_size_offset += 4 * new_sample;
+  }
 
   // Total up size of 4 new st* boxes
   // stco is calculated directly since we can't write it without offsets
   mp4->new_st_size
     = sv_len(mp4->new_stts)
     + sv_len(mp4->new_stsc)
-    + sv_len(mp4->new_stsz)
-    + 12 + ( 4 * (mp4->num_chunk_offsets - chunk + 2) ); // stco size
+    + new_stsz_size
+    + 12 + ( 4 * (last_chunk - chunk + 2) ); // stco size
 
   DEBUG_TRACE("new_st_size: %d, old_st_size: %d\n", mp4->new_st_size, mp4->old_st_size);
 
   // Calculate offset for each chunk
   chunk_offset = SvIV( *( my_hv_fetch(info, "audio_offset") ) );
   chunk_offset -= ( mp4->old_st_size - mp4->new_st_size );
+  chunk_offset -= mp4->dropped_size;
   chunk_offset += 8; // mdat size + fourcc
 
   DEBUG_TRACE("chunk_offset: %d\n", chunk_offset);
 
   // Write new stco box, num_chunk_offsets -= $chunk, skip $chunk items
-  buffer_put_int(&tmp_buf, mp4->num_chunk_offsets - chunk + 1);
-  DEBUG_TRACE("Writing new stco: %d items\n", mp4->num_chunk_offsets - chunk + 1);
-  for (i = chunk - 1; i < mp4->num_chunk_offsets; i++) {
+  buffer_put_int(&tmp_buf, last_chunk - chunk + 1);
+  DEBUG_TRACE("Writing new stco: %d items\n", last_chunk - chunk + 1);
+  for (i = chunk - 1; i < last_chunk; i++) {
     if (i == chunk - 1) {
       // The first chunk offset is the start of mdat (chunk_offset)
       buffer_put_int( &tmp_buf, chunk_offset );
@@ -388,13 +452,22 @@ mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
   DEBUG_TRACE("real st size: %ld\n",
       sv_len(mp4->new_stts)
     + sv_len(mp4->new_stsc)
-    + sv_len(mp4->new_stsz)
+    + new_stsz_size
     + sv_len(mp4->new_stco)
   );
 
+  if (end_offset >= 0) {
+    mp4->clip_size = end_file_offset - file_offset;
+  }
+
   // Make second pass through header, reducing size of all parent boxes by st* size difference
   // Copy all boxes, replacing st* boxes with new ones
-  mp4->seekhdr = newSVpv("", 0);
+  if (scatter) {
+    mp4->seekparts = newAV();
+  }
+  else {
+    mp4->seekhdr = newSVpv("", 0);
+  }
 
   PerlIO_seek(mp4->infile, 0, SEEK_SET);
 
@@ -427,7 +500,18 @@ mp4_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info)
   }
 
   my_hv_store( info, "seek_offset", newSVuv(file_offset) );
-  my_hv_store( info, "seek_header", mp4->seekhdr );
+
+  if (end_offset >= 0) {
+    my_hv_store( info, "seek_length", newSVuv(mp4->clip_size) );
+  }
+
+  if (scatter) {
+    my_hv_store( info, "seek_header_size", newSVuv(mp4->seekparts_size) );
+    my_hv_store( info, "seek_header_parts", newRV_inc( (SV *)mp4->seekparts ) );
+  }
+  else {
+    my_hv_store( info, "seek_header", mp4->seekhdr );
+  }
 
   if (mp4->buf) {
     buffer_free(mp4->buf);
@@ -442,6 +526,7 @@ out:
   if (mp4->new_stsc) SvREFCNT_dec(mp4->new_stsc);
   if (mp4->new_stsz) SvREFCNT_dec(mp4->new_stsz);
   if (mp4->new_stco) SvREFCNT_dec(mp4->new_stco);
+  if (mp4->seekparts) SvREFCNT_dec(mp4->seekparts);
 
   // free seek structs
   if (mp4->time_to_sample) Safefree(mp4->time_to_sample);
@@ -461,1558 +546,2891 @@ out:
   return ret;
 }
 
-mp4info *
-_mp4_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
+// Return the layout of all boxes in the file without parsing them.
+// Only box headers are read, along with the entry counts of sample tables.
+int
+mp4_box_tree(PerlIO *infile, char *file, HV *info)
 {
-  off_t file_size;
-  uint32_t box_size = 0;
+  AV *boxes = newAV();
+  int ret;
+  uint64_t free_size = 0;
+  int i;
 
   mp4info *mp4;
   Newz(0, mp4, sizeof(mp4info), mp4info);
   Newz(0, mp4->buf, sizeof(Buffer), Buffer);
 
-  mp4->audio_offset  = 0;
-  mp4->infile        = infile;
-  mp4->file          = file;
-  mp4->info          = info;
-  mp4->tags          = tags;
-  mp4->current_track = 0;
-  mp4->track_count   = 0;
-  mp4->seen_moov     = 0;
-  mp4->seeking       = seeking ? 1 : 0;
-
-  mp4->time_to_sample   = NULL;
-  mp4->sample_to_chunk  = NULL;
-  mp4->sample_byte_size = NULL;
-  mp4->chunk_offset     = NULL;
+  mp4->infile = infile;
+  mp4->file   = file;
+  mp4->info   = info;
 
   buffer_init(mp4->buf, MP4_BLOCK_SIZE);
 
-  file_size = _file_size(infile);
-  mp4->file_size = file_size;
-
-  my_hv_store( info, "file_size", newSVuv(file_size) );
-
-  // Create empty tracks array
-  my_hv_store( info, "tracks", newRV_noinc( (SV *)newAV() ) );
+  mp4->file_size = _file_size(infile);
+  my_hv_store( info, "file_size", newSVuv(mp4->file_size) );
 
-  while ( (box_size = _mp4_read_box(mp4)) > 0 ) {
-    mp4->audio_offset += box_size;
-    DEBUG_TRACE("read box of size %d / audio_offset %llu\n", box_size, mp4->audio_offset);
+  PerlIO_seek(infile, 0, SEEK_SET);
+  mp4->buf_offset = 0;
 
-    if (mp4->audio_offset >= file_size)
-      break;
-  }
+  ret = _mp4_box_tree_walk(mp4, boxes, 0, mp4->file_size, 0);
 
-  // XXX: if no ftyp was found, assume it is brand 'mp41'
+  // Summarize the layout
+  for (i = 0; i <= av_len(boxes); i++) {
+    HV *box = (HV *)SvRV( *(av_fetch(boxes, i, 0)) );
+    char *type = SvPVX( *(my_hv_fetch(box, "type")) );
+    uint64_t offset = SvUV( *(my_hv_fetch(box, "offset")) );
+    uint64_t size = SvUV( *(my_hv_fetch(box, "header_size")) ) + SvUV( *(my_hv_fetch(box, "payload_size")) );
 
-  // if no bitrate was found (i.e. ALAC), calculate based on file_size/song_length_ms
-  if ( !my_hv_exists(info, "avg_bitrate") ) {
-    SV **entry = my_hv_fetch(info, "song_length_ms");
-    if (entry) {
-      SV **audio_offset = my_hv_fetch(info, "audio_offset");
-      if (audio_offset) {
-        uint32_t song_length_ms = SvIV(*entry);
-        uint32_t bitrate = _bitrate(file_size - SvIV(*audio_offset), song_length_ms);
+    if ( FOURCC_EQ(type, "moov") && !my_hv_exists(info, "moov_offset") ) {
+      my_hv_store( info, "moov_offset", newSVuv(offset) );
+      my_hv_store( info, "moov_size", newSVuv(size) );
 
-        my_hv_store( info, "avg_bitrate", newSVuv(bitrate) );
-        mp4->bitrate = bitrate;
+      if ( my_hv_exists(info, "audio_offset") ) {
+        my_hv_store( info, "leading_mdat", newSVuv(1) );
       }
     }
+    else if ( FOURCC_EQ(type, "mdat") && !my_hv_exists(info, "audio_offset") ) {
+      my_hv_store( info, "audio_offset", newSVuv(offset) );
+      my_hv_store( info, "audio_size", newSVuv(size) );
+    }
+    else if ( FOURCC_EQ(type, "moof") || FOURCC_EQ(type, "mvex") ) {
+      my_hv_store( info, "fragmented", newSVuv(1) );
+    }
+    else if ( FOURCC_EQ(type, "free") || FOURCC_EQ(type, "skip") ) {
+      free_size += size;
+    }
   }
 
-  // DLNA detection, based on code from libdlna
-  if (!mp4->dlna_invalid && mp4->samplerate && mp4->bitrate && mp4->channels) {
-    switch (mp4->audio_object_type) {
-      case AAC_LC:
-      case AAC_LC_ER:
-      {
-        if (mp4->samplerate < 8000 || mp4->samplerate > 48000)
-          break;
+  my_hv_store( info, "free_size", newSVuv(free_size) );
+  my_hv_store( info, "boxes", newRV_noinc( (SV *)boxes ) );
 
-        if (mp4->channels <= 2) {
-          if (mp4->bitrate <= 192000)
-            my_hv_store( info, "dlna_profile", newSVpv("AAC_ISO_192", 0) );
-          else if (mp4->bitrate <= 320000)
-            my_hv_store( info, "dlna_profile", newSVpv("AAC_ISO_320", 0) );
-          else if (mp4->bitrate <= 576000)
-            my_hv_store( info, "dlna_profile", newSVpv("AAC_ISO", 0) );
-        }
-        else if (mp4->channels <= 6) {
-          if (mp4->bitrate <= 1440000)
-            my_hv_store( info, "dlna_profile", newSVpv("AAC_MULT5_ISO", 0) );
-        }
+  buffer_free(mp4->buf);
+  Safefree(mp4->buf);
+  Safefree(mp4);
 
-        break;
-      }
+  return ret;
+}
 
-      case AAC_LTP:
-      case AAC_LTP_ER:
-      {
-        if (mp4->samplerate < 8000)
-          break;
+// Read the boxes between offset and end, descending into containers
+int
+_mp4_box_tree_walk(mp4info *mp4, AV *boxes, uint64_t offset, uint64_t end, uint8_t depth)
+{
+  while (offset + 8 <= end) {
+    HV *box;
+    unsigned char *bptr;
+    uint64_t size;
+    uint8_t hsize = 8;
+    uint32_t real_size = 0; // bytes before the child boxes of a container
+    uint8_t container = 0;
+    char type[5];
 
-        if (mp4->samplerate <= 48000) {
-          if (mp4->channels <= 2 && mp4->bitrate <= 576000)
-            my_hv_store( info, "dlna_profile", newSVpv("AAC_LTP_ISO", 0) );
-        }
-        else if (mp4->samplerate <= 96000) {
-          if (mp4->channels <= 6 && mp4->bitrate <= 2880000)
-            my_hv_store( info, "dlna_profile", newSVpv("AAC_LTP_MULT5_ISO", 0) );
-          else if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
-            my_hv_store( info, "dlna_profile", newSVpv("AAC_LTP_MULT7_ISO", 0) );
-        }
+    if ( !_mp4_box_tree_seek(mp4, offset, 16 < end - offset ? 16 : end - offset) ) {
+      return 0;
+    }
 
-        break;
-      }
+    bptr = (unsigned char *)buffer_ptr(mp4->buf);
+    size = get_u32(bptr);
+    strncpy( type, (char *)bptr + 4, 4 );
+    type[4] = '\0';
 
-      case AAC_HE:
-      {
-        if (mp4->samplerate < 8000)
-          break;
+    if (size == 1) {
+      if (end - offset < 16) {
+        return 0;
+      }
 
-        if (mp4->samplerate <= 24000) {
-          if (mp4->channels > 2)
-            break;
+      size = get_u64(bptr + 8);
+      hsize = 16;
+    }
+    else if (size == 0) {
+      // Box extends to the end of the file
+      size = end - offset;
+    }
 
-          if (mp4->bitrate <= 128000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_L2_ISO_128", 0) );
-          else if (mp4->bitrate <= 320000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_L2_ISO_320", 0) );
-          else if (mp4->bitrate <= 576000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_L2_ISO", 0) );
-        }
-        else if (mp4->samplerate <= 48000) {
-          if (mp4->channels <= 2 && mp4->bitrate <= 576000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_L3_ISO", 0) );
-          else if (mp4->channels <= 6 && mp4->bitrate <= 1440000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_MULT5_ISO", 0) );
-          else if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_MULT7", 0) );
-        }
-        else if (mp4->samplerate <= 96000) {
-          if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_MULT7", 0) );
-        }
+    if (size < hsize) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad %s box size %" PRIu64 " at %" PRIu64 "): %s\n", type, size, offset, mp4->file);
+      return 0;
+    }
 
-        break;
-      }
+    box = newHV();
+    my_hv_store( box, "type", newSVpvn(type, 4) );
+    my_hv_store( box, "offset", newSVuv(offset) );
+    my_hv_store( box, "header_size", newSVuv(hsize) );
+    my_hv_store( box, "payload_size", newSVuv(size - hsize) );
+    my_hv_store( box, "depth", newSVuv(depth) );
+    av_push( boxes, newRV_noinc( (SV *)box ) );
+
+    if (size > end - offset) {
+      // Box is larger than its parent or the file
+      my_hv_store( box, "truncated", newSVuv(1) );
+      size = end - offset;
+    }
 
-      case AAC_PARAM_ER:
-      case AAC_PS:
-      {
-        if (mp4->samplerate < 8000)
-          break;
+    DEBUG_TRACE("%*s%s @ %" PRIu64 " size %" PRIu64 "\n", depth * 2, "", type, offset, size);
 
-        if (mp4->samplerate <= 24000) {
-          if (mp4->channels > 2)
-            break;
+    if (
+         FOURCC_EQ(type, "moov")
+      || FOURCC_EQ(type, "trak")
+      || FOURCC_EQ(type, "edts")
+      || FOURCC_EQ(type, "mdia")
+      || FOURCC_EQ(type, "minf")
+      || FOURCC_EQ(type, "dinf")
+      || FOURCC_EQ(type, "stbl")
+      || FOURCC_EQ(type, "udta")
+      || FOURCC_EQ(type, "ilst")
+      || FOURCC_EQ(type, "mvex")
+      || FOURCC_EQ(type, "moof")
+      || FOURCC_EQ(type, "traf")
+      || FOURCC_EQ(type, "mfra")
+    ) {
+      container = 1;
+    }
+    else if ( FOURCC_EQ(type, "meta") ) {
+      container = 1;
+      real_size = 4;
+    }
+    else if ( FOURCC_EQ(type, "stsd") ) {
+      container = 1;
+      real_size = 8;
+    }
+    else if ( FOURCC_EQ(type, "mp4a") ) {
+      // Sample entry, the esds box follows the audio sample entry fields
+      container = 1;
+      real_size = 28;
+    }
+    else if (
+         FOURCC_EQ(type, "stts")
+      || FOURCC_EQ(type, "stsc")
+      || FOURCC_EQ(type, "stco")
+      || FOURCC_EQ(type, "co64")
+      || FOURCC_EQ(type, "stss")
+      || FOURCC_EQ(type, "ctts")
+      || FOURCC_EQ(type, "stsz")
+    ) {
+      // Sample tables, read the entry count after version/flags
+      uint8_t len = FOURCC_EQ(type, "stsz") ? 12 : 8;
 
-          if (mp4->bitrate <= 128000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L2_128", 0) );
-          else if (mp4->bitrate <= 320000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L2_320", 0) );
-          else if (mp4->bitrate <= 576000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L2", 0) );
+      if ( size - hsize >= len ) {
+        if ( !_mp4_box_tree_seek(mp4, offset + hsize, len) ) {
+          return 0;
         }
-        else if (mp4->samplerate <= 48000) {
-          if (mp4->channels <= 2 && mp4->bitrate <= 576000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L3", 0) );
-          else if (mp4->channels <= 6 && mp4->bitrate <= 1440000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L4", 0) );
-          else if (mp4->channels <= 6 && mp4->bitrate <= 2880000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_MULT5", 0) );
-          else if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_MULT7", 0) );
+
+        bptr = (unsigned char *)buffer_ptr(mp4->buf);
+
+        if ( FOURCC_EQ(type, "stsz") ) {
+          // A non-zero sample size means all samples are the same size
+          my_hv_store( box, "sample_size", newSVuv( get_u32(bptr + 4) ) );
+          my_hv_store( box, "entries", newSVuv( get_u32(bptr + 8) ) );
         }
-        else if (mp4->samplerate <= 96000) {
-          if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
-            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_MULT7", 0) );
+        else {
+          my_hv_store( box, "entries", newSVuv( get_u32(bptr + 4) ) );
         }
-
-        break;
       }
+    }
 
-      case AAC_BSAC_ER:
-      {
-        if (mp4->samplerate < 16000 || mp4->samplerate > 48000)
-          break;
-
-        if (mp4->bitrate > 128000)
-          break;
-
-        if (mp4->channels <= 2)
-          my_hv_store( info, "dlna_profile", newSVpv("BSAC_ISO", 0) );
-        else if (mp4->channels <= 6)
-          my_hv_store( info, "dlna_profile", newSVpv("BSAC_MULT5_ISO", 0) );
-
-        break;
+    if ( container && size - hsize >= real_size ) {
+      if ( !_mp4_box_tree_walk(mp4, boxes, offset + hsize + real_size, offset + size, depth + 1) ) {
+        return 0;
       }
-
-      default:
-        break;
     }
-  }
 
-  buffer_free(mp4->buf);
-  Safefree(mp4->buf);
+    offset += size;
+  }
 
-  return mp4;
+  return 1;
 }
 
+// Make sure len bytes from the given file offset are at the start of the buffer
 int
-_mp4_read_box(mp4info *mp4)
+_mp4_box_tree_seek(mp4info *mp4, uint64_t offset, uint32_t len)
 {
-  uint64_t size;  // total size of box
-  char type[5];
-  uint8_t skip = 0;
-
-  mp4->rsize = 0; // remaining size in box
-
-  if ( !_check_buf(mp4->infile, mp4->buf, 16, MP4_BLOCK_SIZE) ) {
-    return 0;
-  }
-
-  size = buffer_get_int(mp4->buf);
-  strncpy( type, (char *)buffer_ptr(mp4->buf), 4 );
-  type[4] = '\0';
-  buffer_consume(mp4->buf, 4);
-
-  // Check for 64-bit size
-  if (size == 1) {
-    size = buffer_get_int64(mp4->buf);
-    mp4->hsize = 16;
-  }
-  else if (size == 0) {
-    // XXX: size extends to end of file
-    mp4->hsize = 8;
+  if ( offset >= mp4->buf_offset && offset - mp4->buf_offset <= buffer_len(mp4->buf) ) {
+    // Skip forward within the buffer
+    buffer_consume(mp4->buf, offset - mp4->buf_offset);
   }
   else {
-    mp4->hsize = 8;
-  }
+    // Seek past data we don't need, i.e. mdat
+    if ( PerlIO_seek(mp4->infile, offset, SEEK_SET) < 0 ) {
+      return 0;
+    }
 
-  if (size) {
-    mp4->rsize = size - mp4->hsize;
+    buffer_clear(mp4->buf);
   }
 
-  mp4->size = size;
+  mp4->buf_offset = offset;
 
-  DEBUG_TRACE("%s size %llu\n", type, size);
+  return _check_buf(mp4->infile, mp4->buf, len, MP4_BLOCK_SIZE);
+}
+
+// Write tags to the ilst box. The new moov is written over the old one when it fits
+// in the old moov plus any free boxes after it, otherwise the old moov becomes a free
+// box and the new one is written at the end of the file. The mdat box never moves,
+// so chunk offsets in stco/co64 stay valid.
+int
+mp4_write_tags(PerlIO *infile, char *file, HV *tags, HV *opts, HV *result)
+{
+  Buffer buf;
+  Buffer ilst;
+  Buffer out;
+  unsigned char *bptr;
+  off_t file_size = _file_size(infile);
+  uint64_t offset = 0;
+  uint64_t moov_offset = 0;
+  uint64_t moov_size = 0;
+  uint64_t region_end = 0;
+  uint64_t audio_offset = 0;
+  uint64_t zero_offset = 0; // a box running to the end of the file
+  uint64_t new_size;
+  uint64_t region;
+  uint64_t udta_size = 0, meta_size = 0, ilst_size = 0;
+  uint8_t moov_hsize = 8, udta_hsize = 8, meta_hsize = 8, ilst_hsize = 8;
+  int64_t udta = -1, meta = -1, ilst_box = -1;
+  uint64_t span_start, span_end;
+  uint64_t meta_end = 0;
+  uint32_t wrap = 0; // bytes of new udta/meta headers around the ilst box
+  uint32_t padding;
+  uint8_t in_region = 0;
+  uint8_t has_zero = 0;
+  uint8_t fragmented = 0;
+  uint8_t truncated = 0;
+  uint8_t relocate = 0;
+  int ret = -1;
+
+  buffer_init(&buf, MP4_BLOCK_SIZE);
+  buffer_init(&ilst, MP4_BLOCK_SIZE);
+  buffer_init(&out, MP4_BLOCK_SIZE);
+
+  // Find moov and the free space following it among the top-level boxes
+  while (offset + 8 <= file_size) {
+    uint64_t size;
+    uint8_t hsize = 8;
+
+    if ( !_mp4_read_at(infile, offset, &buf, file_size - offset < 16 ? 8 : 16) ) {
+      goto out;
+    }
 
-  if (mp4->seekhdr) {
-    // Copy and adjust header if seeking
-    char tmp_size[4];
+    bptr = buffer_ptr(&buf);
+    size = get_u32(bptr);
 
-    if (
-         FOURCC_EQ(type, "moov")
-      || FOURCC_EQ(type, "trak")
-      || FOURCC_EQ(type, "mdia")
-      || FOURCC_EQ(type, "minf")
-      || FOURCC_EQ(type, "stbl")
-    ) {
-      // Container box, adjust size
-      put_u32(tmp_size, size - (mp4->old_st_size - mp4->new_st_size));
-      DEBUG_TRACE("  Box is parent of st*, changed size to %llu\n", size - (mp4->old_st_size - mp4->new_st_size));
-      sv_catpvn( mp4->seekhdr, tmp_size, 4 );
-      sv_catpvn( mp4->seekhdr, type, 4 );
+    if (size == 1) {
+      if (buffer_len(&buf) < 16) {
+        goto invalid;
+      }
+      size = get_u64(bptr + 8);
+      hsize = 16;
+    }
+    else if (size == 0) {
+      size = file_size - offset;
+      zero_offset = offset;
+      has_zero = 1;
     }
-    // Replace st* boxes with our new versions
-    else if ( FOURCC_EQ(type, "stts") ) {
-      DEBUG_TRACE("adding new stts of size %ld\n", sv_len(mp4->new_stts));
-      sv_catsv( mp4->seekhdr, mp4->new_stts );
+
+    if (size < hsize) {
+      goto invalid;
     }
-    else if ( FOURCC_EQ(type, "stsc") ) {
-      DEBUG_TRACE("adding new stsc of size %ld\n", sv_len(mp4->new_stsc));
-      sv_catsv( mp4->seekhdr, mp4->new_stsc );
+
+    if (size > file_size - offset) {
+      // Truncated box, usually mdat, nothing can be appended after it
+      size = file_size - offset;
+      truncated = 1;
     }
-    else if ( FOURCC_EQ(type, "stsz") ) {
-      DEBUG_TRACE("adding new stsz of size %ld\n", sv_len(mp4->new_stsz));
-      sv_catsv( mp4->seekhdr, mp4->new_stsz );
+
+    if ( !memcmp(bptr + 4, "moov", 4) && !moov_size ) {
+      moov_offset = offset;
+      moov_size   = size;
+      moov_hsize  = hsize;
+      region_end  = offset + size;
+      in_region   = 1;
     }
-    else if ( FOURCC_EQ(type, "stco") ) {
-      DEBUG_TRACE("adding new stco of size %ld\n", sv_len(mp4->new_stco));
-      sv_catsv( mp4->seekhdr, mp4->new_stco );
+    else if ( in_region && (!memcmp(bptr + 4, "free", 4) || !memcmp(bptr + 4, "skip", 4)) ) {
+      region_end = offset + size;
     }
     else {
-      // Normal box, copy it
-      put_u32(tmp_size, size);
-      sv_catpvn( mp4->seekhdr, tmp_size, 4 );
-      sv_catpvn( mp4->seekhdr, type, 4 );
-
-      // stsd is special and contains real bytes and is also a container
-      if ( FOURCC_EQ(type, "stsd") ) {
-        sv_catpvn( mp4->seekhdr, (char *)buffer_ptr(mp4->buf), 8 );
-      }
+      in_region = 0;
 
-      // mp4a is special, ugh
-      else if ( FOURCC_EQ(type, "mp4a") ) {
-        sv_catpvn( mp4->seekhdr, (char *)buffer_ptr(mp4->buf), 28 );
+      if ( !memcmp(bptr + 4, "mdat", 4) && !audio_offset ) {
+        audio_offset = offset;
       }
-
-      // and so is meta
-      else if ( FOURCC_EQ(type, "meta") ) {
-        sv_catpvn( mp4->seekhdr, (char *)buffer_ptr(mp4->buf), mp4->meta_size );
+      else if ( !memcmp(bptr + 4, "moof", 4) ) {
+        fragmented = 1;
       }
+    }
 
-      // Copy contents unless it's a container
-      else if (
-           !FOURCC_EQ(type, "edts")
-        && !FOURCC_EQ(type, "dinf")
-        && !FOURCC_EQ(type, "udta")
-        && !FOURCC_EQ(type, "mdat")
-      ) {
-        if ( !_check_buf(mp4->infile, mp4->buf, size - 8, MP4_BLOCK_SIZE) ) {
-          return 0;
-        }
+    DEBUG_TRACE("Writing tags, %.4s box at %" PRIu64 " size %" PRIu64 "\n", bptr + 4, offset, size);
 
-        // XXX find a way to skip udta completely when rewriting seek header
-        // to avoid useless copying of artwork.  Will require adjusting offsets
-        // differently.
+    offset += size;
+  }
 
-        sv_catpvn( mp4->seekhdr, (char *)buffer_ptr(mp4->buf), size - 8 );
-      }
-    }
+  if (!moov_size || moov_size > 0x7FFFFFFF || (truncated && region_end == file_size)) {
+    goto invalid;
+  }
 
-    // XXX should probably return size here and avoid reading info a second time
-    // or move the header copying code to somewhere else
+  if ( !_mp4_read_at(infile, moov_offset, &buf, moov_size) ) {
+    goto out;
   }
 
-  if ( FOURCC_EQ(type, "ftyp") ) {
-    if ( !_mp4_parse_ftyp(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad ftyp box): %s\n", mp4->file);
-      return 0;
-    }
+  bptr = buffer_ptr(&buf);
+
+  udta = _mp4_find_box(bptr, moov_hsize, moov_size, "udta", &udta_size, &udta_hsize);
+  if (udta >= 0) {
+    meta = _mp4_find_box(bptr, udta + udta_hsize, udta + udta_size, "meta", &meta_size, &meta_hsize);
   }
-  else if (
-       FOURCC_EQ(type, "moov")
-    || FOURCC_EQ(type, "edts")
-    || FOURCC_EQ(type, "mdia")
-    || FOURCC_EQ(type, "minf")
-    || FOURCC_EQ(type, "dinf")
-    || FOURCC_EQ(type, "stbl")
-    || FOURCC_EQ(type, "udta")
-  ) {
-    // These boxes are containers for nested boxes, return only the fact that
-    // we read the header size of the container
-    size = mp4->hsize;
 
-    if ( FOURCC_EQ(type, "trak") ) {
-      mp4->track_count++;
+  if (meta >= 0) {
+    uint64_t children = meta + meta_hsize;
+    meta_end = meta + meta_size;
+
+    // meta is a full box, except in some QuickTime files where hdlr follows the header
+    if ( meta_end - children < 8 || memcmp(bptr + children + 4, "hdlr", 4) ) {
+      children += 4;
     }
+
+    ilst_box = _mp4_find_box(bptr, children, meta_end, "ilst", &ilst_size, &ilst_hsize);
   }
-  else if ( FOURCC_EQ(type, "trak") ) {
-    // Also a container, but we need to increment track_count too
-    size = mp4->hsize;
-    mp4->track_count++;
+
+  // Build the new ilst from the old one and the given tags
+  if ( !_mp4_put_ilst(
+    infile, file_size,
+    ilst_box >= 0 ? bptr + ilst_box + ilst_hsize : NULL,
+    ilst_box >= 0 ? ilst_size - ilst_hsize : 0,
+    tags, &ilst
+  ) ) {
+    goto out;
   }
-  else if ( FOURCC_EQ(type, "mvhd") ) {
-    mp4->seen_moov = 1;
 
-    if ( !_mp4_parse_mvhd(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad mvhd box): %s\n", mp4->file);
-      return 0;
+  // Replace the old ilst and the free boxes after it, or add the missing boxes
+  if (ilst_box >= 0) {
+    span_start = ilst_box;
+    span_end   = ilst_box + ilst_size;
+
+    while (span_end + 8 <= meta_end) {
+      uint64_t size = get_u32(bptr + span_end);
+
+      if ( (memcmp(bptr + span_end + 4, "free", 4) && memcmp(bptr + span_end + 4, "skip", 4))
+        || size < 8 || size > meta_end - span_end
+      ) {
+        break;
+      }
+      span_end += size;
     }
   }
-  else if ( FOURCC_EQ(type, "tkhd") ) {
-    if ( !_mp4_parse_tkhd(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad tkhd box): %s\n", mp4->file);
-      return 0;
-    }
+  else if (meta >= 0) {
+    span_start = span_end = meta_end;
   }
-  else if ( FOURCC_EQ(type, "mdhd") ) {
-    if ( !_mp4_parse_mdhd(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad mdhd box): %s\n", mp4->file);
-      return 0;
-    }
+  else if (udta >= 0) {
+    span_start = span_end = udta + udta_size;
+    wrap = 12 + 33;
   }
-  else if ( FOURCC_EQ(type, "hdlr") ) {
-    if ( !_mp4_parse_hdlr(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad hdlr box): %s\n", mp4->file);
-      return 0;
-    }
+  else {
+    span_start = span_end = moov_size;
+    wrap = 8 + 12 + 33;
   }
-  else if ( FOURCC_EQ(type, "stsd") ) {
-    if ( !_mp4_parse_stsd(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stsd box): %s\n", mp4->file);
-      return 0;
-    }
 
-    // stsd is a special real box + container, count only the real bytes (8)
-    size = 8 + mp4->hsize;
+  new_size = moov_size - (span_end - span_start) + wrap + buffer_len(&ilst);
+  region   = region_end - moov_offset;
+
+  if ( new_size == region || new_size + 8 <= region ) {
+    padding = region - new_size;
   }
-  else if ( FOURCC_EQ(type, "mp4a") ) {
-    if ( !_mp4_parse_mp4a(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad mp4a box): %s\n", mp4->file);
-      return 0;
+  else {
+    // moov can grow in place when nothing follows it, otherwise it moves to the end
+    if (region_end != file_size) {
+      if (fragmented || truncated) {
+        PerlIO_printf(PerlIO_stderr(), "Unable to move the moov box of a %s MP4 file: %s\n", fragmented ? "fragmented" : "truncated", file);
+        goto out;
+      }
+
+      relocate = 1;
     }
 
-    // mp4a is a special real box + container, count only the real bytes (28)
-    size = 28 + mp4->hsize;
+    padding = _opt_iv(opts, "padding", MP4_DEFAULT_PADDING);
+    if ( (padding && padding < 8) || (!relocate && new_size + padding < region) ) {
+      padding = 8;
+    }
+  }
+
+  if (new_size + padding > 0xFFFFFFFF && moov_hsize == 8) {
+    goto invalid;
+  }
+
+  DEBUG_TRACE("New moov size %" PRIu64 ", %d bytes padding, old region %" PRIu64 ", relocate %d\n", new_size, padding, region, relocate);
+
+  // Assemble the new moov
+  buffer_append(&out, bptr, span_start);
+
+  if (wrap == 8 + 12 + 33) {
+    buffer_put_int(&out, wrap + buffer_len(&ilst) + padding);
+    buffer_append(&out, "udta", 4);
+  }
+
+  if (wrap) {
+    buffer_put_int(&out, 12 + 33 + buffer_len(&ilst) + padding);
+    buffer_append(&out, "meta", 4);
+    buffer_put_int(&out, 0);
+
+    // hdlr box used by iTunes
+    buffer_put_int(&out, 33);
+    buffer_append(&out, "hdlr", 4);
+    buffer_put_int(&out, 0);
+    buffer_put_int(&out, 0);
+    buffer_append(&out, "mdirappl", 8);
+    buffer_put_int(&out, 0);
+    buffer_put_int(&out, 0);
+    buffer_put_char(&out, 0);
+  }
+
+  buffer_append(&out, buffer_ptr(&ilst), buffer_len(&ilst));
+
+  if (padding) {
+    buffer_put_int(&out, padding);
+    buffer_append(&out, "free", 4);
+    memset( buffer_append_space(&out, padding - 8), 0, padding - 8 );
+  }
+
+  buffer_append(&out, bptr + span_end, moov_size - span_end);
+
+  // Fix the sizes of the boxes containing the new data
+  bptr = buffer_ptr(&out);
+  _mp4_put_box_size(bptr, moov_hsize, new_size + padding);
+  if (udta >= 0) {
+    _mp4_put_box_size(bptr + udta, udta_hsize, udta_size + new_size + padding - moov_size);
+  }
+  if (meta >= 0) {
+    _mp4_put_box_size(bptr + meta, meta_hsize, meta_size + new_size + padding - moov_size);
+  }
+
+  if (relocate) {
+    unsigned char header[16];
+
+    if (has_zero) {
+      // The last box runs to the end of the file, give it a real size before appending
+      if ( file_size - zero_offset > 0xFFFFFFFF ) {
+        goto invalid;
+      }
+
+      put_u32(header, file_size - zero_offset);
+      if ( PerlIO_seek(infile, zero_offset, SEEK_SET) == -1 || PerlIO_write(infile, header, 4) != 4 ) {
+        goto write_error;
+      }
+    }
+
+    if ( PerlIO_seek(infile, file_size, SEEK_SET) == -1
+      || PerlIO_write(infile, buffer_ptr(&out), buffer_len(&out)) != buffer_len(&out)
+      || PerlIO_flush(infile) != 0
+    ) {
+      goto write_error;
+    }
+
+    // Turn the old moov into a free box
+    if (region > 0xFFFFFFFF) {
+      put_u32(header, 1);
+      memcpy(header + 4, "free", 4);
+      put_u32(header + 8, region >> 32);
+      put_u32(header + 12, region & 0xFFFFFFFF);
+    }
+    else {
+      put_u32(header, region);
+      memcpy(header + 4, "free", 4);
+    }
+
+    if ( PerlIO_seek(infile, moov_offset, SEEK_SET) == -1
+      || PerlIO_write(infile, header, region > 0xFFFFFFFF ? 16 : 8) != (region > 0xFFFFFFFF ? 16 : 8)
+      || PerlIO_flush(infile) != 0
+    ) {
+      goto write_error;
+    }
+  }
+  else {
+    if ( PerlIO_seek(infile, moov_offset, SEEK_SET) == -1
+      || PerlIO_write(infile, buffer_ptr(&out), buffer_len(&out)) != buffer_len(&out)
+      || PerlIO_flush(infile) != 0
+    ) {
+      goto write_error;
+    }
+  }
+
+  my_hv_store( result, "in_place", newSVuv(1) );
+  my_hv_store( result, "moov_relocated", newSVuv(relocate) );
+  my_hv_store( result, "audio_offset", newSVuv(audio_offset) );
+  my_hv_store( result, "padding", newSVuv(padding) );
+  ret = 1;
+  goto out;
+
+invalid:
+  PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file, unable to write tags: %s\n", file);
+  goto out;
+
+write_error:
+  PerlIO_printf(PerlIO_stderr(), "Unable to write tags to MP4 file: %s\n", file);
+
+out:
+  buffer_free(&buf);
+  buffer_free(&ilst);
+  buffer_free(&out);
+
+  return ret;
+}
+
+mp4info *
+_mp4_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking, uint32_t seek_track)
+{
+  off_t file_size;
+  uint32_t box_size = 0;
+
+  mp4info *mp4;
+  Newz(0, mp4, sizeof(mp4info), mp4info);
+  Newz(0, mp4->buf, sizeof(Buffer), Buffer);
+
+  mp4->audio_offset  = 0;
+  mp4->infile        = infile;
+  mp4->file          = file;
+  mp4->info          = info;
+  mp4->tags          = tags;
+  mp4->current_track = 0;
+  mp4->track_count   = 0;
+  mp4->seen_moov     = 0;
+  mp4->seeking       = seeking ? 1 : 0;
+  mp4->seek_track    = seek_track;
+
+  mp4->time_to_sample   = NULL;
+  mp4->sample_to_chunk  = NULL;
+  mp4->sample_byte_size = NULL;
+  mp4->chunk_offset     = NULL;
+
+  buffer_init(mp4->buf, MP4_BLOCK_SIZE);
+
+  file_size = _file_size(infile);
+  mp4->file_size = file_size;
+
+  my_hv_store( info, "file_size", newSVuv(file_size) );
+
+  // Create empty tracks array
+  my_hv_store( info, "tracks", newRV_noinc( (SV *)newAV() ) );
+
+  while ( (box_size = _mp4_read_box(mp4)) > 0 ) {
+    mp4->audio_offset += box_size;
+    DEBUG_TRACE("read box of size %d / audio_offset %llu\n", box_size, mp4->audio_offset);
+
+    if (mp4->audio_offset >= file_size)
+      break;
+  }
+
+  // XXX: if no ftyp was found, assume it is brand 'mp41'
+
+  // if no bitrate was found (i.e. ALAC), calculate based on file_size/song_length_ms
+  if ( !my_hv_exists(info, "avg_bitrate") ) {
+    SV **entry = my_hv_fetch(info, "song_length_ms");
+    if (entry) {
+      SV **audio_offset = my_hv_fetch(info, "audio_offset");
+      if (audio_offset) {
+        uint32_t song_length_ms = SvIV(*entry);
+        uint32_t bitrate = _bitrate(file_size - SvIV(*audio_offset), song_length_ms);
+
+        my_hv_store( info, "avg_bitrate", newSVuv(bitrate) );
+        mp4->bitrate = bitrate;
+      }
+    }
+  }
+
+  // DLNA detection, based on code from libdlna
+  if (!mp4->dlna_invalid && mp4->samplerate && mp4->bitrate && mp4->channels) {
+    switch (mp4->audio_object_type) {
+      case AAC_LC:
+      case AAC_LC_ER:
+      {
+        if (mp4->samplerate < 8000 || mp4->samplerate > 48000)
+          break;
+
+        if (mp4->channels <= 2) {
+          if (mp4->bitrate <= 192000)
+            my_hv_store( info, "dlna_profile", newSVpv("AAC_ISO_192", 0) );
+          else if (mp4->bitrate <= 320000)
+            my_hv_store( info, "dlna_profile", newSVpv("AAC_ISO_320", 0) );
+          else if (mp4->bitrate <= 576000)
+            my_hv_store( info, "dlna_profile", newSVpv("AAC_ISO", 0) );
+        }
+        else if (mp4->channels <= 6) {
+          if (mp4->bitrate <= 1440000)
+            my_hv_store( info, "dlna_profile", newSVpv("AAC_MULT5_ISO", 0) );
+        }
+
+        break;
+      }
+
+      case AAC_LTP:
+      case AAC_LTP_ER:
+      {
+        if (mp4->samplerate < 8000)
+          break;
+
+        if (mp4->samplerate <= 48000) {
+          if (mp4->channels <= 2 && mp4->bitrate <= 576000)
+            my_hv_store( info, "dlna_profile", newSVpv("AAC_LTP_ISO", 0) );
+        }
+        else if (mp4->samplerate <= 96000) {
+          if (mp4->channels <= 6 && mp4->bitrate <= 2880000)
+            my_hv_store( info, "dlna_profile", newSVpv("AAC_LTP_MULT5_ISO", 0) );
+          else if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
+            my_hv_store( info, "dlna_profile", newSVpv("AAC_LTP_MULT7_ISO", 0) );
+        }
+
+        break;
+      }
+
+      case AAC_HE:
+      {
+        if (mp4->samplerate < 8000)
+          break;
+
+        if (mp4->samplerate <= 24000) {
+          if (mp4->channels > 2)
+            break;
+
+          if (mp4->bitrate <= 128000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_L2_ISO_128", 0) );
+          else if (mp4->bitrate <= 320000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_L2_ISO_320", 0) );
+          else if (mp4->bitrate <= 576000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_L2_ISO", 0) );
+        }
+        else if (mp4->samplerate <= 48000) {
+          if (mp4->channels <= 2 && mp4->bitrate <= 576000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_L3_ISO", 0) );
+          else if (mp4->channels <= 6 && mp4->bitrate <= 1440000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_MULT5_ISO", 0) );
+          else if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_MULT7", 0) );
+        }
+        else if (mp4->samplerate <= 96000) {
+          if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAAC_MULT7", 0) );
+        }
+
+        break;
+      }
+
+      case AAC_PARAM_ER:
+      case AAC_PS:
+      {
+        if (mp4->samplerate < 8000)
+          break;
+
+        if (mp4->samplerate <= 24000) {
+          if (mp4->channels > 2)
+            break;
+
+          if (mp4->bitrate <= 128000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L2_128", 0) );
+          else if (mp4->bitrate <= 320000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L2_320", 0) );
+          else if (mp4->bitrate <= 576000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L2", 0) );
+        }
+        else if (mp4->samplerate <= 48000) {
+          if (mp4->channels <= 2 && mp4->bitrate <= 576000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L3", 0) );
+          else if (mp4->channels <= 6 && mp4->bitrate <= 1440000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_L4", 0) );
+          else if (mp4->channels <= 6 && mp4->bitrate <= 2880000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_MULT5", 0) );
+          else if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_MULT7", 0) );
+        }
+        else if (mp4->samplerate <= 96000) {
+          if (mp4->channels <= 8 && mp4->bitrate <= 4032000)
+            my_hv_store( info, "dlna_profile", newSVpv("HEAACv2_MULT7", 0) );
+        }
+
+        break;
+      }
+
+      case AAC_BSAC_ER:
+      {
+        if (mp4->samplerate < 16000 || mp4->samplerate > 48000)
+          break;
+
+        if (mp4->bitrate > 128000)
+          break;
+
+        if (mp4->channels <= 2)
+          my_hv_store( info, "dlna_profile", newSVpv("BSAC_ISO", 0) );
+        else if (mp4->channels <= 6)
+          my_hv_store( info, "dlna_profile", newSVpv("BSAC_MULT5_ISO", 0) );
+
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  buffer_free(mp4->buf);
+  Safefree(mp4->buf);
+
+  return mp4;
+}
+
+int
+_mp4_read_box(mp4info *mp4)
+{
+  uint64_t size;  // total size of box
+  char type[5];
+  uint8_t skip = 0;
+
+  mp4->rsize = 0; // remaining size in box
+
+  if ( !_check_buf(mp4->infile, mp4->buf, 16, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  size = buffer_get_int(mp4->buf);
+  strncpy( type, (char *)buffer_ptr(mp4->buf), 4 );
+  type[4] = '\0';
+  buffer_consume(mp4->buf, 4);
+
+  // Check for 64-bit size
+  if (size == 1) {
+    size = buffer_get_int64(mp4->buf);
+    mp4->hsize = 16;
+  }
+  else if (size == 0) {
+    // XXX: size extends to end of file
+    mp4->hsize = 8;
+  }
+  else {
+    mp4->hsize = 8;
+  }
+
+  if (size) {
+    mp4->rsize = size - mp4->hsize;
+  }
+
+  mp4->size = size;
+
+  DEBUG_TRACE("%s size %llu\n", type, size);
+
+  if (mp4->seekhdr || mp4->seekparts) {
+    // Copy and adjust header if seeking, nothing needs to be parsed again
+    return _mp4_seekhdr_box(mp4, type, size);
+  }
+
+  if ( FOURCC_EQ(type, "ftyp") ) {
+    if ( !_mp4_parse_ftyp(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad ftyp box): %s\n", mp4->file);
+      return 0;
+    }
+  }
+  else if (
+       FOURCC_EQ(type, "moov")
+    || FOURCC_EQ(type, "edts")
+    || FOURCC_EQ(type, "mdia")
+    || FOURCC_EQ(type, "minf")
+    || FOURCC_EQ(type, "dinf")
+    || FOURCC_EQ(type, "stbl")
+    || FOURCC_EQ(type, "udta")
+  ) {
+    // These boxes are containers for nested boxes, return only the fact that
+    // we read the header size of the container
+    size = mp4->hsize;
+
+    if ( FOURCC_EQ(type, "trak") ) {
+      mp4->track_count++;
+    }
+  }
+  else if ( FOURCC_EQ(type, "trak") ) {
+    // Also a container, but we need to increment track_count too
+    mp4->trak_size = size;
+    mp4->dropped_size += size;
+
+    size = mp4->hsize;
+    mp4->track_count++;
+  }
+  else if ( FOURCC_EQ(type, "mvhd") ) {
+    mp4->seen_moov = 1;
+
+    if ( !_mp4_parse_mvhd(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad mvhd box): %s\n", mp4->file);
+      return 0;
+    }
+  }
+  else if ( FOURCC_EQ(type, "tkhd") ) {
+    if ( !_mp4_parse_tkhd(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad tkhd box): %s\n", mp4->file);
+      return 0;
+    }
+  }
+  else if ( FOURCC_EQ(type, "mdhd") ) {
+    if ( !_mp4_parse_mdhd(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad mdhd box): %s\n", mp4->file);
+      return 0;
+    }
+  }
+  else if ( FOURCC_EQ(type, "hdlr") ) {
+    if ( !_mp4_parse_hdlr(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad hdlr box): %s\n", mp4->file);
+      return 0;
+    }
+
+    if ( mp4->seeking && !mp4->seek_trak ) {
+      // Pick the requested track, or the first audio track
+      HV *trackinfo = _mp4_get_current_trackinfo(mp4);
+      SV **handler_type = my_hv_fetch(trackinfo, "handler_type");
+
+      if (
+           handler_type != NULL
+        && FOURCC_EQ(SvPVX(*handler_type), "soun")
+        && ( !mp4->seek_track || mp4->seek_track == mp4->current_track )
+      ) {
+        DEBUG_TRACE("  Seeking in track %d\n", mp4->current_track);
+        mp4->seek_track     = mp4->current_track;
+        mp4->seek_trak      = mp4->track_count;
+        mp4->seek_timescale = mp4->samplerate; // from mdhd
+        mp4->dropped_size  -= mp4->trak_size;
+      }
+    }
+  }
+  else if ( FOURCC_EQ(type, "stsd") ) {
+    if ( !_mp4_parse_stsd(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stsd box): %s\n", mp4->file);
+      return 0;
+    }
+
+    // stsd is a special real box + container, count only the real bytes (8)
+    size = 8 + mp4->hsize;
+  }
+  else if ( FOURCC_EQ(type, "mp4a") ) {
+    if ( !_mp4_parse_mp4a(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad mp4a box): %s\n", mp4->file);
+      return 0;
+    }
+
+    // mp4a is a special real box + container, count only the real bytes (28)
+    size = 28 + mp4->hsize;
+  }
+  else if ( FOURCC_EQ(type, "alac") ) {
+    if ( !_mp4_parse_alac(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad alac box): %s\n", mp4->file);
+      return 0;
+    }
+
+    // skip rest (alac description)
+    mp4->rsize -= 28;
+    skip = 1;
+  }
+  else if ( FOURCC_EQ(type, "drms") ) {
+    // Mark encoding
+    HV *trackinfo = _mp4_get_current_trackinfo(mp4);
+
+    my_hv_store( trackinfo, "encoding", newSVpvn("drms", 4) );
+
+    // Skip rest
+    skip = 1;
+  }
+  else if ( FOURCC_EQ(type, "esds") ) {
+    if ( !_mp4_parse_esds(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad esds box): %s\n", mp4->file);
+      return 0;
+    }
+  }
+  else if ( FOURCC_EQ(type, "stts") ) {
+    if ( _mp4_is_seek_track(mp4) ) {
+      if ( !_mp4_parse_stts(mp4) ) {
+        PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stts box): %s\n", mp4->file);
+        return 0;
+      }
+      mp4->old_st_size += size;
+    }
+    else {
+      skip = 1;
+    }
+  }
+  else if ( FOURCC_EQ(type, "stsc") ) {
+    if ( _mp4_is_seek_track(mp4) ) {
+      if ( !_mp4_parse_stsc(mp4) ) {
+        PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stsc box): %s\n", mp4->file);
+        return 0;
+      }
+      mp4->old_st_size += size;
+    }
+    else {
+      skip = 1;
+    }
+  }
+  else if ( FOURCC_EQ(type, "stsz") ) {
+    if ( _mp4_is_seek_track(mp4) ) {
+      mp4->sample_byte_size_offset = mp4->audio_offset + mp4->hsize + 12;
+
+      if ( !_mp4_parse_stsz(mp4) ) {
+        PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stsz box): %s\n", mp4->file);
+        return 0;
+      }
+      mp4->old_st_size += size;
+    }
+    else {
+      skip = 1;
+    }
+  }
+  else if ( FOURCC_EQ(type, "stco") ) {
+    if ( _mp4_is_seek_track(mp4) ) {
+      if ( !_mp4_parse_stco(mp4) ) {
+        PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stco box): %s\n", mp4->file);
+        return 0;
+      }
+      mp4->old_st_size += size;
+    }
+    else {
+      skip = 1;
+    }
+  }
+  else if ( FOURCC_EQ(type, "meta") ) {
+    uint8_t meta_size = _mp4_parse_meta(mp4);
+    if ( !meta_size ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad meta box): %s\n", mp4->file);
+      return 0;
+    }
+
+    mp4->meta_size = meta_size;
+
+    // meta is a special real box + container, count only the real bytes
+    size = meta_size + mp4->hsize;
+  }
+  else if ( FOURCC_EQ(type, "ilst") ) {
+    if ( !_mp4_parse_ilst(mp4) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad ilst box): %s\n", mp4->file);
+      return 0;
+    }
+  }
+  else if ( FOURCC_EQ(type, "mdat") ) {
+    // Audio data here, there may be boxes after mdat, so we have to skip it
+    skip = 1;
+
+    // If we haven't seen moov yet, set a flag so we can print a warning
+    // or handle it some other way
+    if ( !mp4->seen_moov ) {
+      my_hv_store( mp4->info, "leading_mdat", newSVuv(1) );
+      mp4->dlna_invalid = 1; // DLNA 8.6.34.8, moov must be before mdat
+    }
+
+    // Record audio offset and length
+    my_hv_store( mp4->info, "audio_offset", newSVuv(mp4->audio_offset) );
+    my_hv_store( mp4->info, "audio_size", newSVuv(size) );
+    mp4->audio_size = size;
+  }
+  else {
+    DEBUG_TRACE("  Unhandled box, skipping\n");
+    skip = 1;
+  }
+
+  if (skip) {
+    _mp4_skip(mp4, mp4->rsize);
+  }
+
+  return size;
+}
+
+// Returns true if sample tables of the current track are needed for seeking
+uint8_t
+_mp4_is_seek_track(mp4info *mp4)
+{
+  return mp4->seeking && mp4->seek_trak && mp4->seek_trak == mp4->track_count;
+}
+
+// Copy a box to the rewritten seek header during the second seek pass
+// Returns the number of bytes read, as with _mp4_read_box
+uint32_t
+_mp4_seekhdr_box(mp4info *mp4, char *type, uint64_t size)
+{
+  char tmp_size[4];
+  uint32_t real_size = 0;
+
+  if ( FOURCC_EQ(type, "trak") ) {
+    mp4->track_count++;
+
+    if (mp4->track_count != mp4->seek_trak) {
+      // Leave out all other tracks
+      DEBUG_TRACE("  Dropping trak %d\n", mp4->track_count);
+      _mp4_skip(mp4, mp4->rsize);
+
+      return size;
+    }
+  }
+
+  if ( FOURCC_EQ(type, "moov") ) {
+    put_u32(tmp_size, size - (mp4->old_st_size - mp4->new_st_size) - mp4->dropped_size);
+    _mp4_seekhdr_append(mp4, tmp_size, 4);
+    _mp4_seekhdr_append(mp4, type, 4);
+
+    return mp4->hsize;
+  }
+
+  if (
+       FOURCC_EQ(type, "trak")
+    || FOURCC_EQ(type, "mdia")
+    || FOURCC_EQ(type, "minf")
+    || FOURCC_EQ(type, "stbl")
+  ) {
+    // Container box, adjust size
+    put_u32(tmp_size, size - (mp4->old_st_size - mp4->new_st_size));
+    DEBUG_TRACE("  Box is parent of st*, changed size to %" PRIu64 "\n", size - (mp4->old_st_size - mp4->new_st_size));
+    _mp4_seekhdr_append(mp4, tmp_size, 4);
+    _mp4_seekhdr_append(mp4, type, 4);
+
+    return mp4->hsize;
+  }
+
+  // Replace st* boxes with our new versions
+  if (
+       FOURCC_EQ(type, "stts")
+    || FOURCC_EQ(type, "stsc")
+    || FOURCC_EQ(type, "stsz")
+    || FOURCC_EQ(type, "stco")
+  ) {
+    SV *box = FOURCC_EQ(type, "stts") ? mp4->new_stts
+            : FOURCC_EQ(type, "stsc") ? mp4->new_stsc
+            : FOURCC_EQ(type, "stsz") ? mp4->new_stsz
+            : mp4->new_stco;
+
+    DEBUG_TRACE("adding new %s of size %ld\n", type, sv_len(box));
+    _mp4_seekhdr_append(mp4, SvPVX(box), sv_len(box));
+
+    // When returning a scatter list, new_stsz holds only the box header
+    if ( mp4->seekparts && FOURCC_EQ(type, "stsz") ) {
+      _mp4_seekhdr_append_range(
+        mp4,
+        mp4->sample_byte_size_offset,
+        get_u32(SvPVX(box)) - sv_len(box)
+      );
+    }
+
+    _mp4_skip(mp4, mp4->rsize);
+
+    return size;
+  }
+
+  // A clip needs a correct mdat size and new durations
+  if ( mp4->clip_duration ) {
+    if ( FOURCC_EQ(type, "mdat") ) {
+      put_u32(tmp_size, mp4->clip_size + 8);
+      _mp4_seekhdr_append(mp4, tmp_size, 4);
+      _mp4_seekhdr_append(mp4, type, 4);
+      _mp4_skip(mp4, mp4->rsize);
+
+      return size;
+    }
+    else if (
+         FOURCC_EQ(type, "mvhd")
+      || FOURCC_EQ(type, "tkhd")
+      || FOURCC_EQ(type, "mdhd")
+    ) {
+      return _mp4_seekhdr_duration_box(mp4, type, size);
+    }
+  }
+
+  // Normal box, copy it
+  put_u32(tmp_size, size);
+  _mp4_seekhdr_append(mp4, tmp_size, 4);
+  _mp4_seekhdr_append(mp4, type, 4);
+
+  if (
+       FOURCC_EQ(type, "edts")
+    || FOURCC_EQ(type, "dinf")
+    || FOURCC_EQ(type, "udta")
+  ) {
+    // Container, children are copied as we read them
+    return mp4->hsize;
+  }
+
+  // stsd, mp4a and meta contain some real bytes and are also containers
+  if ( FOURCC_EQ(type, "stsd") ) {
+    real_size = 8;
+  }
+  else if ( FOURCC_EQ(type, "mp4a") ) {
+    real_size = 28;
+  }
+  else if ( FOURCC_EQ(type, "meta") ) {
+    // version/flags + meta version of hdlr
+    if ( !_check_buf(mp4->infile, mp4->buf, 12, MP4_BLOCK_SIZE) ) {
+      return 0;
+    }
+
+    real_size = 4 + get_u32( (unsigned char *)buffer_ptr(mp4->buf) + 4 );
+  }
+
+  if (real_size) {
+    if ( !_check_buf(mp4->infile, mp4->buf, real_size, MP4_BLOCK_SIZE) ) {
+      return 0;
+    }
+
+    _mp4_seekhdr_append(mp4, (char *)buffer_ptr(mp4->buf), real_size);
+    buffer_consume(mp4->buf, real_size);
+
+    return real_size + mp4->hsize;
+  }
+
+  if ( FOURCC_EQ(type, "mdat") ) {
+    // Audio data is not part of the header
+    _mp4_skip(mp4, mp4->rsize);
+
+    return size;
+  }
+
+  // XXX find a way to skip udta completely when rewriting seek header
+  // to avoid useless copying of artwork.  Will require adjusting offsets
+  // differently.
+
+  if (mp4->seekparts) {
+    // Refer to the original bytes instead of copying them
+    _mp4_seekhdr_append_range(mp4, mp4->audio_offset + mp4->hsize, mp4->rsize);
+    _mp4_skip(mp4, mp4->rsize);
+  }
+  else {
+    if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+      return 0;
+    }
+
+    _mp4_seekhdr_append(mp4, (char *)buffer_ptr(mp4->buf), mp4->rsize);
+    buffer_consume(mp4->buf, mp4->rsize);
+  }
+
+  return size;
+}
+
+// Copy a mvhd, tkhd or mdhd box, replacing the duration with the duration of a clip
+uint32_t
+_mp4_seekhdr_duration_box(mp4info *mp4, char *type, uint64_t size)
+{
+  char tmp_size[4];
+  unsigned char *bptr;
+  uint8_t version;
+  uint32_t pos;
+  uint64_t duration = mp4->clip_duration;
+
+  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  bptr = (unsigned char *)buffer_ptr(mp4->buf);
+  version = bptr[0];
+
+  // version/flags, ctime, mtime, timescale or track ID (+ reserved for tkhd)
+  pos = version == 1 ? 24 : 16;
+  if ( FOURCC_EQ(type, "tkhd") ) {
+    pos += 4;
+  }
+
+  if ( mp4->rsize < pos + (version == 1 ? 8 : 4) ) {
+    return 0;
+  }
+
+  if ( !FOURCC_EQ(type, "mdhd") ) {
+    // mvhd and tkhd are in the movie timescale, clip_duration is in the media timescale
+    SV **mv_timescale = my_hv_fetch(mp4->info, "mv_timescale");
+
+    if (mv_timescale != NULL && mp4->seek_timescale) {
+      duration = duration * SvIV(*mv_timescale) / mp4->seek_timescale;
+    }
+  }
+
+  DEBUG_TRACE("  Setting %s duration to %" PRIu64 "\n", type, duration);
+
+  if (version == 1) {
+    put_u32(bptr + pos, duration >> 32);
+    put_u32(bptr + pos + 4, duration & 0xFFFFFFFF);
+  }
+  else {
+    put_u32(bptr + pos, duration);
+  }
+
+  put_u32(tmp_size, size);
+  _mp4_seekhdr_append(mp4, tmp_size, 4);
+  _mp4_seekhdr_append(mp4, type, 4);
+  _mp4_seekhdr_append(mp4, (char *)bptr, mp4->rsize);
+  buffer_consume(mp4->buf, mp4->rsize);
+
+  return size;
+}
+
+// Add bytes to the rewritten seek header
+void
+_mp4_seekhdr_append(mp4info *mp4, const char *data, uint32_t len)
+{
+  if (mp4->seekparts) {
+    SV **last = av_fetch(mp4->seekparts, av_len(mp4->seekparts), 0);
+
+    // Merge with a previous string part
+    if ( last != NULL && !SvROK(*last) ) {
+      sv_catpvn(*last, data, len);
+    }
+    else {
+      av_push( mp4->seekparts, newSVpvn(data, len) );
+    }
+
+    mp4->seekparts_size += len;
+  }
+  else {
+    sv_catpvn(mp4->seekhdr, data, len);
+  }
+}
+
+// Add a range of bytes from the original file to the seek header scatter list
+void
+_mp4_seekhdr_append_range(mp4info *mp4, uint64_t offset, uint64_t len)
+{
+  SV **last = av_fetch(mp4->seekparts, av_len(mp4->seekparts), 0);
+
+  if (!len) {
+    return;
+  }
+
+  mp4->seekparts_size += len;
+
+  // Merge with a previous range if contiguous
+  if ( last != NULL && SvROK(*last) ) {
+    AV *range = (AV *)SvRV(*last);
+    uint64_t prev_offset = SvUV( *(av_fetch(range, 0, 0)) );
+    uint64_t prev_len = SvUV( *(av_fetch(range, 1, 0)) );
+
+    if (prev_offset + prev_len == offset) {
+      av_store( range, 1, newSVuv(prev_len + len) );
+      return;
+    }
   }
-  else if ( FOURCC_EQ(type, "alac") ) {
-    if ( !_mp4_parse_alac(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad alac box): %s\n", mp4->file);
-      return 0;
+
+  {
+    AV *range = newAV();
+    av_push( range, newSVuv(offset) );
+    av_push( range, newSVuv(len) );
+    av_push( mp4->seekparts, newRV_noinc( (SV *)range ) );
+  }
+}
+
+uint8_t
+_mp4_parse_ftyp(mp4info *mp4)
+{
+  AV *compatible_brands = newAV();
+
+  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  my_hv_store( mp4->info, "major_brand", newSVpvn( buffer_ptr(mp4->buf), 4 ) );
+  buffer_consume(mp4->buf, 4);
+
+  my_hv_store( mp4->info, "minor_version", newSVuv( buffer_get_int(mp4->buf) ) );
+
+  mp4->rsize -= 8;
+
+  if (mp4->rsize % 4) {
+    // invalid ftyp
+    return 0;
+  }
+
+  while (mp4->rsize > 0) {
+    av_push( compatible_brands, newSVpvn( buffer_ptr(mp4->buf), 4 ) );
+    buffer_consume(mp4->buf, 4);
+    mp4->rsize -= 4;
+  }
+
+  my_hv_store( mp4->info, "compatible_brands", newRV_noinc( (SV *)compatible_brands ) );
+
+  return 1;
+}
+
+uint8_t
+_mp4_parse_mvhd(mp4info *mp4)
+{
+  uint32_t timescale;
+  uint8_t version;
+
+  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  version = buffer_get_char(mp4->buf);
+  buffer_consume(mp4->buf, 3); // flags
+
+  if (version == 0) { // 32-bit values
+    // Skip ctime and mtime
+    buffer_consume(mp4->buf, 8);
+
+    timescale = buffer_get_int(mp4->buf);
+    my_hv_store( mp4->info, "mv_timescale", newSVuv(timescale) );
+
+    my_hv_store( mp4->info, "song_length_ms", newSVuv( (buffer_get_int(mp4->buf) * 1.0 / timescale ) * 1000 ) );
+  }
+  else if (version == 1) { // 64-bit values
+    // Skip ctime and mtime
+    buffer_consume(mp4->buf, 16);
+
+    timescale = buffer_get_int(mp4->buf);
+    my_hv_store( mp4->info, "mv_timescale", newSVuv(timescale) );
+
+    my_hv_store( mp4->info, "song_length_ms", newSVuv( (buffer_get_int64(mp4->buf) * 1.0 / timescale ) * 1000 ) );
+  }
+  else {
+    return 0;
+  }
+
+  // Skip rest
+  buffer_consume(mp4->buf, 80);
+
+  return 1;
+}
+
+uint8_t
+_mp4_parse_tkhd(mp4info *mp4)
+{
+  AV *tracks = (AV *)SvRV( *(my_hv_fetch(mp4->info, "tracks")) );
+  HV *trackinfo = newHV();
+  uint32_t id;
+  double width;
+  double height;
+  uint8_t version;
+
+  uint32_t timescale = SvIV( *(my_hv_fetch(mp4->info, "mv_timescale")) );
+
+  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  version = buffer_get_char(mp4->buf);
+  buffer_consume(mp4->buf, 3); // flags
+
+  // XXX DLNA Requirement [8.6.34.5]: For the default audio track, "Track_enabled"
+  // must be set to the value of 1 in the "flags" field of Track Header Box of the track.
+
+  if (version == 0) { // 32-bit values
+    // Skip ctime and mtime
+    buffer_consume(mp4->buf, 8);
+
+    id = buffer_get_int(mp4->buf);
+
+    my_hv_store( trackinfo, "id", newSVuv(id) );
+
+    // Skip reserved
+    buffer_consume(mp4->buf, 4);
+
+    my_hv_store( trackinfo, "duration", newSVuv( (buffer_get_int(mp4->buf) * 1.0 / timescale ) * 1000 ) );
+  }
+  else if (version == 1) { // 64-bit values
+    // Skip ctime and mtime
+    buffer_consume(mp4->buf, 16);
+
+    id = buffer_get_int(mp4->buf);
+
+    my_hv_store( trackinfo, "id", newSVuv(id) );
+
+    // Skip reserved
+    buffer_consume(mp4->buf, 4);
+
+    my_hv_store( trackinfo, "duration", newSVuv( (buffer_get_int64(mp4->buf) * 1.0 / timescale ) * 1000 ) );
+  }
+  else {
+    return 0;
+  }
+
+  // Skip reserved, layer, alternate_group, volume, reserved, matrix
+  buffer_consume(mp4->buf, 52);
+
+  // width/height are fixed-point 16.16
+  width = buffer_get_short(mp4->buf);
+  width += buffer_get_short(mp4->buf) / 65536.;
+  if (width > 0) {
+    my_hv_store( trackinfo, "width", newSVnv(width) );
+  }
+
+  height = buffer_get_short(mp4->buf);
+  height += buffer_get_short(mp4->buf) / 65536.;
+  if (height > 0) {
+    my_hv_store( trackinfo, "height", newSVnv(height) );
+  }
+
+  av_push( tracks, newRV_noinc( (SV *)trackinfo ) );
+
+  // Remember the current track we're dealing with
+  mp4->current_track = id;
+
+  return 1;
+}
+
+uint8_t
+_mp4_parse_mdhd(mp4info *mp4)
+{
+  uint32_t timescale;
+  uint8_t version;
+
+  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  version = buffer_get_char(mp4->buf);
+  buffer_consume(mp4->buf, 3); // flags
+
+  if (version == 0) { // 32-bit values
+    // Skip ctime and mtime
+    buffer_consume(mp4->buf, 8);
+
+    timescale = buffer_get_int(mp4->buf);
+    my_hv_store( mp4->info, "samplerate", newSVuv(timescale) );
+
+    // Skip duration, if have song_length_ms from mvhd
+    if ( my_hv_exists( mp4->info, "song_length_ms" ) ) {
+      buffer_consume(mp4->buf, 4);
+    }
+    else {
+      my_hv_store( mp4->info, "song_length_ms", newSVuv( (buffer_get_int(mp4->buf) * 1.0 / timescale ) * 1000 ) );
+    }
+  }
+  else if (version == 1) { // 64-bit values
+    // Skip ctime and mtime
+    buffer_consume(mp4->buf, 16);
+
+    timescale = buffer_get_int(mp4->buf);
+    my_hv_store( mp4->info, "samplerate", newSVuv(timescale) );
+
+    // Skip duration, if have song_length_ms from mvhd
+    if ( my_hv_exists( mp4->info, "song_length_ms" ) ) {
+      buffer_consume(mp4->buf, 8);
+    }
+    else {
+      my_hv_store( mp4->info, "song_length_ms", newSVuv( (buffer_get_int64(mp4->buf) * 1.0 / timescale ) * 1000 ) );
     }
+  }
+  else {
+    return 0;
+  }
+
+  mp4->samplerate = timescale;
+
+  // Skip rest
+  buffer_consume(mp4->buf, 4);
+
+  return 1;
+}
+
+uint8_t
+_mp4_parse_hdlr(mp4info *mp4)
+{
+  HV *trackinfo = _mp4_get_current_trackinfo(mp4);
+  SV *handler_name;
+
+  if (!trackinfo) {
+    return 0;
+  }
+
+  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  // Skip version, flags, pre_defined
+  buffer_consume(mp4->buf, 8);
+
+  my_hv_store( trackinfo, "handler_type", newSVpvn( buffer_ptr(mp4->buf), 4 ) );
+  buffer_consume(mp4->buf, 4);
+
+  // Skip reserved
+  buffer_consume(mp4->buf, 12);
+
+  handler_name = newSVpv( buffer_ptr(mp4->buf), 0 );
+  sv_utf8_decode(handler_name);
+  my_hv_store( trackinfo, "handler_name", handler_name );
+
+  buffer_consume(mp4->buf, mp4->rsize - 24);
+
+  return 1;
+}
+
+uint8_t
+_mp4_parse_stsd(mp4info *mp4)
+{
+  uint32_t entry_count;
+
+  if ( !_check_buf(mp4->infile, mp4->buf, 8, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
+
+  // Skip version/flags
+  buffer_consume(mp4->buf, 4);
 
-    // skip rest (alac description)
-    mp4->rsize -= 28;
-    skip = 1;
+  entry_count = buffer_get_int(mp4->buf);
+
+  return 1;
+}
+
+uint8_t
+_mp4_parse_mp4a(mp4info *mp4)
+{
+  HV *trackinfo = _mp4_get_current_trackinfo(mp4);
+
+  if ( !_check_buf(mp4->infile, mp4->buf, 28, MP4_BLOCK_SIZE) ) {
+    return 0;
   }
-  else if ( FOURCC_EQ(type, "drms") ) {
-    // Mark encoding
-    HV *trackinfo = _mp4_get_current_trackinfo(mp4);
 
-    my_hv_store( trackinfo, "encoding", newSVpvn("drms", 4) );
+  my_hv_store( trackinfo, "encoding", newSVpvn("mp4a", 4) );
 
-    // Skip rest
-    skip = 1;
+  // Skip reserved
+  buffer_consume(mp4->buf, 16);
+
+  mp4->channels = buffer_get_short(mp4->buf);
+  my_hv_store( trackinfo, "channels", newSVuv(mp4->channels) );
+  my_hv_store( trackinfo, "bits_per_sample", newSVuv( buffer_get_short(mp4->buf) ) );
+
+  // Skip reserved
+  buffer_consume(mp4->buf, 4);
+
+  // Skip bogus samplerate
+  buffer_consume(mp4->buf, 2);
+
+  // Skip reserved
+  buffer_consume(mp4->buf, 2);
+
+  return 1;
+}
+
+uint8_t
+_mp4_parse_esds(mp4info *mp4)
+{
+  HV *trackinfo = _mp4_get_current_trackinfo(mp4);
+  uint32_t len = 0;
+  uint32_t avg_bitrate;
+
+  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+    return 0;
   }
-  else if ( FOURCC_EQ(type, "esds") ) {
-    if ( !_mp4_parse_esds(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad esds box): %s\n", mp4->file);
+
+  // Skip version/flags
+  buffer_consume(mp4->buf, 4);
+
+  // Public docs on esds are hard to find, this is based on faad
+  // and http://www.geocities.com/xhelmboyx/quicktime/formats/mp4-layout.txt
+
+  // verify ES_DescrTag
+  if (buffer_get_char(mp4->buf) == 0x03) {
+    // read length
+    if ( _mp4_descr_length(mp4->buf) < 5 + 15 ) {
       return 0;
     }
+
+    // skip 3 bytes
+    buffer_consume(mp4->buf, 3);
   }
-  else if ( FOURCC_EQ(type, "stts") ) {
-    if ( mp4->seeking && mp4->track_count == 1 ) {
-      if ( !_mp4_parse_stts(mp4) ) {
-        PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stts box): %s\n", mp4->file);
-        return 0;
-      }
-      mp4->old_st_size += size;
-    }
-    else {
-      skip = 1;
-    }
+  else {
+    // skip 2 bytes
+    buffer_consume(mp4->buf, 2);
   }
-  else if ( FOURCC_EQ(type, "stsc") ) {
-    if ( mp4->seeking && mp4->track_count == 1 ) {
-      if ( !_mp4_parse_stsc(mp4) ) {
-        PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stsc box): %s\n", mp4->file);
-        return 0;
-      }
-      mp4->old_st_size += size;
-    }
-    else {
-      skip = 1;
-    }
+
+  // verify DecoderConfigDescrTab
+  if (buffer_get_char(mp4->buf) != 0x04) {
+    return 0;
   }
-  else if ( FOURCC_EQ(type, "stsz") ) {
-    if ( mp4->seeking && mp4->track_count == 1 ) {
-      if ( !_mp4_parse_stsz(mp4) ) {
-        PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stsz box): %s\n", mp4->file);
-        return 0;
-      }
-      mp4->old_st_size += size;
-    }
-    else {
-      skip = 1;
-    }
+
+  // read length
+  if ( _mp4_descr_length(mp4->buf) < 13 ) {
+    return 0;
   }
-  else if ( FOURCC_EQ(type, "stco") ) {
-    if ( mp4->seeking && mp4->track_count == 1 ) {
-      if ( !_mp4_parse_stco(mp4) ) {
-        PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad stco box): %s\n", mp4->file);
-        return 0;
-      }
-      mp4->old_st_size += size;
-    }
-    else {
-      skip = 1;
+
+  // XXX: map to string
+  my_hv_store( trackinfo, "audio_type", newSVuv( buffer_get_char(mp4->buf) ) );
+
+  buffer_consume(mp4->buf, 4);
+
+  my_hv_store( trackinfo, "max_bitrate", newSVuv( buffer_get_int(mp4->buf) ) );
+
+  avg_bitrate = buffer_get_int(mp4->buf);
+  if (avg_bitrate) {
+    if ( my_hv_exists(mp4->info, "avg_bitrate") ) {
+      // If there are multiple tracks, just add up the bitrates
+      avg_bitrate += SvIV(*(my_hv_fetch(mp4->info, "avg_bitrate")));
     }
+    my_hv_store( mp4->info, "avg_bitrate", newSVuv(avg_bitrate) );
+    mp4->bitrate = avg_bitrate;
   }
-  else if ( FOURCC_EQ(type, "meta") ) {
-    uint8_t meta_size = _mp4_parse_meta(mp4);
-    if ( !meta_size ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad meta box): %s\n", mp4->file);
-      return 0;
-    }
-
-    mp4->meta_size = meta_size;
 
-    // meta is a special real box + container, count only the real bytes
-    size = meta_size + mp4->hsize;
+  // verify DecSpecificInfoTag
+  if (buffer_get_char(mp4->buf) != 0x05) {
+    return 0;
   }
-  else if ( FOURCC_EQ(type, "ilst") ) {
-    if ( !_mp4_parse_ilst(mp4) ) {
-      PerlIO_printf(PerlIO_stderr(), "Invalid MP4 file (bad ilst box): %s\n", mp4->file);
-      return 0;
+
+  // Read audio object type
+  // 5 bits, if 0x1F, read 6 more bits
+  len = _mp4_descr_length(mp4->buf);
+  if (len > 0) {
+    uint32_t aot;
+
+    len *= 8; // count the number of bits left
+
+    aot = buffer_get_bits(mp4->buf, 5);
+    len -= 5;
+
+    if ( aot == 0x1F ) {
+      aot = 32 + buffer_get_bits(mp4->buf, 6);
+      len -= 6;
     }
-  }
-  else if ( FOURCC_EQ(type, "mdat") ) {
-    // Audio data here, there may be boxes after mdat, so we have to skip it
-    skip = 1;
 
-    // If we haven't seen moov yet, set a flag so we can print a warning
-    // or handle it some other way
-    if ( !mp4->seen_moov ) {
-      my_hv_store( mp4->info, "leading_mdat", newSVuv(1) );
-      mp4->dlna_invalid = 1; // DLNA 8.6.34.8, moov must be before mdat
+    // samplerate: 4 bits
+    //   if 0xF, samplerate is next 24 bits
+    //   else lookup in samplerate table
+    {
+      uint32_t samplerate = buffer_get_bits(mp4->buf, 4);
+      len -= 4;
+
+      if ( !mp4->seeking || _mp4_is_seek_track(mp4) ) {
+        mp4->samplerate_index = samplerate;
+        mp4->core_object_type = aot;
+      }
+
+      if (samplerate == 0xF) { // XXX need test file with 24-bit samplerate field
+        samplerate = buffer_get_bits(mp4->buf, 24);
+        len -= 24;
+      }
+      else {
+        samplerate = samplerate_table[samplerate];
+      }
+
+      // Channel configuration (4 bits)
+      // XXX This is sometimes wrong (1 when it should be 2)
+      mp4->channels = buffer_get_bits(mp4->buf, 4);
+      my_hv_store( trackinfo, "channels", newSVuv(mp4->channels) );
+      len -= 4;
+
+      if ( !mp4->seeking || _mp4_is_seek_track(mp4) ) {
+        mp4->channel_config = mp4->channels;
+      }
+
+      if (aot == AAC_SLS) {
+        // Read some SLS-specific config
+        // bits per sample (3 bits) { 8, 16, 20, 24 }
+        uint8_t bps = buffer_get_bits(mp4->buf, 3);
+        len -= 3;
+
+        my_hv_store( trackinfo, "bits_per_sample", newSVuv( bps_table[bps] ) );
+      }
+      else if (aot == AAC_HE || aot == AAC_PS) {
+        // Read extended samplerate info
+        samplerate = buffer_get_bits(mp4->buf, 4);
+        len -= 4;
+        if (samplerate == 0xF) { // XXX need test file with 24-bit samplerate field
+          samplerate = buffer_get_bits(mp4->buf, 24);
+          len -= 24;
+        }
+        else {
+          samplerate = samplerate_table[samplerate];
+        }
+
+        // Object type of the core decoder follows
+        if (len >= 5) {
+          uint8_t core_object_type = buffer_get_bits(mp4->buf, 5);
+          len -= 5;
+
+          if ( !mp4->seeking || _mp4_is_seek_track(mp4) ) {
+            mp4->core_object_type = core_object_type;
+          }
+        }
+      }
+
+      my_hv_store( trackinfo, "samplerate", newSVuv(samplerate) );
+      mp4->samplerate = samplerate;
     }
 
-    // Record audio offset and length
-    my_hv_store( mp4->info, "audio_offset", newSVuv(mp4->audio_offset) );
-    my_hv_store( mp4->info, "audio_size", newSVuv(size) );
-    mp4->audio_size = size;
+    my_hv_store( trackinfo, "audio_object_type", newSVuv(aot) );
+    mp4->audio_object_type = aot;
+
+    // Skip rest of box
+    buffer_get_bits(mp4->buf, len);
   }
-  else {
-    DEBUG_TRACE("  Unhandled box, skipping\n");
-    skip = 1;
+
+  // verify SL config descriptor type tag
+  if (buffer_get_char(mp4->buf) != 0x06) {
+    return 0;
   }
 
-  if (skip) {
-    _mp4_skip(mp4, mp4->rsize);
+  _mp4_descr_length(mp4->buf);
+
+  // verify SL value
+  if (buffer_get_char(mp4->buf) != 0x02) {
+    return 0;
   }
 
-  return size;
+  return 1;
 }
 
 uint8_t
-_mp4_parse_ftyp(mp4info *mp4)
+_mp4_parse_alac(mp4info *mp4)
 {
-  AV *compatible_brands = newAV();
+  HV *trackinfo = _mp4_get_current_trackinfo(mp4);
 
-  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
+  if ( !_check_buf(mp4->infile, mp4->buf, 28, MP4_BLOCK_SIZE) ) {
     return 0;
   }
 
-  my_hv_store( mp4->info, "major_brand", newSVpvn( buffer_ptr(mp4->buf), 4 ) );
-  buffer_consume(mp4->buf, 4);
+  my_hv_store( trackinfo, "encoding", newSVpvn("alac", 4) );
 
-  my_hv_store( mp4->info, "minor_version", newSVuv( buffer_get_int(mp4->buf) ) );
+  // Skip reserved
+  buffer_consume(mp4->buf, 16);
 
-  mp4->rsize -= 8;
+  mp4->channels = buffer_get_short(mp4->buf);
+  my_hv_store( trackinfo, "channels", newSVuv(mp4->channels) );
+  my_hv_store( trackinfo, "bits_per_sample", newSVuv( buffer_get_short(mp4->buf) ) );
 
-  if (mp4->rsize % 4) {
-    // invalid ftyp
-    return 0;
-  }
+  // Skip reserved
+  buffer_consume(mp4->buf, 4);
 
-  while (mp4->rsize > 0) {
-    av_push( compatible_brands, newSVpvn( buffer_ptr(mp4->buf), 4 ) );
-    buffer_consume(mp4->buf, 4);
-    mp4->rsize -= 4;
-  }
+  // Skip bogus samplerate
+  buffer_consume(mp4->buf, 2);
 
-  my_hv_store( mp4->info, "compatible_brands", newRV_noinc( (SV *)compatible_brands ) );
+  // Skip reserved
+  buffer_consume(mp4->buf, 2);
 
   return 1;
 }
 
 uint8_t
-_mp4_parse_mvhd(mp4info *mp4)
+_mp4_parse_stts(mp4info *mp4)
 {
-  uint32_t timescale;
-  uint8_t version;
+  int i;
 
   if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
     return 0;
   }
 
-  version = buffer_get_char(mp4->buf);
-  buffer_consume(mp4->buf, 3); // flags
+  // Skip version/flags
+  buffer_consume(mp4->buf, 4);
 
-  if (version == 0) { // 32-bit values
-    // Skip ctime and mtime
-    buffer_consume(mp4->buf, 8);
+  mp4->num_time_to_samples = buffer_get_int(mp4->buf);
+  DEBUG_TRACE("  num_time_to_samples %d\n", mp4->num_time_to_samples);
 
-    timescale = buffer_get_int(mp4->buf);
-    my_hv_store( mp4->info, "mv_timescale", newSVuv(timescale) );
+  New(0,
+    mp4->time_to_sample,
+    mp4->num_time_to_samples * sizeof(*mp4->time_to_sample),
+    struct tts
+  );
 
-    my_hv_store( mp4->info, "song_length_ms", newSVuv( (buffer_get_int(mp4->buf) * 1.0 / timescale ) * 1000 ) );
+  if ( !mp4->time_to_sample ) {
+    PerlIO_printf(PerlIO_stderr(), "Unable to parse stts: too large\n");
+    return 0;
   }
-  else if (version == 1) { // 64-bit values
-    // Skip ctime and mtime
-    buffer_consume(mp4->buf, 16);
 
-    timescale = buffer_get_int(mp4->buf);
-    my_hv_store( mp4->info, "mv_timescale", newSVuv(timescale) );
+  for (i = 0; i < mp4->num_time_to_samples; i++) {
+    mp4->time_to_sample[i].sample_count    = buffer_get_int(mp4->buf);
+    mp4->time_to_sample[i].sample_duration = buffer_get_int(mp4->buf);
 
-    my_hv_store( mp4->info, "song_length_ms", newSVuv( (buffer_get_int64(mp4->buf) * 1.0 / timescale ) * 1000 ) );
-  }
-  else {
-    return 0;
+    DEBUG_TRACE(
+      "  sample_count %d sample_duration %d\n",
+      mp4->time_to_sample[i].sample_count,
+      mp4->time_to_sample[i].sample_duration
+    );
   }
 
-  // Skip rest
-  buffer_consume(mp4->buf, 80);
-
   return 1;
 }
 
 uint8_t
-_mp4_parse_tkhd(mp4info *mp4)
+_mp4_parse_stsc(mp4info *mp4)
 {
-  AV *tracks = (AV *)SvRV( *(my_hv_fetch(mp4->info, "tracks")) );
-  HV *trackinfo = newHV();
-  uint32_t id;
-  double width;
-  double height;
-  uint8_t version;
-
-  uint32_t timescale = SvIV( *(my_hv_fetch(mp4->info, "mv_timescale")) );
+  int i;
 
   if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
     return 0;
   }
 
-  version = buffer_get_char(mp4->buf);
-  buffer_consume(mp4->buf, 3); // flags
-
-  // XXX DLNA Requirement [8.6.34.5]: For the default audio track, "Track_enabled"
-  // must be set to the value of 1 in the "flags" field of Track Header Box of the track.
-
-  if (version == 0) { // 32-bit values
-    // Skip ctime and mtime
-    buffer_consume(mp4->buf, 8);
-
-    id = buffer_get_int(mp4->buf);
-
-    my_hv_store( trackinfo, "id", newSVuv(id) );
-
-    // Skip reserved
-    buffer_consume(mp4->buf, 4);
-
-    my_hv_store( trackinfo, "duration", newSVuv( (buffer_get_int(mp4->buf) * 1.0 / timescale ) * 1000 ) );
-  }
-  else if (version == 1) { // 64-bit values
-    // Skip ctime and mtime
-    buffer_consume(mp4->buf, 16);
-
-    id = buffer_get_int(mp4->buf);
+  // Skip version/flags
+  buffer_consume(mp4->buf, 4);
 
-    my_hv_store( trackinfo, "id", newSVuv(id) );
+  mp4->num_sample_to_chunks = buffer_get_int(mp4->buf);
+  DEBUG_TRACE("  num_sample_to_chunks %d\n", mp4->num_sample_to_chunks);
 
-    // Skip reserved
-    buffer_consume(mp4->buf, 4);
+  New(0,
+    mp4->sample_to_chunk,
+    mp4->num_sample_to_chunks * sizeof(*mp4->sample_to_chunk),
+    struct stc
+  );
 
-    my_hv_store( trackinfo, "duration", newSVuv( (buffer_get_int64(mp4->buf) * 1.0 / timescale ) * 1000 ) );
-  }
-  else {
+  if ( !mp4->sample_to_chunk ) {
+    PerlIO_printf(PerlIO_stderr(), "Unable to parse stsc: too large\n");
     return 0;
   }
 
-  // Skip reserved, layer, alternate_group, volume, reserved, matrix
-  buffer_consume(mp4->buf, 52);
+  for (i = 0; i < mp4->num_sample_to_chunks; i++) {
+    mp4->sample_to_chunk[i].first_chunk = buffer_get_int(mp4->buf);
+    mp4->sample_to_chunk[i].samples_per_chunk = buffer_get_int(mp4->buf);
 
-  // width/height are fixed-point 16.16
-  width = buffer_get_short(mp4->buf);
-  width += buffer_get_short(mp4->buf) / 65536.;
-  if (width > 0) {
-    my_hv_store( trackinfo, "width", newSVnv(width) );
-  }
+    // Skip sample desc index
+    buffer_consume(mp4->buf, 4);
 
-  height = buffer_get_short(mp4->buf);
-  height += buffer_get_short(mp4->buf) / 65536.;
-  if (height > 0) {
-    my_hv_store( trackinfo, "height", newSVnv(height) );
+    DEBUG_TRACE("  first_chunk %d samples_per_chunk %d\n",
+      mp4->sample_to_chunk[i].first_chunk,
+      mp4->sample_to_chunk[i].samples_per_chunk
+    );
   }
 
-  av_push( tracks, newRV_noinc( (SV *)trackinfo ) );
-
-  // Remember the current track we're dealing with
-  mp4->current_track = id;
-
   return 1;
 }
 
 uint8_t
-_mp4_parse_mdhd(mp4info *mp4)
+_mp4_parse_stsz(mp4info *mp4)
 {
-  uint32_t timescale;
-  uint8_t version;
+  int i;
 
   if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
     return 0;
   }
 
-  version = buffer_get_char(mp4->buf);
-  buffer_consume(mp4->buf, 3); // flags
+  // Skip version/flags
+  buffer_consume(mp4->buf, 4);
 
-  if (version == 0) { // 32-bit values
-    // Skip ctime and mtime
-    buffer_consume(mp4->buf, 8);
+  // Check sample size is 0
+  if ( buffer_get_int(mp4->buf) != 0 ) {
+    DEBUG_TRACE("  stsz uses fixed sample size\n");
+    buffer_consume(mp4->buf, 4);
+    return 1;
+  }
 
-    timescale = buffer_get_int(mp4->buf);
-    my_hv_store( mp4->info, "samplerate", newSVuv(timescale) );
+  mp4->num_sample_byte_sizes = buffer_get_int(mp4->buf);
 
-    // Skip duration, if have song_length_ms from mvhd
-    if ( my_hv_exists( mp4->info, "song_length_ms" ) ) {
-      buffer_consume(mp4->buf, 4);
-    }
-    else {
-      my_hv_store( mp4->info, "song_length_ms", newSVuv( (buffer_get_int(mp4->buf) * 1.0 / timescale ) * 1000 ) );
-    }
-  }
-  else if (version == 1) { // 64-bit values
-    // Skip ctime and mtime
-    buffer_consume(mp4->buf, 16);
+  DEBUG_TRACE("  num_sample_byte_sizes %d\n", mp4->num_sample_byte_sizes);
 
-    timescale = buffer_get_int(mp4->buf);
-    my_hv_store( mp4->info, "samplerate", newSVuv(timescale) );
+  New(0,
+    mp4->sample_byte_size,
+    mp4->num_sample_byte_sizes * sizeof(*mp4->sample_byte_size),
+    uint16_t
+  );
 
-    // Skip duration, if have song_length_ms from mvhd
-    if ( my_hv_exists( mp4->info, "song_length_ms" ) ) {
-      buffer_consume(mp4->buf, 8);
-    }
-    else {
-      my_hv_store( mp4->info, "song_length_ms", newSVuv( (buffer_get_int64(mp4->buf) * 1.0 / timescale ) * 1000 ) );
-    }
-  }
-  else {
+  if ( !mp4->sample_byte_size ) {
+    PerlIO_printf(PerlIO_stderr(), "Unable to parse stsz: too large\n");
     return 0;
   }
 
-  mp4->samplerate = timescale;
+  for (i = 0; i < mp4->num_sample_byte_sizes; i++) {
+    uint32_t v = buffer_get_int(mp4->buf);
 
-  // Skip rest
-  buffer_consume(mp4->buf, 4);
+    if (v > 0x0000ffff) {
+      DEBUG_TRACE("stsz[%d] > 65 kB (%ld)\n", i, (long)v);
+      return 0;
+    }
+
+    mp4->sample_byte_size[i] = v;
+
+    //DEBUG_TRACE("  sample_byte_size %d\n", v);
+  }
 
   return 1;
 }
 
 uint8_t
-_mp4_parse_hdlr(mp4info *mp4)
+_mp4_parse_stco(mp4info *mp4)
 {
-  HV *trackinfo = _mp4_get_current_trackinfo(mp4);
-  SV *handler_name;
-
-  if (!trackinfo) {
-    return 0;
-  }
+  int i;
 
   if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
     return 0;
   }
 
-  // Skip version, flags, pre_defined
-  buffer_consume(mp4->buf, 8);
-
-  my_hv_store( trackinfo, "handler_type", newSVpvn( buffer_ptr(mp4->buf), 4 ) );
+  // Skip version/flags
   buffer_consume(mp4->buf, 4);
 
-  // Skip reserved
-  buffer_consume(mp4->buf, 12);
-
-  handler_name = newSVpv( buffer_ptr(mp4->buf), 0 );
-  sv_utf8_decode(handler_name);
-  my_hv_store( trackinfo, "handler_name", handler_name );
-
-  buffer_consume(mp4->buf, mp4->rsize - 24);
-
-  return 1;
-}
+  mp4->num_chunk_offsets = buffer_get_int(mp4->buf);
+  DEBUG_TRACE("  num_chunk_offsets %d\n", mp4->num_chunk_offsets);
 
-uint8_t
-_mp4_parse_stsd(mp4info *mp4)
-{
-  uint32_t entry_count;
+  New(0,
+    mp4->chunk_offset,
+    mp4->num_chunk_offsets * sizeof(*mp4->chunk_offset),
+    uint32_t
+  );
 
-  if ( !_check_buf(mp4->infile, mp4->buf, 8, MP4_BLOCK_SIZE) ) {
+  if ( !mp4->chunk_offset ) {
+    PerlIO_printf(PerlIO_stderr(), "Unable to parse stco: too large\n");
     return 0;
   }
 
-  // Skip version/flags
-  buffer_consume(mp4->buf, 4);
+  for (i = 0; i < mp4->num_chunk_offsets; i++) {
+    mp4->chunk_offset[i] = buffer_get_int(mp4->buf);
 
-  entry_count = buffer_get_int(mp4->buf);
+    //DEBUG_TRACE("  chunk_offset %d\n", mp4->chunk_offset[i]);
+  }
 
   return 1;
 }
 
 uint8_t
-_mp4_parse_mp4a(mp4info *mp4)
+_mp4_parse_meta(mp4info *mp4)
 {
-  HV *trackinfo = _mp4_get_current_trackinfo(mp4);
+  uint32_t hdlr_size;
+  char type[5];
 
-  if ( !_check_buf(mp4->infile, mp4->buf, 28, MP4_BLOCK_SIZE) ) {
+  if ( !_check_buf(mp4->infile, mp4->buf, 12, MP4_BLOCK_SIZE) ) {
     return 0;
   }
 
-  my_hv_store( trackinfo, "encoding", newSVpvn("mp4a", 4) );
-
-  // Skip reserved
-  buffer_consume(mp4->buf, 16);
-
-  mp4->channels = buffer_get_short(mp4->buf);
-  my_hv_store( trackinfo, "channels", newSVuv(mp4->channels) );
-  my_hv_store( trackinfo, "bits_per_sample", newSVuv( buffer_get_short(mp4->buf) ) );
+  // Skip version/flags
+  buffer_consume(mp4->buf, 4);
 
-  // Skip reserved
+  // Parse/skip meta version of hdlr
+  hdlr_size = buffer_get_int(mp4->buf);
+  strncpy( type, (char *)buffer_ptr(mp4->buf), 4 );
+  type[4] = '\0';
   buffer_consume(mp4->buf, 4);
 
-  // Skip bogus samplerate
-  buffer_consume(mp4->buf, 2);
+  if ( !FOURCC_EQ(type, "hdlr") ) {
+    return 0;
+  }
 
-  // Skip reserved
-  buffer_consume(mp4->buf, 2);
+  // Skip rest of hdlr
+  if ( !_check_buf(mp4->infile, mp4->buf, hdlr_size - 8, MP4_BLOCK_SIZE) ) {
+    return 0;
+  }
 
-  return 1;
+  buffer_consume(mp4->buf, hdlr_size - 8);
+
+  return 12 + hdlr_size - 8;
 }
 
 uint8_t
-_mp4_parse_esds(mp4info *mp4)
+_mp4_parse_ilst(mp4info *mp4)
 {
-  HV *trackinfo = _mp4_get_current_trackinfo(mp4);
-  uint32_t len = 0;
-  uint32_t avg_bitrate;
+  while (mp4->rsize) {
+    uint32_t size;
+    char key[5];
 
-  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
-    return 0;
-  }
+    if ( !_check_buf(mp4->infile, mp4->buf, 8, MP4_BLOCK_SIZE) ) {
+      return 0;
+    }
 
-  // Skip version/flags
-  buffer_consume(mp4->buf, 4);
+    DEBUG_TRACE("  ilst rsize %llu\n", mp4->rsize);
 
-  // Public docs on esds are hard to find, this is based on faad
-  // and http://www.geocities.com/xhelmboyx/quicktime/formats/mp4-layout.txt
+    // Read Apple annotation box
+    size = buffer_get_int(mp4->buf);
+    strncpy( key, (char *)buffer_ptr(mp4->buf), 4 );
+    key[4] = '\0';
+    buffer_consume(mp4->buf, 4);
 
-  // verify ES_DescrTag
-  if (buffer_get_char(mp4->buf) == 0x03) {
-    // read length
-    if ( _mp4_descr_length(mp4->buf) < 5 + 15 ) {
-      return 0;
+    DEBUG_TRACE("  %s size %d\n", key, size);
+
+    // Note: extra _check_buf calls in this function and other ilst functions
+    // are to avoid reading in the full size of ilst in the case of large artwork
+
+    upcase(key);
+
+    if ( FOURCC_EQ(key, "----") ) {
+      // user-specified key/value pair
+      if ( !_mp4_parse_ilst_custom(mp4, size - 8) ) {
+        return 0;
+      }
     }
+    else {
+      uint32_t bsize;
 
-    // skip 3 bytes
-    buffer_consume(mp4->buf, 3);
-  }
-  else {
-    // skip 2 bytes
-    buffer_consume(mp4->buf, 2);
-  }
+      // Ensure we have 8 bytes
+      if ( !_check_buf(mp4->infile, mp4->buf, 8, MP4_BLOCK_SIZE) ) {
+        return 0;
+      }
 
-  // verify DecoderConfigDescrTab
-  if (buffer_get_char(mp4->buf) != 0x04) {
-    return 0;
-  }
+      // Verify data box
+      bsize = buffer_get_int(mp4->buf);
 
-  // read length
-  if ( _mp4_descr_length(mp4->buf) < 13 ) {
-    return 0;
-  }
+      DEBUG_TRACE("    box size %d\n", bsize);
 
-  // XXX: map to string
-  my_hv_store( trackinfo, "audio_type", newSVuv( buffer_get_char(mp4->buf) ) );
+      // Sanity check for bad data size
+      if ( bsize <= size - 8 ) {
+        SV *skey;
 
-  buffer_consume(mp4->buf, 4);
+        char *bptr = buffer_ptr(mp4->buf);
+        if ( !FOURCC_EQ(bptr, "data") ) {
+          return 0;
+        }
 
-  my_hv_store( trackinfo, "max_bitrate", newSVuv( buffer_get_int(mp4->buf) ) );
+        buffer_consume(mp4->buf, 4);
 
-  avg_bitrate = buffer_get_int(mp4->buf);
-  if (avg_bitrate) {
-    if ( my_hv_exists(mp4->info, "avg_bitrate") ) {
-      // If there are multiple tracks, just add up the bitrates
-      avg_bitrate += SvIV(*(my_hv_fetch(mp4->info, "avg_bitrate")));
+        skey = newSVpv(key, 0);
+
+        if ( !_mp4_parse_ilst_data(mp4, bsize - 8, skey) ) {
+          SvREFCNT_dec(skey);
+          return 0;
+        }
+
+        SvREFCNT_dec(skey);
+
+        // XXX: bug 14476, files with multiple COVR images aren't handled here, just skipped for now
+        if ( bsize < size - 8 ) {
+          DEBUG_TRACE("    skipping rest of box, %d\n", size - 8 - bsize );
+          _mp4_skip(mp4, size - 8 - bsize);
+        }
+      }
+      else {
+        DEBUG_TRACE("    invalid data size %d, skipping value\n", bsize);
+        _mp4_skip(mp4, size - 12);
+      }
     }
-    my_hv_store( mp4->info, "avg_bitrate", newSVuv(avg_bitrate) );
-    mp4->bitrate = avg_bitrate;
-  }
 
-  // verify DecSpecificInfoTag
-  if (buffer_get_char(mp4->buf) != 0x05) {
-    return 0;
+    mp4->rsize -= size;
   }
 
-  // Read audio object type
-  // 5 bits, if 0x1F, read 6 more bits
-  len = _mp4_descr_length(mp4->buf);
-  if (len > 0) {
-    uint32_t aot;
+  return 1;
+}
 
-    len *= 8; // count the number of bits left
+uint8_t
+_mp4_parse_ilst_data(mp4info *mp4, uint32_t size, SV *key)
+{
+  uint32_t flags;
+  unsigned char *ckey;
+  SV *value;
 
-    aot = buffer_get_bits(mp4->buf, 5);
-    len -= 5;
+  ckey = (unsigned char *)SvPVX(key);
+  if ( FOURCC_EQ(ckey, "COVR") && _env_true("AUDIO_SCAN_NO_ARTWORK") ) {
+    // Skip artwork if requested and avoid the memory cost
+    value = newSVuv(size - 8);
 
-    if ( aot == 0x1F ) {
-      aot = 32 + buffer_get_bits(mp4->buf, 6);
-      len -= 6;
+    my_hv_store( mp4->tags, "COVR_offset", newSVuv(mp4->audio_offset + (mp4->size - mp4->rsize) + 24) );
+
+    _mp4_skip(mp4, size);
+  }
+  else {
+    // Read the full ilst value
+    if ( !_check_buf(mp4->infile, mp4->buf, size, MP4_BLOCK_SIZE) ) {
+      return 0;
     }
 
-    // samplerate: 4 bits
-    //   if 0xF, samplerate is next 24 bits
-    //   else lookup in samplerate table
-    {
-      uint32_t samplerate = buffer_get_bits(mp4->buf, 4);
-      len -= 4;
+    // Version(0) + Flags
+    flags = buffer_get_int(mp4->buf);
 
-      if (samplerate == 0xF) { // XXX need test file with 24-bit samplerate field
-        samplerate = buffer_get_bits(mp4->buf, 24);
-        len -= 24;
-      }
-      else {
-        samplerate = samplerate_table[samplerate];
-      }
+    // Skip reserved
+    buffer_consume(mp4->buf, 4);
 
-      // Channel configuration (4 bits)
-      // XXX This is sometimes wrong (1 when it should be 2)
-      mp4->channels = buffer_get_bits(mp4->buf, 4);
-      my_hv_store( trackinfo, "channels", newSVuv(mp4->channels) );
-      len -= 4;
+    DEBUG_TRACE("      flags %d\n", flags);
 
-      if (aot == AAC_SLS) {
-        // Read some SLS-specific config
-        // bits per sample (3 bits) { 8, 16, 20, 24 }
-        uint8_t bps = buffer_get_bits(mp4->buf, 3);
-        len -= 3;
+    if ( !flags || flags == 21 ) {
+      if ( FOURCC_EQ( SvPVX(key), "TRKN" ) || FOURCC_EQ( SvPVX(key), "DISK" ) ) {
+        // Special case trkn, disk (pair of 16-bit ints)
+        uint16_t num = 0;
+        uint16_t total = 0;
 
-        my_hv_store( trackinfo, "bits_per_sample", newSVuv( bps_table[bps] ) );
+        buffer_consume(mp4->buf, 2); // padding
+
+        num = buffer_get_short(mp4->buf);
+
+        // Total may not always be present
+        if (size > 12) {
+          total = buffer_get_short(mp4->buf);
+          buffer_consume(mp4->buf, size - 14); // optional padding
+        }
+
+        DEBUG_TRACE("      %d/%d\n", num, total);
+
+        if (total) {
+          my_hv_store_ent( mp4->tags, key, newSVpvf( "%d/%d", num, total ) );
+        }
+        else if (num) {
+          my_hv_store_ent( mp4->tags, key, newSVuv(num) );
+        }
+
+        return 1;
       }
-      else if (aot == AAC_HE || aot == AAC_PS) {
-        // Read extended samplerate info
-        samplerate = buffer_get_bits(mp4->buf, 4);
-        len -= 4;
-        if (samplerate == 0xF) { // XXX need test file with 24-bit samplerate field
-          samplerate = buffer_get_bits(mp4->buf, 24);
-          len -= 24;
+      else if ( FOURCC_EQ( SvPVX(key), "GNRE" ) ) {
+        // Special case genre, 16-bit int as id3 genre code
+        char const *genre_string;
+        uint16_t genre_num = buffer_get_short(mp4->buf);
+
+        if (genre_num > 0 && genre_num < NGENRES + 1) {
+          genre_string = _id3_genre_index(genre_num - 1);
+          my_hv_store_ent( mp4->tags, key, newSVpv( genre_string, 0 ) );
+        }
+
+        return 1;
+      }
+      else {
+        // Other binary type, try to guess type based on size
+        uint32_t dsize = size - 8;
+
+        if (dsize == 1) {
+          value = newSVuv( buffer_get_char(mp4->buf) );
+        }
+        else if (dsize == 2) {
+          value = newSVuv( buffer_get_short(mp4->buf) );
+        }
+        else if (dsize == 4) {
+          value = newSVuv( buffer_get_int(mp4->buf) );
+        }
+        else if (dsize == 8) {
+          value = newSVuv( buffer_get_int64(mp4->buf) );
         }
         else {
-          samplerate = samplerate_table[samplerate];
+          value = newSVpvn( buffer_ptr(mp4->buf), dsize );
+          buffer_consume(mp4->buf, dsize);
         }
       }
-
-      my_hv_store( trackinfo, "samplerate", newSVuv(samplerate) );
-      mp4->samplerate = samplerate;
     }
+    else { // text data
+      value = newSVpvn( buffer_ptr(mp4->buf), size - 8 );
+      sv_utf8_decode(value);
 
-    my_hv_store( trackinfo, "audio_object_type", newSVuv(aot) );
-    mp4->audio_object_type = aot;
+      // strip copyright symbol 0xA9 out of key
+      if ( ckey[0] == 0xA9 ) {
+        ckey++;
+      }
 
-    // Skip rest of box
-    buffer_get_bits(mp4->buf, len);
-  }
+      DEBUG_TRACE("      %s = %s\n", ckey, SvPVX(value));
 
-  // verify SL config descriptor type tag
-  if (buffer_get_char(mp4->buf) != 0x06) {
-    return 0;
+      buffer_consume(mp4->buf, size - 8);
+    }
   }
 
-  _mp4_descr_length(mp4->buf);
-
-  // verify SL value
-  if (buffer_get_char(mp4->buf) != 0x02) {
-    return 0;
+  // if key exists, create array
+  if ( my_hv_exists( mp4->tags, (char *)ckey ) ) {
+    SV **entry = my_hv_fetch( mp4->tags, (char *)ckey );
+    if (entry != NULL) {
+      if ( SvROK(*entry) && SvTYPE(SvRV(*entry)) == SVt_PVAV ) {
+        av_push( (AV *)SvRV(*entry), value );
+      }
+      else {
+        // A non-array entry, convert to array.
+        AV *ref = newAV();
+        av_push( ref, newSVsv(*entry) );
+        av_push( ref, value );
+        my_hv_store( mp4->tags, (char *)ckey, newRV_noinc( (SV*)ref ) );
+      }
+    }
+  }
+  else {
+    my_hv_store( mp4->tags, (char *)ckey, value );
   }
 
   return 1;
 }
 
 uint8_t
-_mp4_parse_alac(mp4info *mp4)
+_mp4_parse_ilst_custom(mp4info *mp4, uint32_t size)
 {
-  HV *trackinfo = _mp4_get_current_trackinfo(mp4);
-
-  if ( !_check_buf(mp4->infile, mp4->buf, 28, MP4_BLOCK_SIZE) ) {
-    return 0;
-  }
-
-  my_hv_store( trackinfo, "encoding", newSVpvn("alac", 4) );
-
-  // Skip reserved
-  buffer_consume(mp4->buf, 16);
-
-  mp4->channels = buffer_get_short(mp4->buf);
-  my_hv_store( trackinfo, "channels", newSVuv(mp4->channels) );
-  my_hv_store( trackinfo, "bits_per_sample", newSVuv( buffer_get_short(mp4->buf) ) );
+  SV *key = NULL;
 
-  // Skip reserved
-  buffer_consume(mp4->buf, 4);
+  while (size) {
+    char type[5];
+    uint32_t bsize;
 
-  // Skip bogus samplerate
-  buffer_consume(mp4->buf, 2);
+    // Ensure we have 8 bytes to get the size and type
+    if ( !_check_buf(mp4->infile, mp4->buf, 8, MP4_BLOCK_SIZE) ) {
+      return 0;
+    }
 
-  // Skip reserved
-  buffer_consume(mp4->buf, 2);
+    // Read box
+    bsize = buffer_get_int(mp4->buf);
+    strncpy( type, (char *)buffer_ptr(mp4->buf), 4 );
+    type[4] = '\0';
+    buffer_consume(mp4->buf, 4);
 
-  return 1;
-}
+    DEBUG_TRACE("    %s size %d\n", type, bsize);
 
-uint8_t
-_mp4_parse_stts(mp4info *mp4)
-{
-  int i;
+    if ( FOURCC_EQ(type, "name") ) {
+      // Ensure we have bsize bytes
+      if ( !_check_buf(mp4->infile, mp4->buf, bsize, MP4_BLOCK_SIZE) ) {
+        return 0;
+      }
 
-  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
-    return 0;
-  }
+      buffer_consume(mp4->buf, 4); // padding
+      key = newSVpvn( buffer_ptr(mp4->buf), bsize - 12);
+      sv_utf8_decode(key);
+      upcase(SvPVX(key));
+      buffer_consume(mp4->buf, bsize - 12);
 
-  // Skip version/flags
-  buffer_consume(mp4->buf, 4);
+      DEBUG_TRACE("      %s\n", SvPVX(key));
+    }
+    else if ( FOURCC_EQ(type, "data") ) {
+      if (!key) {
+        // No key yet, data is out of order
+        return 0;
+      }
 
-  mp4->num_time_to_samples = buffer_get_int(mp4->buf);
-  DEBUG_TRACE("  num_time_to_samples %d\n", mp4->num_time_to_samples);
+      if ( !_mp4_parse_ilst_data(mp4, bsize - 8, key) ) {
+        SvREFCNT_dec(key);
+        return 0;
+      }
+    }
+    else {
+      // skip (mean, or other boxes)
+      if ( !_check_buf(mp4->infile, mp4->buf, bsize - 8, MP4_BLOCK_SIZE) ) {
+        return 0;
+      }
 
-  New(0,
-    mp4->time_to_sample,
-    mp4->num_time_to_samples * sizeof(*mp4->time_to_sample),
-    struct tts
-  );
+      buffer_consume(mp4->buf, bsize - 8);
+    }
 
-  if ( !mp4->time_to_sample ) {
-    PerlIO_printf(PerlIO_stderr(), "Unable to parse stts: too large\n");
-    return 0;
+    size -= bsize;
   }
 
-  for (i = 0; i < mp4->num_time_to_samples; i++) {
-    mp4->time_to_sample[i].sample_count    = buffer_get_int(mp4->buf);
-    mp4->time_to_sample[i].sample_duration = buffer_get_int(mp4->buf);
-
-    DEBUG_TRACE(
-      "  sample_count %d sample_duration %d\n",
-      mp4->time_to_sample[i].sample_count,
-      mp4->time_to_sample[i].sample_duration
-    );
-  }
+  SvREFCNT_dec(key);
 
   return 1;
 }
 
-uint8_t
-_mp4_parse_stsc(mp4info *mp4)
+HV *
+_mp4_get_current_trackinfo(mp4info *mp4)
 {
+  // Return the trackinfo hash for track id == mp4->current_track
+  AV *tracks;
+  HV *trackinfo;
   int i;
 
-  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
-    return 0;
+  SV **entry = my_hv_fetch(mp4->info, "tracks");
+  if (entry != NULL) {
+    tracks = (AV *)SvRV(*entry);
   }
-
-  // Skip version/flags
-  buffer_consume(mp4->buf, 4);
-
-  mp4->num_sample_to_chunks = buffer_get_int(mp4->buf);
-  DEBUG_TRACE("  num_sample_to_chunks %d\n", mp4->num_sample_to_chunks);
-
-  New(0,
-    mp4->sample_to_chunk,
-    mp4->num_sample_to_chunks * sizeof(*mp4->sample_to_chunk),
-    struct stc
-  );
-
-  if ( !mp4->sample_to_chunk ) {
-    PerlIO_printf(PerlIO_stderr(), "Unable to parse stsc: too large\n");
-    return 0;
+  else {
+    return NULL;
   }
 
-  for (i = 0; i < mp4->num_sample_to_chunks; i++) {
-    mp4->sample_to_chunk[i].first_chunk = buffer_get_int(mp4->buf);
-    mp4->sample_to_chunk[i].samples_per_chunk = buffer_get_int(mp4->buf);
-
-    // Skip sample desc index
-    buffer_consume(mp4->buf, 4);
+  // Find entry for this stream number
+  for (i = 0; av_len(tracks) >= 0 && i <= av_len(tracks); i++) {
+    SV **info = av_fetch(tracks, i, 0);
+    if (info != NULL) {
+      SV **tid;
 
-    DEBUG_TRACE("  first_chunk %d samples_per_chunk %d\n",
-      mp4->sample_to_chunk[i].first_chunk,
-      mp4->sample_to_chunk[i].samples_per_chunk
-    );
+      trackinfo = (HV *)SvRV(*info);
+      tid = my_hv_fetch( trackinfo, "id" );
+      if (tid != NULL) {
+        if ( SvIV(*tid) == mp4->current_track ) {
+          return trackinfo;
+        }
+      }
+    }
   }
 
-  return 1;
+  return NULL;
 }
 
-uint8_t
-_mp4_parse_stsz(mp4info *mp4)
+uint32_t
+_mp4_descr_length(Buffer *buf)
 {
-  int i;
-
-  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
-    return 0;
-  }
-
-  // Skip version/flags
-  buffer_consume(mp4->buf, 4);
+  uint8_t b;
+  uint8_t num_bytes = 0;
+  uint32_t length = 0;
 
-  // Check sample size is 0
-  if ( buffer_get_int(mp4->buf) != 0 ) {
-    DEBUG_TRACE("  stsz uses fixed sample size\n");
-    buffer_consume(mp4->buf, 4);
-    return 1;
-  }
+  do {
+    b = buffer_get_char(buf);
+    num_bytes++;
+    length = (length << 7) | (b & 0x7f);
+  } while ( (b & 0x80) && num_bytes < 4 );
 
-  mp4->num_sample_byte_sizes = buffer_get_int(mp4->buf);
+  return length;
+}
 
-  DEBUG_TRACE("  num_sample_byte_sizes %d\n", mp4->num_sample_byte_sizes);
+void
+_mp4_skip(mp4info *mp4, uint32_t size)
+{
+  if ( buffer_len(mp4->buf) >= size ) {
+    //buffer_dump(mp4->buf, size);
+    buffer_consume(mp4->buf, size);
 
-  New(0,
-    mp4->sample_byte_size,
-    mp4->num_sample_byte_sizes * sizeof(*mp4->sample_byte_size),
-    uint16_t
-  );
+    DEBUG_TRACE("  skipped buffer data size %d\n", size);
+  }
+  else {
+    PerlIO_seek(mp4->infile, size - buffer_len(mp4->buf), SEEK_CUR);
+    buffer_clear(mp4->buf);
 
-  if ( !mp4->sample_byte_size ) {
-    PerlIO_printf(PerlIO_stderr(), "Unable to parse stsz: too large\n");
-    return 0;
+    DEBUG_TRACE("  seeked past %d bytes to %d\n", size, (int)PerlIO_tell(mp4->infile));
   }
+}
 
-  for (i = 0; i < mp4->num_sample_byte_sizes; i++) {
-    uint32_t v = buffer_get_int(mp4->buf);
+uint32_t
+_mp4_samples_in_chunk(mp4info *mp4, uint32_t chunk)
+{
+  int i;
 
-    if (v > 0x0000ffff) {
-      DEBUG_TRACE("stsz[%d] > 65 kB (%ld)\n", i, (long)v);
-      return 0;
+  for (i = mp4->num_sample_to_chunks - 1; i >= 0; i--) {
+    if (mp4->sample_to_chunk[i].first_chunk <= chunk) {
+      return mp4->sample_to_chunk[i].samples_per_chunk;
     }
-
-    mp4->sample_byte_size[i] = v;
-
-    //DEBUG_TRACE("  sample_byte_size %d\n", v);
   }
 
-  return 1;
+  return mp4->sample_to_chunk[0].samples_per_chunk;
 }
 
-uint8_t
-_mp4_parse_stco(mp4info *mp4)
+uint32_t
+_mp4_total_samples(mp4info *mp4)
 {
   int i;
+  uint32_t total = 0;
 
-  if ( !_check_buf(mp4->infile, mp4->buf, mp4->rsize, MP4_BLOCK_SIZE) ) {
-    return 0;
+  for (i = 0; i < mp4->num_time_to_samples; i++) {
+    total += mp4->time_to_sample[i].sample_count;
   }
 
-  // Skip version/flags
-  buffer_consume(mp4->buf, 4);
-
-  mp4->num_chunk_offsets = buffer_get_int(mp4->buf);
-  DEBUG_TRACE("  num_chunk_offsets %d\n", mp4->num_chunk_offsets);
-
-  New(0,
-    mp4->chunk_offset,
-    mp4->num_chunk_offsets * sizeof(*mp4->chunk_offset),
-    uint32_t
-  );
+  return total;
+}
 
-  if ( !mp4->chunk_offset ) {
-    PerlIO_printf(PerlIO_stderr(), "Unable to parse stco: too large\n");
-    return 0;
-  }
+uint32_t
+_mp4_get_sample_duration(mp4info *mp4, uint32_t sample)
+{
+  int i;
+  uint32_t co = 0;
 
-  for (i = 0; i < mp4->num_chunk_offsets; i++) {
-    mp4->chunk_offset[i] = buffer_get_int(mp4->buf);
+  for (i = 0; i < mp4->num_time_to_samples; i++) {
+    uint32_t delta = mp4->time_to_sample[i].sample_count;
+    if (sample < co + delta) {
+      return mp4->time_to_sample[i].sample_duration;
+    }
 
-    //DEBUG_TRACE("  chunk_offset %d\n", mp4->chunk_offset[i]);
+    co += delta;
   }
 
-  return 1;
+  return 0;
 }
 
-uint8_t
-_mp4_parse_meta(mp4info *mp4)
+// Find the sample containing the given time (in timescale units) using the
+// time_to_sample table.  The start time of the sample is returned in sound_sample.
+uint32_t
+_mp4_sample_for_time(mp4info *mp4, uint32_t sound_sample_loc, uint32_t *sound_sample)
 {
-  uint32_t hdlr_size;
-  char type[5];
-
-  if ( !_check_buf(mp4->infile, mp4->buf, 12, MP4_BLOCK_SIZE) ) {
-    return 0;
-  }
+  uint32_t i = 0;
+  uint32_t j;
+  uint32_t sample = 0;
 
-  // Skip version/flags
-  buffer_consume(mp4->buf, 4);
+  *sound_sample = 0;
 
-  // Parse/skip meta version of hdlr
-  hdlr_size = buffer_get_int(mp4->buf);
-  strncpy( type, (char *)buffer_ptr(mp4->buf), 4 );
-  type[4] = '\0';
-  buffer_consume(mp4->buf, 4);
+  while ( (i < mp4->num_time_to_samples) &&
+      (*sound_sample < sound_sample_loc)
+  ) {
+      j = (sound_sample_loc - *sound_sample) / mp4->time_to_sample[i].sample_duration;
 
-  if ( !FOURCC_EQ(type, "hdlr") ) {
-    return 0;
-  }
+      DEBUG_TRACE(
+        "i = %d / j = %d, sample_count[i]: %d, sample_duration[i]: %d\n",
+        i, j,
+        mp4->time_to_sample[i].sample_count,
+        mp4->time_to_sample[i].sample_duration
+      );
 
-  // Skip rest of hdlr
-  if ( !_check_buf(mp4->infile, mp4->buf, hdlr_size - 8, MP4_BLOCK_SIZE) ) {
-    return 0;
+      if (j <= mp4->time_to_sample[i].sample_count) {
+        sample += j;
+        *sound_sample += j * mp4->time_to_sample[i].sample_duration;
+        break;
+      }
+      else {
+        // XXX need test for this bit of code (variable stts)
+        *sound_sample += (mp4->time_to_sample[i].sample_duration
+            * mp4->time_to_sample[i].sample_count);
+        sample += mp4->time_to_sample[i].sample_count;
+        i++;
+      }
   }
 
-  buffer_consume(mp4->buf, hdlr_size - 8);
-
-  return 12 + hdlr_size - 8;
+  return sample;
 }
 
-uint8_t
-_mp4_parse_ilst(mp4info *mp4)
+// Find the chunk containing the given sample using the sample_to_chunk table.
+// The first sample in the chunk is returned in chunk_sample.
+uint32_t
+_mp4_chunk_for_sample(mp4info *mp4, uint32_t sample, uint32_t *chunk_sample)
 {
-  while (mp4->rsize) {
-    uint32_t size;
-    char key[5];
-
-    if ( !_check_buf(mp4->infile, mp4->buf, 8, MP4_BLOCK_SIZE) ) {
-      return 0;
-    }
-
-    DEBUG_TRACE("  ilst rsize %llu\n", mp4->rsize);
-
-    // Read Apple annotation box
-    size = buffer_get_int(mp4->buf);
-    strncpy( key, (char *)buffer_ptr(mp4->buf), 4 );
-    key[4] = '\0';
-    buffer_consume(mp4->buf, 4);
+  uint32_t i;
+  uint32_t chunk;
+  uint32_t range_samples = 0;
+  uint32_t total_samples = 0;
+  uint32_t prev_chunk         = mp4->sample_to_chunk[0].first_chunk;
+  uint32_t prev_chunk_samples = mp4->sample_to_chunk[0].samples_per_chunk;
 
-    DEBUG_TRACE("  %s size %d\n", key, size);
+  for (i = 1; i < mp4->num_sample_to_chunks; i++) {
+    chunk = mp4->sample_to_chunk[i].first_chunk;
+    range_samples = (chunk - prev_chunk) * prev_chunk_samples;
 
-    // Note: extra _check_buf calls in this function and other ilst functions
-    // are to avoid reading in the full size of ilst in the case of large artwork
+    DEBUG_TRACE("prev_chunk: %d, prev_chunk_samples: %d, chunk: %d, range_samples: %d\n",
+      prev_chunk, prev_chunk_samples, chunk, range_samples);
 
-    upcase(key);
+    if (sample < total_samples + range_samples)
+      break;
 
-    if ( FOURCC_EQ(key, "----") ) {
-      // user-specified key/value pair
-      if ( !_mp4_parse_ilst_custom(mp4, size - 8) ) {
-        return 0;
-      }
-    }
-    else {
-      uint32_t bsize;
+    total_samples += range_samples;
+    prev_chunk = mp4->sample_to_chunk[i].first_chunk;
+    prev_chunk_samples = mp4->sample_to_chunk[i].samples_per_chunk;
+  }
 
-      // Ensure we have 8 bytes
-      if ( !_check_buf(mp4->infile, mp4->buf, 8, MP4_BLOCK_SIZE) ) {
-        return 0;
-      }
+  DEBUG_TRACE("prev_chunk: %d, prev_chunk_samples: %d, total_samples: %d\n", prev_chunk, prev_chunk_samples, total_samples);
 
-      // Verify data box
-      bsize = buffer_get_int(mp4->buf);
+  if (sample >= mp4->sample_to_chunk[0].samples_per_chunk) {
+    chunk = prev_chunk + (sample - total_samples) / prev_chunk_samples;
+  }
+  else {
+    chunk = 1;
+  }
 
-      DEBUG_TRACE("    box size %d\n", bsize);
+  /* Get sample of the first sample in the chunk */
+  *chunk_sample = total_samples + (chunk - prev_chunk) * prev_chunk_samples;
 
-      // Sanity check for bad data size
-      if ( bsize <= size - 8 ) {
-        SV *skey;
+  return chunk;
+}
 
-        char *bptr = buffer_ptr(mp4->buf);
-        if ( !FOURCC_EQ(bptr, "data") ) {
-          return 0;
-        }
+// Append ADTS frames for samples starting at sample to the scatter list,
+// each made of a 7-byte ADTS header and a file range for the raw AAC frame.
+// chunk, chunk_sample and file_offset locate the first sample.
+uint8_t
+_mp4_adts_frames(mp4info *mp4, uint32_t sample, uint32_t end_sample, uint32_t chunk, uint32_t chunk_sample, uint32_t file_offset, uint32_t max_frames)
+{
+  unsigned char header[7];
+  uint32_t frames = 0;
+  uint32_t left;
 
-        buffer_consume(mp4->buf, 4);
+  // Only AAC Main, LC, SSR and LTP have an ADTS profile
+  if ( mp4->core_object_type < AAC_MAIN || mp4->core_object_type > AAC_LTP ) {
+    PerlIO_printf(PerlIO_stderr(), "find_frame: ADTS requires AAC Main, LC, SSR or LTP (audio object type %d): %s\n", mp4->core_object_type, mp4->file);
+    return 0;
+  }
 
-        skey = newSVpv(key, 0);
+  // ADTS can't signal an explicit samplerate or a channel config in a PCE
+  if ( mp4->samplerate_index >= 0xD || !mp4->channel_config || mp4->channel_config > 7 ) {
+    PerlIO_printf(PerlIO_stderr(), "find_frame: unable to use ADTS for this AAC configuration: %s\n", mp4->file);
+    return 0;
+  }
 
-        if ( !_mp4_parse_ilst_data(mp4, bsize - 8, skey) ) {
-          SvREFCNT_dec(skey);
-          return 0;
-        }
+  // syncword, MPEG-4, layer 0, no CRC
+  header[0] = 0xFF;
+  header[1] = 0xF1;
+  header[2] = ((mp4->core_object_type - 1) << 6) | (mp4->samplerate_index << 2) | (mp4->channel_config >> 2);
 
-        SvREFCNT_dec(skey);
+  mp4->seekparts = newAV();
 
-        // XXX: bug 14476, files with multiple COVR images aren't handled here, just skipped for now
-        if ( bsize < size - 8 ) {
-          DEBUG_TRACE("    skipping rest of box, %d\n", size - 8 - bsize );
-          _mp4_skip(mp4, size - 8 - bsize);
-        }
-      }
-      else {
-        DEBUG_TRACE("    invalid data size %d, skipping value\n", bsize);
-        _mp4_skip(mp4, size - 12);
-      }
-    }
+  left = _mp4_samples_in_chunk(mp4, chunk) - (sample - chunk_sample);
 
-    mp4->rsize -= size;
+  if (end_sample > mp4->num_sample_byte_sizes) {
+    end_sample = mp4->num_sample_byte_sizes;
   }
 
-  return 1;
-}
+  while ( sample < end_sample && (!max_frames || frames < max_frames) ) {
+    uint32_t frame_length;
 
-uint8_t
-_mp4_parse_ilst_data(mp4info *mp4, uint32_t size, SV *key)
-{
-  uint32_t flags;
-  unsigned char *ckey;
-  SV *value;
+    if (!left) {
+      // Move to the next chunk
+      if (++chunk > mp4->num_chunk_offsets) {
+        break;
+      }
 
-  ckey = (unsigned char *)SvPVX(key);
-  if ( FOURCC_EQ(ckey, "COVR") && _env_true("AUDIO_SCAN_NO_ARTWORK") ) {
-    // Skip artwork if requested and avoid the memory cost
-    value = newSVuv(size - 8);
+      file_offset = mp4->chunk_offset[chunk - 1];
+      left = _mp4_samples_in_chunk(mp4, chunk);
+      continue;
+    }
 
-    my_hv_store( mp4->tags, "COVR_offset", newSVuv(mp4->audio_offset + (mp4->size - mp4->rsize) + 24) );
+    frame_length = mp4->sample_byte_size[sample] + 7;
 
-    _mp4_skip(mp4, size);
-  }
-  else {
-    // Read the full ilst value
-    if ( !_check_buf(mp4->infile, mp4->buf, size, MP4_BLOCK_SIZE) ) {
+    if (frame_length > 0x1FFF) {
+      PerlIO_printf(PerlIO_stderr(), "find_frame: AAC frame too large for ADTS (%d bytes): %s\n", frame_length, mp4->file);
       return 0;
     }
 
-    // Version(0) + Flags
-    flags = buffer_get_int(mp4->buf);
-
-    // Skip reserved
-    buffer_consume(mp4->buf, 4);
-
-    DEBUG_TRACE("      flags %d\n", flags);
-
-    if ( !flags || flags == 21 ) {
-      if ( FOURCC_EQ( SvPVX(key), "TRKN" ) || FOURCC_EQ( SvPVX(key), "DISK" ) ) {
-        // Special case trkn, disk (pair of 16-bit ints)
-        uint16_t num = 0;
-        uint16_t total = 0;
+    // 13-bit frame length, buffer fullness 0x7FF (VBR), 1 raw data block
+    header[3] = ((mp4->channel_config & 0x3) << 6) | (frame_length >> 11);
+    header[4] = (frame_length >> 3) & 0xFF;
+    header[5] = ((frame_length & 0x7) << 5) | 0x1F;
+    header[6] = 0xFC;
 
-        buffer_consume(mp4->buf, 2); // padding
+    _mp4_seekhdr_append(mp4, (char *)header, 7);
+    _mp4_seekhdr_append_range(mp4, file_offset, mp4->sample_byte_size[sample]);
 
-        num = buffer_get_short(mp4->buf);
+    file_offset += mp4->sample_byte_size[sample];
+    sample++;
+    left--;
+    frames++;
+  }
 
-        // Total may not always be present
-        if (size > 12) {
-          total = buffer_get_short(mp4->buf);
-          buffer_consume(mp4->buf, size - 14); // optional padding
-        }
+  my_hv_store( mp4->info, "adts_frames", newSVuv(frames) );
 
-        DEBUG_TRACE("      %d/%d\n", num, total);
+  if (sample < end_sample) {
+    my_hv_store( mp4->info, "adts_next_sample", newSVuv(sample) );
+  }
 
-        if (total) {
-          my_hv_store_ent( mp4->tags, key, newSVpvf( "%d/%d", num, total ) );
-        }
-        else if (num) {
-          my_hv_store_ent( mp4->tags, key, newSVuv(num) );
-        }
+  return 1;
+}
 
-        return 1;
-      }
-      else if ( FOURCC_EQ( SvPVX(key), "GNRE" ) ) {
-        // Special case genre, 16-bit int as id3 genre code
-        char const *genre_string;
-        uint16_t genre_num = buffer_get_short(mp4->buf);
+int
+_mp4_read_at(PerlIO *infile, uint64_t offset, Buffer *buf, uint32_t len)
+{
+  buffer_clear(buf);
 
-        if (genre_num > 0 && genre_num < NGENRES + 1) {
-          genre_string = _id3_genre_index(genre_num - 1);
-          my_hv_store_ent( mp4->tags, key, newSVpv( genre_string, 0 ) );
-        }
+  if ( PerlIO_seek(infile, offset, SEEK_SET) == -1 ) {
+    return 0;
+  }
 
-        return 1;
-      }
-      else {
-        // Other binary type, try to guess type based on size
-        uint32_t dsize = size - 8;
+  return len ? _check_buf(infile, buf, len, len) : 1;
+}
 
-        if (dsize == 1) {
-          value = newSVuv( buffer_get_char(mp4->buf) );
-        }
-        else if (dsize == 2) {
-          value = newSVuv( buffer_get_short(mp4->buf) );
-        }
-        else if (dsize == 4) {
-          value = newSVuv( buffer_get_int(mp4->buf) );
-        }
-        else if (dsize == 8) {
-          value = newSVuv( buffer_get_int64(mp4->buf) );
-        }
-        else {
-          value = newSVpvn( buffer_ptr(mp4->buf), dsize );
-          buffer_consume(mp4->buf, dsize);
-        }
-      }
-    }
-    else { // text data
-      value = newSVpvn( buffer_ptr(mp4->buf), size - 8 );
-      sv_utf8_decode(value);
+// Find the first box of the given type between start and end of an in-memory box,
+// returns its offset or -1
+int64_t
+_mp4_find_box(unsigned char *bptr, uint64_t start, uint64_t end, const char *type, uint64_t *size, uint8_t *hsize)
+{
+  while (start + 8 <= end) {
+    uint64_t bsize = get_u32(bptr + start);
+    uint8_t bhsize = 8;
 
-      // strip copyright symbol 0xA9 out of key
-      if ( ckey[0] == 0xA9 ) {
-        ckey++;
+    if (bsize == 1) {
+      if (start + 16 > end) {
+        break;
       }
+      bsize  = get_u64(bptr + start + 8);
+      bhsize = 16;
+    }
+    else if (bsize == 0) {
+      bsize = end - start;
+    }
 
-      DEBUG_TRACE("      %s = %s\n", ckey, SvPVX(value));
+    if (bsize < bhsize || bsize > end - start) {
+      break;
+    }
 
-      buffer_consume(mp4->buf, size - 8);
+    if ( !memcmp(bptr + start + 4, type, 4) ) {
+      *size  = bsize;
+      *hsize = bhsize;
+      return start;
     }
+
+    start += bsize;
   }
 
-  // if key exists, create array
-  if ( my_hv_exists( mp4->tags, (char *)ckey ) ) {
-    SV **entry = my_hv_fetch( mp4->tags, (char *)ckey );
-    if (entry != NULL) {
-      if ( SvROK(*entry) && SvTYPE(SvRV(*entry)) == SVt_PVAV ) {
-        av_push( (AV *)SvRV(*entry), value );
+  return -1;
+}
+
+void
+_mp4_put_box_size(unsigned char *bptr, uint8_t hsize, uint64_t size)
+{
+  if (hsize == 16) {
+    put_u32(bptr + 8, size >> 32);
+    put_u32(bptr + 12, size & 0xFFFFFFFF);
+  }
+  else {
+    put_u32(bptr, size);
+  }
+}
+
+// Return the tag key of an ilst atom as read by _mp4_parse_ilst. info is set to the
+// atom name, the flags and size of its first value, and for custom atoms the mean
+// and name boxes.
+SV *
+_mp4_ilst_key(unsigned char *atom, uint32_t size, Buffer *info)
+{
+  SV *key = NULL;
+  uint32_t pos = 8;
+  uint8_t custom = memcmp(atom + 4, "----", 4) ? 0 : 1;
+  uint8_t have_data = 0;
+
+  buffer_clear(info);
+  buffer_append(info, atom + 4, 4);
+  buffer_put_int(info, 1);
+  buffer_put_int(info, 0);
+
+  while (pos + 8 <= size) {
+    uint32_t bsize = get_u32(atom + pos);
+
+    if (bsize < 8 || bsize > size - pos) {
+      break;
+    }
+
+    if ( !memcmp(atom + pos + 4, "data", 4) ) {
+      if (!have_data && bsize >= 16) {
+        put_u32( (unsigned char *)buffer_ptr(info) + 4, get_u32(atom + pos + 8) & 0xFFFFFF );
+        put_u32( (unsigned char *)buffer_ptr(info) + 8, bsize - 16 );
+        have_data = 1;
       }
-      else {
-        // A non-array entry, convert to array.
-        AV *ref = newAV();
-        av_push( ref, newSVsv(*entry) );
-        av_push( ref, value );
-        my_hv_store( mp4->tags, (char *)ckey, newRV_noinc( (SV*)ref ) );
+    }
+    else if ( custom && (!memcmp(atom + pos + 4, "mean", 4) || !memcmp(atom + pos + 4, "name", 4)) ) {
+      if ( !key && !memcmp(atom + pos + 4, "name", 4) && bsize >= 12 ) {
+        key = newSVpvn( (char *)atom + pos + 12, bsize - 12 );
+        sv_utf8_decode(key);
+        upcase(SvPVX(key));
       }
+
+      buffer_append(info, atom + pos, bsize);
     }
+
+    pos += bsize;
   }
-  else {
-    my_hv_store( mp4->tags, (char *)ckey, value );
+
+  if (!custom) {
+    char name[5];
+
+    memcpy(name, atom + 4, 4);
+    name[4] = '\0';
+    upcase(name);
+
+    // strip copyright symbol 0xA9 out of key
+    key = newSVpv( (unsigned char)name[0] == 0xA9 ? name + 1 : name, 0 );
   }
 
-  return 1;
+  return key;
 }
 
-uint8_t
-_mp4_parse_ilst_custom(mp4info *mp4, uint32_t size)
+// Build an ilst box, keeping the atoms of tags not given and adding the given tags
+int
+_mp4_put_ilst(PerlIO *infile, off_t file_size, unsigned char *old, uint32_t old_len, HV *tags, Buffer *out)
 {
-  SV *key = NULL;
+  HV *replaced = newHV();
+  Buffer info;
+  const char **keys;
+  uint32_t num_keys;
+  uint32_t i;
+  int ret = 0;
 
-  while (size) {
-    char type[5];
-    uint32_t bsize;
+  buffer_init(&info, 64);
 
-    // Ensure we have 8 bytes to get the size and type
-    if ( !_check_buf(mp4->infile, mp4->buf, 8, MP4_BLOCK_SIZE) ) {
-      return 0;
+  buffer_put_int(out, 0);
+  buffer_append(out, "ilst", 4);
+
+  while (old_len >= 8) {
+    uint32_t size = get_u32(old);
+    SV *key;
+
+    if (size < 8 || size > old_len) {
+      break;
     }
 
-    // Read box
-    bsize = buffer_get_int(mp4->buf);
-    strncpy( type, (char *)buffer_ptr(mp4->buf), 4 );
-    type[4] = '\0';
-    buffer_consume(mp4->buf, 4);
+    key = _mp4_ilst_key(old, size, &info);
 
-    DEBUG_TRACE("    %s size %d\n", type, bsize);
+    if ( key && hv_exists_ent(tags, key, 0) ) {
+      DEBUG_TRACE("  replacing %s atom\n", SvPVX(key));
 
-    if ( FOURCC_EQ(type, "name") ) {
-      // Ensure we have bsize bytes
-      if ( !_check_buf(mp4->infile, mp4->buf, bsize, MP4_BLOCK_SIZE) ) {
-        return 0;
+      if ( !hv_exists_ent(replaced, key, 0) ) {
+        hv_store_ent( replaced, key, newSVpvn( buffer_ptr(&info), buffer_len(&info) ), 0 );
       }
+    }
+    else {
+      buffer_append(out, old, size);
+    }
 
-      buffer_consume(mp4->buf, 4); // padding
-      key = newSVpvn( buffer_ptr(mp4->buf), bsize - 12);
-      sv_utf8_decode(key);
-      upcase(SvPVX(key));
-      buffer_consume(mp4->buf, bsize - 12);
+    if (key) {
+      SvREFCNT_dec(key);
+    }
 
-      DEBUG_TRACE("      %s\n", SvPVX(key));
+    old     += size;
+    old_len -= size;
+  }
+
+  num_keys = _sorted_keys(tags, &keys);
+
+  for (i = 0; i < num_keys; i++) {
+    SV **entry = my_hv_fetch(tags, keys[i]);
+    SV **prev;
+    AV *values = NULL;
+    char name[5];
+    uint8_t int_size = 0;
+    uint8_t found = 0;
+    unsigned char *custom = NULL;
+    uint32_t custom_len = 0;
+    const char *atom_name = name;
+    uint32_t atom = 0;
+    int32_t n = 1;
+    int32_t j;
+    const mp4_ilst_atom *a;
+
+    if ( entry == NULL || !SvOK(*entry) || !strcmp(keys[i], "COVR_offset") ) {
+      continue;
     }
-    else if ( FOURCC_EQ(type, "data") ) {
-      if (!key) {
-        // No key yet, data is out of order
-        return 0;
+
+    if ( SvROK(*entry) ) {
+      if ( SvTYPE(SvRV(*entry)) != SVt_PVAV ) {
+        continue;
       }
+      values = (AV *)SvRV(*entry);
+      n = av_len(values) + 1;
+    }
 
-      if ( !_mp4_parse_ilst_data(mp4, bsize - 8, key) ) {
-        SvREFCNT_dec(key);
-        return 0;
+    for (a = mp4_ilst_atoms; a->key; a++) {
+      if ( !strcmp(a->key, keys[i]) ) {
+        memcpy(name, a->name, 4);
+        int_size = a->int_size;
+        found = 1;
+        break;
       }
     }
-    else {
-      // skip (mean, or other boxes)
-      if ( !_check_buf(mp4->infile, mp4->buf, bsize - 8, MP4_BLOCK_SIZE) ) {
-        return 0;
+
+    // Keep the name and value type of a replaced atom
+    prev = my_hv_fetch(replaced, keys[i]);
+    if (prev != NULL) {
+      unsigned char *p = (unsigned char *)SvPVX(*prev);
+      uint32_t flags = get_u32(p + 4);
+      uint32_t dsize = get_u32(p + 8);
+
+      memcpy(name, p, 4);
+      found = 1;
+
+      if ( !memcmp(name, "----", 4) ) {
+        custom     = p + 12;
+        custom_len = SvCUR(*prev) - 12;
       }
 
-      buffer_consume(mp4->buf, bsize - 8);
+      if ( (!flags || flags == 21) && (dsize == 1 || dsize == 2 || dsize == 4 || dsize == 8) ) {
+        int_size = dsize;
+      }
+      else if (flags == 1) {
+        int_size = 0;
+      }
     }
 
-    size -= bsize;
-  }
+    if (!found) {
+      memcpy(name, "----", 4);
+    }
 
-  SvREFCNT_dec(key);
+    name[4] = '\0';
 
-  return 1;
-}
+    for (j = 0; j < n; j++) {
+      SV *value = *entry;
 
-HV *
-_mp4_get_current_trackinfo(mp4info *mp4)
-{
-  // Return the trackinfo hash for track id == mp4->current_track
-  AV *tracks;
-  HV *trackinfo;
-  int i;
+      if (values) {
+        SV **v = av_fetch(values, j, 0);
+        if (v == NULL || !SvOK(*v)) {
+          continue;
+        }
+        value = *v;
+      }
 
-  SV **entry = my_hv_fetch(mp4->info, "tracks");
-  if (entry != NULL) {
-    tracks = (AV *)SvRV(*entry);
-  }
-  else {
-    return NULL;
-  }
+      // Custom atoms and covr hold all values in one atom, others repeat the atom
+      if ( !atom || (memcmp(name, "----", 4) && memcmp(name, "covr", 4)) ) {
+        atom_name = name;
 
-  // Find entry for this stream number
-  for (i = 0; av_len(tracks) >= 0 && i <= av_len(tracks); i++) {
-    SV **info = av_fetch(tracks, i, 0);
-    if (info != NULL) {
-      SV **tid;
+        // A genre without an ID3 genre number is written as text
+        if ( !memcmp(name, "gnre", 4) && !_mp4_genre_number(SvPV_nolen(value)) ) {
+          atom_name = "\xA9gen";
+        }
 
-      trackinfo = (HV *)SvRV(*info);
-      tid = my_hv_fetch( trackinfo, "id" );
-      if (tid != NULL) {
-        if ( SvIV(*tid) == mp4->current_track ) {
-          return trackinfo;
+        atom = buffer_len(out);
+        buffer_put_int(out, 0);
+        buffer_append(out, atom_name, 4);
+
+        if (custom) {
+          buffer_append(out, custom, custom_len);
+        }
+        else if ( !memcmp(name, "----", 4) ) {
+          buffer_put_int(out, 28);
+          buffer_append(out, "mean", 4);
+          buffer_put_int(out, 0);
+          buffer_append(out, "com.apple.iTunes", 16);
+
+          buffer_put_int(out, 12 + strlen(keys[i]));
+          buffer_append(out, "name", 4);
+          buffer_put_int(out, 0);
+          buffer_append(out, keys[i], strlen(keys[i]));
         }
       }
+
+      if ( !_mp4_put_ilst_value(infile, file_size, out, atom_name, int_size, value, tags) ) {
+        goto out;
+      }
+
+      put_u32( (unsigned char *)buffer_ptr(out) + atom, buffer_len(out) - atom );
     }
   }
 
-  return NULL;
+  put_u32( buffer_ptr(out), buffer_len(out) );
+  ret = 1;
+
+out:
+  Safefree(keys);
+  SvREFCNT_dec(replaced);
+  buffer_free(&info);
+
+  return ret;
 }
 
-uint32_t
-_mp4_descr_length(Buffer *buf)
+// Add a data box with the value of an atom
+int
+_mp4_put_ilst_value(PerlIO *infile, off_t file_size, Buffer *out, const char *name, uint8_t int_size, SV *value, HV *tags)
 {
-  uint8_t b;
-  uint8_t num_bytes = 0;
-  uint32_t length = 0;
+  unsigned char data[8];
 
-  do {
-    b = buffer_get_char(buf);
-    num_bytes++;
-    length = (length << 7) | (b & 0x7f);
-  } while ( (b & 0x80) && num_bytes < 4 );
+  if ( !memcmp(name, "trkn", 4) || !memcmp(name, "disk", 4) ) {
+    // Pair of 16-bit ints, number and total
+    unsigned int num = 0;
+    unsigned int total = 0;
 
-  return length;
-}
+    sscanf( SvPV_nolen(value), "%u/%u", &num, &total );
 
-void
-_mp4_skip(mp4info *mp4, uint32_t size)
-{
-  if ( buffer_len(mp4->buf) >= size ) {
-    //buffer_dump(mp4->buf, size);
-    buffer_consume(mp4->buf, size);
+    memset(data, 0, 8);
+    put_u16(data + 2, num);
+    put_u16(data + 4, total);
 
-    DEBUG_TRACE("  skipped buffer data size %d\n", size);
+    _mp4_put_ilst_data( out, 0, data, !memcmp(name, "trkn", 4) ? 8 : 6 );
   }
-  else {
-    PerlIO_seek(mp4->infile, size - buffer_len(mp4->buf), SEEK_CUR);
-    buffer_clear(mp4->buf);
+  else if ( !memcmp(name, "gnre", 4) ) {
+    // ID3 genre number + 1
+    put_u16( data, _mp4_genre_number(SvPV_nolen(value)) );
 
-    DEBUG_TRACE("  seeked past %d bytes to %d\n", size, (int)PerlIO_tell(mp4->infile));
+    _mp4_put_ilst_data(out, 0, data, 2);
   }
-}
+  else if ( !memcmp(name, "covr", 4) ) {
+    STRLEN len;
+    unsigned char *image;
+    uint32_t flags;
+    Buffer buf;
 
-uint32_t
-_mp4_samples_in_chunk(mp4info *mp4, uint32_t chunk)
-{
-  int i;
+    buffer_init(&buf, 0);
 
-  for (i = mp4->num_sample_to_chunks - 1; i >= 0; i--) {
-    if (mp4->sample_to_chunk[i].first_chunk <= chunk) {
-      return mp4->sample_to_chunk[i].samples_per_chunk;
+    if ( SvPOK(value) ) {
+      image = (unsigned char *)SvPV(value, len);
+    }
+    else {
+      // Artwork skipped with AUDIO_SCAN_NO_ARTWORK, copy it from the file
+      SV **offset = my_hv_fetch(tags, "COVR_offset");
+
+      len = SvUV(value);
+
+      if ( offset == NULL || SvUV(*offset) > file_size || len > file_size - SvUV(*offset)
+        || !_mp4_read_at(infile, SvUV(*offset), &buf, len)
+      ) {
+        PerlIO_printf(PerlIO_stderr(), "Unable to read the COVR artwork to copy\n");
+        buffer_free(&buf);
+        return 0;
+      }
+
+      image = (unsigned char *)buffer_ptr(&buf);
+    }
+
+    if ( len >= 4 && !memcmp(image, "\x89PNG", 4) ) {
+      flags = 14;
+    }
+    else if ( len >= 2 && image[0] == 'B' && image[1] == 'M' ) {
+      flags = 27;
+    }
+    else {
+      flags = 13;
     }
+
+    _mp4_put_ilst_data(out, flags, image, len);
+
+    buffer_free(&buf);
   }
+  else if (int_size) {
+    uint64_t num = SvUV(value);
+    int i;
 
-  return mp4->sample_to_chunk[0].samples_per_chunk;
-}
+    for (i = int_size - 1; i >= 0; i--) {
+      data[i] = num & 0xFF;
+      num >>= 8;
+    }
 
-uint32_t
-_mp4_total_samples(mp4info *mp4)
-{
-  int i;
-  uint32_t total = 0;
+    _mp4_put_ilst_data(out, 21, data, int_size);
+  }
+  else {
+    STRLEN len;
+    char *str = SvPVutf8(value, len);
 
-  for (i = 0; i < mp4->num_time_to_samples; i++) {
-    total += mp4->time_to_sample[i].sample_count;
+    _mp4_put_ilst_data(out, 1, str, len);
   }
 
-  return total;
+  return 1;
 }
 
-uint32_t
-_mp4_get_sample_duration(mp4info *mp4, uint32_t sample)
+void
+_mp4_put_ilst_data(Buffer *out, uint32_t flags, const void *data, uint32_t len)
 {
-  int i;
-  uint32_t co = 0;
+  buffer_put_int(out, 16 + len);
+  buffer_append(out, "data", 4);
+  buffer_put_int(out, flags);
+  buffer_put_int(out, 0);
+  buffer_append(out, data, len);
+}
 
-  for (i = 0; i < mp4->num_time_to_samples; i++) {
-    uint32_t delta = mp4->time_to_sample[i].sample_count;
-    if (sample < co + delta) {
-      return mp4->time_to_sample[i].sample_duration;
-    }
+// Return the ID3 genre number + 1 used by gnre, or 0 if the genre isn't in the list
+uint16_t
+_mp4_genre_number(const char *genre)
+{
+  unsigned int i;
 
-    co += delta;
+  for (i = 0; i < NGENRES; i++) {
+    if ( !strcasecmp(_id3_genre_index(i), genre) ) {
+      return i + 1;
+    }
   }
 
   return 0;
@@ -38,6 +38,10 @@
 
 #define MPC_BLOCK_SIZE 1024
 #define MPC_OLD_GAIN_REF 64.82
+#define MPC_FRAME_LENGTH 1152
+#define MPC_SV7_FIRST_BIT 200 // SV7 frames start after the 25-byte header
+#define MPC_MAX_PACKET_HEADER 11 // 2-byte key and up to 9 bytes of size
+#define MPC_MAX_SEEK_TABLE 0x100000
 
 const int32_t samplefreqs[4] = { 44100, 48000, 37800, 32000 };
 
@@ -265,14 +269,26 @@ _mpc_read_header_sv7(mpc_streaminfo *si)
 
 static int
 get_mpcfileinfo(PerlIO *infile, char *file, HV *info)
+{
+  int ret;
+  mpc_streaminfo *si;
+
+  Newz(0, si, sizeof(mpc_streaminfo), mpc_streaminfo);
+
+  ret = _mpc_parse(infile, file, info, si);
+
+  Safefree(si);
+
+  return ret;
+}
+
+static int
+_mpc_parse(PerlIO *infile, char *file, HV *info, mpc_streaminfo *si)
 {
   Buffer buf;
   int32_t ret = 0;
   unsigned char *bptr;
 
-  mpc_streaminfo *si;
-
-  Newz(0, si, sizeof(mpc_streaminfo), mpc_streaminfo);
   buffer_init(&buf, MPC_BLOCK_SIZE);
 
   si->buf    = &buf;
@@ -353,8 +369,398 @@ get_mpcfileinfo(PerlIO *infile, char *file, HV *info)
   }
 
 out:
-  Safefree(si);
+  si->buf = NULL;
+  buffer_free(&buf);
+
+  return ret;
+}
+
+static int
+mpc_find_frame(PerlIO *infile, char *file, int offset)
+{
+  int64_t frame_offset;
+  uint64_t frame;
+  uint32_t bit;
+
+  HV *info = newHV();
+
+  frame_offset = _mpc_find_frame(infile, file, offset, info, &frame, &bit);
+
+  // Don't leak
+  SvREFCNT_dec(info);
+
+  return frame_offset > 0x7FFFFFFF ? -1 : frame_offset;
+}
+
+// Returns seek_offset and seek_frame, the frame starting there. SV7 frames are not
+// byte-aligned, so for SV7 seek_offset is the 32-bit word containing the frame and
+// seek_bit is the bit in that word where it starts.
+static int
+mpc_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  int64_t frame_offset;
+  uint64_t frame = 0;
+  uint32_t bit = 0;
+
+  frame_offset = _mpc_find_frame(infile, file, offset, info, &frame, &bit);
+
+  my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+
+  if (frame_offset >= 0) {
+    my_hv_store( info, "seek_frame", newSVuv(frame) );
+
+    if ( SvIV( *(my_hv_fetch(info, "stream_version")) ) < 8 ) {
+      my_hv_store( info, "seek_bit", newSVuv(bit) );
+    }
+  }
+
+  return frame_offset;
+}
+
+static int64_t
+_mpc_find_frame(PerlIO *infile, char *file, int offset, HV *info, uint64_t *frame, uint32_t *bit)
+{
+  int64_t frame_offset = -1;
+  uint64_t sample;
+  Buffer buf;
+
+  mpc_streaminfo *si;
+
+  Newz(0, si, sizeof(mpc_streaminfo), mpc_streaminfo);
+
+  _mpc_parse(infile, file, info, si);
+
+  if ( offset < 0 || !si->sample_freq ) {
+    goto out;
+  }
+
+  buffer_init(&buf, MPC_BLOCK_SIZE);
+
+  si->buf    = &buf;
+  si->infile = infile;
+
+  sample = (uint64_t)offset * si->sample_freq / 1000;
+
+  if (si->stream_version >= 8) {
+    frame_offset = _mpc_sv8_find_frame(si, sample, frame);
+  }
+  else if (si->frames) {
+    frame_offset = _mpc_sv7_find_frame(si, sample, frame, bit);
+  }
+
   buffer_free(&buf);
 
+out:
+  Safefree(si);
+
+  return frame_offset;
+}
+
+// Reads the SV8 packet header at offset into key, returns the size of the whole
+// packet and the size of its header in header_size, or 0 if there is no packet
+static uint64_t
+_mpc_sv8_packet(mpc_streaminfo *si, off_t offset, unsigned char *key, uint32_t *header_size)
+{
+  unsigned char *bptr;
+  uint64_t size;
+  int i;
+
+  if (offset + 3 > si->total_file_length) {
+    return 0;
+  }
+
+  buffer_clear(si->buf);
+  PerlIO_seek(si->infile, offset, SEEK_SET);
+
+  if ( !_check_buf(si->infile, si->buf, 3, MPC_MAX_PACKET_HEADER) ) {
+    return 0;
+  }
+
+  bptr = buffer_ptr(si->buf);
+
+  // Keys are two capital letters
+  if ( bptr[0] < 'A' || bptr[0] > 'Z' || bptr[1] < 'A' || bptr[1] > 'Z' ) {
+    return 0;
+  }
+
+  key[0] = bptr[0];
+  key[1] = bptr[1];
+  buffer_consume(si->buf, 2);
+
+  // Make sure the size isn't cut off by the end of the file
+  for (i = 0; i < buffer_len(si->buf) && (bptr[2 + i] & 0x80); i++) { }
+
+  if ( i >= buffer_len(si->buf) ) {
+    return 0;
+  }
+
+  *header_size = 2 + _mpc_bits_get_size(si->buf, &size);
+
+  if (size < *header_size) {
+    return 0;
+  }
+
+  return size;
+}
+
+// Finds the AP packet containing sample. SV8 files normally have a seek table with
+// the offset of every 2^n-th packet, from there the packets are hopped over one by
+// one. Without a seek table, hopping starts at the first packet.
+static int64_t
+_mpc_sv8_find_frame(mpc_streaminfo *si, uint64_t sample, uint64_t *frame)
+{
+  off_t offset = si->header_position + 4;
+  off_t first_ap = -1;
+  off_t seek_table = -1;
+  uint64_t target;
+  uint64_t packet_frame = 0;
+  uint64_t size;
+  uint32_t header_size;
+  uint32_t frames_per_packet = 1 << si->block_pwr;
+  unsigned char key[2];
+
+  if (si->pcm_samples && sample >= si->pcm_samples) {
+    return -1;
+  }
+
+  // Frame numbers include the silence at the beginning
+  target = (sample + si->beg_silence) / MPC_FRAME_LENGTH;
+
+  // Find the seek table offset and the first audio packet
+  while ( (size = _mpc_sv8_packet(si, offset, key, &header_size)) > 0 ) {
+    if ( !memcmp(key, "AP", 2) ) {
+      first_ap = offset;
+      break;
+    }
+
+    if ( !memcmp(key, "SO", 2) && _check_buf(si->infile, si->buf, 1, MPC_MAX_PACKET_HEADER) ) {
+      uint64_t seek_table_offset;
+      _mpc_bits_get_size(si->buf, &seek_table_offset);
+
+      // Relative to the start of the SO packet
+      seek_table = offset + seek_table_offset;
+    }
+
+    offset += size;
+  }
+
+  if (first_ap < 0) {
+    return -1;
+  }
+
+  offset = first_ap;
+
+  if (seek_table > 0) {
+    off_t point_offset;
+    uint64_t point_frame;
+
+    if ( _mpc_sv8_seek_table(si, seek_table, target, &point_offset, &point_frame)
+      && _mpc_sv8_packet(si, point_offset, key, &header_size) && !memcmp(key, "AP", 2)
+    ) {
+      offset = point_offset;
+      packet_frame = point_frame;
+    }
+    else {
+      DEBUG_TRACE("Invalid seek table, hopping from the first packet\n");
+    }
+  }
+
+  DEBUG_TRACE("Seeking to frame %" PRIu64 " from frame %" PRIu64 " @ %" PRIu64 "\n", target, packet_frame, (uint64_t)offset);
+
+  while ( (size = _mpc_sv8_packet(si, offset, key, &header_size)) > 0 ) {
+    if ( !memcmp(key, "AP", 2) ) {
+      if (target < packet_frame + frames_per_packet) {
+        *frame = packet_frame;
+        return offset;
+      }
+
+      packet_frame += frames_per_packet;
+    }
+    else if ( !memcmp(key, "SE", 2) ) {
+      // End of stream
+      break;
+    }
+
+    offset += size;
+  }
+
+  return -1;
+}
+
+// Reads the ST packet at offset and returns the closest seek point at or before
+// frame. The first two offsets are stored as sizes, the rest as Golomb coded
+// differences from the offset predicted by the previous two.
+static int
+_mpc_sv8_seek_table(mpc_streaminfo *si, off_t offset, uint64_t frame, off_t *point_offset, uint64_t *point_frame)
+{
+  unsigned char key[2];
+  uint32_t header_size;
+  uint64_t size, count, i, point;
+  uint32_t seek_pwr;
+  int64_t last[2];
+  mpc_bits bits;
+
+  size = _mpc_sv8_packet(si, offset, key, &header_size);
+
+  if ( !size || memcmp(key, "ST", 2) || size - header_size > MPC_MAX_SEEK_TABLE ) {
+    return 0;
+  }
+
+  if ( !_check_buf(si->infile, si->buf, size - header_size, size - header_size) ) {
+    return 0;
+  }
+
+  bits.ptr = buffer_ptr(si->buf);
+  bits.end = bits.ptr + (size - header_size);
+  bits.bit = 0;
+
+  count    = _mpc_bits_read_size(&bits);
+  seek_pwr = si->block_pwr + _mpc_bits_read(&bits, 4);
+
+  if (!count) {
+    return 0;
+  }
+
+  point = frame >> seek_pwr;
+  if (point >= count) {
+    point = count - 1;
+  }
+
+  last[0] = si->header_position + _mpc_bits_read_size(&bits);
+
+  if (point > 0) {
+    last[1] = si->header_position + _mpc_bits_read_size(&bits);
+
+    for (i = 2; i <= point; i++) {
+      uint32_t code = _mpc_bits_golomb(&bits, 12);
+      int64_t diff = (code & 1) ? -(int64_t)(code >> 1) : (int64_t)(code >> 1);
+
+      last[i & 1] = diff + 2 * last[(i - 1) & 1] - last[i & 1];
+    }
+  }
+
+  if (bits.ptr > bits.end) {
+    // Ran past the end of the table
+    return 0;
+  }
+
+  *point_offset = last[point & 1];
+  *point_frame  = point << seek_pwr;
+
+  DEBUG_TRACE("Seek table: %" PRIu64 " points every %d frames, point %" PRIu64 " @ %" PRIu64 "\n", count, 1 << seek_pwr, point, (uint64_t)*point_offset);
+
+  return 1;
+}
+
+static uint32_t
+_mpc_bits_read(mpc_bits *bits, uint32_t n)
+{
+  uint32_t ret = 0;
+
+  while (n--) {
+    ret <<= 1;
+
+    if (bits->ptr < bits->end) {
+      ret |= (bits->ptr[0] >> (7 - bits->bit)) & 1;
+    }
+
+    if (++bits->bit == 8) {
+      bits->bit = 0;
+      bits->ptr++;
+    }
+  }
+
   return ret;
 }
+
+static uint64_t
+_mpc_bits_read_size(mpc_bits *bits)
+{
+  uint32_t tmp;
+  uint64_t size = 0;
+
+  do {
+    tmp = _mpc_bits_read(bits, 8);
+    size = (size << 7) | (tmp & 0x7F);
+  } while ( (tmp & 0x80) && bits->ptr < bits->end );
+
+  return size;
+}
+
+static uint32_t
+_mpc_bits_golomb(mpc_bits *bits, uint32_t k)
+{
+  uint32_t l = 0;
+
+  while ( !_mpc_bits_read(bits, 1) && bits->ptr < bits->end ) {
+    l++;
+  }
+
+  return (l << k) | _mpc_bits_read(bits, k);
+}
+
+// SV7 frames are stored in 32-bit little-endian words, starting from the most
+// significant bit, and each starts with its length in 20 bits. Walk the frame
+// lengths up to the frame with the sample.
+static int64_t
+_mpc_sv7_find_frame(mpc_streaminfo *si, uint64_t sample, uint64_t *frame, uint32_t *bit)
+{
+  uint64_t target = sample / MPC_FRAME_LENGTH;
+  uint64_t pos = MPC_SV7_FIRST_BIT;
+  uint64_t word = 0; // word at the start of the buffer
+  uint64_t i;
+
+  if (target >= si->frames) {
+    return -1;
+  }
+
+  buffer_clear(si->buf);
+  PerlIO_seek(si->infile, si->header_position, SEEK_SET);
+
+  for (i = 0; i < target; i++) {
+    unsigned char *bptr;
+    uint32_t shift = pos & 31;
+    uint64_t value;
+
+    // Move the buffer up to the word with the frame
+    if ( (pos >> 5) > word ) {
+      uint64_t skip = ((pos >> 5) - word) * 4;
+
+      if ( buffer_len(si->buf) >= skip ) {
+        buffer_consume(si->buf, skip);
+      }
+      else {
+        PerlIO_seek(si->infile, skip - buffer_len(si->buf), SEEK_CUR);
+        buffer_clear(si->buf);
+      }
+
+      word = pos >> 5;
+    }
+
+    // The length only needs the second word if it crosses into it
+    if ( si->header_position + word * 4 + (shift > 12 ? 8 : 4) > si->total_file_length ) {
+      return -1;
+    }
+
+    if ( !_check_buf(si->infile, si->buf, shift > 12 ? 8 : 4, MPC_BLOCK_SIZE * 8) ) {
+      return -1;
+    }
+
+    bptr = buffer_ptr(si->buf);
+    value = (uint64_t)get_u32le(bptr) << 32;
+    if (shift > 12) {
+      value |= get_u32le(bptr + 4);
+    }
+
+    pos += 20 + ((value >> (44 - shift)) & 0xFFFFF);
+  }
+
+  if ( si->header_position + (pos >> 3) >= si->total_file_length ) {
+    return -1;
+  }
+
+  *frame = target;
+  *bit   = pos & 31;
+
+  return si->header_position + (pos >> 5) * 4;
+}
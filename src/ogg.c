@@ -25,322 +25,121 @@ get_ogg_metadata(PerlIO *infile, char *file, HV *info, HV *tags)
 int
 _ogg_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
 {
-  Buffer ogg_buf, vorbis_buf;
+  ogg_reader r;
+  ogg_page last_page;
+  Buffer vorbis_buf;
   unsigned char *bptr;
-  unsigned int buf_size;
 
-  unsigned int id3_size = 0; // size of leading ID3 data
-
-  off_t file_size;           // total file size
   off_t audio_size;          // total size of audio without tags
   off_t audio_offset = 0;    // offset to audio
 
-  unsigned char ogghdr[28];
-  char header_type;
-  int serialno;
-  int final_serialno;
-  int pagenum;
-  uint8_t num_segments;
-  int pagelen;
-  int page = 0;
-  int packets = 0;
-  int streams = 0;
-
-  unsigned char vorbishdr[23];
   unsigned char channels;
   unsigned int blocksize_0 = 0;
-  unsigned int avg_buf_size;
   unsigned int samplerate = 0;
   unsigned int bitrate_nominal = 0;
-  uint64_t granule_pos = 0;
-
-  unsigned char vorbis_type = 0;
 
   int i;
   int err = 0;
 
-  buffer_init(&ogg_buf, OGG_BLOCK_SIZE);
+  _ogg_reader_init(&r, infile, file);
   buffer_init(&vorbis_buf, 0);
 
-  file_size = _file_size(infile);
-  my_hv_store( info, "file_size", newSVuv(file_size) );
+  my_hv_store( info, "file_size", newSVuv(r.file_size) );
+
+  // Skip ID3 tags if any
+  r.offset = _ogg_skip_id3(&r);
 
-  if ( !_check_buf(infile, &ogg_buf, 10, OGG_BLOCK_SIZE) ) {
+  if ( !_ogg_next_page(&r) ) {
+    PerlIO_printf(PerlIO_stderr(), "Not an Ogg file (bad OggS header): %s\n", file);
     err = -1;
     goto out;
   }
 
-  // Skip ID3 tags if any
-  bptr = (unsigned char *)buffer_ptr(&ogg_buf);
-  if (
-    (bptr[0] == 'I' && bptr[1] == 'D' && bptr[2] == '3') &&
-    bptr[3] < 0xff && bptr[4] < 0xff &&
-    bptr[6] < 0x80 && bptr[7] < 0x80 && bptr[8] < 0x80 && bptr[9] < 0x80
-  ) {
-    /* found an ID3 header... */
-    id3_size = 10 + (bptr[6]<<21) + (bptr[7]<<14) + (bptr[8]<<7) + bptr[9];
-
-    if (bptr[5] & 0x10) {
-      // footer present
-      id3_size += 10;
-    }
-
-    buffer_clear(&ogg_buf);
-
-    audio_offset += id3_size;
-
-    DEBUG_TRACE("Skipping ID3v2 tag of size %d\n", id3_size);
+  // Read packets from the first logical bitstream
+  r.serialno = r.page.serialno;
 
-    PerlIO_seek(infile, id3_size, SEEK_SET);
+  // Identification header
+  if ( !_ogg_read_packet(&r, &vorbis_buf) ) {
+    err = -1;
+    goto out;
   }
 
-  while (1) {
-    // Grab 28-byte Ogg header
-    if ( !_check_buf(infile, &ogg_buf, 28, OGG_BLOCK_SIZE) ) {
-      err = -1;
-      goto out;
-    }
-
-    buffer_get(&ogg_buf, ogghdr, 28);
-
-    audio_offset += 28;
-
-    // check that the first four bytes are 'OggS'
-    if ( ogghdr[0] != 'O' || ogghdr[1] != 'g' || ogghdr[2] != 'g' || ogghdr[3] != 'S' ) {
-      PerlIO_printf(PerlIO_stderr(), "Not an Ogg file (bad OggS header): %s\n", file);
-      goto out;
-    }
-
-    // Header type flag
-    header_type = ogghdr[5];
+  bptr = (unsigned char *)buffer_ptr(&vorbis_buf);
 
-    // Absolute granule position, used to find the first audio page
-    bptr = ogghdr + 6;
-    granule_pos = (uint64_t)CONVERT_INT32LE(bptr);
-    bptr += 4;
-    granule_pos |= (uint64_t)CONVERT_INT32LE(bptr) << 32;
-
-    // Stream serial number
-    serialno = CONVERT_INT32LE((ogghdr+14));
-
-    // Count start-of-stream pages
-    if ( header_type & 0x02 ) {
-      streams++;
-    }
-
-    // Keep track of packet count
-    if ( !(header_type & 0x01) ) {
-      packets++;
-    }
-
-    // stop processing if we reach the 3rd packet and have no data
-    if (packets > 2 * streams && !buffer_len(&vorbis_buf) ) {
-      break;
-    }
-
-    // Page seq number
-    pagenum = CONVERT_INT32LE((ogghdr+18));
-
-    if (page >= 0 && page == pagenum) {
-      page++;
-    }
-    else {
-      page = -1;
-      DEBUG_TRACE("Missing page(s) in Ogg file: %s\n", file);
-    }
-
-    DEBUG_TRACE("OggS page %d / packet %d at %d\n", pagenum, packets, (int)(audio_offset - 28));
-    DEBUG_TRACE("  granule_pos: %llu\n", granule_pos);
-
-    // If the granule_pos > 0, we have reached the end of headers and
-    // this is the first audio page
-    if (granule_pos > 0 && granule_pos != -1) {
-      // If seeking, don't waste time on comments
-      if (seeking) {
-        break;
-      }
+  if ( buffer_len(&vorbis_buf) < 30 || bptr[0] != 1 || strncmp( (char *)bptr + 1, "vorbis", 6 ) ) {
+    PerlIO_printf(PerlIO_stderr(), "Not a Vorbis file (bad vorbis header): %s\n", file);
+    err = -1;
+    goto out;
+  }
 
-      // Parse comments, but only if we have any extra data in the buffer
-      if ( buffer_len(&vorbis_buf) > 0 ) {
-        _parse_vorbis_comments(infile, &vorbis_buf, tags, 1);
-        DEBUG_TRACE("  parsed vorbis comments\n");
-      }
+  bptr += 7;
 
-      buffer_clear(&vorbis_buf);
+  my_hv_store( info, "version", newSViv( CONVERT_INT32LE(bptr) ) );
 
-      break;
-    }
+  channels = bptr[4];
+  my_hv_store( info, "channels", newSViv(channels) );
+  my_hv_store( info, "stereo", newSViv( channels == 2 ? 1 : 0 ) );
 
-    // Number of page segments
-    num_segments = ogghdr[26];
+  samplerate = CONVERT_INT32LE((bptr+5));
+  my_hv_store( info, "samplerate", newSViv(samplerate) );
+  my_hv_store( info, "bitrate_upper", newSViv( CONVERT_INT32LE((bptr+9)) ) );
 
-    // Calculate total page size
-    pagelen = ogghdr[27];
-    if (num_segments > 1) {
-      int i;
+  bitrate_nominal = CONVERT_INT32LE((bptr+13));
+  my_hv_store( info, "bitrate_nominal", newSViv(bitrate_nominal) );
+  my_hv_store( info, "bitrate_lower", newSViv( CONVERT_INT32LE((bptr+17)) ) );
 
-      if ( !_check_buf(infile, &ogg_buf, num_segments, OGG_BLOCK_SIZE) ) {
-        err = -1;
-        goto out;
-      }
+  blocksize_0 = 2 << ((bptr[21] & 0xF0) >> 4);
+  my_hv_store( info, "blocksize_0", newSViv( blocksize_0 ) );
+  my_hv_store( info, "blocksize_1", newSViv( 2 << (bptr[21] & 0x0F) ) );
 
-      for( i = 0; i < num_segments - 1; i++ ) {
-        u_char x;
-        x = buffer_get_char(&ogg_buf);
-        pagelen += x;
-      }
+  DEBUG_TRACE("  parsed vorbis info header\n");
 
-      audio_offset += num_segments - 1;
-    }
+  // Comment header, if seeking, don't waste time on comments
+  buffer_clear(&vorbis_buf);
+  _ogg_packet_begin(&r);
 
-    if ( !_check_buf(infile, &ogg_buf, pagelen, OGG_BLOCK_SIZE) ) {
-      err = -1;
-      goto out;
+  if ( _ogg_packet_read(&r, &vorbis_buf, 7) == 7 && !seeking ) {
+    if ( !strncmp( (char *)buffer_ptr(&vorbis_buf) + 1, "vorbis", 6 ) ) {
+      _ogg_parse_comments(&r, tags);
+      DEBUG_TRACE("  parsed vorbis comments\n");
     }
+  }
 
-    // Still don't have enough data, must have reached the end of the file
-    if ( buffer_len(&ogg_buf) < pagelen ) {
-      PerlIO_printf(PerlIO_stderr(), "Premature end of file: %s\n", file);
+  // Skip the framing bit, or the comments if not parsed
+  _ogg_packet_end(&r);
+  buffer_clear(&vorbis_buf);
 
+  // The first page with a granule_pos is the first audio page, this may
+  // be the page where the headers end
+  while ( r.page.serialno != r.serialno || r.page.granule_pos == 0 || r.page.granule_pos == (uint64_t)-1 ) {
+    if ( !_ogg_next_page(&r) ) {
       err = -1;
       goto out;
     }
-
-    audio_offset += pagelen;
-
-    // Copy page into vorbis buffer
-    buffer_append( &vorbis_buf, buffer_ptr(&ogg_buf), pagelen );
-    DEBUG_TRACE("  Read %d into vorbis buffer\n", pagelen);
-
-    // Process vorbis packet
-    if ( !vorbis_type ) {
-      vorbis_type = buffer_get_char(&vorbis_buf);
-      // Verify 'vorbis' string
-      if ( strncmp( buffer_ptr(&vorbis_buf), "vorbis", 6 ) ) {
-        PerlIO_printf(PerlIO_stderr(), "Not a Vorbis file (bad vorbis header): %s\n", file);
-        goto out;
-      }
-      buffer_consume( &vorbis_buf, 6 );
-
-      DEBUG_TRACE("  Found vorbis packet type %d\n", vorbis_type);
-    }
-
-    if (vorbis_type == 1) {
-      // Parse info
-      // Grab 23-byte Vorbis header
-      if ( buffer_len(&vorbis_buf) < 23 ) {
-        PerlIO_printf(PerlIO_stderr(), "Not a Vorbis file (bad vorbis header): %s\n", file);
-        goto out;
-      }
-
-      buffer_get(&vorbis_buf, vorbishdr, 23);
-
-      my_hv_store( info, "version", newSViv( CONVERT_INT32LE(vorbishdr) ) );
-
-      channels = vorbishdr[4];
-      my_hv_store( info, "channels", newSViv(channels) );
-      my_hv_store( info, "stereo", newSViv( channels == 2 ? 1 : 0 ) );
-
-      samplerate = CONVERT_INT32LE((vorbishdr+5));
-      my_hv_store( info, "samplerate", newSViv(samplerate) );
-      my_hv_store( info, "bitrate_upper", newSViv( CONVERT_INT32LE((vorbishdr+9)) ) );
-
-      bitrate_nominal = CONVERT_INT32LE((vorbishdr+13));
-      my_hv_store( info, "bitrate_nominal", newSViv(bitrate_nominal) );
-      my_hv_store( info, "bitrate_lower", newSViv( CONVERT_INT32LE((vorbishdr+17)) ) );
-
-      blocksize_0 = 2 << ((vorbishdr[21] & 0xF0) >> 4);
-      my_hv_store( info, "blocksize_0", newSViv( blocksize_0 ) );
-      my_hv_store( info, "blocksize_1", newSViv( 2 << (vorbishdr[21] & 0x0F) ) );
-
-      DEBUG_TRACE("  parsed vorbis info header\n");
-
-      buffer_clear(&vorbis_buf);
-      vorbis_type = 0;
-    }
-
-    // Skip rest of this page
-    buffer_consume( &ogg_buf, pagelen );
   }
 
-  buffer_clear(&ogg_buf);
-
-  // audio_offset is 28 less because we read the Ogg header
-  audio_offset -= 28;
+  audio_offset = r.page.offset;
 
   // from the first packet past the comments
   my_hv_store( info, "audio_offset", newSViv(audio_offset) );
 
-  audio_size = file_size - audio_offset;
+  audio_size = r.file_size - audio_offset;
   my_hv_store( info, "audio_size", newSVuv(audio_size) );
 
-  my_hv_store( info, "serial_number", newSVuv(serialno) );
-
-  // calculate average bitrate and duration
-  avg_buf_size = blocksize_0 * 2;
-  if ( file_size > avg_buf_size ) {
-    DEBUG_TRACE("Seeking to %d to calculate bitrate/duration\n", (int)(file_size - avg_buf_size));
-    PerlIO_seek(infile, file_size - avg_buf_size, SEEK_SET);
-  }
-  else {
-    DEBUG_TRACE("Seeking to %d to calculate bitrate/duration\n", (int)audio_offset);
-    PerlIO_seek(infile, audio_offset, SEEK_SET);
-  }
-
-  if ( PerlIO_read(infile, buffer_append_space(&ogg_buf, avg_buf_size), avg_buf_size) == 0 ) {
-    if ( PerlIO_error(infile) ) {
-      PerlIO_printf(PerlIO_stderr(), "Error reading: %s\n", strerror(errno));
-    }
-    else {
-      PerlIO_printf(PerlIO_stderr(), "File too small. Probably corrupted.\n");
-    }
-
-    err = -1;
-    goto out;
-  }
-
-  // Find sync
-  bptr = (unsigned char *)buffer_ptr(&ogg_buf);
-  buf_size = buffer_len(&ogg_buf);
-  while (
-    buf_size >= 14
-    && (bptr[0] != 'O' || bptr[1] != 'g' || bptr[2] != 'g' || bptr[3] != 'S')
-  ) {
-    bptr++;
-    buf_size--;
-
-    if ( buf_size < 14 ) {
-      // Give up, use less accurate bitrate for length
-      DEBUG_TRACE("buf_size %d, using less accurate bitrate for length\n", buf_size);
-
-      my_hv_store( info, "song_length_ms", newSVpvf( "%d", (int)((audio_size * 8) / bitrate_nominal) * 1000) );
-      my_hv_store( info, "bitrate_average", newSViv(bitrate_nominal) );
-
-      goto out;
-    }
-  }
-  bptr += 6;
-
-  // Get absolute granule value
-  granule_pos = (uint64_t)CONVERT_INT32LE(bptr);
-  bptr += 4;
-  granule_pos |= (uint64_t)CONVERT_INT32LE(bptr) << 32;
-  bptr += 4;
+  my_hv_store( info, "serial_number", newSVuv(r.serialno) );
 
-  // Get serial number of this page, if the serial doesn't match the beginning of the file
-  // we have changed logical bitstreams and can't use the granule_pos for bitrate
-  final_serialno = CONVERT_INT32LE((bptr));
-
-  if ( granule_pos && samplerate && serialno == final_serialno ) {
+  // calculate average bitrate and duration from the last page of this stream,
+  // pages of other logical bitstreams are skipped
+  if ( _ogg_last_page(&r, audio_offset, &last_page) && last_page.granule_pos && samplerate ) {
     // XXX: needs to adjust for initial granule value if file does not start at 0 samples
-    int length = (int)((granule_pos * 1.0 / samplerate) * 1000);
+    int length = (int)((last_page.granule_pos * 1.0 / samplerate) * 1000);
     my_hv_store( info, "song_length_ms", newSVuv(length) );
     my_hv_store( info, "bitrate_average", newSVuv( _bitrate(audio_size, length) ) );
 
-    DEBUG_TRACE("Using granule_pos %llu / samplerate %d to calculate bitrate/duration\n", granule_pos, samplerate);
+    DEBUG_TRACE("Using granule_pos %" PRIu64 " / samplerate %d to calculate bitrate/duration\n", last_page.granule_pos, samplerate);
   }
-  else {
-    // Use nominal bitrate
+  else if (bitrate_nominal) {
+    // Use nominal bitrate, the last page may also be missing if the file is too small
     my_hv_store( info, "song_length_ms", newSVpvf( "%d", (int)((audio_size * 8) / bitrate_nominal) * 1000) );
     my_hv_store( info, "bitrate_average", newSVuv(bitrate_nominal) );
 
@@ -348,7 +147,7 @@ _ogg_parse(PerlIO *infile, char *file, HV *info, HV *tags, uint8_t seeking)
   }
 
 out:
-  buffer_free(&ogg_buf);
+  _ogg_reader_free(&r);
   buffer_free(&vorbis_buf);
 
   if (err) return err;
@@ -394,7 +193,6 @@ _parse_vorbis_comments(PerlIO *infile, Buffer *vorbis_buf, HV *tags, int has_fra
 #endif
     ) {
       // parse METADATA_BLOCK_PICTURE according to http://wiki.xiph.org/VorbisComment#METADATA_BLOCK_PICTURE
-      AV *pictures;
       HV *picture;
       Buffer pic_buf;
       uint32_t pic_length;
@@ -415,20 +213,7 @@ _parse_vorbis_comments(PerlIO *infile, Buffer *vorbis_buf, HV *tags, int has_fra
       else {
         DEBUG_TRACE("  found picture of length %d\n", pic_length);
 
-        if ( my_hv_exists(tags, "ALLPICTURES") ) {
-          SV **entry = my_hv_fetch(tags, "ALLPICTURES");
-          if (entry != NULL) {
-            pictures = (AV *)SvRV(*entry);
-            av_push( pictures, newRV_noinc( (SV *)picture ) );
-          }
-        }
-        else {
-          pictures = newAV();
-
-          av_push( pictures, newRV_noinc( (SV *)picture ) );
-
-          my_hv_store( tags, "ALLPICTURES", newRV_noinc( (SV *)pictures ) );
-        }
+        _vorbis_add_picture(tags, picture);
       }
 
       buffer_free(&pic_buf);
@@ -441,17 +226,7 @@ _parse_vorbis_comments(PerlIO *infile, Buffer *vorbis_buf, HV *tags, int has_fra
 #endif
     ) {
       // decode COVERART into ALLPICTURES
-      AV *pictures;
-      HV *picture = newHV();
-
-      // Fill in recommended default values for most of the picture hash
-      my_hv_store( picture, "color_index", newSVuv(0) );
-      my_hv_store( picture, "depth", newSVuv(0) );
-      my_hv_store( picture, "description", newSVpvn("", 0) );
-      my_hv_store( picture, "height", newSVuv(0) );
-      my_hv_store( picture, "width", newSVuv(0) );
-      my_hv_store( picture, "mime_type", newSVpvn("image/", 6) ); // As recommended, real mime should be in COVERARTMIME
-      my_hv_store( picture, "picture_type", newSVuv(0) ); // Other
+      HV *picture = _vorbis_coverart_picture();
 
       if ( _env_true("AUDIO_SCAN_NO_ARTWORK") ) {
         my_hv_store( picture, "image_data", newSVuv(len - 9) );
@@ -468,20 +243,7 @@ _parse_vorbis_comments(PerlIO *infile, Buffer *vorbis_buf, HV *tags, int has_fra
         buffer_consume(vorbis_buf, len - 9);
       }
 
-      if ( my_hv_exists(tags, "ALLPICTURES") ) {
-        SV **entry = my_hv_fetch(tags, "ALLPICTURES");
-        if (entry != NULL) {
-          pictures = (AV *)SvRV(*entry);
-          av_push( pictures, newRV_noinc( (SV *)picture ) );
-        }
-      }
-      else {
-        pictures = newAV();
-
-        av_push( pictures, newRV_noinc( (SV *)picture ) );
-
-        my_hv_store( tags, "ALLPICTURES", newRV_noinc( (SV *)pictures ) );
-      }
+      _vorbis_add_picture(tags, picture);
     }
     else {
       New(0, tmp, (int)len + 1, char);
@@ -500,193 +262,1019 @@ _parse_vorbis_comments(PerlIO *infile, Buffer *vorbis_buf, HV *tags, int has_fra
   }
 }
 
-static int
-ogg_find_frame(PerlIO *infile, char *file, int offset)
+// Parse the comments of an Ogg comment header straight from the packet, so only the
+// comment being parsed is ever held in memory. With AUDIO_SCAN_NO_ARTWORK, pictures
+// are skipped by length after decoding just the picture header.
+void
+_ogg_parse_comments(ogg_reader *r, HV *tags)
 {
-  int frame_offset = -1;
-  uint32_t samplerate;
-  uint32_t song_length_ms;
-  uint64_t target_sample;
+  Buffer buf;
+  uint32_t len;
+  uint32_t num_comments;
+  char *bptr;
+  SV *vendor;
 
-  // We need to read all metadata first to get some data we need to calculate
-  HV *info = newHV();
-  HV *tags = newHV();
-  if ( _ogg_parse(infile, file, info, tags, 1) != 0 ) {
-    goto out;
-  }
+  buffer_init(&buf, 64);
 
-  song_length_ms = SvIV( *(my_hv_fetch( info, "song_length_ms" )) );
-  if (offset >= song_length_ms) {
+  // Vendor string
+  if ( _ogg_packet_read(r, &buf, 4) < 4 ) {
     goto out;
   }
 
-  samplerate = SvIV( *(my_hv_fetch( info, "samplerate" )) );
+  len = buffer_get_int_le(&buf);
 
-  // Determine target sample we're looking for
-  target_sample = ((offset - 1) / 10) * (samplerate / 100);
-  DEBUG_TRACE("Looking for target sample %llu\n", target_sample);
+  if ( _ogg_packet_read(r, &buf, len) < len ) {
+    DEBUG_TRACE("invalid Vorbis vendor length: %u\n", len);
+    goto out;
+  }
 
-  frame_offset = _ogg_binary_search_sample(infile, file, info, target_sample);
+  vendor = newSVpvn( buffer_ptr(&buf), len );
+  sv_utf8_decode(vendor);
+  my_hv_store( tags, "VENDOR", vendor );
+  buffer_clear(&buf);
 
-out:
-  // Don't leak
-  SvREFCNT_dec(info);
-  SvREFCNT_dec(tags);
+  // Number of comments
+  if ( _ogg_packet_read(r, &buf, 4) < 4 ) {
+    goto out;
+  }
 
-  return frame_offset;
-}
+  num_comments = buffer_get_int_le(&buf);
 
-int
-_ogg_binary_search_sample(PerlIO *infile, char *file, HV *info, uint64_t target_sample)
-{
-  Buffer buf;
-  unsigned char *bptr;
-  unsigned int buf_size;
-  int frame_offset = -1;
-  int prev_frame_offset = -1;
-  uint64_t granule_pos = 0;
-  uint64_t prev_granule_pos = 0;
-  uint32_t cur_serialno;
-  off_t low;
-  off_t high;
-  off_t mid;
-  int i;
+  while (num_comments--) {
+    uint32_t n;
 
-  off_t audio_offset = SvIV( *(my_hv_fetch( info, "audio_offset" )) );
-  off_t file_size    = SvIV( *(my_hv_fetch( info, "file_size" )) );
-  uint32_t serialno  = SvIV( *(my_hv_fetch( info, "serial_number" )) );
+    buffer_clear(&buf);
 
-  // Binary search the entire file
-  low  = audio_offset;
-  high = file_size;
+    if ( _ogg_packet_read(r, &buf, 4) < 4 ) {
+      break;
+    }
 
-  // We need enough for at least 2 packets
-  buffer_init(&buf, OGG_BLOCK_SIZE * 2);
+    len = buffer_get_int_le(&buf);
 
-  while (low <= high) {
-    off_t packet_offset;
+    // Enough to tell picture comments apart from the rest
+    n = len < 9 ? len : 9;
+    if ( _ogg_packet_read(r, &buf, n) < n ) {
+      DEBUG_TRACE("invalid Vorbis comment length: %u\n", len);
+      break;
+    }
 
-    mid = low + ((high - low) / 2);
+    bptr = buffer_ptr(&buf);
 
-    DEBUG_TRACE("  Searching for sample %llu between %d and %d (mid %d)\n", target_sample, (int)low, (int)high, (int)mid);
+    if (
+      len >= 23 &&
+#ifdef _MSC_VER
+      !strnicmp(bptr, "METADATA_", 9)
+#else
+      !strncasecmp(bptr, "METADATA_", 9)
+#endif
+    ) {
+      if ( _ogg_packet_read(r, &buf, 14) < 14 ) {
+        break;
+      }
 
-    if (mid > file_size - 28) {
-      DEBUG_TRACE("  Reached end of file, aborting\n");
-      frame_offset = -1;
-      goto out;
+      bptr = buffer_ptr(&buf);
     }
 
-    if ( (PerlIO_seek(infile, mid, SEEK_SET)) == -1 ) {
-      frame_offset = -1;
-      goto out;
+    if (
+      len >= 23 &&
+#ifdef _MSC_VER
+      !strnicmp(bptr, "METADATA_BLOCK_PICTURE=", 23)
+#else
+      !strncasecmp(bptr, "METADATA_BLOCK_PICTURE=", 23)
+#endif
+    ) {
+      _ogg_parse_picture(r, len - 23, tags);
     }
+    else if (
+      len >= 9 &&
+#ifdef _MSC_VER
+      !strnicmp(bptr, "COVERART=", 9)
+#else
+      !strncasecmp(bptr, "COVERART=", 9)
+#endif
+    ) {
+      HV *picture = _vorbis_coverart_picture();
+      uint32_t chars = len - 9;
 
-    if ( !_check_buf(infile, &buf, 28, OGG_BLOCK_SIZE * 2) ) {
-      frame_offset = -1;
-      goto out;
-    }
+      if ( _env_true("AUDIO_SCAN_NO_ARTWORK") ) {
+        my_hv_store( picture, "image_data", newSVuv(chars) );
+      }
+      else {
+        SV *data = newSVpvn("", 0);
 
-    bptr = buffer_ptr(&buf);
-    buf_size = buffer_len(&buf);
-
-    // Find all packets within this buffer, we need at least 2 packets
-    // to figure out what samples we have
-    while (buf_size >= 4) {
-      // Save info from previous packet
-      prev_frame_offset = frame_offset;
-      prev_granule_pos  = granule_pos;
-
-      while (
-        buf_size >= 4
-        &&
-        (bptr[0] != 'O' || bptr[1] != 'g' || bptr[2] != 'g' || bptr[3] != 'S')
-      ) {
-        bptr++;
-        buf_size--;
+        _ogg_read_base64_sv(r, &buf, &chars, data, chars / 4 * 3 + 2);
+        DEBUG_TRACE("  found picture of length %d\n", (int)SvCUR(data));
+
+        my_hv_store( picture, "image_data", data );
       }
 
-      if (buf_size < 4) {
-        // No more packets found in buffer
+      _ogg_packet_read(r, NULL, chars);
+
+      _vorbis_add_picture(tags, picture);
+    }
+    else {
+      n = len - buffer_len(&buf);
+      if ( _ogg_packet_read(r, &buf, n) < n ) {
+        DEBUG_TRACE("invalid Vorbis comment length: %u\n", len);
         break;
       }
 
-      // Remember how far into the buffer this packet is
-      packet_offset = buffer_len(&buf) - buf_size;
+      // NUL-terminate for _split_vorbis_comment
+      buffer_put_char(&buf, 0);
 
-      frame_offset = mid + packet_offset;
+      _split_vorbis_comment( buffer_ptr(&buf), tags );
+    }
+  }
 
-      // Make sure we have at least the Ogg header
-      if ( !_check_buf(infile, &buf, 28, 28) ) {
-        frame_offset = -1;
-        goto out;
-      }
+out:
+  buffer_free(&buf);
+}
 
-      // Read granule_pos for this packet
-      bptr = buffer_ptr(&buf);
-      bptr += packet_offset + 6;
-      granule_pos = (uint64_t)CONVERT_INT32LE(bptr);
-      bptr += 4;
-      granule_pos |= (uint64_t)CONVERT_INT32LE(bptr) << 32;
-      bptr += 4;
-      buf_size -= 14;
-
-      // Also read serial number, if this ever changes within a file it is a chained
-      // file and we can't seek
-      cur_serialno = CONVERT_INT32LE(bptr);
-
-      if (serialno != cur_serialno) {
-        DEBUG_TRACE("  serial number changed to %x, aborting seek\n", cur_serialno);
-        frame_offset = -1;
-        goto out;
-      }
+// METADATA_BLOCK_PICTURE is a base64-encoded FLAC picture block, decode the header
+// a piece at a time as the mime type and description lengths become known
+static void
+_ogg_parse_picture(ogg_reader *r, uint32_t chars, HV *tags)
+{
+  Buffer hdr;
+  Buffer tmp;
+  HV *picture = NULL;
+  uint32_t pic_length;
+  uint32_t want = 8; // picture_type and mime_length
+  uint8_t step = 0;
+  unsigned char *bptr;
+  int i;
 
-      DEBUG_TRACE("  frame offset: %d, prev_frame_offset: %d, granule_pos: %llu, prev_granule_pos %llu\n",
-        frame_offset, prev_frame_offset, granule_pos, prev_granule_pos
-      );
+  buffer_init(&hdr, 64);
+  buffer_init(&tmp, OGG_BLOCK_SIZE);
 
-      // Break out after reading 2 packets
-      if (granule_pos && prev_granule_pos) {
+  while (step < 3) {
+    while ( buffer_len(&hdr) < want ) {
+      uint32_t max = (want - buffer_len(&hdr) + 2) / 3 * 3;
+      uint32_t n = _ogg_read_base64( r, &tmp, &chars, buffer_append_space(&hdr, max), max );
+
+      buffer_consume_end(&hdr, max - n);
+
+      if (n < max) {
         break;
       }
     }
 
-    // Now, we know the first (prev_granule_pos + 1) and last (granule_pos) samples
-    // in the packet starting at frame_offset
-
-    if ((prev_granule_pos + 1) <= target_sample && granule_pos >= target_sample) {
-      // found frame
-      DEBUG_TRACE("  found frame at %d\n", frame_offset);
+    if ( buffer_len(&hdr) < want ) {
       goto out;
     }
 
-    if (target_sample < (prev_granule_pos + 1)) {
-      // Special case when very first frame has the sample
-      if (prev_frame_offset == audio_offset) {
-        DEBUG_TRACE("  first frame has target sample\n");
-        frame_offset = prev_frame_offset;
-        break;
+    if (step < 2) {
+      // mime_length or desc_length is at the end of what we have so far
+      uint32_t len;
+
+      bptr = (unsigned char *)buffer_ptr(&hdr) + want - 4;
+      len = GET_INT32BE(bptr);
+
+      // The header can't be longer than what's left of the comment
+      if ( len > chars + buffer_len(&hdr) ) {
+        goto out;
       }
 
-      high = mid - 1;
-      DEBUG_TRACE("  high = %d\n", (int)high);
-    }
-    else {
-      low = mid + 1;
-      DEBUG_TRACE("  low = %d\n", (int)low);
+      // mime type and desc_length, or description, width, height, depth, color_index and pic_length
+      want += len + (step == 0 ? 4 : 20);
     }
 
-    // XXX this can be pretty inefficient in some cases
+    step++;
+  }
 
-    // Reset and binary search again
-    buffer_clear(&buf);
+  picture = _decode_flac_picture_header(r->infile, &hdr, &pic_length);
+  if ( !picture ) {
+    goto out;
+  }
+
+  DEBUG_TRACE("  found picture of length %d\n", pic_length);
+
+  if ( _env_true("AUDIO_SCAN_NO_ARTWORK") ) {
+    my_hv_store( picture, "image_data", newSVuv(pic_length) );
+  }
+  else {
+    // Decode the image straight into the scalar, starting with what was
+    // decoded along with the header
+    SV *data = newSV(pic_length + 3);
+    uint32_t have = buffer_len(&hdr) < pic_length ? buffer_len(&hdr) : pic_length;
+
+    SvPOK_only(data);
+    Copy( buffer_ptr(&hdr), SvPVX(data), have, char );
+    SvCUR_set(data, have);
+
+    _ogg_read_base64_sv(r, &tmp, &chars, data, pic_length);
+
+    if ( SvCUR(data) < pic_length ) {
+      SvREFCNT_dec(data);
+      SvREFCNT_dec( (SV *)picture );
+      picture = NULL;
+      goto out;
+    }
 
-    frame_offset = -1;
-    granule_pos = 0;
+    my_hv_store( picture, "image_data", data );
   }
 
+  _vorbis_add_picture(tags, picture);
+
 out:
-  buffer_free(&buf);
+  if ( !picture ) {
+    PerlIO_printf(PerlIO_stderr(), "Invalid Vorbis METADATA_BLOCK_PICTURE comment\n");
+  }
 
-  return frame_offset;
+  // Skip anything not decoded
+  _ogg_packet_read(r, NULL, chars);
+
+  buffer_free(&hdr);
+  buffer_free(&tmp);
+}
+
+// Decode base64 from the current packet into dst, *chars is the number of base64
+// characters left in the comment. At most max bytes are written, max must be a
+// multiple of 3. Returns the number of bytes written, less than max at the end of
+// the data.
+static uint32_t
+_ogg_read_base64(ogg_reader *r, Buffer *tmp, uint32_t *chars, unsigned char *dst, uint32_t max)
+{
+  uint32_t want = max / 3 * 4;
+  uint32_t got;
+
+  if (want > *chars) {
+    want = *chars;
+  }
+
+  buffer_clear(tmp);
+  got = _ogg_packet_read(r, tmp, want);
+  *chars -= got;
+
+  if (got < want) {
+    // Packet ended early
+    *chars = 0;
+  }
+
+  return _decode_base64_block( (unsigned char *)buffer_ptr(tmp), got, dst );
 }
 
+// Decode base64 from the current packet onto the end of data, until it is limit bytes long
+static uint32_t
+_ogg_read_base64_sv(ogg_reader *r, Buffer *tmp, uint32_t *chars, SV *data, uint32_t limit)
+{
+  while ( SvCUR(data) < limit && *chars ) {
+    uint32_t max = limit - SvCUR(data);
+    uint32_t n;
+
+    if (max > OGG_BLOCK_SIZE / 4 * 3) {
+      max = OGG_BLOCK_SIZE / 4 * 3;
+    }
+
+    max = (max + 2) / 3 * 3;
+
+    SvGROW(data, SvCUR(data) + max + 1);
+    n = _ogg_read_base64( r, tmp, chars, (unsigned char *)SvPVX(data) + SvCUR(data), max );
+    SvCUR_set( data, SvCUR(data) + n );
+
+    if (n < max) {
+      break;
+    }
+  }
+
+  if ( SvCUR(data) > limit ) {
+    SvCUR_set(data, limit);
+  }
+
+  return SvCUR(data);
+}
+
+static void
+_vorbis_add_picture(HV *tags, HV *picture)
+{
+  AV *pictures;
+
+  if ( my_hv_exists(tags, "ALLPICTURES") ) {
+    SV **entry = my_hv_fetch(tags, "ALLPICTURES");
+    if (entry != NULL) {
+      pictures = (AV *)SvRV(*entry);
+      av_push( pictures, newRV_noinc( (SV *)picture ) );
+    }
+  }
+  else {
+    pictures = newAV();
+
+    av_push( pictures, newRV_noinc( (SV *)picture ) );
+
+    my_hv_store( tags, "ALLPICTURES", newRV_noinc( (SV *)pictures ) );
+  }
+}
+
+// COVERART only has the image, fill in recommended default values for the rest of the picture hash
+static HV *
+_vorbis_coverart_picture(void)
+{
+  HV *picture = newHV();
+
+  my_hv_store( picture, "color_index", newSVuv(0) );
+  my_hv_store( picture, "depth", newSVuv(0) );
+  my_hv_store( picture, "description", newSVpvn("", 0) );
+  my_hv_store( picture, "height", newSVuv(0) );
+  my_hv_store( picture, "width", newSVuv(0) );
+  my_hv_store( picture, "mime_type", newSVpvn("image/", 6) ); // As recommended, real mime should be in COVERARTMIME
+  my_hv_store( picture, "picture_type", newSVuv(0) ); // Other
+
+  return picture;
+}
+
+static int
+ogg_find_frame(PerlIO *infile, char *file, int offset)
+{
+  int frame_offset = -1;
+  uint32_t samplerate;
+  uint32_t song_length_ms;
+  uint64_t target_sample;
+
+  // We need to read all metadata first to get some data we need to calculate
+  HV *info = newHV();
+  HV *tags = newHV();
+  if ( _ogg_parse(infile, file, info, tags, 1) != 0 ) {
+    goto out;
+  }
+
+  // Without the last page the length and the search range are unknown
+  if ( !my_hv_exists(info, "song_length_ms") ) {
+    goto out;
+  }
+
+  song_length_ms = SvIV( *(my_hv_fetch( info, "song_length_ms" )) );
+  if (offset >= song_length_ms) {
+    goto out;
+  }
+
+  samplerate = SvIV( *(my_hv_fetch( info, "samplerate" )) );
+
+  // Determine target sample we're looking for
+  target_sample = ((offset - 1) / 10) * (samplerate / 100);
+  DEBUG_TRACE("Looking for target sample %llu\n", target_sample);
+
+  frame_offset = _ogg_search_sample(infile, file, info, target_sample);
+
+out:
+  // Don't leak
+  SvREFCNT_dec(info);
+  SvREFCNT_dec(tags);
+
+  return frame_offset;
+}
+
+// Find the page containing target_sample, using the granule positions of the
+// pages found so far to interpolate where it should be
+int
+_ogg_search_sample(PerlIO *infile, char *file, HV *info, uint64_t target_sample)
+{
+  ogg_reader r;
+  ogg_page_hdr page;
+  int frame_offset = -1;
+  int ret;
+  off_t limit;
+  off_t pos;
+  uint8_t bisect = 0;
+
+  off_t audio_offset = SvIV( *(my_hv_fetch( info, "audio_offset" )) );
+  uint32_t samplerate     = SvIV( *(my_hv_fetch( info, "samplerate" )) );
+  uint32_t song_length_ms = SvIV( *(my_hv_fetch( info, "song_length_ms" )) );
+
+  // The target is between the end of the low page and the start of the high page,
+  // the high page being the first page known to contain the target
+  off_t low;
+  off_t high;
+  uint64_t low_granule  = 0;
+  uint64_t high_granule = (uint64_t)song_length_ms * samplerate / 1000;
+
+  if (high_granule <= target_sample) {
+    high_granule = target_sample + 1;
+  }
+
+  _ogg_reader_init(&r, infile, file);
+  r.serialno = SvIV( *(my_hv_fetch( info, "serial_number" )) );
+
+  low   = audio_offset;
+  high  = r.file_size;
+  limit = high;
+
+  while (limit - low > OGG_BLOCK_SIZE) {
+    off_t guess;
+
+    if (bisect) {
+      // The last guess was past the final page before high, try halfway
+      guess = low + (limit - low) / 2;
+    }
+    else {
+      guess = low + (off_t)( (double)(target_sample - low_granule) / (high_granule - low_granule) * (high - low) );
+
+      // Aim a little early so we land on the page before the target rather than after it
+      guess -= OGG_BLOCK_SIZE;
+      if (guess < low) {
+        guess = low;
+      }
+      else if (guess >= limit) {
+        guess = limit - 1;
+      }
+    }
+
+    DEBUG_TRACE("  Searching for sample %" PRIu64 " between %" PRIu64 " (%" PRIu64 ") and %" PRIu64 " (%" PRIu64 "), guess %" PRIu64 "\n",
+      target_sample, (uint64_t)low, low_granule, (uint64_t)high, high_granule, (uint64_t)guess);
+
+    ret = _ogg_seek_page(&r, guess, high, &page);
+
+    if (ret == 0) {
+      // No page starts between guess and high
+      limit  = guess;
+      bisect = 1;
+      continue;
+    }
+
+    if (page.granule_pos < target_sample) {
+      low = page.offset + page.size;
+      low_granule = page.granule_pos;
+    }
+    else {
+      high = page.offset;
+      high_granule = page.granule_pos;
+    }
+
+    limit  = high;
+    bisect = 0;
+  }
+
+  // Walk the remaining pages
+  pos = low;
+  while (pos < high) {
+    ret = _ogg_seek_page(&r, pos, high, &page);
+
+    if (ret == 0) {
+      break;
+    }
+
+    if (page.granule_pos >= target_sample) {
+      high = page.offset;
+      break;
+    }
+
+    pos = page.offset + page.size;
+  }
+
+  if (high < r.file_size) {
+    DEBUG_TRACE("  found frame at %" PRIu64 "\n", (uint64_t)high);
+    frame_offset = high;
+  }
+
+  _ogg_reader_free(&r);
+
+  return frame_offset;
+}
+
+// Find the first page of the stream at or after offset with a granule position, starting
+// before limit. Returns 1 if found, 0 if not.
+int
+_ogg_seek_page(ogg_reader *r, off_t offset, off_t limit, ogg_page_hdr *page)
+{
+  off_t pos = offset;
+  uint32_t i;
+  int cached = (r->cache_next + OGG_PAGE_CACHE_SIZE - 1) % OGG_PAGE_CACHE_SIZE;
+
+  // Any page we have already found from an earlier offset up to this offset
+  for (i = 0; i < r->cache_len; i++) {
+    ogg_page_hdr *hdr = &r->cache[ (cached + OGG_PAGE_CACHE_SIZE - i) % OGG_PAGE_CACHE_SIZE ];
+
+    if (hdr->probe <= offset && offset <= hdr->offset) {
+      if (hdr->offset >= limit) {
+        return 0;
+      }
+
+      DEBUG_TRACE("  cached page at %" PRIu64 "\n", (uint64_t)hdr->offset);
+      *page = *hdr;
+      return 1;
+    }
+  }
+
+  while ( _ogg_sync_page(r, pos, limit, &r->page) ) {
+    pos = r->page.offset;
+
+    // Pages of other multiplexed or chained streams don't tell us anything
+    // about our granule positions
+    if (r->page.serialno != r->serialno) {
+      DEBUG_TRACE("  skipping page of stream %x\n", r->page.serialno);
+      pos += r->page.size;
+      continue;
+    }
+
+    if (r->page.granule_pos == (uint64_t)-1) {
+      // No packet ends on this page
+      pos += r->page.size;
+      continue;
+    }
+
+    DEBUG_TRACE("  page at %" PRIu64 ", size %d, granule_pos %" PRIu64 "\n", (uint64_t)pos, r->page.size, r->page.granule_pos);
+
+    page->offset      = pos;
+    page->probe       = offset;
+    page->size        = r->page.size;
+    page->granule_pos = r->page.granule_pos;
+
+    r->cache[r->cache_next] = *page;
+    r->cache_next = (r->cache_next + 1) % OGG_PAGE_CACHE_SIZE;
+    if (r->cache_len < OGG_PAGE_CACHE_SIZE) {
+      r->cache_len++;
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
+
+// Find the first valid page header at or after offset, starting before limit
+int
+_ogg_sync_page(ogg_reader *r, off_t offset, off_t limit, ogg_page *page)
+{
+  unsigned char *bptr;
+  off_t pos = offset;
+  uint32_t avail;
+  uint32_t i;
+
+  while (pos < limit && pos + OGG_HEADER_SIZE <= r->file_size) {
+    avail = r->file_size - pos < OGG_BLOCK_SIZE ? r->file_size - pos : OGG_BLOCK_SIZE;
+
+    if ( !_ogg_reader_fill(r, pos, avail) ) {
+      return 0;
+    }
+
+    // Sync to the next capture pattern
+    bptr = buffer_ptr(&r->buf);
+    for (i = 0; i + 4 <= avail; i++) {
+      if (bptr[i] == 'O' && bptr[i + 1] == 'g' && bptr[i + 2] == 'g' && bptr[i + 3] == 'S') {
+        break;
+      }
+    }
+
+    if (i + 4 > avail) {
+      pos += avail - 3;
+      continue;
+    }
+
+    pos += i;
+
+    if (pos >= limit) {
+      break;
+    }
+
+    if ( _ogg_parse_page(r, pos, page) ) {
+      return 1;
+    }
+
+    // Not a page header
+    pos++;
+  }
+
+  return 0;
+}
+
+// Returns the offset of the first byte after any leading ID3v2 tag
+off_t
+_ogg_skip_id3(ogg_reader *r)
+{
+  unsigned char *bptr;
+  off_t id3_size = 0;
+
+  if ( r->file_size < 10 || !_ogg_reader_fill(r, 0, 10) ) {
+    return 0;
+  }
+
+  bptr = (unsigned char *)buffer_ptr(&r->buf);
+  if (
+    (bptr[0] == 'I' && bptr[1] == 'D' && bptr[2] == '3') &&
+    bptr[3] < 0xff && bptr[4] < 0xff &&
+    bptr[6] < 0x80 && bptr[7] < 0x80 && bptr[8] < 0x80 && bptr[9] < 0x80
+  ) {
+    /* found an ID3 header... */
+    id3_size = 10 + (bptr[6]<<21) + (bptr[7]<<14) + (bptr[8]<<7) + bptr[9];
+
+    if (bptr[5] & 0x10) {
+      // footer present
+      id3_size += 10;
+    }
+
+    DEBUG_TRACE("Skipping ID3v2 tag of size %d\n", (int)id3_size);
+  }
+
+  return id3_size;
+}
+
+void
+_ogg_reader_init(ogg_reader *r, PerlIO *infile, char *file)
+{
+  Zero(r, 1, ogg_reader);
+
+  r->infile    = infile;
+  r->file      = file;
+  r->file_size = _file_size(infile);
+  r->buf_offset = -1;
+
+  buffer_init(&r->buf, OGG_BLOCK_SIZE);
+}
+
+void
+_ogg_reader_free(ogg_reader *r)
+{
+  buffer_free(&r->buf);
+}
+
+// Make sure len bytes from the given file offset are at the start of the buffer
+int
+_ogg_reader_fill(ogg_reader *r, off_t offset, uint32_t len)
+{
+  if ( r->buf_offset >= 0 && offset >= r->buf_offset && offset - r->buf_offset <= buffer_len(&r->buf) ) {
+    buffer_consume(&r->buf, offset - r->buf_offset);
+  }
+  else {
+    if ( PerlIO_seek(r->infile, offset, SEEK_SET) == -1 ) {
+      return 0;
+    }
+
+    buffer_clear(&r->buf);
+  }
+
+  r->buf_offset = offset;
+
+  return _check_buf(r->infile, &r->buf, len, OGG_BLOCK_SIZE);
+}
+
+// Read the page header at offset, returns 0 if there isn't a valid header
+int
+_ogg_parse_page(ogg_reader *r, off_t offset, ogg_page *page)
+{
+  unsigned char *bptr;
+
+  if ( offset + OGG_HEADER_SIZE > r->file_size || !_ogg_reader_fill(r, offset, OGG_HEADER_SIZE) ) {
+    return 0;
+  }
+
+  bptr = (unsigned char *)buffer_ptr(&r->buf);
+
+  // Capture pattern and stream structure version
+  if ( bptr[0] != 'O' || bptr[1] != 'g' || bptr[2] != 'g' || bptr[3] != 'S' || bptr[4] != 0 ) {
+    return 0;
+  }
+
+  page->num_segments = bptr[26];
+
+  if ( offset + OGG_HEADER_SIZE + page->num_segments > r->file_size ) {
+    return 0;
+  }
+
+  if ( !_ogg_reader_fill(r, offset, OGG_HEADER_SIZE + page->num_segments) ) {
+    return 0;
+  }
+
+  _ogg_page_header( (unsigned char *)buffer_ptr(&r->buf), page );
+  page->offset = offset;
+
+  return 1;
+}
+
+// Fill in page from a complete page header, including the segment table
+void
+_ogg_page_header(unsigned char *bptr, ogg_page *page)
+{
+  uint32_t i;
+
+  page->header_type  = bptr[5];
+  page->granule_pos  = (uint64_t)CONVERT_INT32LE((bptr + 6));
+  page->granule_pos |= (uint64_t)CONVERT_INT32LE((bptr + 10)) << 32;
+  page->serialno     = CONVERT_INT32LE((bptr + 14));
+  page->pagenum      = CONVERT_INT32LE((bptr + 18));
+  page->num_segments = bptr[26];
+  page->size         = OGG_HEADER_SIZE + page->num_segments;
+
+  Copy(bptr + OGG_HEADER_SIZE, page->lacing, page->num_segments, uint8_t);
+
+  for (i = 0; i < page->num_segments; i++) {
+    page->size += page->lacing[i];
+  }
+}
+
+// Read the page at the current offset, which may belong to any stream
+int
+_ogg_next_page(ogg_reader *r)
+{
+  if ( !_ogg_parse_page(r, r->offset, &r->page) ) {
+    return 0;
+  }
+
+  DEBUG_TRACE("OggS page %d (serial %x) at %" PRIu64 ", size %d, granule_pos %" PRIu64 "\n",
+    r->page.pagenum, r->page.serialno, (uint64_t)r->offset, r->page.size, r->page.granule_pos);
+
+  r->segment     = 0;
+  r->body_offset = r->offset + OGG_HEADER_SIZE + r->page.num_segments;
+  r->offset     += r->page.size;
+
+  return 1;
+}
+
+// Skip whatever is left of the current packet
+void
+_ogg_packet_end(ogg_reader *r)
+{
+  if ( r->packet_started && !(r->seg_last && !r->seg_remaining) ) {
+    _ogg_packet_read(r, NULL, 0xFFFFFFFF);
+  }
+}
+
+// Start reading the next packet of the stream
+void
+_ogg_packet_begin(ogg_reader *r)
+{
+  _ogg_packet_end(r);
+
+  r->seg_remaining  = 0;
+  r->seg_last       = 0;
+  r->packet_started = 0;
+  r->orphan         = 0;
+  r->truncated      = 0;
+}
+
+// Move to the next segment of the current packet, loading pages as needed.
+// Returns 0 at the end of the file.
+static int
+_ogg_next_segment(ogg_reader *r)
+{
+  while (1) {
+    uint8_t lace;
+
+    if (r->segment >= r->page.num_segments) {
+      // Move to the next page of this stream
+      do {
+        if ( !_ogg_next_page(r) ) {
+          return 0;
+        }
+      } while (r->page.serialno != r->serialno);
+
+      if ( (r->page.header_type & OGG_CONTINUED) && !r->packet_started ) {
+        // Rest of a packet we don't have the start of
+        r->orphan = 1;
+      }
+
+      continue;
+    }
+
+    lace = r->page.lacing[r->segment++];
+
+    if (r->orphan) {
+      r->body_offset += lace;
+      if (lace < 255) {
+        r->orphan = 0;
+      }
+      continue;
+    }
+
+    r->seg_remaining  = lace;
+    r->seg_last       = lace < 255;
+    r->packet_started = 1;
+
+    return 1;
+  }
+}
+
+// Read up to len bytes of the current packet into out, or skip them if out is NULL.
+// Skipping only reads the page headers. Returns the number of bytes read, which is
+// less than len at the end of the packet.
+uint32_t
+_ogg_packet_read(ogg_reader *r, Buffer *out, uint32_t len)
+{
+  uint32_t done = 0;
+
+  while (done < len) {
+    uint32_t n;
+
+    if (!r->seg_remaining) {
+      if ( r->seg_last || !_ogg_next_segment(r) ) {
+        break;
+      }
+      continue;
+    }
+
+    n = len - done;
+    if (n > r->seg_remaining) {
+      n = r->seg_remaining;
+    }
+
+    if (out) {
+      if ( r->body_offset + n > r->file_size ) {
+        PerlIO_printf(PerlIO_stderr(), "Premature end of file: %s\n", r->file);
+        r->truncated = 1;
+      }
+      else if ( !_ogg_reader_fill(r, r->body_offset, n) ) {
+        r->truncated = 1;
+      }
+
+      if (r->truncated) {
+        r->seg_remaining = 0;
+        r->seg_last = 1;
+        break;
+      }
+
+      buffer_append(out, buffer_ptr(&r->buf), n);
+    }
+
+    r->body_offset   += n;
+    r->seg_remaining -= n;
+    done += n;
+  }
+
+  return done;
+}
+
+// Returns 1 if the current packet has been read to its end
+int
+_ogg_packet_complete(ogg_reader *r)
+{
+  return r->packet_started && r->seg_last && !r->seg_remaining && !r->truncated
+    && r->body_offset <= r->file_size;
+}
+
+// Read the next complete packet of the stream, joining packets continued across pages.
+// Returns 0 at the end of the file.
+int
+_ogg_read_packet(ogg_reader *r, Buffer *packet)
+{
+  buffer_clear(packet);
+
+  _ogg_packet_begin(r);
+
+  while ( _ogg_packet_read(r, packet, OGG_BLOCK_SIZE) == OGG_BLOCK_SIZE ) { }
+
+  return _ogg_packet_complete(r);
+}
+
+/* CRC-32, poly = 0x04c11db7, init = 0, as used by Ogg pages */
+uint32_t const _ogg_crc_table[256] = {
+  0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
+  0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
+  0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd, 0x4c11db70, 0x48d0c6c7,
+  0x4593e01e, 0x4152fda9, 0x5f15adac, 0x5bd4b01b, 0x569796c2, 0x52568b75,
+  0x6a1936c8, 0x6ed82b7f, 0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3,
+  0x709f7b7a, 0x745e66cd, 0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
+  0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5, 0xbe2b5b58, 0xbaea46ef,
+  0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033, 0xa4ad16ea, 0xa06c0b5d,
+  0xd4326d90, 0xd0f37027, 0xddb056fe, 0xd9714b49, 0xc7361b4c, 0xc3f706fb,
+  0xceb42022, 0xca753d95, 0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1,
+  0xe13ef6f4, 0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d, 0x34867077, 0x30476dc0,
+  0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5, 0x2ac12072,
+  0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16, 0x018aeb13, 0x054bf6a4,
+  0x0808d07d, 0x0cc9cdca, 0x7897ab07, 0x7c56b6b0, 0x71159069, 0x75d48dde,
+  0x6b93dddb, 0x6f52c06c, 0x6211e6b5, 0x66d0fb02, 0x5e9f46bf, 0x5a5e5b08,
+  0x571d7dd1, 0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
+  0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b, 0xbb60adfc,
+  0xb6238b25, 0xb2e29692, 0x8aad2b2f, 0x8e6c3698, 0x832f1041, 0x87ee0df6,
+  0x99a95df3, 0x9d684044, 0x902b669d, 0x94ea7b2a, 0xe0b41de7, 0xe4750050,
+  0xe9362689, 0xedf73b3e, 0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2,
+  0xc6bcf05f, 0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34,
+  0xdc3abded, 0xd8fba05a, 0x690ce0ee, 0x6dcdfd59, 0x608edb80, 0x644fc637,
+  0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb, 0x4f040d56, 0x4bc510e1,
+  0x46863638, 0x42472b8f, 0x5c007b8a, 0x58c1663d, 0x558240e4, 0x51435d53,
+  0x251d3b9e, 0x21dc2629, 0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5,
+  0x3f9b762c, 0x3b5a6b9b, 0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff,
+  0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623, 0xf12f560e, 0xf5ee4bb9,
+  0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65, 0xeba91bbc, 0xef68060b,
+  0xd727bbb6, 0xd3e6a601, 0xdea580d8, 0xda649d6f, 0xc423cd6a, 0xc0e2d0dd,
+  0xcda1f604, 0xc960ebb3, 0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7,
+  0xae3afba2, 0xaafbe615, 0xa7b8c0cc, 0xa379dd7b, 0x9b3660c6, 0x9ff77d71,
+  0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74, 0x857130c3,
+  0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640, 0x4e8ee645, 0x4a4ffbf2,
+  0x470cdd2b, 0x43cdc09c, 0x7b827d21, 0x7f436096, 0x7200464f, 0x76c15bf8,
+  0x68860bfd, 0x6c47164a, 0x61043093, 0x65c52d24, 0x119b4be9, 0x155a565e,
+  0x18197087, 0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
+  0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d, 0x2056cd3a,
+  0x2d15ebe3, 0x29d4f654, 0xc5a92679, 0xc1683bce, 0xcc2b1d17, 0xc8ea00a0,
+  0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb, 0xdbee767c, 0xe3a1cbc1, 0xe760d676,
+  0xea23f0af, 0xeee2ed18, 0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4,
+  0x89b8fd09, 0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662,
+  0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668,
+  0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
+};
+
+// Find the last complete page of the stream with a granule position, searching
+// backwards from the end of the file. The window read from the end doubles until
+// a page is found, up to OGG_LAST_PAGE_MAX_WINDOW, so trailing junk or a large
+// final page only costs a few more reads. Candidate pages must pass the CRC check.
+// Returns 0 if there is no page within the max window, callers then fall back to
+// the nominal bitrate.
+int
+_ogg_last_page(ogg_reader *r, off_t min_offset, ogg_page *page)
+{
+  Buffer win;              // file data from start to the end of the file
+  off_t start = r->file_size;
+  uint32_t window = OGG_LAST_PAGE_WINDOW;
+  uint8_t found = 0;
+
+  buffer_init(&win, OGG_LAST_PAGE_WINDOW);
+
+  while (start > min_offset) {
+    Buffer tmp;
+    off_t end = start;
+
+    start = r->file_size > window ? r->file_size - window : 0;
+    if (start < min_offset) {
+      start = min_offset;
+    }
+
+    DEBUG_TRACE("Looking for last page between %" PRIu64 " and %" PRIu64 "\n", (uint64_t)start, (uint64_t)end);
+
+    // Read only the new part of the window, in front of what we have
+    buffer_init(&tmp, r->file_size - start);
+
+    if ( PerlIO_seek(r->infile, start, SEEK_SET) == -1
+      || PerlIO_read(r->infile, buffer_append_space(&tmp, end - start), end - start) != end - start
+    ) {
+      buffer_free(&tmp);
+      break;
+    }
+
+    buffer_append(&tmp, buffer_ptr(&win), buffer_len(&win));
+    buffer_free(&win);
+    win = tmp;
+
+    // Scan backwards, the first matching page is the last one
+    found = _ogg_last_page_in(r, (unsigned char *)buffer_ptr(&win), start, end - 1, r->file_size, page);
+
+    if (found || window >= OGG_LAST_PAGE_MAX_WINDOW) {
+      break;
+    }
+
+    window *= 2;
+    if (window > OGG_LAST_PAGE_MAX_WINDOW) {
+      window = OGG_LAST_PAGE_MAX_WINDOW;
+    }
+  }
+
+  buffer_free(&win);
+
+  // The reader's buffer no longer matches the file position
+  buffer_clear(&r->buf);
+  r->buf_offset = -1;
+
+  return found;
+}
+
+// Scan bptr, holding the file from start to end, backwards from pos for the last
+// complete page of the stream with a granule position
+int
+_ogg_last_page_in(ogg_reader *r, unsigned char *bptr, off_t start, off_t pos, off_t end, ogg_page *page)
+{
+  if (pos > end - OGG_HEADER_SIZE) {
+    pos = end - OGG_HEADER_SIZE;
+  }
+
+  for ( ; pos >= start; pos--) {
+    unsigned char *p = bptr + (pos - start);
+
+    if ( p[0] == 'O' && p[1] == 'g' && p[2] == 'g' && p[3] == 'S'
+      && _ogg_check_page(p, end - pos, page)
+      && page->serialno == r->serialno
+      && page->granule_pos != (uint64_t)-1
+    ) {
+      page->offset = pos;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Check that the len bytes at p start with a complete page with a valid CRC
+int
+_ogg_check_page(unsigned char *p, off_t len, ogg_page *page)
+{
+  uint32_t crc = 0;
+  uint32_t i;
+
+  if ( len < OGG_HEADER_SIZE || p[4] != 0 || len < OGG_HEADER_SIZE + p[26] ) {
+    return 0;
+  }
+
+  _ogg_page_header(p, page);
+
+  if ( page->size > len ) {
+    DEBUG_TRACE("Ignoring truncated page\n");
+    return 0;
+  }
+
+  // The checksum is calculated with the CRC field set to 0
+  for (i = 0; i < page->size; i++) {
+    crc = (crc << 8) ^ _ogg_crc_table[ ((crc >> 24) ^ (i >= 22 && i < 26 ? 0 : p[i])) & 0xFF ];
+  }
+
+  if ( crc != (uint32_t)CONVERT_INT32LE((p + 22)) ) {
+    DEBUG_TRACE("Ignoring page with bad CRC\n");
+    return 0;
+  }
+
+  return 1;
+}
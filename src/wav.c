@@ -16,6 +16,21 @@
 
 #include "wav.h"
 
+// Wave64 chunk GUIDs we know, and the RIFF chunk id each is parsed as
+static const struct {
+  char *id;
+  char *guid;
+} w64_chunks[] = {
+  { "fmt ", W64_FMT_GUID },
+  { "fact", W64_FACT_GUID },
+  { "data", W64_DATA_GUID },
+  { "list", W64_LIST_GUID },
+  { "levl", W64_LEVL_GUID },
+  { "bext", W64_BEXT_GUID },
+  { "junk", W64_JUNK_GUID },
+  { NULL, NULL }
+};
+
 static int
 get_wav_metadata(PerlIO *infile, char *file, HV *info, HV *tags)
 {
@@ -33,8 +48,12 @@ get_wav_metadata(PerlIO *infile, char *file, HV *info, HV *tags)
     goto out;
   }
 
-  if ( !strncmp( (char *)buffer_ptr(&buf), "RIFF", 4 ) ) {
-    // We've got a RIFF file
+  if (
+       !strncmp( (char *)buffer_ptr(&buf), "RIFF", 4 )
+    || !strncmp( (char *)buffer_ptr(&buf), "RF64", 4 )
+    || !strncmp( (char *)buffer_ptr(&buf), "BW64", 4 )
+  ) {
+    // We've got a RIFF file, RF64 and BW64 keep 64-bit sizes in a ds64 chunk
     buffer_consume(&buf, 4);
 
     chunk_size = buffer_get_int_le(&buf);
@@ -50,7 +69,26 @@ get_wav_metadata(PerlIO *infile, char *file, HV *info, HV *tags)
 
     my_hv_store( info, "file_size", newSVuv(file_size) );
 
-    _parse_wav(infile, &buf, file, file_size, info, tags);
+    _parse_wav(infile, &buf, file, file_size, 12, 0, info, tags);
+  }
+  else if ( !memcmp( buffer_ptr(&buf), W64_RIFF_GUID, 12 ) ) {
+    // Sony Wave64, GUID chunk ids and 64-bit chunk sizes
+    if ( !_check_buf(infile, &buf, 40, WAV_BLOCK_SIZE) ) {
+      err = -1;
+      goto out;
+    }
+
+    if ( memcmp( buffer_ptr(&buf), W64_RIFF_GUID, 16 ) || memcmp( (char *)buffer_ptr(&buf) + 24, W64_WAVE_GUID, 16 ) ) {
+      PerlIO_printf(PerlIO_stderr(), "Invalid Wave64 file: missing wave GUID: %s\n", file);
+      err = -1;
+      goto out;
+    }
+
+    buffer_consume(&buf, 40);
+
+    my_hv_store( info, "file_size", newSVuv(file_size) );
+
+    _parse_wav(infile, &buf, file, file_size, 40, 1, info, tags);
   }
   else if ( !strncmp( (char *)buffer_ptr(&buf), "FORM", 4 ) ) {
     // We've got an AIFF file
@@ -90,33 +128,77 @@ out:
 }
 
 void
-_parse_wav(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *info, HV *tags)
+_parse_wav(PerlIO *infile, Buffer *buf, char *file, off_t file_size, off_t offset, uint8_t w64, HV *info, HV *tags)
 {
-  uint32_t offset = 12;
+  int header_size = w64 ? W64_HEADER_SIZE : 8;
+  uint64_t ds64_data_size = 0;
+  uint64_t ds64_samples = 0;
 
-  while ( offset < file_size - 8 ) {
+  while ( offset < file_size - header_size ) {
     char chunk_id[5];
-    uint32_t chunk_size;
+    uint64_t chunk_size, data_size;
+    unsigned char *bptr;
 
-    // Verify we have at least 8 bytes
-    if ( !_check_buf(infile, buf, 8, WAV_BLOCK_SIZE) ) {
+    // Verify we have a full chunk header
+    if ( !_check_buf(infile, buf, header_size, WAV_BLOCK_SIZE) ) {
       return;
     }
 
-    strncpy( chunk_id, (char *)buffer_ptr(buf), 4 );
+    bptr = buffer_ptr(buf);
+
+    strncpy( chunk_id, (char *)bptr, 4 );
     chunk_id[4] = '\0';
-    buffer_consume(buf, 4);
 
-    chunk_size = buffer_get_int_le(buf);
+    if (w64) {
+      // Wave64 chunks are identified by the whole GUID, the size is 64-bit,
+      // includes the header and chunks are 8-byte aligned
+      int i;
 
-    // Adjust for padding
-    if ( chunk_size % 2 ) {
-      chunk_size++;
+      strcpy( chunk_id, "GUID" );
+
+      for (i = 0; w64_chunks[i].id; i++) {
+        if ( !memcmp(bptr, w64_chunks[i].guid, 16) ) {
+          strcpy( chunk_id, w64_chunks[i].id );
+          break;
+        }
+      }
+
+      chunk_size = get_u64le(bptr + 16);
+      buffer_consume(buf, W64_HEADER_SIZE);
+
+      if (chunk_size < W64_HEADER_SIZE) {
+        DEBUG_TRACE("Invalid Wave64 chunk size %" PRIu64 "\n", chunk_size);
+        return;
+      }
+
+      chunk_size -= W64_HEADER_SIZE;
+      data_size = chunk_size;
+
+      if ( chunk_size % 8 ) {
+        chunk_size += 8 - (chunk_size % 8);
+      }
     }
+    else {
+      buffer_consume(buf, 4);
 
-    offset += 8;
+      chunk_size = buffer_get_int_le(buf);
+
+      // RF64/BW64 data chunk size is in ds64
+      if ( chunk_size == RF64_SIZE_IN_DS64 && ds64_data_size && !strcmp( chunk_id, "data" ) ) {
+        chunk_size = ds64_data_size;
+      }
+
+      // Adjust for padding
+      if ( chunk_size % 2 ) {
+        chunk_size++;
+      }
+
+      data_size = chunk_size;
+    }
 
-    DEBUG_TRACE("%s size %d\n", chunk_id, chunk_size);
+    offset += header_size;
+
+    DEBUG_TRACE("%s size %" PRIu64 "\n", chunk_id, chunk_size);
 
     // Seek past data, everything else we parse
     // XXX: Are there other large chunks we should ignore?
@@ -124,13 +206,13 @@ _parse_wav(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *info
       SV **bitrate;
 
       my_hv_store( info, "audio_offset", newSVuv(offset) );
-      my_hv_store( info, "audio_size", newSVuv(chunk_size) );
+      my_hv_store( info, "audio_size", newSVuv(data_size) );
 
       // Calculate duration, unless we already know it (i.e. from 'fact')
       if ( !my_hv_fetch( info, "song_length_ms" ) ) {
         bitrate = my_hv_fetch( info, "bitrate" );
         if (bitrate != NULL) {
-          my_hv_store( info, "song_length_ms", newSVuv( (chunk_size / (SvIV(*bitrate) / 8.)) * 1000 ) );
+          my_hv_store( info, "song_length_ms", newSVuv( (data_size / (SvIV(*bitrate) / 8.)) * 1000 ) );
         }
       }
 
@@ -150,7 +232,7 @@ _parse_wav(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *info
     }
     else if ( !strcmp( chunk_id, "id3 " ) || !strcmp( chunk_id, "ID3 " ) || !strcmp( chunk_id, "ID32" ) ) {
       // Read header to verify version
-      unsigned char *bptr = buffer_ptr(buf);
+      bptr = buffer_ptr(buf);
 
       if (
         (bptr[0] == 'I' && bptr[1] == 'D' && bptr[2] == '3') &&
@@ -172,52 +254,95 @@ _parse_wav(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *info
         return;
       }
 
-      // Make sure we have enough data
-      if ( !_check_buf(infile, buf, chunk_size, WAV_BLOCK_SIZE) ) {
-        return;
+      if (
+           !strcmp( chunk_id, "fmt " )
+        || !strcmp( chunk_id, "LIST" )
+        || !strcmp( chunk_id, "PEAK" )
+        || !strcmp( chunk_id, "fact" )
+        || !strcmp( chunk_id, "ds64" )
+      ) {
+        // Make sure we have enough data
+        if ( !_check_buf(infile, buf, chunk_size, WAV_BLOCK_SIZE) ) {
+          return;
+        }
+      }
+      else {
+        if (
+             !strcmp(chunk_id, "SAUR") // Wavosour data chunk
+          || !strcmp(chunk_id, "otom") // Wavosaur?
+          || !strcmp(chunk_id, "PAD ") // Padding
+          || !strcmp(chunk_id, "JUNK") // Padding, reserved for ds64 in BWF
+          || !strcmp(chunk_id, "junk") // Wave64 padding
+          || !strcmp(chunk_id, "bext") // BWF broadcast extension
+          || !strcmp(chunk_id, "iXML")
+          || !strcmp(chunk_id, "axml")
+          || !strcmp(chunk_id, "chna") // BW64 channel assignment
+          || !strcmp(chunk_id, "list") // Wave64 list
+          || !strcmp(chunk_id, "levl") // Wave64 peak envelope
+        ) {
+          // Known chunks to skip
+        }
+        else {
+          // Warn about unknown chunks so we can investigate them
+          PerlIO_printf(PerlIO_stderr(), "Unhandled WAV chunk %s size %" PRIu64 " (skipped)\n", chunk_id, chunk_size);
+        }
+
+        // Seek past it rather than reading it, BWF chunks can be large
+        PerlIO_seek(infile, offset + chunk_size, SEEK_SET);
+        buffer_clear(buf);
+
+        offset += chunk_size;
+        continue;
       }
 
       if ( !strcmp( chunk_id, "fmt " ) ) {
-        _parse_wav_fmt(buf, chunk_size, info);
+        _parse_wav_fmt(buf, data_size, info);
       }
       else if ( !strcmp( chunk_id, "LIST" ) ) {
-        _parse_wav_list(buf, chunk_size, tags);
+        _parse_wav_list(buf, data_size, tags);
       }
       else if ( !strcmp( chunk_id, "PEAK" ) ) {
-        _parse_wav_peak(buf, chunk_size, info, 0);
+        _parse_wav_peak(buf, data_size, info, 0);
+      }
+      else if ( !strcmp( chunk_id, "ds64" ) ) {
+        // RF64/BW64 riff size, data size, sample count, then a table of
+        // other chunk sizes we don't need
+        if ( data_size >= 24 ) {
+          buffer_consume(buf, 8);
+          ds64_data_size = buffer_get_int64_le(buf);
+          ds64_samples = buffer_get_int64_le(buf);
+          DEBUG_TRACE("  ds64 data size %" PRIu64 " samples %" PRIu64 "\n", ds64_data_size, ds64_samples);
+          buffer_consume(buf, data_size - 24);
+        }
+        else {
+          buffer_consume(buf, data_size);
+        }
       }
       else if ( !strcmp( chunk_id, "fact" ) ) {
         // A 4-byte fact chunk in a non-PCM wav is the number of samples
         // Use it to calculate duration
-        if ( chunk_size == 4 ) {
-          uint32_t num_samples = buffer_get_int_le(buf);
+        if ( data_size == 4 ) {
+          uint64_t num_samples = buffer_get_int_le(buf);
           SV **samplerate = my_hv_fetch( info, "samplerate" );
+
+          if ( num_samples == RF64_SIZE_IN_DS64 && ds64_samples ) {
+            num_samples = ds64_samples;
+          }
+
           if (samplerate != NULL) {
-            DEBUG_TRACE("[wav] Setting song_length_ms from fact chunk: ( num_samples(%d) * 1000 / samplerate(%ld) )\n", num_samples, SvIV(*samplerate));
-            // GH#2, cast num_samples to 64-bit to avoid 32-bit overflow
-            my_hv_store( info, "song_length_ms", newSVuv( ((uint64_t)num_samples * 1000) / SvIV(*samplerate) ) );
+            DEBUG_TRACE("[wav] Setting song_length_ms from fact chunk: ( num_samples(%" PRIu64 ") * 1000 / samplerate(%ld) )\n", num_samples, SvIV(*samplerate));
+            // GH#2, num_samples is 64-bit to avoid 32-bit overflow
+            my_hv_store( info, "song_length_ms", newSVuv( (num_samples * 1000) / SvIV(*samplerate) ) );
           }
         }
         else {
           // Unknown, skip it
-          buffer_consume(buf, chunk_size);
+          buffer_consume(buf, data_size);
         }
       }
-      else {
-        if (
-             !strcmp(chunk_id, "SAUR") // Wavosour data chunk
-          || !strcmp(chunk_id, "otom") // Wavosaur?
-          || !strcmp(chunk_id, "PAD ") // Padding
-        ) {
-          // Known chunks to skip
-        }
-        else {
-          // Warn about unknown chunks so we can investigate them
-          PerlIO_printf(PerlIO_stderr(), "Unhandled WAV chunk %s size %d (skipped)\n", chunk_id, chunk_size);
-        }
 
-        buffer_consume(buf, chunk_size);
-      }
+      // Wave64 chunks are padded to 8 bytes
+      buffer_consume(buf, chunk_size - data_size);
     }
 
     offset += chunk_size;
@@ -249,6 +374,13 @@ _parse_wav_fmt(Buffer *buf, uint32_t chunk_size, HV *info)
 
     // Bug 14462, a WAV file with only an 18-byte fmt chunk should ignore extra_len bytes
     if (extra_len && chunk_size > 18) {
+      // WAVE_FORMAT_EXTENSIBLE, the real format is at the start of the SubFormat GUID
+      if ( format == 0xFFFE && extra_len >= 22 && chunk_size >= 40 ) {
+        buffer_consume(buf, 6);
+        my_hv_store( info, "subformat", newSVuv( buffer_get_short_le(buf) ) );
+        extra_len -= 8;
+      }
+
       DEBUG_TRACE(" skipping extra_len bytes in fmt: %d\n", extra_len);
       buffer_consume(buf, extra_len);
     }
@@ -358,13 +490,13 @@ _parse_wav_peak(Buffer *buf, uint32_t chunk_size, HV *info, uint8_t big_endian)
 }
 
 void
-_parse_aiff(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *info, HV *tags)
+_parse_aiff(PerlIO *infile, Buffer *buf, char *file, off_t file_size, HV *info, HV *tags)
 {
-  uint32_t offset = 12;
+  off_t offset = 12;
 
   while ( offset < file_size - 8 ) {
     char chunk_id[5];
-    int chunk_size;
+    uint64_t chunk_size;
 
     // Verify we have at least 8 bytes
     if ( !_check_buf(infile, buf, 8, WAV_BLOCK_SIZE) ) {
@@ -384,12 +516,12 @@ _parse_aiff(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *inf
 
     offset += 8;
 
-    DEBUG_TRACE("%s size %d\n", chunk_id, chunk_size);
+    DEBUG_TRACE("%s size %" PRIu64 "\n", chunk_id, chunk_size);
 
     // Seek past SSND, everything else we parse
     // XXX: Are there other large chunks we should ignore?
     if ( !strcmp( chunk_id, "SSND" ) ) {
-      int ssnd_offset, ssnd_blocksize;
+      uint32_t ssnd_offset, ssnd_blocksize;
 
       if ( !_check_buf(infile, buf, 8, WAV_BLOCK_SIZE) ) {
         return;
@@ -400,6 +532,11 @@ _parse_aiff(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *inf
 
       DEBUG_TRACE("SSND offset: %u block size: %u\n", ssnd_offset, ssnd_blocksize);
 
+      if ( chunk_size < 8 + (uint64_t)ssnd_offset ) {
+        DEBUG_TRACE("Invalid SSND offset\n");
+        return;
+      }
+
       my_hv_store( info, "audio_offset", newSVuv(offset + 8 + ssnd_offset) );
       my_hv_store( info, "audio_size", newSVuv(chunk_size - 8 - ssnd_offset) );
 
@@ -424,12 +561,12 @@ _parse_aiff(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *inf
       }
 
       // Seen ID3 chunks with the chunk size in little-endian instead of big-endian
-      if (chunk_size < 0 || offset + chunk_size > file_size) {
+      if (offset + chunk_size > file_size) {
         break;
       }
 
       // Seek past ID3 and clear buffer
-      DEBUG_TRACE("Seeking past ID3 to %d\n", offset + chunk_size);
+      DEBUG_TRACE("Seeking past ID3 to %" PRIu64 "\n", offset + chunk_size);
       PerlIO_seek(infile, offset + chunk_size, SEEK_SET);
       buffer_clear(buf);
     }
@@ -452,7 +589,7 @@ _parse_aiff(PerlIO *infile, Buffer *buf, char *file, uint32_t file_size, HV *inf
         _parse_wav_peak(buf, chunk_size, info, 1);
       }
       else {
-        PerlIO_printf(PerlIO_stderr(), "Unhandled AIFF chunk %s size %d (skipped)\n", chunk_id, chunk_size);
+        PerlIO_printf(PerlIO_stderr(), "Unhandled AIFF chunk %s size %" PRIu64 " (skipped)\n", chunk_id, chunk_size);
         buffer_consume(buf, chunk_size);
       }
     }
@@ -494,3 +631,619 @@ _parse_aiff_comm(Buffer *buf, uint32_t chunk_size, HV *info)
       my_hv_store( info, "dlna_profile", newSVpv("LPCM_low", 0) );
   }
 }
+
+static int
+wav_find_frame(PerlIO *infile, char *file, int offset)
+{
+  int64_t frame_offset = -1;
+
+  // We need to read all metadata first to get some data we need to calculate
+  HV *info = newHV();
+  HV *tags = newHV();
+
+  if ( get_wav_metadata(infile, file, info, tags) == 0 ) {
+    frame_offset = _wav_find_frame(info, offset);
+  }
+
+  // Offsets past 2GB only fit in seek_offset from find_frame_return_info
+  if (frame_offset > 0x7FFFFFFF) {
+    frame_offset = -1;
+  }
+
+  // Don't leak
+  SvREFCNT_dec(info);
+  SvREFCNT_dec(tags);
+
+  return frame_offset;
+}
+
+// Returns seek_offset and seek_header, the file header up to the audio data
+// with the chunk sizes and sample counts reduced to the remaining audio
+static int
+wav_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  int64_t frame_offset = -1;
+  HV *tags = newHV();
+
+  if ( get_wav_metadata(infile, file, info, tags) == 0 ) {
+    frame_offset = _wav_find_frame(info, offset);
+  }
+
+  my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+
+  if (frame_offset >= 0) {
+    SV *header = _wav_seek_header(infile, info, frame_offset);
+
+    if (header != NULL) {
+      my_hv_store( info, "seek_header", header );
+    }
+  }
+
+  SvREFCNT_dec(tags);
+
+  return frame_offset;
+}
+
+// Size of the audio data, limited to what is actually in the file
+uint64_t
+_wav_audio_size(HV *info)
+{
+  uint64_t audio_offset = SvIV( *(my_hv_fetch(info, "audio_offset")) );
+  uint64_t audio_size   = SvIV( *(my_hv_fetch(info, "audio_size")) );
+  uint64_t file_size    = SvIV( *(my_hv_fetch(info, "file_size")) );
+
+  if ( audio_offset + audio_size > file_size ) {
+    audio_size = file_size > audio_offset ? file_size - audio_offset : 0;
+  }
+
+  return audio_size;
+}
+
+// PCM and the other formats we support are constant bitrate, so the offset
+// is the byte rate times the time, rounded down to a whole block
+int64_t
+_wav_find_frame(HV *info, int offset)
+{
+  uint64_t audio_size, bitrate, block_align, pos;
+  SV **entry;
+
+  if ( offset < 0 || !my_hv_exists(info, "audio_offset") || !my_hv_exists(info, "bitrate") ) {
+    return -1;
+  }
+
+  audio_size = _wav_audio_size(info);
+  bitrate    = SvIV( *(my_hv_fetch(info, "bitrate")) );
+
+  entry = my_hv_fetch(info, "block_align");
+  block_align = entry != NULL && SvIV(*entry) > 0 ? SvIV(*entry) : 1;
+
+  pos = (uint64_t)offset * bitrate / 8000;
+  pos -= pos % block_align;
+
+  DEBUG_TRACE("wav_find_frame: %d ms -> audio byte %" PRIu64 " of %" PRIu64 "\n", offset, pos, audio_size);
+
+  if (pos >= audio_size) {
+    return -1;
+  }
+
+  return SvIV( *(my_hv_fetch(info, "audio_offset")) ) + pos;
+}
+
+SV *
+_wav_seek_header(PerlIO *infile, HV *info, uint64_t frame_offset)
+{
+  uint64_t audio_offset = SvIV( *(my_hv_fetch(info, "audio_offset")) );
+  uint64_t audio_size   = _wav_audio_size(info);
+  uint64_t remaining    = audio_size - (frame_offset - audio_offset);
+  double scale          = audio_size ? (double)remaining / audio_size : 0;
+  uint64_t pos;
+  unsigned char *bptr;
+  SV *header;
+
+  if ( audio_offset > WAV_MAX_SEEK_HEADER || (header = _read_header(infile, audio_offset)) == NULL ) {
+    return NULL;
+  }
+
+  bptr = (unsigned char *)SvPVX(header);
+
+  if ( !memcmp(bptr, "FORM", 4) ) {
+    SV **block_align = my_hv_fetch(info, "block_align");
+
+    put_u32( bptr + 4, audio_offset - 8 + remaining );
+
+    for ( pos = 12; pos + 8 <= audio_offset; ) {
+      uint32_t size = get_u32(bptr + pos + 4);
+
+      if ( !memcmp(bptr + pos, "COMM", 4) && pos + 14 <= audio_offset ) {
+        // numSampleFrames
+        put_u32( bptr + pos + 10, block_align != NULL && SvIV(*block_align) > 0 ? remaining / SvIV(*block_align) : 0 );
+      }
+      else if ( !memcmp(bptr + pos, "SSND", 4) ) {
+        // Includes the SSND offset and block size before the audio
+        put_u32( bptr + pos + 4, audio_offset - pos - 8 + remaining );
+        break;
+      }
+
+      pos += 8 + (uint64_t)size + (size % 2);
+    }
+  }
+  else if ( !memcmp(bptr, W64_RIFF_GUID, 16) ) {
+    put_u64le( bptr + 16, audio_offset + remaining );
+
+    for ( pos = 40; pos + W64_HEADER_SIZE <= audio_offset; ) {
+      uint64_t size = get_u64le(bptr + pos + 16);
+
+      if ( size < W64_HEADER_SIZE ) {
+        break;
+      }
+
+      if ( !memcmp(bptr + pos, W64_FACT_GUID, 16) && pos + 28 <= audio_offset ) {
+        put_u32le( bptr + pos + 24, get_u32le(bptr + pos + 24) * scale + 0.5 );
+      }
+      else if ( !memcmp(bptr + pos, W64_DATA_GUID, 16) && pos + W64_HEADER_SIZE == audio_offset ) {
+        put_u64le( bptr + pos + 16, W64_HEADER_SIZE + remaining );
+      }
+
+      pos += size + (size % 8 ? 8 - (size % 8) : 0);
+    }
+  }
+  else {
+    // RIFF, or RF64/BW64 where the sizes that don't fit are in ds64
+    uint8_t rf64 = memcmp(bptr, "RIFF", 4) ? 1 : 0;
+
+    if (!rf64) {
+      put_u32le( bptr + 4, audio_offset - 8 + remaining );
+    }
+
+    for ( pos = 12; pos + 8 <= audio_offset; ) {
+      uint32_t size = get_u32le(bptr + pos + 4);
+
+      if ( !memcmp(bptr + pos, "ds64", 4) && pos + 32 <= audio_offset ) {
+        put_u64le( bptr + pos + 8, audio_offset - 8 + remaining );
+        put_u64le( bptr + pos + 16, remaining );
+        put_u64le( bptr + pos + 24, get_u64le(bptr + pos + 24) * scale + 0.5 );
+      }
+      else if ( !memcmp(bptr + pos, "fact", 4) && pos + 12 <= audio_offset ) {
+        uint32_t samples = get_u32le(bptr + pos + 8);
+
+        if (samples != RF64_SIZE_IN_DS64) {
+          put_u32le( bptr + pos + 8, samples * scale + 0.5 );
+        }
+      }
+      else if ( !memcmp(bptr + pos, "data", 4) && pos + 8 == audio_offset ) {
+        if ( !rf64 || size != RF64_SIZE_IN_DS64 ) {
+          put_u32le( bptr + pos + 4, remaining );
+        }
+      }
+
+      pos += 8 + (uint64_t)size + (size % 2);
+    }
+  }
+
+  return header;
+}
+
+// Decode the PCM audio of a WAV or AIFF file once, returning the usual info with
+// the peak and RMS of each channel and the EBU R128 integrated loudness
+int
+wav_pcm_analysis(PerlIO *infile, char *file, HV *info)
+{
+  Buffer buf;
+  HV *tags = newHV();
+  AV *peaks, *rms;
+  int format, err = -1;
+  uint16_t channels, bytes, c;
+  uint32_t samplerate, block_align, segment_frames;
+  uint64_t total_frames, segment_count, done = 0;
+  double *samples = NULL, *segments = NULL, *peak = NULL, *sumsq = NULL, *weight = NULL;
+  double **planes = NULL;
+  uint64_t *peak_pos = NULL;
+  biquad *shelf = NULL, *highpass = NULL;
+  double loudness;
+
+  buffer_init(&buf, 0);
+
+  if ( get_wav_metadata(infile, file, info, tags) != 0 || !my_hv_exists(info, "audio_offset") ) {
+    goto out;
+  }
+
+  format = _pcm_format(info);
+
+  if (format == PCM_UNSUPPORTED) {
+    PerlIO_printf(PerlIO_stderr(), "Unsupported PCM format for analysis: %s\n", file);
+    goto out;
+  }
+
+  channels   = SvIV( *(my_hv_fetch(info, "channels")) );
+  samplerate = SvIV( *(my_hv_fetch(info, "samplerate")) );
+  bytes      = (SvIV( *(my_hv_fetch(info, "bits_per_sample")) ) + 7) / 8;
+
+  if (!channels || samplerate < 10) {
+    goto out;
+  }
+
+  block_align    = channels * bytes;
+  total_frames   = _wav_audio_size(info) / block_align;
+  segment_frames = samplerate / 10;
+  segment_count  = total_frames / segment_frames + 1;
+
+  Newxz(samples, (size_t)channels * PCM_ANALYSIS_FRAMES, double);
+  Newx(planes, channels, double *);
+  Newxz(segments, segment_count, double);
+  Newxz(peak, channels, double);
+  Newxz(peak_pos, channels, uint64_t);
+  Newxz(sumsq, channels, double);
+  Newx(weight, channels, double);
+  Newx(shelf, channels, biquad);
+  Newx(highpass, channels, biquad);
+
+  for (c = 0; c < channels; c++) {
+    planes[c] = samples + (size_t)c * PCM_ANALYSIS_FRAMES;
+
+    // BS.1770 channel weights, assuming the usual L R C LFE Ls Rs order
+    weight[c] = 1.0;
+    if (channels == 5 && c >= 3) {
+      weight[c] = 1.41;
+    }
+    else if (channels >= 6 && c == 3) {
+      weight[c] = 0.0;
+    }
+    else if (channels >= 6 && (c == 4 || c == 5)) {
+      weight[c] = 1.41;
+    }
+
+    _pcm_k_weighting(samplerate, &shelf[c], &highpass[c]);
+  }
+
+  buffer_free(&buf);
+  buffer_init(&buf, PCM_ANALYSIS_FRAMES * block_align);
+
+  PerlIO_seek(infile, SvIV( *(my_hv_fetch(info, "audio_offset")) ), SEEK_SET);
+
+  while (done < total_frames) {
+    uint32_t frames = total_frames - done > PCM_ANALYSIS_FRAMES ? PCM_ANALYSIS_FRAMES : total_frames - done;
+
+    if ( !_check_buf(infile, &buf, frames * block_align, frames * block_align) ) {
+      PerlIO_printf(PerlIO_stderr(), "Unable to read audio for analysis: %s\n", file);
+      goto out;
+    }
+
+    _pcm_decode(buffer_ptr(&buf), frames, channels, format, planes);
+    buffer_consume(&buf, frames * block_align);
+
+    for (c = 0; c < channels; c++) {
+      double *x = planes[c];
+      double max = 0, sum = 0;
+      uint32_t i;
+
+      // Kept branch-free so these can be vectorized
+      for (i = 0; i < frames; i++) {
+        double a = fabs(x[i]);
+        max = a > max ? a : max;
+        sum += x[i] * x[i];
+      }
+
+      sumsq[c] += sum;
+
+      if (max > peak[c]) {
+        for (i = 0; fabs(x[i]) != max; i++) { }
+        peak[c] = max;
+        peak_pos[c] = done + i;
+      }
+
+      if (weight[c] == 0.0) {
+        continue;
+      }
+
+      // Mean square of the K-weighted signal in 100ms segments,
+      // 400ms gating blocks are made from 4 segments
+      _pcm_k_filter(x, frames, &shelf[c], &highpass[c]);
+
+      for (i = 0; i < frames; ) {
+        uint64_t segment = (done + i) / segment_frames;
+        uint64_t end = (segment + 1) * segment_frames - done;
+
+        if (end > frames) {
+          end = frames;
+        }
+
+        for (sum = 0; i < end; i++) {
+          sum += x[i] * x[i];
+        }
+
+        segments[segment] += weight[c] * sum;
+      }
+    }
+
+    done += frames;
+  }
+
+  peaks = newAV();
+  rms = newAV();
+
+  for (c = 0; c < channels; c++) {
+    HV *p = newHV();
+
+    my_hv_store( p, "value", newSVnv(peak[c]) );
+    my_hv_store( p, "position", newSVuv(peak_pos[c]) );
+    av_push( peaks, newRV_noinc( (SV *)p ) );
+
+    av_push( rms, newSVnv( done ? sqrt(sumsq[c] / done) : 0 ) );
+  }
+
+  my_hv_store( info, "sample_peak", newRV_noinc( (SV *)peaks ) );
+  my_hv_store( info, "rms", newRV_noinc( (SV *)rms ) );
+  my_hv_store( info, "analyzed_frames", newSVuv(done) );
+
+  loudness = _pcm_gated_loudness(segments, total_frames / segment_frames, segment_frames);
+
+  if (loudness > -HUGE_VAL) {
+    my_hv_store( info, "loudness", newSVnv(loudness) );
+  }
+
+  err = 0;
+
+out:
+  buffer_free(&buf);
+  SvREFCNT_dec(tags);
+
+  if (samples)  Safefree(samples);
+  if (planes)   Safefree(planes);
+  if (segments) Safefree(segments);
+  if (peak)     Safefree(peak);
+  if (peak_pos) Safefree(peak_pos);
+  if (sumsq)    Safefree(sumsq);
+  if (weight)   Safefree(weight);
+  if (shelf)    Safefree(shelf);
+  if (highpass) Safefree(highpass);
+
+  return err;
+}
+
+// Sample format of the audio data, from the WAV format code or AIFC compression type
+int
+_pcm_format(HV *info)
+{
+  SV **entry;
+  int bytes;
+
+  if ( !my_hv_exists(info, "bits_per_sample") || !my_hv_exists(info, "channels") || !my_hv_exists(info, "samplerate") ) {
+    return PCM_UNSUPPORTED;
+  }
+
+  bytes = (SvIV( *(my_hv_fetch(info, "bits_per_sample")) ) + 7) / 8;
+
+  if ( (entry = my_hv_fetch(info, "format")) != NULL ) {
+    int format = SvIV(*entry);
+
+    if ( format == 0xFFFE && (entry = my_hv_fetch(info, "subformat")) != NULL ) {
+      format = SvIV(*entry);
+    }
+
+    if (format == 1) {
+      switch (bytes) {
+        case 1: return PCM_U8;
+        case 2: return PCM_S16LE;
+        case 3: return PCM_S24LE;
+        case 4: return PCM_S32LE;
+      }
+    }
+    else if (format == 3) {
+      switch (bytes) {
+        case 4: return PCM_F32LE;
+        case 8: return PCM_F64LE;
+      }
+    }
+  }
+  else {
+    char *type = "NONE";
+
+    if ( (entry = my_hv_fetch(info, "compression_type")) != NULL ) {
+      type = SvPVX(*entry);
+    }
+
+    if ( !strcmp(type, "NONE") || !strcmp(type, "twos") || !strcmp(type, "in24") || !strcmp(type, "in32") ) {
+      switch (bytes) {
+        case 1: return PCM_S8;
+        case 2: return PCM_S16BE;
+        case 3: return PCM_S24BE;
+        case 4: return PCM_S32BE;
+      }
+    }
+    else if ( !strcmp(type, "sowt") ) {
+      switch (bytes) {
+        case 1: return PCM_S8;
+        case 2: return PCM_S16LE;
+        case 3: return PCM_S24LE;
+        case 4: return PCM_S32LE;
+      }
+    }
+    else if ( !strcmp(type, "raw ") && bytes == 1 ) {
+      return PCM_U8;
+    }
+    else if ( !strcasecmp(type, "fl32") && bytes == 4 ) {
+      return PCM_F32BE;
+    }
+    else if ( !strcasecmp(type, "fl64") && bytes == 8 ) {
+      return PCM_F64BE;
+    }
+  }
+
+  return PCM_UNSUPPORTED;
+}
+
+// Integer samples are placed in the top bits of an int32 so every width
+// scales the same way
+#define PCM_INT(v)   ( (double)(int32_t)(v) * (1.0 / 2147483648.0) )
+#define PCM_DECODE(size, expr)                    \
+  for (i = 0; i < frames; i++) {                  \
+    for (c = 0; c < channels; c++) {              \
+      planes[c][i] = (expr);                      \
+      bptr += size;                               \
+    }                                             \
+  }
+
+static double
+_pcm_f32(uint32_t v)
+{
+  float f;
+  memcpy(&f, &v, 4);
+  return f;
+}
+
+static double
+_pcm_f64(uint64_t v)
+{
+  double d;
+  memcpy(&d, &v, 8);
+  return d;
+}
+
+// Deinterleave a block of frames into one plane of doubles per channel,
+// with integer samples scaled to -1.0 .. 1.0
+void
+_pcm_decode(const unsigned char *bptr, uint32_t frames, uint16_t channels, int format, double **planes)
+{
+  uint32_t i;
+  uint16_t c;
+
+  switch (format) {
+    case PCM_U8:
+      PCM_DECODE(1, (bptr[0] - 128) * (1.0 / 128) );
+      break;
+    case PCM_S8:
+      PCM_DECODE(1, PCM_INT( (uint32_t)bptr[0] << 24 ) );
+      break;
+    case PCM_S16LE:
+      PCM_DECODE(2, PCM_INT( (uint32_t)bptr[0] << 16 | (uint32_t)bptr[1] << 24 ) );
+      break;
+    case PCM_S16BE:
+      PCM_DECODE(2, PCM_INT( (uint32_t)bptr[1] << 16 | (uint32_t)bptr[0] << 24 ) );
+      break;
+    case PCM_S24LE:
+      PCM_DECODE(3, PCM_INT( (uint32_t)bptr[0] << 8 | (uint32_t)bptr[1] << 16 | (uint32_t)bptr[2] << 24 ) );
+      break;
+    case PCM_S24BE:
+      PCM_DECODE(3, PCM_INT( (uint32_t)bptr[2] << 8 | (uint32_t)bptr[1] << 16 | (uint32_t)bptr[0] << 24 ) );
+      break;
+    case PCM_S32LE:
+      PCM_DECODE(4, PCM_INT( get_u32le(bptr) ) );
+      break;
+    case PCM_S32BE:
+      PCM_DECODE(4, PCM_INT( get_u32(bptr) ) );
+      break;
+    case PCM_F32LE:
+      PCM_DECODE(4, _pcm_f32( get_u32le(bptr) ) );
+      break;
+    case PCM_F32BE:
+      PCM_DECODE(4, _pcm_f32( get_u32(bptr) ) );
+      break;
+    case PCM_F64LE:
+      PCM_DECODE(8, _pcm_f64( get_u64le(bptr) ) );
+      break;
+    case PCM_F64BE:
+      PCM_DECODE(8, _pcm_f64( get_u64(bptr) ) );
+      break;
+  }
+}
+
+// BS.1770 K-weighting, a high shelf followed by a high-pass filter. The
+// coefficients are derived for the samplerate as in libebur128.
+void
+_pcm_k_weighting(uint32_t samplerate, biquad *shelf, biquad *highpass)
+{
+  double f0 = 1681.974450955533;
+  double G  = 3.999843853973347;
+  double Q  = 0.7071752369554196;
+  double K  = tan(M_PI * f0 / samplerate);
+  double Vh = pow(10.0, G / 20.0);
+  double Vb = pow(Vh, 0.4996667741545416);
+  double a0 = 1.0 + K / Q + K * K;
+
+  shelf->b0 = (Vh + Vb * K / Q + K * K) / a0;
+  shelf->b1 = 2.0 * (K * K - Vh) / a0;
+  shelf->b2 = (Vh - Vb * K / Q + K * K) / a0;
+  shelf->a1 = 2.0 * (K * K - 1.0) / a0;
+  shelf->a2 = (1.0 - K / Q + K * K) / a0;
+  shelf->z1 = shelf->z2 = 0;
+
+  f0 = 38.13547087602444;
+  Q  = 0.5003270373238773;
+  K  = tan(M_PI * f0 / samplerate);
+  a0 = 1.0 + K / Q + K * K;
+
+  highpass->b0 = 1.0;
+  highpass->b1 = -2.0;
+  highpass->b2 = 1.0;
+  highpass->a1 = 2.0 * (K * K - 1.0) / a0;
+  highpass->a2 = (1.0 - K / Q + K * K) / a0;
+  highpass->z1 = highpass->z2 = 0;
+}
+
+// Run both K-weighting filters over a channel in place
+void
+_pcm_k_filter(double *x, uint32_t frames, biquad *shelf, biquad *highpass)
+{
+  double s1 = shelf->z1, s2 = shelf->z2;
+  double h1 = highpass->z1, h2 = highpass->z2;
+  uint32_t i;
+
+  for (i = 0; i < frames; i++) {
+    double in = x[i];
+    double y  = shelf->b0 * in + s1;
+
+    s1 = shelf->b1 * in - shelf->a1 * y + s2;
+    s2 = shelf->b2 * in - shelf->a2 * y;
+
+    in = y;
+    y  = highpass->b0 * in + h1;
+
+    h1 = highpass->b1 * in - highpass->a1 * y + h2;
+    h2 = highpass->b2 * in - highpass->a2 * y;
+
+    x[i] = y;
+  }
+
+  shelf->z1 = s1;
+  shelf->z2 = s2;
+  highpass->z1 = h1;
+  highpass->z2 = h2;
+}
+
+// EBU R128 integrated loudness from the weighted sums of squares of complete
+// 100ms segments. Each 400ms block overlaps the next by 75%, blocks below
+// -70 LUFS are dropped, then blocks more than 10 LU below the mean of the rest.
+// Returns -HUGE_VAL if there is no block above the gates.
+double
+_pcm_gated_loudness(double *segments, uint64_t count, uint32_t segment_frames)
+{
+  double absolute = pow(10.0, (-70.0 + 0.691) / 10.0);
+  double relative, sum = 0;
+  uint64_t j, n = 0;
+  int pass;
+
+  relative = absolute;
+
+  for (pass = 0; pass < 2; pass++) {
+    sum = 0;
+    n = 0;
+
+    for (j = 0; j + 4 <= count; j++) {
+      double z = (segments[j] + segments[j + 1] + segments[j + 2] + segments[j + 3]) / (4.0 * segment_frames);
+
+      if (z > absolute && z > relative) {
+        sum += z;
+        n++;
+      }
+    }
+
+    if (!n) {
+      return -HUGE_VAL;
+    }
+
+    // -10 LU relative to the mean of the blocks above the absolute gate
+    relative = sum / n * 0.1;
+  }
+
+  return -0.691 + 10.0 * log10(sum / n);
+}
@@ -26,6 +26,308 @@ get_wavpack_info(PerlIO *infile, char *file, HV *info)
   return 0;
 }
 
+int
+wavpack_find_frame(PerlIO *infile, char *file, int offset)
+{
+  off_t frame_offset;
+  uint64_t sample;
+
+  HV *info = newHV();
+
+  frame_offset = _wavpack_find_frame(infile, file, offset, info, NULL, &sample);
+
+  // Don't leak
+  SvREFCNT_dec(info);
+
+  // Offsets past 2GB only fit in seek_offset from find_frame_return_info
+  return frame_offset > 0x7FFFFFFF ? -1 : frame_offset;
+}
+
+// Returns seek_offset and seek_sample, the first sample of the block at seek_offset.
+// Every block can be decoded on its own, so no header is needed in front of it.
+// A seektable from block_index() can be passed in the seektable option.
+int
+wavpack_find_frame_return_info(PerlIO *infile, char *file, int offset, HV *info, HV *opts)
+{
+  off_t frame_offset;
+  uint64_t sample = 0;
+
+  frame_offset = _wavpack_find_frame(infile, file, offset, info, opts, &sample);
+
+  my_hv_store( info, "seek_offset", newSViv(frame_offset) );
+
+  if (frame_offset >= 0) {
+    my_hv_store( info, "seek_sample", newSVuv(sample) );
+  }
+
+  return frame_offset;
+}
+
+off_t
+_wavpack_find_frame(PerlIO *infile, char *file, int offset, HV *info, HV *opts, uint64_t *sample)
+{
+  off_t frame_offset = -1;
+  uint64_t target;
+  uint32_t scale;
+  SV **seektable = NULL;
+  WavpackHeader hdr;
+
+  wvpinfo *wvp = _wavpack_parse(infile, file, info, 1);
+
+  // Old versions and files without a valid block can't be seeked
+  if ( offset < 0 || wvp->header->version < 0x402 || !my_hv_exists(info, "samplerate") ) {
+    goto out;
+  }
+
+  // DSD blocks count bytes of 8 samples
+  scale = (wvp->header->flags & WAVPACK_DSD_FLAG) ? 8 : 1;
+
+  target = (uint64_t)offset * SvIV( *(my_hv_fetch(info, "samplerate")) ) / 1000 / scale;
+
+  if ( opts && my_hv_exists(opts, "seektable") ) {
+    seektable = my_hv_fetch(opts, "seektable");
+  }
+
+  frame_offset = _wavpack_find_sample(
+    wvp, target, (seektable != NULL && SvPOK(*seektable)) ? *seektable : NULL, scale, &hdr
+  );
+
+  if (frame_offset >= 0) {
+    *sample = (uint64_t)hdr.block_index * scale;
+  }
+
+out:
+  buffer_free(wvp->buf);
+  Safefree(wvp->buf);
+  Safefree(wvp->header);
+  Safefree(wvp);
+
+  return frame_offset;
+}
+
+// Finds the initial block containing sample (counted in block units). The position is
+// first guessed from the file size and the total sample count, narrowed down by the
+// headers found at each guess, then the remaining blocks are walked using their sizes.
+off_t
+_wavpack_find_sample(wvpinfo *wvp, uint64_t sample, SV *seektable, uint32_t scale, WavpackHeader *hdr)
+{
+  off_t lo_offset = wvp->audio_offset;
+  uint64_t lo_sample = 0;
+  off_t hi_offset = wvp->file_size;
+  uint64_t hi_sample = 0;
+  off_t offset;
+  int i;
+
+  SV **total_samples = my_hv_fetch( wvp->info, "total_samples" );
+  if (total_samples != NULL && wvp->header->total_samples != 0xFFFFFFFF) {
+    hi_sample = SvUV(*total_samples) / scale;
+  }
+
+  if (hi_sample && sample >= hi_sample) {
+    return -1;
+  }
+
+  // Start from the closest seek points around the sample
+  if (seektable != NULL) {
+    STRLEN len;
+    unsigned char *bptr = (unsigned char *)SvPV(seektable, len);
+    uint32_t points = len / 16;
+    uint32_t lo = 0;
+    uint32_t hi = points;
+
+    while (lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+
+      if ( get_u64(bptr + mid * 16) / scale <= sample ) {
+        lo = mid + 1;
+      }
+      else {
+        hi = mid;
+      }
+    }
+
+    if (lo > 0) {
+      lo_sample = get_u64(bptr + (lo - 1) * 16) / scale;
+      lo_offset = get_u64(bptr + (lo - 1) * 16 + 8);
+    }
+
+    if (lo < points) {
+      hi_sample = get_u64(bptr + lo * 16) / scale;
+      hi_offset = get_u64(bptr + lo * 16 + 8);
+    }
+
+    DEBUG_TRACE("seektable bounds %" PRIu64 " @ %" PRIu64 ", %" PRIu64 " @ %" PRIu64 "\n", lo_sample, (uint64_t)lo_offset, hi_sample, (uint64_t)hi_offset);
+  }
+
+  for (i = 0; i < WAVPACK_MAX_GUESSES; i++) {
+    off_t guess;
+
+    // Close enough to walk
+    if ( hi_sample <= lo_sample || hi_offset - lo_offset < WAVPACK_BLOCK_SIZE * 4 ) {
+      break;
+    }
+
+    guess = lo_offset + (off_t)( (double)(sample - lo_sample) / (hi_sample - lo_sample) * (hi_offset - lo_offset) );
+
+    if ( guess <= lo_offset || guess >= hi_offset ) {
+      break;
+    }
+
+    offset = _wavpack_next_block(wvp, guess, hi_offset, hdr);
+
+    DEBUG_TRACE("guess %" PRIu64 " for sample %" PRIu64 ", found block @ %" PRId64 "\n", (uint64_t)guess, sample, (int64_t)offset);
+
+    if ( offset < 0 || hdr->block_index > sample ) {
+      // The block with the sample starts before the guess
+      if (offset >= 0) {
+        hi_sample = hdr->block_index;
+      }
+      hi_offset = guess;
+    }
+    else {
+      if ( sample < (uint64_t)hdr->block_index + hdr->block_samples ) {
+        return offset;
+      }
+
+      lo_offset = offset;
+      lo_sample = hdr->block_index;
+
+      // Only a few blocks to go
+      if ( sample - lo_sample < (uint64_t)hdr->block_samples * 4 ) {
+        break;
+      }
+    }
+  }
+
+  // Hop from block to block using ckSize
+  offset = lo_offset;
+
+  while ( (offset = _wavpack_next_block(wvp, offset, wvp->file_size, hdr)) >= 0 ) {
+    if ( sample < (uint64_t)hdr->block_index + hdr->block_samples ) {
+      return offset;
+    }
+
+    offset += 8 + hdr->ckSize;
+  }
+
+  return -1;
+}
+
+// Returns the offset of the next initial block with audio at or after offset, and
+// its header in hdr, or -1 if there is none before end
+off_t
+_wavpack_next_block(wvpinfo *wvp, off_t offset, off_t end, WavpackHeader *hdr)
+{
+  unsigned char *bptr;
+
+  buffer_clear(wvp->buf);
+  PerlIO_seek(wvp->infile, offset, SEEK_SET);
+
+  while (offset + 32 <= end) {
+    if ( !_check_buf(wvp->infile, wvp->buf, 32, WAVPACK_BLOCK_SIZE) ) {
+      return -1;
+    }
+
+    bptr = buffer_ptr(wvp->buf);
+
+    if ( bptr[0] == 'w' && bptr[1] == 'v' && bptr[2] == 'p' && bptr[3] == 'k' ) {
+      hdr->ckSize        = get_u32le(bptr + 4);
+      hdr->version       = get_u16le(bptr + 8);
+      hdr->track_no      = bptr[10];
+      hdr->index_no      = bptr[11];
+      hdr->total_samples = get_u32le(bptr + 12);
+      hdr->block_index   = get_u32le(bptr + 16);
+      hdr->block_samples = get_u32le(bptr + 20);
+      hdr->flags         = get_u32le(bptr + 24);
+      hdr->crc           = get_u32le(bptr + 28);
+
+      // Sanity check the header, the signature may also appear in the audio data
+      if ( hdr->version >= 0x402 && hdr->version <= 0x410
+        && hdr->ckSize >= 24 && hdr->ckSize < WAVPACK_MAX_BLOCK_SIZE && !(hdr->ckSize & 1)
+      ) {
+        if ( (hdr->flags & WAVPACK_INITIAL_BLOCK) && hdr->block_samples ) {
+          return offset;
+        }
+
+        // Skip the other channels of a multichannel group and blocks without audio
+        DEBUG_TRACE("skipping block @ %" PRIu64 " (flags 0x%x, block_samples %u)\n", (uint64_t)offset, hdr->flags, hdr->block_samples);
+
+        offset += 8 + hdr->ckSize;
+        buffer_clear(wvp->buf);
+        PerlIO_seek(wvp->infile, offset, SEEK_SET);
+        continue;
+      }
+    }
+
+    buffer_consume(wvp->buf, 1);
+    offset++;
+  }
+
+  return -1;
+}
+
+// Walks every block once and returns a seektable of initial blocks for find_frame_return_info
+void
+wavpack_block_index(PerlIO *infile, char *file, HV *info, HV *opts)
+{
+  off_t offset;
+  uint32_t scale;
+  uint64_t interval;
+  uint64_t next_point = 0;
+  uint64_t total_samples = 0;
+  uint32_t blocks = 0;
+  uint32_t seekpoints = 0;
+  WavpackHeader hdr;
+  Buffer points;
+
+  wvpinfo *wvp = _wavpack_parse(infile, file, info, 1);
+
+  if ( wvp->header->version < 0x402 || !my_hv_exists(info, "samplerate") ) {
+    goto out;
+  }
+
+  scale = (wvp->header->flags & WAVPACK_DSD_FLAG) ? 8 : 1;
+
+  interval = (uint64_t)_opt_iv(opts, "interval_ms", 10000) * SvIV( *(my_hv_fetch(info, "samplerate")) ) / 1000;
+
+  buffer_init(&points, WAVPACK_BLOCK_SIZE);
+
+  offset = wvp->audio_offset;
+
+  while ( (offset = _wavpack_next_block(wvp, offset, wvp->file_size, &hdr)) >= 0 ) {
+    uint64_t sample = (uint64_t)hdr.block_index * scale;
+    unsigned char point[16];
+
+    blocks++;
+
+    if (sample >= next_point) {
+      put_u64(point, sample);
+      put_u64(point + 8, offset);
+      buffer_append(&points, point, 16);
+      seekpoints++;
+
+      next_point = interval ? sample + interval - sample % interval : sample + 1;
+    }
+
+    total_samples = sample + (uint64_t)hdr.block_samples * scale;
+
+    offset += 8 + hdr.ckSize;
+  }
+
+  my_hv_store( info, "blocks", newSVuv(blocks) );
+  my_hv_store( info, "total_samples", newSVuv(total_samples) );
+  my_hv_store( info, "seekpoints", newSVuv(seekpoints) );
+  my_hv_store( info, "seektable", newSVpvn( (char *)buffer_ptr(&points), buffer_len(&points) ) );
+
+  buffer_free(&points);
+
+out:
+  buffer_free(wvp->buf);
+  Safefree(wvp->buf);
+  Safefree(wvp->header);
+  Safefree(wvp);
+}
+
 wvpinfo *
 _wavpack_parse(PerlIO *infile, char *file, HV *info, uint8_t seeking)
 {
@@ -75,7 +377,8 @@ _wavpack_parse(PerlIO *infile, char *file, HV *info, uint8_t seeking)
 
       wvp->audio_offset++;
 
-      if ( !buffer_len(wvp->buf) ) {
+      // Keep a full block header buffered, the signature check reads 4 bytes
+      if ( buffer_len(wvp->buf) < 32 ) {
         if ( !_check_buf(infile, wvp->buf, 32, WAVPACK_BLOCK_SIZE) ) {
           PerlIO_printf(PerlIO_stderr(), "Unable to find a valid WavPack block in file: %s\n", file);
           err = -1;
@@ -95,9 +398,12 @@ _wavpack_parse(PerlIO *infile, char *file, HV *info, uint8_t seeking)
   my_hv_store( info, "audio_size", newSVuv(wvp->file_size - wvp->audio_offset) );
 
 out:
-  buffer_free(wvp->buf);
-  Safefree(wvp->buf);
-  Safefree(wvp->header);
+  // When seeking, the caller reuses the buffer and first block header
+  if (!wvp->seeking) {
+    buffer_free(wvp->buf);
+    Safefree(wvp->buf);
+    Safefree(wvp->header);
+  }
 
   return wvp;
 }
@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 31;
+use Test::More tests => 41;
 
 use Audio::Scan;
 
@@ -71,6 +72,73 @@ use Audio::Scan;
     ok( !exists $info->{dlna_profile}, '32-bit AIFF no DLNA profile ok' );
 }
 
+# Seeking, the header is rewritten for the remaining audio
+{
+    my $file = _f('aiff32.aiff');
+
+    is( Audio::Scan->find_frame( $file, 5 ), 1852, 'AIFF find_frame ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 5 );
+
+    is( $info->{seek_offset}, 1852, 'AIFF seek_offset ok' );
+
+    my $s = Audio::Scan->scan( _seeked( $file, $info, '.aiff' ) );
+
+    is( $s->{info}->{audio_offset}, 92, 'AIFF seeked audio_offset ok' );
+    is( $s->{info}->{audio_size}, 2048, 'AIFF seeked audio_size ok' );
+    is( $s->{info}->{song_length_ms}, 5, 'AIFF seeked COMM duration ok' );
+}
+
+# PCM analysis
+{
+    my $r = Audio::Scan->pcm_analysis( _f('aiff32.aiff') );
+
+    is( $r->{sample_peak}->[0]->{position}, $r->{peak}->[0]->{position}, 'AIFF analysis peak 1 matches PEAK chunk' );
+    is( $r->{sample_peak}->[1]->{value}, $r->{peak}->[1]->{value}, 'AIFF analysis peak 2 matches PEAK chunk' );
+
+    # 24-bit big-endian 1kHz sine at -23 dBFS
+    my $rate = 48000;
+    my $amp = 10 ** (-23 / 20);
+    my $audio = join '', map {
+        my $v = int( $amp * sin( 2 * 3.14159265358979 * 1000 * $_ / $rate ) * 8388607.5 );
+        ( substr( pack( 'l>', $v ), 1 ) ) x 2;
+    } 0 .. $rate * 5 - 1;
+
+    my $comm = 'COMM' . pack( 'N', 18 ) . pack( 'nNn', 2, $rate * 5, 24 ) . pack( 'H*', '400ebb80000000000000' );
+    my $ssnd = 'SSND' . pack( 'N', 8 + length $audio ) . pack( 'NN', 0, 0 ) . $audio;
+    my $data = 'FORM' . pack( 'N', 4 + length($comm) + length $ssnd ) . 'AIFF' . $comm . $ssnd;
+
+    my $tmp = File::Temp->new( SUFFIX => '.aiff' );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    $r = Audio::Scan->pcm_analysis( $tmp->filename );
+
+    is( $r->{analyzed_frames}, $rate * 5, 'AIFF 24-bit analysis frames ok' );
+    ok( abs( $r->{loudness} + 23 ) < 0.1, 'AIFF 24-bit analysis loudness ok' );
+    ok( abs( $r->{sample_peak}->[0]->{value} - $amp ) < 0.0001, 'AIFF 24-bit analysis peak ok' );
+}
+
+sub _seeked {
+    my ( $file, $info, $suffix ) = @_;
+
+    open my $fh, '<', $file or die "Cannot open $file: $!";
+    binmode $fh;
+    seek $fh, $info->{seek_offset}, 0;
+    my $data = $info->{seek_header} . do { local $/; <$fh> };
+    close $fh;
+
+    my $tmp = File::Temp->new( SUFFIX => $suffix );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'aiff', shift );
 }
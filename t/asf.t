@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 142;
+use Test::More tests => 160;
 
 use Audio::Scan;
 
@@ -155,6 +156,46 @@ eval {
     is( $tags->{'WM/Picture'}->{offset}, 1121, 'WM/Picture in Header Extension/Metadata Library length ok' );
 }
 
+# Large WM/Picture in the Metadata Library is skipped by length, built by growing
+# the image in bug17355-picture-offset.wma by 1MB
+{
+    open my $fh, '<', _f('bug17355-picture-offset.wma');
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    my $extra = 1024 * 1024;
+
+    # Image length, Metadata Library data length
+    substr $data, 1093, 4, pack( 'V', 88902 + $extra );
+    substr $data, 1066, 4, pack( 'V', 88931 + $extra );
+
+    # Metadata Library, Header Extension (and its data size) and Header object sizes
+    for my $guid ( '941c23449894d149a1411d134e457054', 'b503bf5f2ea9cf118ee300c00c205365', '3026b2758e66cf11a6d900aa0062ce6c' ) {
+        my $pos = index $data, pack( 'H*', $guid );
+        substr $data, $pos + 16, 4, pack( 'V', unpack( 'V', substr $data, $pos + 16, 4 ) + $extra );
+        if ( $guid =~ /^b503/ ) {
+            substr $data, $pos + 42, 4, pack( 'V', unpack( 'V', substr $data, $pos + 42, 4 ) + $extra );
+        }
+    }
+
+    substr $data, 1121 + 88902, 0, "\0" x $extra;
+
+    my $tmp = File::Temp->new( SUFFIX => '.wma' );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    local $ENV{AUDIO_SCAN_NO_ARTWORK} = 1;
+
+    my $s = Audio::Scan->scan( $tmp->filename );
+
+    is( $s->{tags}->{'WM/Picture'}->{image}, 88902 + $extra, 'Large WM/Picture skipped length ok' );
+    is( $s->{tags}->{'WM/Picture'}->{offset}, 1121, 'Large WM/Picture skipped offset ok' );
+    is( $s->{tags}->{Title}, 'Concert Of The Age', 'Large WM/Picture following objects ok' );
+    is( $s->{info}->{audio_offset}, 94556 + $extra, 'Large WM/Picture audio_offset ok' );
+}
+
 # WMA Pro 10 file
 {
     my $s = Audio::Scan->scan( _f('wma92-48k-pro.wma') );
@@ -354,6 +395,89 @@ eval {
     is( $offset, 6679, 'Find frame CBR without ASF_Index ok' );
 }
 
+# Seek header for the packets after the seek point
+{
+    my $info = Audio::Scan->find_frame_return_info( _f('wma92-32k.wma'), 740 );
+    is( $info->{seek_offset}, 6679, 'Find frame return info offset ok' );
+    is( $info->{seek_packet}, 1, 'Find frame return info packet ok' );
+    is( length( $info->{seek_header} ), 5161, 'Find frame return info header length ok' );
+
+    open my $fh, '<', _f('wma92-32k.wma');
+    binmode $fh;
+    seek $fh, $info->{seek_offset}, 0;
+    my $audio = do { local $/; <$fh> };
+    close $fh;
+
+    my $tmp = File::Temp->new( SUFFIX => '.wma' );
+    binmode $tmp;
+    print $tmp $info->{seek_header} . $audio;
+    close $tmp;
+
+    my $s = Audio::Scan->scan( $tmp->filename );
+    is( $s->{info}->{data_packets}, 4, 'Seek header data packets ok' );
+    is( $s->{info}->{song_length_ms}, 652, 'Seek header duration ok' );
+    is( $s->{info}->{audio_size}, 4 * 1518, 'Seek header audio size ok' );
+    is( $s->{tags}->{Title}, 'Voice Test', 'Seek header tags ok' );
+}
+
+# Truncated header, no seek header can be built
+{
+    open my $fh, '<', _f('wma92-32k.wma');
+    binmode $fh;
+    read $fh, my $data, 700;
+    close $fh;
+
+    my $tmp = File::Temp->new( SUFFIX => '.wma' );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    my $info = Audio::Scan->find_frame_return_info( $tmp->filename, 740 );
+    is( $info->{seek_offset}, -1, 'Find frame return info truncated header offset ok' );
+    ok( !exists $info->{seek_header}, 'Find frame return info truncated header no seek_header ok' );
+}
+
+# Broadcast file can't be seeked
+{
+    my $offset = Audio::Scan->find_frame( _f('wma-live.wma'), 1000 );
+    is( $offset, -1, 'Find frame broadcast file ok' );
+}
+
+# Find frame in a long file without ASF_Index, built by repeating the packets of
+# wma92-32k.wma with increasing send times
+{
+    open my $fh, '<', _f('wma92-32k.wma');
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    my $packets = 2000;
+    my $header  = substr $data, 0, 5161;
+
+    # File Properties play duration (100ns units, includes 1579ms preroll)
+    my $props = index $header, pack( 'H*', 'a1dcab8c47a9cf118ee400c00c205365' );
+    substr $header, $props + 64, 8, pack( 'V2', ( ( $packets * 371 + 1579 ) * 10000 ) & 0xFFFFFFFF, int( ( $packets * 371 + 1579 ) * 10000 / 2**32 ) );
+
+    # Data object size and packet count
+    substr $header, 5161 - 50 + 16, 8, pack( 'V2', 50 + $packets * 1518, 0 );
+    substr $header, 5161 - 50 + 40, 8, pack( 'V2', $packets, 0 );
+
+    my $tmp = File::Temp->new( SUFFIX => '.wma' );
+    binmode $tmp;
+    print $tmp $header;
+    for my $i ( 0 .. $packets - 1 ) {
+        my $packet = substr $data, 5161 + ( $i % 5 ) * 1518, 1518;
+        substr $packet, 6, 4, pack( 'V', $i * 371 );
+        print $tmp $packet;
+    }
+    close $tmp;
+
+    for my $time ( 100, 300_000, 600_050, 741_900 ) {
+        my $offset = Audio::Scan->find_frame( $tmp->filename, $time );
+        is( $offset, 5161 + int( $time / 371 ) * 1518, "Find frame long file without ASF_Index at $time ok" );
+    }
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'asf', shift );
 }
@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 16;
+use Test::More tests => 27;
 
 use Audio::Scan;
 
@@ -40,6 +41,82 @@ use Audio::Scan;
     is( $info->{samplerate}, 5644800, 'Sample rate ok' );
 }
 
+# Seeking to a group of channel bytes
+{
+    my $file = _f('dff64.dff');
+
+    is( Audio::Scan->find_frame( $file, 30 ), 130 + 21168, 'DSDIFF find_frame ok' );
+    is( Audio::Scan->find_frame( $file, 100 ), -1, 'DSDIFF find_frame past the end ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30 );
+
+    is( $info->{seek_offset}, 21298, 'DSDIFF seek_offset ok' );
+    is( length $info->{seek_header}, 130, 'DSDIFF seek_header length ok' );
+
+    my $s = Audio::Scan->scan( _seeked( $file, $info, '.dff' ) );
+
+    is( $s->{info}->{audio_offset}, 130, 'DSDIFF seeked audio_offset ok' );
+    is( $s->{info}->{audio_size}, 40540 - 21168, 'DSDIFF seeked audio_size ok' );
+    is( $s->{info}->{song_length_ms}, 27, 'DSDIFF seeked duration ok' );
+}
+
+# DoP frames, the same audio as the DSF test file
+{
+    my $dop = Audio::Scan->dop( _f('dff64.dff'), 0 );
+    my $dsf = Audio::Scan->dop( catfile( $FindBin::Bin, 'dsf', 'dsf64.dsf' ), 0 );
+
+    is( $dop->{dop_frames}, 10135, 'DSDIFF DoP frames ok' );
+    is( $dop->{dop_data}, $dsf->{dop_data}, 'DSDIFF DoP matches DSF ok' );
+
+    my $first = Audio::Scan->dop( _f('dff64.dff'), 0, { max_frames => 1001 } );
+    my $rest  = Audio::Scan->dop( _f('dff64.dff'), 0, { start_frame => $first->{dop_next_frame} } );
+
+    is( $first->{dop_data} . $rest->{dop_data}, $dop->{dop_data}, 'DSDIFF DoP continues across calls ok' );
+
+    # CHNL chunk with no channels
+    $dop = Audio::Scan->dop( _patched( _f('dff64.dff'), 76, pack( 'n', 0 ), '.dff' ), 0 );
+    ok( !defined $dop, 'DSDIFF DoP without channels returns undef' );
+}
+
+sub _seeked {
+    my ( $file, $info, $suffix ) = @_;
+
+    open my $fh, '<', $file or die "Cannot open $file: $!";
+    binmode $fh;
+    seek $fh, $info->{seek_offset}, 0;
+    my $data = $info->{seek_header} . do { local $/; <$fh> };
+    close $fh;
+
+    my $tmp = File::Temp->new( SUFFIX => $suffix );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
+sub _patched {
+    my ( $file, $offset, $bytes, $suffix ) = @_;
+
+    open my $fh, '<', $file or die "Cannot open $file: $!";
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    substr( $data, $offset, length $bytes, $bytes );
+
+    my $tmp = File::Temp->new( SUFFIX => $suffix );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'dsdiff', shift );
 }
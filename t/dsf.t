@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 35;
+use Test::More tests => 55;
 
 use Audio::Scan;
 
@@ -74,6 +75,104 @@ use Audio::Scan;
     is( $tags->{TALB}, 'Depeche Mode', 'TALB ok' );
 }
 
+# Seeking to a group of channel blocks
+{
+    my $file = _f('dsf64.dsf');
+
+    is( Audio::Scan->find_frame( $file, 30 ), 92 + 2 * 4096 * 2, 'DSF find_frame ok' );
+    is( Audio::Scan->find_frame( $file, 100 ), -1, 'DSF find_frame past the end ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 30 );
+
+    is( $info->{seek_offset}, 16476, 'DSF seek_offset ok' );
+    is( length $info->{seek_header}, 92, 'DSF seek_header length ok' );
+
+    my $s = Audio::Scan->scan( _seeked( $file, $info, '.dsf' ) );
+
+    is( $s->{info}->{audio_size}, 40960 - 16384, 'DSF seeked audio_size ok' );
+    is( $s->{info}->{song_length_ms}, 34, 'DSF seeked duration ok' );
+    ok( !exists $s->{info}->{id3_version}, 'DSF seeked metadata pointer cleared ok' );
+}
+
+# DoP frames
+{
+    my $file = _f('dsf64.dsf');
+    my $dop = Audio::Scan->dop( $file, 0 );
+
+    is( $dop->{dop_frames}, 10135, 'DSF DoP frames ok' );
+    is( $dop->{dop_samplerate}, 176400, 'DSF DoP samplerate ok' );
+    is( length $dop->{dop_data}, 10135 * 2 * 3, 'DSF DoP data length ok' );
+    ok( !exists $dop->{dop_next_frame}, 'DSF DoP no next frame at the end ok' );
+    is( unpack( 'H*', substr $dop->{dop_data}, 0, 12 ), '6996056996059669fa9669fa', 'DSF DoP markers and bit order ok' );
+
+    my $first = Audio::Scan->dop( $file, 0, { max_frames => 3000 } );
+    my $rest  = Audio::Scan->dop( $file, 0, { start_frame => $first->{dop_next_frame} } );
+
+    is( $first->{dop_next_frame}, 3000, 'DSF DoP next frame ok' );
+    is( $first->{dop_data} . $rest->{dop_data}, $dop->{dop_data}, 'DSF DoP continues across calls ok' );
+
+    my $seek = Audio::Scan->dop( $file, 10, { max_frames => 2, container => 4 } );
+
+    is( $seek->{dop_start_frame}, 1764, 'DSF DoP seek start frame ok' );
+    is( $seek->{dop_data}, "\0" . substr( $dop->{dop_data}, 1764 * 6, 3 ) . "\0" . substr( $dop->{dop_data}, 1764 * 6 + 3, 3 )
+        . "\0" . substr( $dop->{dop_data}, 1765 * 6, 3 ) . "\0" . substr( $dop->{dop_data}, 1765 * 6 + 3, 3 ), 'DSF DoP 32-bit container ok' );
+
+    $seek = Audio::Scan->dop( $file, 100 );
+
+    is( $seek->{dop_frames}, 0, 'DSF DoP past the end ok' );
+}
+
+# DoP from MSB-first and unsupported files
+{
+    my $dop = Audio::Scan->dop( _patched( _f('dsf64.dsf'), 60, pack( 'V', 8 ), '.dsf' ), 0, { max_frames => 2 } );
+    is( unpack( 'H*', $dop->{dop_data} ), '9669059669056996fa6996fa', 'DSF DoP MSB-first bit order ok' );
+
+    $dop = Audio::Scan->dop( _patched( _f('dsf64.dsf'), 52, pack( 'V', 0 ), '.dsf' ), 0 );
+    ok( !defined $dop, 'DSF DoP without channels returns undef' );
+
+    $dop = Audio::Scan->dop( catfile( $FindBin::Bin, 'mp3', 'no-tags-mp1l2.mp3' ), 0 );
+    ok( !defined $dop, 'DoP from an MP3 file returns undef' );
+}
+
+sub _seeked {
+    my ( $file, $info, $suffix ) = @_;
+
+    open my $fh, '<', $file or die "Cannot open $file: $!";
+    binmode $fh;
+    seek $fh, $info->{seek_offset}, 0;
+    my $data = $info->{seek_header} . do { local $/; <$fh> };
+    close $fh;
+
+    my $tmp = File::Temp->new( SUFFIX => $suffix );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
+sub _patched {
+    my ( $file, $offset, $bytes, $suffix ) = @_;
+
+    open my $fh, '<', $file or die "Cannot open $file: $!";
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    substr( $data, $offset, length $bytes, $bytes );
+
+    my $tmp = File::Temp->new( SUFFIX => $suffix );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'dsf', shift );
 }
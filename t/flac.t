@@ -1,8 +1,10 @@
 use strict;
 
+use File::Copy ();
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 71;
+use Test::More tests => 112;
 
 use Audio::Scan;
 
@@ -174,6 +176,130 @@ use Audio::Scan;
     is( $offset, 337723, 'Find frame in picture file ok' );
 }
 
+# Frame index
+{
+    my $index = Audio::Scan->frame_index( _f('tiny.flac'), { interval_ms => 0 } );
+
+    is( $index->{frames}, 11, 'Frame index frame count ok' );
+    is( $index->{indexed_samples}, 44975, 'Frame index indexed_samples ok' );
+    is( $index->{seekpoints}, 11, 'Frame index point per frame ok' );
+
+    # Same points as the file's own SEEKTABLE
+    my @points = unpack 'x4 (Q> Q> n)*', $index->{seektable_block};
+    is( join( ',', @points[ 27 .. 32 ] ), '36864,67767,4096,40960,72568,4015', 'Frame index seektable ok' );
+
+    $index = Audio::Scan->frame_index( _f('tiny.flac') );
+    is( length( $index->{seektable_block} ), 4 + 18, 'Frame index with default interval ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( _f('tiny.flac'), 500, { seektable => $index->{seektable_block} } );
+    is( $info->{seek_offset}, 50005, 'Find frame with frame index ok' );
+
+    # Guessing fails in this truncated file
+    $index = Audio::Scan->frame_index( _f('test.flac'), { interval_ms => 0 } );
+    is( $index->{total_samples}, 153200460, 'Frame index keeps STREAMINFO total_samples' );
+    is( $index->{indexed_samples}, 32256, 'Frame index indexed_samples of truncated file ok' );
+    $info = Audio::Scan->find_frame_return_info( _f('test.flac'), 500, { seektable => $index->{seektable_block} } );
+    is( $info->{seek_offset}, 12002, 'Find frame in truncated file with frame index ok' );
+
+    open my $fh, '<', _f('tiny.flac');
+    $index = Audio::Scan->frame_index_fh( flac => $fh, { interval_ms => 0 } );
+    close $fh;
+    is( $index->{frames}, 11, 'Frame index with filehandle ok' );
+
+    # Other formats are not handed to the FLAC parser
+    $index = Audio::Scan->frame_index( catfile( $FindBin::Bin, 'mp3', 'no-tags-mp1l2.mp3' ) );
+    ok( !defined $index, 'Frame index of an MP3 file returns undef' );
+}
+
+# Seek header
+{
+    my $info = Audio::Scan->find_frame_return_info( _f('tiny.flac'), 500 );
+
+    is( $info->{seek_offset}, 50005, 'Find frame return info ok' );
+    is( length( $info->{seek_header} ), 4 + 4 + 34 + 4 + 5 * 18, 'Seek header length ok' );
+
+    my ( $magic, $si, $st ) = unpack 'a4 x4 a34 x4 a*', $info->{seek_header};
+    is( $magic, 'fLaC', 'Seek header magic ok' );
+
+    # 44975 samples - 20480 skipped
+    my ( $hi, $lo ) = unpack 'x13 C N', $si;
+    is( ( $hi & 0x0F ) * 2**32 + $lo, 24495, 'Seek header total_samples ok' );
+    is( unpack( 'H*', substr( $si, 18 ) ), '0' x 32, 'Seek header MD5 cleared ok' );
+
+    # First seek point is the seek frame, the rest are shifted by it
+    my @points = unpack '(Q> Q> n)*', $st;
+    is( join( ',', @points[ 0 .. 5 ] ), '0,0,4096,4096,8365,4096', 'Seek header seektable rebased ok' );
+}
+
+# Seek to CUESHEET tracks
+{
+    my $index = Audio::Scan->frame_index( _f('cuesheet.flac') );
+    my $tracks = $index->{tracks};
+
+    is( scalar @{$tracks}, 2, 'Cuesheet tracks ok' );
+    is( $tracks->[0]->{offset}, 8848, 'Cuesheet track 1 offset ok' );
+    is( $tracks->[0]->{size}, 41701, 'Cuesheet track 1 size ok' );
+    is( $tracks->[0]->{end_sample}, 22000, 'Cuesheet track 1 end_sample ok' );
+    is( $tracks->[1]->{start_sample}, 22000, 'Cuesheet track 2 start_sample ok' );
+    is( $tracks->[1]->{offset}, 50549, 'Cuesheet track 2 offset ok' );
+    is( $tracks->[1]->{end_sample}, 44975, 'Cuesheet track 2 end_sample ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( _f('cuesheet.flac'), 0, { track => 2 } );
+    is( $info->{seek_offset}, 50549, 'Find frame at track 2 ok' );
+
+    $info = Audio::Scan->find_frame_return_info( _f('cuesheet.flac'), 0, { track => 2, index => 0 } );
+    is( $info->{seek_offset}, 42305, 'Find frame at track 2 index 0 ok' );
+
+    $info = Audio::Scan->find_frame_return_info( _f('cuesheet.flac'), 0, { track => 3 } );
+    is( $info->{seek_offset}, -1, 'Find frame at missing track ok' );
+
+    my $offset = Audio::Scan->find_frame( _f('cuesheet.flac'), { track => 2, offset => 300 } );
+    is( $offset, 71855, 'Find frame in track 2 ok' );
+
+    $offset = Audio::Scan->find_frame( _f('cuesheet.flac'), { track => 1, offset => 900 } );
+    is( $offset, 76615, 'Find frame in track 1 ok' );
+
+    open my $fh, '<', _f('cuesheet.flac');
+    $offset = Audio::Scan->find_frame_fh( flac => $fh, { track => 2 } );
+    close $fh;
+    is( $offset, 50549, 'Find frame fh at track 2 ok' );
+}
+
+# Write tags in place using the padding, or rewrite the file when they don't fit
+{
+    my $tmp = File::Temp->new( SUFFIX => '.flac' );
+    File::Copy::copy( _f('picture.flac'), $tmp->filename );
+
+    my $s = Audio::Scan->scan( $tmp->filename );
+    my $tags = { %{ $s->{tags} }, TITLE => "New \x{263a} title", ARTIST => [ 'A', 'B' ] };
+
+    my $ret = Audio::Scan->write_tags( $tmp->filename, $tags );
+    is( $ret->{in_place}, 1, 'Write tags in place ok' );
+    is( $ret->{padding}, 7936, 'Write tags padding ok' );
+
+    my $s2 = Audio::Scan->scan( $tmp->filename );
+    is( $s2->{info}->{audio_offset}, 45795, 'Write tags in place audio_offset ok' );
+    is( $s2->{tags}->{TITLE}, "New \x{263a} title", 'Write tags utf8 title ok' );
+    is_deeply( $s2->{tags}->{ARTIST}, [ 'A', 'B' ], 'Write tags multiple values ok' );
+    is( $s2->{tags}->{ALLPICTURES}->[0]->{image_data}, $s->{tags}->{ALLPICTURES}->[0]->{image_data}, 'Write tags kept picture ok' );
+
+    chmod 0640, $tmp->filename;
+
+    $tags->{BIG} = 'x' x 20000;
+    $ret = Audio::Scan->write_tags( $tmp->filename, $tags, { padding => 1000 } );
+    is( $ret->{in_place}, 0, 'Write tags rewrite ok' );
+    is( ( stat $tmp->filename )[2] & 07777, 0640, 'Write tags rewrite keeps mode ok' );
+
+    my $s3 = Audio::Scan->scan( $tmp->filename );
+    is( $s3->{info}->{audio_offset}, 58867, 'Write tags rewrite audio_offset ok' );
+    is( _audio( $tmp->filename, 58867 ), _audio( _f('picture.flac'), 45795 ), 'Write tags rewrite audio ok' );
+
+    # Pictures are replaced when given, an empty list removes them
+    $ret = Audio::Scan->write_tags( $tmp->filename, { TITLE => 'x', ALLPICTURES => [] } );
+    my $s4 = Audio::Scan->scan( $tmp->filename );
+    ok( !$s4->{tags}->{ALLPICTURES} && $ret->{in_place}, 'Write tags remove pictures ok' );
+}
+
 # Calc duration/bitrate when missing header information
 {
     my $s = Audio::Scan->scan( _f('bad-streaminfo.flac') );
@@ -199,6 +325,17 @@ use Audio::Scan;
     is( $tags->{ALBUM}, 'Quod Libet Test Data', 'CVE-2007-4619 handled ok' );
 }
 
+sub _audio {
+    my ( $file, $offset ) = @_;
+
+    open my $fh, '<', $file;
+    binmode $fh;
+    seek $fh, $offset, 0;
+    local $/;
+
+    return <$fh>;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'flac', shift );
 }
@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp;
 use FindBin ();
-use Test::More tests => 20;
+use Test::More tests => 42;
 
 use Audio::Scan;
 
@@ -46,6 +47,85 @@ use Audio::Scan;
     is( $tags->{YEAR}, "2004", 'APEv1 year ok' );
 }
 
+# Seeking
+{
+    my $file = _f('apev2.ape');
+
+    is( Audio::Scan->find_frame( $file, 0 ), 29204, 'Seek to first frame ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 1000 );
+    is( $info->{seek_offset}, 29204, 'seek_offset ok' );
+    is( $info->{seek_frame}, 0, 'seek_frame ok' );
+    is( $info->{seek_skip_samples}, 44100, 'seek_skip_samples ok' );
+    is( $info->{seek_bit}, 0, 'seek_bit ok' );
+
+    # The file is truncated after the first frame
+    is( Audio::Scan->find_frame( $file, 2000 ), -1, 'Seek past end of truncated file ok' );
+
+    # Point the seek table at frames 1001 bytes apart, with an ID3v2 tag in front
+    open my $fh, '<', $file;
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    substr( $data, 76 + $_ * 4, 4, pack( 'V', 29204 + $_ * 1001 ) ) for 0..60;
+    my $id3 = "ID3\x03\x00\x00\x00\x00\x00\x0a" . ( "\0" x 10 );
+
+    $file = _tmp( $id3 . $data );
+
+    $info = Audio::Scan->find_frame_return_info( $file, 50000 );
+    is( $info->{seek_frame}, 29, 'Seek table seek_frame ok' );
+    is( $info->{seek_offset}, 20 + 29204 + 29 * 1001 - 1, 'Seek table seek_offset ok' );
+    is( $info->{seek_bit}, 8, 'Seek table seek_bit ok' );
+    is( $info->{seek_skip_samples}, 2205000 - 29 * 73728, 'Seek table seek_skip_samples ok' );
+
+    is( Audio::Scan->find_frame( $file, 100799 ), 20 + 29204 + 60 * 1001, 'Seek to last frame ok' );
+    is( Audio::Scan->find_frame( $file, 100800 ), -1, 'Seek past last sample ok' );
+}
+
+# Old versions, 3.80 has 9216 samples per frame and a table of bit offsets
+{
+    my @bits = ( 0, 3, 5, 7, 1 );
+    my $seek_table = join '', map { pack 'V', 57 + $_ * 1001 } 0..4;
+    my $header = pack( 'A4 v v v v V V V V V', 'MAC ', 3800, 2000, 32, 2, 44100, 0, 0, 5, 1000 );
+
+    my $file = _tmp( $header . $seek_table . pack( 'C*', @bits ) . ( "\0" x 5200 ) );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 500 );
+    is( $info->{song_length_ms}, 858, '3.80 song_length_ms ok' );
+    is( $info->{seek_frame}, 2, '3.80 seek_frame ok' );
+    is( $info->{seek_offset}, 57 + 2002 - 2, '3.80 seek_offset ok' );
+    is( $info->{seek_bit}, 16 + 5, '3.80 seek_bit ok' );
+    is( $info->{seek_skip_samples}, 22050 - 2 * 9216, '3.80 seek_skip_samples ok' );
+
+    is( Audio::Scan->find_frame( $file, 0 ), 57, '3.80 seek to first frame ok' );
+
+    # 3.97 with peak level, seek table size and a stored WAV header before the seek table
+    $seek_table = join '', map { pack 'V', 104 + $_ * 1001 } 0..4;
+    $header = pack( 'A4 v v v v V V V V V V V', 'MAC ', 3970, 2000, 4 | 16, 2, 44100, 44, 0, 5, 1000, 0, 5 );
+
+    $file = _tmp( $header . ( "\0" x 44 ) . $seek_table . ( "\0" x 5200 ) );
+
+    $info = Audio::Scan->find_frame_return_info( $file, 8000 );
+    is( $info->{seek_frame}, 1, '3.97 seek_frame ok' );
+    is( $info->{seek_offset}, 104 + 1001 - 1, '3.97 seek_offset ok' );
+    is( $info->{seek_bit}, 8, '3.97 seek_bit ok' );
+    is( $info->{seek_skip_samples}, 352800 - 294912, '3.97 seek_skip_samples ok' );
+}
+
+sub _tmp {
+    my $data = shift;
+
+    my $tmp = File::Temp->new( SUFFIX => '.ape' );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'mac', shift );
 }
@@ -1,9 +1,11 @@
 use strict;
 
 use Digest::MD5 qw(md5_hex);
+use File::Copy ();
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 396;
+use Test::More tests => 408;
 use Test::Warn;
 
 use Audio::Scan;
@@ -1321,6 +1323,45 @@ eval {
     is( $tags->{MP3GAIN_MINMAX}, '123,203', 'bad APE tag MP3GAIN_MINMAX ok' );
 }
 
+# Write ID3v2 tags in place using the tag padding
+{
+    my $tmp = File::Temp->new( SUFFIX => '.mp3' );
+    File::Copy::copy( _f('v2.3-itunes81.mp3'), $tmp->filename );
+
+    my $ret = Audio::Scan->write_tags( $tmp->filename, {
+        TIT2              => "New \x{263a} title",
+        TPE1              => [ 'A', 'B' ],
+        TCMP              => undef,
+        'MY DESCRIPTION'  => 'value',
+        COMM              => [ 'eng', '', 'Replaced' ],
+    } );
+    is( $ret->{in_place}, 1, 'Write ID3 tags in place ok' );
+    is( $ret->{audio_offset}, 12714, 'Write ID3 tags audio_offset ok' );
+
+    my $s = Audio::Scan->scan( $tmp->filename );
+    my $tags = $s->{tags};
+    is( $s->{info}->{id3_version}, 'ID3v2.3.0', 'Write ID3 tags kept version ok' );
+    is( $tags->{TIT2}, "New \x{263a} title", 'Write ID3 UTF-16 title ok' );
+    is_deeply( $tags->{TPE1}, [ 'A', 'B' ], 'Write ID3 multiple values ok' );
+    ok( !exists $tags->{TCMP}, 'Write ID3 removed frame ok' );
+    is( $tags->{'MY DESCRIPTION'}, 'value', 'Write ID3 TXXX ok' );
+    is_deeply( $tags->{COMM}, [ 'eng', '', 'Replaced' ], 'Write ID3 COMM ok' );
+    is( $tags->{TALB}, 'Album Name', 'Write ID3 kept other frames ok' );
+    is( length( $tags->{APIC}->[3] ), 2103, 'Write ID3 kept APIC ok' );
+}
+
+# Write ID3v2 tags to a file without a tag
+{
+    my $tmp = File::Temp->new( SUFFIX => '.mp3' );
+    File::Copy::copy( _f('no-tags-mp1l3.mp3'), $tmp->filename );
+
+    my $ret = Audio::Scan->write_tags( $tmp->filename, { TIT2 => 'Title' }, { padding => 100 } );
+    is( $ret->{in_place}, 0, 'Write ID3 tags new tag ok' );
+
+    my $s = Audio::Scan->scan( $tmp->filename );
+    is( $s->{info}->{audio_offset}, $ret->{audio_offset}, 'Write ID3 tags new tag audio_offset ok' );
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'mp3', shift );
 }
@@ -1,8 +1,10 @@
 use strict;
 
+use File::Copy ();
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 120;
+use Test::More tests => 174;
 
 use Audio::Scan;
 
@@ -279,11 +281,36 @@ use Audio::Scan;
     is( length( $info->{seek_header} ), 34274, 'Find frame in ALAC multiple stts header ok' );
 }
 
-# Find frame in HD-AAC file (2 tracks) (not yet supported)
+# Find frame in HD-AAC file (2 tracks), seeks in the first audio track
 {
     my $info = Audio::Scan->find_frame_return_info( _f('hd-aac.m4a'), 10 );
 
-    is( $info->{seek_offset}, -1, 'Find frame in HD-AAC ok' );
+    is( $info->{seek_offset}, 312206, 'Find frame in HD-AAC ok' );
+    is( $info->{seek_track_id}, 1, 'Find frame in HD-AAC track ID ok' );
+    is( length( $info->{seek_header} ), 158324, 'Find frame in HD-AAC header ok' );
+
+    my $traks = () = $info->{seek_header} =~ /trak/g;
+    is( $traks, 1, 'Find frame in HD-AAC header has one trak ok' );
+}
+
+# Find frame in the SLS track of HD-AAC
+{
+    my $info = Audio::Scan->find_frame_return_info( _f('hd-aac.m4a'), 5000, { track_id => 2 } );
+
+    is( $info->{seek_offset}, 950071, 'Find frame in HD-AAC track 2 ok' );
+    is( $info->{seek_track_id}, 2, 'Find frame in HD-AAC track 2 ID ok' );
+    is( length( $info->{seek_header} ), 156474, 'Find frame in HD-AAC track 2 header ok' );
+}
+
+# Hint track can't be selected for seeking
+{
+    my $info = Audio::Scan->find_frame_return_info( _f('hint-track.m4a'), 5000 );
+
+    is( $info->{seek_offset}, 226485, 'Find frame with hint track ok' );
+
+    $info = Audio::Scan->find_frame_return_info( _f('hint-track.m4a'), 5000, { track_id => 2 } );
+
+    is( $info->{seek_offset}, -1, 'Find frame in hint track not possible ok' );
 }
 
 # Find frame with info from filehandle
@@ -298,6 +325,205 @@ use Audio::Scan;
     close $fh;
 }
 
+# Find frame with info returned as a scatter list
+{
+    my $info = Audio::Scan->find_frame_return_info( _f('alac-multiple-stts.m4a'), 30000, { scatter => 1 } );
+
+    is( $info->{seek_offset}, 2123193, 'Find frame scatter offset ok' );
+    ok( !exists $info->{seek_header}, 'Find frame scatter has no seek_header ok' );
+    is( $info->{seek_header_size}, 34274, 'Find frame scatter header size ok' );
+
+    # Reassemble the header and compare to the normal rewritten header
+    open my $fh, '<', _f('alac-multiple-stts.m4a');
+    binmode $fh;
+
+    my $header = '';
+    for my $part ( @{ $info->{seek_header_parts} } ) {
+        if ( ref $part ) {
+            seek $fh, $part->[0], 0;
+            read $fh, my $buf, $part->[1];
+            $header .= $buf;
+        }
+        else {
+            $header .= $part;
+        }
+    }
+
+    close $fh;
+
+    my $orig = Audio::Scan->find_frame_return_info( _f('alac-multiple-stts.m4a'), 30000 );
+    ok( $header eq $orig->{seek_header}, 'Find frame scatter header matches seek_header ok' );
+}
+
+# Find a clip with start and end times
+{
+    my $info = Audio::Scan->find_frame_range( _f('alac-multiple-stts.m4a'), 30000, 60000 );
+
+    is( $info->{seek_offset}, 2123193, 'Find frame range offset ok' );
+    is( $info->{seek_length}, 2937938, 'Find frame range length ok' );
+    is( length( $info->{seek_header} ), 5414, 'Find frame range header ok' );
+
+    # mdhd duration is the sum of the clip's sample durations
+    my $header = $info->{seek_header};
+    my $mdhd = index( $header, 'mdhd' );
+    is( unpack( 'N', substr( $header, $mdhd + 20, 4 ) ), 1327104, 'Find frame range mdhd duration ok' );
+
+    # mdat size covers only the clip
+    is( unpack( 'N', substr( $header, -8, 4 ) ), 2937938 + 8, 'Find frame range mdat size ok' );
+}
+
+# Find a clip with an end time past the end of the file
+{
+    open my $fh, '<', _f('alac-multiple-stts.m4a');
+
+    my $info = Audio::Scan->find_frame_fh_range( mp4 => $fh, 600000, 9999999 );
+
+    # Clip ends at the end of mdat
+    is( $info->{seek_offset} + $info->{seek_length}, 35798 + 64724643, 'Find frame range to end of file ok' );
+
+    close $fh;
+}
+
+# ADTS frames from an HE-AAC file
+{
+    my $info = Audio::Scan->find_frame_return_info( _f('heaac.mp4'), 0, { adts => 1 } );
+
+    is( $info->{seek_offset}, 3850, 'ADTS offset ok' );
+    is( $info->{adts_frames}, 606, 'ADTS frame count ok' );
+    is( $info->{adts_size}, 120634, 'ADTS size ok' );
+    ok( !exists $info->{adts_next_sample}, 'ADTS no next sample ok' );
+
+    # LC profile, 8000 Hz (the HE-AAC core rate, index 11), 1 channel, frame length 7 + 193
+    is( unpack( 'H*', $info->{adts_parts}->[0] ), 'fff16c40191ffc', 'ADTS header ok' );
+    is_deeply( $info->{adts_parts}->[1], [ 3850, 193 ], 'ADTS first frame range ok' );
+}
+
+# ADTS frames returned in windows
+{
+    my $info = Audio::Scan->find_frame_return_info( _f('heaac.mp4'), 1000, { adts => 1, max_frames => 10 } );
+
+    is( $info->{adts_next_sample}, 17, 'ADTS window next sample ok' );
+
+    $info = Audio::Scan->find_frame_return_info( _f('heaac.mp4'), 0, { adts => 1, start_sample => 17, max_frames => 10 } );
+
+    is( $info->{seek_offset}, 7192, 'ADTS window start_sample ok' );
+}
+
+# ADTS not possible for ALAC
+{
+    my $info = Audio::Scan->find_frame_return_info( _f('alac.m4a'), 0, { adts => 1 } );
+
+    is( $info->{seek_offset}, -1, 'ADTS with ALAC not supported ok' );
+}
+
+# Box tree
+{
+    my $tree = Audio::Scan->box_tree( _f('alac-multiple-stts.m4a') );
+    my $boxes = $tree->{boxes};
+
+    is( scalar @{$boxes}, 33, 'Box tree count ok' );
+    is( $tree->{moov_offset}, 32, 'Box tree moov offset ok' );
+    is( $tree->{moov_size}, 34873, 'Box tree moov size ok' );
+    is( $tree->{audio_offset}, 35798, 'Box tree mdat offset ok' );
+    is( $tree->{free_size}, 2779, 'Box tree free size ok' );
+    ok( !$tree->{leading_mdat}, 'Box tree moov before mdat ok' );
+
+    my ($stsz) = grep { $_->{type} eq 'stsz' } @{$boxes};
+    is_deeply( $stsz, {
+        type         => 'stsz',
+        offset       => 550,
+        header_size  => 8,
+        payload_size => 26640,
+        depth        => 5,
+        entries      => 6657,
+        sample_size  => 0,
+    }, 'Box tree stsz ok' );
+
+    my ($stco) = grep { $_->{type} eq 'stco' } @{$boxes};
+    is( $stco->{entries}, 1332, 'Box tree stco entries ok' );
+
+    # Truncated file
+    is( $boxes->[-1]->{type}, 'mdat', 'Box tree last box ok' );
+    ok( $boxes->[-1]->{truncated}, 'Box tree truncated mdat ok' );
+}
+
+# Box tree with mdat before moov
+{
+    open my $fh, '<', _f('heaac.mp4');
+    my $tree = Audio::Scan->box_tree_fh( mp4 => $fh );
+    close $fh;
+
+    ok( $tree->{leading_mdat}, 'Box tree leading mdat ok' );
+
+    my ($esds) = grep { $_->{type} eq 'esds' } @{ $tree->{boxes} };
+    is( $esds->{depth}, 7, 'Box tree esds inside mp4a ok' );
+
+    # Other formats are not handed to the MP4 parser
+    $tree = Audio::Scan->box_tree( catfile( $FindBin::Bin, 'mp3', 'no-tags-mp1l2.mp3' ) );
+    ok( !defined $tree, 'Box tree of an MP3 file returns undef' );
+}
+
+# Write ilst tags in place using free space, or move moov to the end of the file
+{
+    my $tmp = File::Temp->new( SUFFIX => '.m4a' );
+    File::Copy::copy( _f('itunes811.m4a'), $tmp->filename );
+
+    my $audio = _audio( $tmp->filename, 6169, 320 );
+
+    my $ret = Audio::Scan->write_tags( $tmp->filename, {
+        NAM         => "New \x{263a} title",
+        TRKN        => '3/12',
+        GNRE        => 'Rock',
+        TMPO        => 130,
+        ART         => undef,
+        'MY CUSTOM' => [ 'a', 'b' ],
+    } );
+    is( $ret->{in_place}, 1, 'Write tags in place ok' );
+    ok( !$ret->{moov_relocated}, 'Write tags moov not relocated ok' );
+    is( $ret->{padding}, 1988, 'Write tags padding ok' );
+    is( -s $tmp->filename, 6489, 'Write tags file size unchanged ok' );
+
+    my $s = Audio::Scan->scan( $tmp->filename );
+    my $tags = $s->{tags};
+    is( $tags->{NAM}, "New \x{263a} title", 'Write tags utf8 title ok' );
+    is( $tags->{TRKN}, '3/12', 'Write tags trkn ok' );
+    is( $tags->{GNRE}, 'Rock', 'Write tags gnre ok' );
+    is( $tags->{TMPO}, 130, 'Write tags tmpo ok' );
+    ok( !exists $tags->{ART}, 'Write tags removed ART ok' );
+    is_deeply( $tags->{'MY CUSTOM'}, [ 'a', 'b' ], 'Write tags custom atom ok' );
+    is( $tags->{ALB}, 'Album', 'Write tags kept ALB ok' );
+
+    # Artwork skipped with AUDIO_SCAN_NO_ARTWORK is copied from the file
+    my $covr = $tags->{COVR};
+    {
+        local $ENV{AUDIO_SCAN_NO_ARTWORK} = 1;
+        my $t = Audio::Scan->scan_tags( $tmp->filename )->{tags};
+
+        $ret = Audio::Scan->write_tags( $tmp->filename, {
+            COVR        => $t->{COVR},
+            COVR_offset => $t->{COVR_offset},
+            LYR         => 'x' x 5000,
+        }, { padding => 100 } );
+    }
+
+    is( $ret->{moov_relocated}, 1, 'Write tags moov relocated ok' );
+
+    $s = Audio::Scan->scan( $tmp->filename );
+    ok( $s->{tags}->{COVR} eq $covr && length( $s->{tags}->{LYR} ) == 5000, 'Write tags relocated tags ok' );
+    is( _audio( $tmp->filename, 6169, 320 ), $audio, 'Write tags relocated audio ok' );
+}
+
+sub _audio {
+    my ( $file, $offset, $len ) = @_;
+
+    open my $fh, '<', $file;
+    binmode $fh;
+    seek $fh, $offset, 0;
+    read $fh, my $buf, $len;
+
+    return $buf;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'mp4', shift );
 }
@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp;
 use FindBin ();
-use Test::More tests => 36;
+use Test::More tests => 58;
 
 use Audio::Scan;
 
@@ -76,6 +77,118 @@ use Audio::Scan;
     is( $tags->{'COVER ART (FRONT)_offset'}, 68925, 'APEv2 AUDIO_SCAN_NO_ARTWORK cover offset ok' );
 }
 
+# SV7 seeking walks the frame lengths, frames aren't byte-aligned
+{
+    my $file = _f('apev2-cover.mpc');
+
+    is( Audio::Scan->find_frame( $file, 0 ), 24, 'SV7 seek to start ok' );
+    is( Audio::Scan->find_frame( $file, 1000 ), 26660, 'SV7 seek to 1000ms ok' );
+    is( Audio::Scan->find_frame( $file, 5000 ), -1, 'SV7 seek past end ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 2600 );
+    is( $info->{seek_offset}, 67272, 'SV7 seek_offset ok' );
+    is( $info->{seek_frame}, 99, 'SV7 seek_frame ok' );
+    is( $info->{seek_bit}, 3, 'SV7 seek_bit ok' );
+
+    # Truncated file
+    is( Audio::Scan->find_frame( _f('apev2.mpc'), 2600 ), -1, 'SV7 seek past end of truncated file ok' );
+}
+
+# SV8 seeking
+{
+    is( Audio::Scan->find_frame( _f('sv8.mpc'), 0 ), 46, 'SV8 seek to first packet ok' );
+
+    # 40 audio packets of 4 frames, with a seek table point every 2 packets
+    my @ap;
+    my $audio = '';
+    for my $i ( 0..39 ) {
+        push @ap, length($audio);
+        $audio .= _packet( 'AP', chr($i) x ( 100 + $i * 37 % 50 ) );
+    }
+
+    my $samples = 40 * 4 * 1152 - 576 - 100;
+    my $sh = _packet( 'SH', pack( 'N', 0 ) . chr(8) . _size($samples) . _size(576) . "\x1f\x11" );
+
+    # The seek table offset is relative to the SO packet and its size depends on it
+    my $so = '';
+    $so = _packet( 'SO', _size( length($so) + length($audio) ) ) for 1..2;
+
+    my $header_size = 4 + length($sh) + length($so);
+    $_ += $header_size for @ap;
+
+    # Seek distance of 1 (2 packets), first two offsets as sizes, then Golomb
+    # coded differences from the offset predicted by the previous two
+    my @points = map { $ap[ $_ * 2 ] } 0..19;
+    my $bits = _bits( _size(20) ) . sprintf( '%04b', 1 ) . _bits( _size( $points[0] ) ) . _bits( _size( $points[1] ) );
+    for my $i ( 2..$#points ) {
+        my $diff = $points[$i] - 2 * $points[ $i - 1 ] + $points[ $i - 2 ];
+        my $code = $diff < 0 ? -$diff * 2 + 1 : $diff * 2;
+        $bits .= ( '0' x ( $code >> 12 ) ) . '1' . sprintf( '%012b', $code & 0xfff );
+    }
+    my $st = _packet( 'ST', pack( 'B*', $bits ) );
+
+    my $mpc = 'MPCK' . $sh . $so . $audio . $st . _packet( 'SE', '' );
+    is( length('MPCK' . $sh . $so), $header_size, 'SV8 test file header ok' );
+
+    my $file = _tmp($mpc);
+
+    for my $ms ( 0, 13, 1000, 2500, 4100 ) {
+        my $packet = int( ( int( $ms * 44100 / 1000 ) + 576 ) / 1152 / 4 );
+        my $info = Audio::Scan->find_frame_return_info( $file, $ms );
+        is( $info->{seek_offset}, $ap[$packet], "SV8 seek to ${ms}ms ok" );
+        is( $info->{seek_frame}, $packet * 4, "SV8 seek_frame for ${ms}ms ok" );
+    }
+
+    is( Audio::Scan->find_frame( $file, 5000 ), -1, 'SV8 seek past end ok' );
+
+    # Packets before the seek point aren't read, hopping would not count this one
+    my $skipped = $mpc;
+    substr( $skipped, $ap[3], 2, 'ZZ' );
+    is( Audio::Scan->find_frame( _tmp($skipped), 2500 ), $ap[24], 'SV8 seek uses seek table ok' );
+
+    # Without a valid seek table the packets are hopped over from the first one
+    substr( $mpc, length($mpc) - length($st) - 3, 2, 'XX' );
+    is( Audio::Scan->find_frame( _tmp($mpc), 2500 ), $ap[24], 'SV8 seek without seek table ok' );
+}
+
+sub _size {
+    my $size = shift;
+
+    my $ret = chr( $size & 0x7f );
+    while ( $size >>= 7 ) {
+        $ret = chr( 0x80 | ( $size & 0x7f ) ) . $ret;
+    }
+
+    return $ret;
+}
+
+sub _packet {
+    my ( $key, $data ) = @_;
+
+    # The size includes the key and the size itself
+    my $n = 1;
+    $n++ while length( _size( 2 + $n + length($data) ) ) > $n;
+
+    return $key . _size( 2 + $n + length($data) ) . $data;
+}
+
+sub _bits {
+    return unpack( 'B*', shift );
+}
+
+sub _tmp {
+    my $data = shift;
+
+    my $tmp = File::Temp->new( SUFFIX => '.mpc' );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'musepack', shift );
 }
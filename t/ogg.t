@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 72;
+use Test::More tests => 82;
 
 use Audio::Scan;
 
@@ -100,8 +101,9 @@ eval {
     my $tags = $s->{tags};
     my $pic = $tags->{ALLPICTURES}->[0];
 
-    is( length( $pic->{image_data} ), 78527, 'COVERART real length ok' ); # without base64 encoding
+    is( length( $pic->{image_data} ), 78526, 'COVERART real length ok' ); # without base64 encoding
     is( unpack( 'H*', substr( $pic->{image_data}, 0, 4 ) ), 'ffd8ffe0', 'COVERART JPEG picture data ok ');
+    is( unpack( 'H*', substr( $pic->{image_data}, -2 ) ), 'ffd9', 'COVERART JPEG picture end ok' );
 }
 
 # Test METADATA_BLOCK_PICTURE
@@ -136,6 +138,7 @@ eval {
 
     is( length( $pic->{image_data} ), 25078, 'METADATA_BLOCK_PICTURE real length ok' );
     is( unpack( 'H*', substr( $pic->{image_data}, 0, 4 ) ), 'ffd8ffe0', 'METADATA_BLOCK_PICTURE JPEG picture data ok ');
+    is( unpack( 'H*', substr( $pic->{image_data}, -2 ) ), 'ffd9', 'METADATA_BLOCK_PICTURE JPEG picture end ok' );
 
     is( length( $pic2->{image_data} ), 1761, 'METADATA_BLOCK_PICTURE pic2 real length ok' );
     is( unpack( 'H*', substr( $pic2->{image_data}, 0, 4 ) ), 'ffd8ffe0', 'METADATA_BLOCK_PICTURE JPEG pic2 data ok ');
@@ -168,8 +171,8 @@ eval {
 
     my $info = $s->{info};
 
-    is($info->{bitrate_average}, 2028, 'Bug1155-2 bitrate ok');
-    is($info->{song_length_ms}, 5864, 'Bug1155-2 duration ok');
+    is($info->{bitrate_average}, 1189, 'Bug1155-2 bitrate ok');
+    is($info->{song_length_ms}, 10000, 'Bug1155-2 duration ok');
 }
 
 {
@@ -177,8 +180,8 @@ eval {
 
     my $info = $s->{info};
 
-    is($info->{bitrate_average}, 633, 'Bug803 bitrate ok');
-    is($info->{song_length_ms}, 219104, 'Bug803 song length ok');
+    is($info->{bitrate_average}, 631, 'Bug803 bitrate ok');
+    is($info->{song_length_ms}, 219693, 'Bug803 song length ok');
 }
 
 {
@@ -187,8 +190,8 @@ eval {
     my $info = $s->{info};
     my $tags = $s->{tags};
 
-    is($info->{bitrate_average}, 534, 'Bug905 bitrate ok');
-    is($info->{song_length_ms}, 223484, 'Bug905 song length ok');
+    is($info->{bitrate_average}, 528, 'Bug905 bitrate ok');
+    is($info->{song_length_ms}, 225986, 'Bug905 song length ok');
     is($tags->{DATE}, '08-05-1998', 'Bug905 date ok');
 }
 
@@ -262,8 +265,49 @@ eval {
 
     my $info = $s->{info};
 
-    is( $info->{bitrate_average}, 128000, 'Multiple bitstreams bitrate ok' );
-    is( $info->{song_length_ms}, 0, 'Multiple bitstreams length ok' );
+    # Duration comes from the last page of the first stream
+    is( $info->{bitrate_average}, 1437, 'Multiple bitstreams bitrate ok' );
+    is( $info->{song_length_ms}, 48227, 'Multiple bitstreams length ok' );
+
+    # The second stream starts after the only audio page of the first one
+    my $offset = Audio::Scan->find_frame( _f('multiple-bitstreams.ogg'), 30000 );
+    is( $offset, 4380, 'Multiple bitstreams find_frame ok' );
+}
+
+# Pages of another stream between the audio pages are skipped when seeking
+{
+    my @ours  = _pages( _f('normal.ogg') );
+    my $other = ( _pages( _f('multiple-bitstreams.ogg') ) )[0];
+
+    my $tmp = File::Temp->new( SUFFIX => '.ogg' );
+    binmode $tmp;
+    print $tmp join( '', @ours[0..2], map { ( $_, $other ) } @ours[3..$#ours] );
+    close $tmp;
+
+    my $info = Audio::Scan->scan_info( $tmp->filename )->{info};
+    is( $info->{song_length_ms}, 1019, 'Multiplexed stream length ok' );
+
+    is( Audio::Scan->find_frame( $tmp->filename, 500 ), 8259, 'Multiplexed find_frame before other pages ok' );
+    is( Audio::Scan->find_frame( $tmp->filename, 800 ), 12439 + 58, 'Multiplexed find_frame after one other page ok' );
+    is( Audio::Scan->find_frame( $tmp->filename, 1000 ), 16602 + 2 * 58, 'Multiplexed find_frame after two other pages ok' );
+}
+
+# No page within the backward search window, duration from the nominal bitrate
+{
+    open my $fh, '<', _f('normal.ogg');
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    my $tmp = File::Temp->new( SUFFIX => '.ogg' );
+    binmode $tmp;
+    print $tmp $data . ( "\0" x 700_000 );
+    close $tmp;
+
+    my $info = Audio::Scan->scan_info( $tmp->filename )->{info};
+
+    is( $info->{bitrate_average}, 112000, 'Trailer past the search window nominal bitrate ok' );
+    is( $info->{song_length_ms}, 50000, 'Trailer past the search window length from bitrate ok' );
 }
 
 # RT 118888, file with bad terminal header page was causing a crash trying to read non-existent comments
@@ -275,7 +319,31 @@ eval {
     my $info = $s->{info};
 
     is( $info->{audio_size}, 10210, 'Incorrect terminal header page audio_size ok' );
-    is( $info->{song_length_ms}, 387, 'Incorrect terminal header page song_length_ms ok' );
+    is( $info->{song_length_ms}, 535, 'Incorrect terminal header page song_length_ms ok' );
+
+    # Comment header shares a page with the setup header and audio
+    is( $s->{tags}->{VENDOR}, 'Xiph.Org libVorbis I 20030909', 'Comment header on audio page ok' );
+}
+
+sub _pages {
+    my $file = shift;
+
+    open my $fh, '<', $file or die "Cannot open $file: $!";
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    my @pages;
+    my $pos = 0;
+    while ( $pos < length $data ) {
+        my $segments = ord substr( $data, $pos + 26, 1 );
+        my $size = 27 + $segments;
+        $size += $_ for unpack 'C*', substr( $data, $pos + 27, $segments );
+        push @pages, substr( $data, $pos, $size );
+        $pos += $size;
+    }
+
+    return @pages;
 }
 
 sub _f {
@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp;
 use FindBin ();
-use Test::More tests => 74;
+use Test::More tests => 81;
 
 use Audio::Scan;
 
@@ -132,13 +133,13 @@ eval {
   my $info = $s->{info};
   my $tags = $s->{tags};
   
-  is($info->{bitrate_average}, 419457, 'Bitrate ok');
+  is($info->{bitrate_average}, 419786, 'Bitrate ok');
   is($info->{channels}, 6, 'Channels ok');
   is($info->{file_size}, 200704, 'File size ok' );
   is($info->{stereo}, 0, 'Stereo ok');
   is($info->{samplerate}, 48000, 'Sample Rate ok');
   is($info->{input_samplerate}, 48000, 'Input Sample Rate ok');
-  is($info->{song_length_ms}, 3825, 'Song length ok');
+  is($info->{song_length_ms}, 3822, 'Song length ok'); # last page is truncated
   is($info->{audio_offset}, 151, 'Audio offset ok');
   is($info->{audio_size}, 200553, 'Audio size ok');
   is($info->{audio_md5}, '41942e1bf1b794cf3b2eac34f8f797cd', 'Audio MD5 ok' );
@@ -146,6 +147,66 @@ eval {
   is($tags->{VENDOR}, "opus-tools 0.1.0 (using libopus 0.9.10-83-g7143b2d)\n", 'vendor tag ok' );
 }
 
+# Find frame
+{
+  my $offset = Audio::Scan->find_frame( _f('test-8-7.1.opus'), 5000 );
+
+  is( $offset, 161397, 'Find frame ok' );
+
+  $offset = Audio::Scan->find_frame( _f('tron.6ch.tinypkts.opus'), 1000 );
+
+  is( $offset, 51896, 'Find frame with small pages ok' );
+
+  open my $fh, '<', _f('tron.6ch.tinypkts.opus');
+
+  $offset = Audio::Scan->find_frame_fh( opus => $fh, 3821 );
+
+  is( $offset, 200188, 'Find frame in last complete page via filehandle ok' );
+
+  close $fh;
+}
+
+# Trailing data after the last page, found while the search window grows but not
+# past its maximum
+{
+  open my $fh, '<', _f('test-2-stereo.opus');
+  binmode $fh;
+  my $data = do { local $/; <$fh> };
+  close $fh;
+
+  my $tmp = File::Temp->new( SUFFIX => '.opus' );
+  binmode $tmp;
+  print $tmp $data . ( "\0" x 400_000 );
+  close $tmp;
+
+  my $info = Audio::Scan->scan_info( $tmp->filename )->{info};
+  is( $info->{song_length_ms}, 2925, 'Song length with large trailer ok' );
+  is( Audio::Scan->find_frame( $tmp->filename, 1000 ), 147, 'Find frame with large trailer ok' );
+
+  $tmp = File::Temp->new( SUFFIX => '.opus' );
+  binmode $tmp;
+  print $tmp $data . ( "\0" x 700_000 );
+  close $tmp;
+
+  $info = Audio::Scan->scan_info( $tmp->filename )->{info};
+  ok( !exists $info->{song_length_ms}, 'No song length with trailer past the search window ok' );
+}
+
+# Vorbis file with an .opus suffix can't be seeked
+{
+  open my $fh, '<', catfile( $FindBin::Bin, 'ogg', 'normal.ogg' );
+  binmode $fh;
+  my $data = do { local $/; <$fh> };
+  close $fh;
+
+  my $tmp = File::Temp->new( SUFFIX => '.opus' );
+  binmode $tmp;
+  print $tmp $data;
+  close $tmp;
+
+  is( Audio::Scan->find_frame( $tmp->filename, 1000 ), -1, 'Find frame in non-Opus file ok' );
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'opus', shift );
 }
@@ -1,8 +1,10 @@
 use strict;
 
+use Config;
 use File::Spec::Functions;
+use File::Temp ();
 use FindBin ();
-use Test::More tests => 58;
+use Test::More tests => 99;
 
 use Audio::Scan;
 
@@ -136,6 +138,222 @@ use Audio::Scan;
     is( $info->{song_length_ms}, 20000, 'GH#2, song_length_ms ok for 32/384 file with a high number of samples' );
 }
 
+# RF64, sizes in the ds64 chunk
+{
+    my @chunks = _chunks( _f('wav32.wav') );
+    my ($fact) = map { unpack 'V', $_->[1] } grep { $_->[0] eq 'fact' } @chunks;
+
+    my $ds64 = pack 'VV VV VV V', 0, 0, 3808, 0, $fact, 0, 0;
+    my $data = 'RF64' . pack('V', 0xFFFFFFFF) . 'WAVE' . 'ds64' . pack('V', length $ds64) . $ds64;
+    for my $c (@chunks) {
+        my $size = $c->[0] eq 'data' ? 0xFFFFFFFF : length $c->[1];
+        my $body = $c->[0] eq 'fact' ? pack('V', 0xFFFFFFFF) : $c->[1];
+        $data .= $c->[0] . pack('V', $size) . $body;
+    }
+
+    my $s = Audio::Scan->scan( _tmp( $data, '.wav' ) );
+    my $info = $s->{info};
+
+    is( $info->{audio_offset}, 124, 'RF64 audio offset ok' );
+    is( $info->{audio_size}, 3808, 'RF64 audio size ok' );
+    is( $info->{song_length_ms}, 10, 'RF64 duration from ds64 sample count ok' );
+    is( $info->{samplerate}, 44100, 'RF64 samplerate ok' );
+    is( $info->{peak}->[0]->{position}, 284, 'RF64 chunk after ds64 ok' );
+
+    my $rf64 = _tmp( $data, '.wav' );
+    my $seek = Audio::Scan->find_frame_return_info( $rf64, 5 );
+    $s = Audio::Scan->scan( _seeked( $rf64, $seek, '.wav' ) );
+
+    is( $s->{info}->{audio_size}, 2048, 'RF64 seeked ds64 data size ok' );
+    is( $s->{info}->{song_length_ms}, 5, 'RF64 seeked ds64 sample count ok' );
+
+    # A data chunk over 4GB, truncated after the header
+    SKIP: {
+        skip 'needs 64-bit integers', 2 unless $Config{ivsize} >= 8;
+
+        $ds64 = pack 'VV VV VV V', 0, 0, 0x2A05F200, 1, 0, 0, 0;
+        $data = 'BW64' . pack('V', 0xFFFFFFFF) . 'WAVE' . 'ds64' . pack('V', length $ds64) . $ds64;
+        $data .= 'fmt ' . pack('V', 16) . $chunks[0]->[1];
+        $data .= 'data' . pack('V', 0xFFFFFFFF) . ( "\0" x 1024 );
+
+        $s = Audio::Scan->scan( _tmp( $data, '.wav' ) );
+
+        is( $s->{info}->{audio_size}, 5_000_000_000, 'BW64 data size over 4GB ok' );
+        is( $s->{info}->{song_length_ms}, 14172335, 'BW64 duration over 4GB ok' );
+    }
+}
+
+# Sony Wave64
+{
+    my $suffix = pack 'H*', 'f3acd3118cd100c04f8edb8a';
+    my %guid = (
+        'riff' => 'riff' . pack( 'H*', '2e91cf11a5d628db04c10000' ),
+        'list' => 'list' . pack( 'H*', '2f91cf11a5d628db04c10000' ),
+        'wave' => 'wave' . $suffix,
+        'fmt ' => 'fmt ' . $suffix,
+        'fact' => 'fact' . $suffix,
+        'data' => 'data' . $suffix,
+        'junk' => 'knuj' . $suffix,
+    );
+
+    # A list and junk chunk before the audio, both skipped
+    my @chunks = _chunks( _f('8kmp38.wav') );
+    splice @chunks, 2, 0, [ 'list', 'INFO' ], [ 'junk', "\0" x 12 ];
+
+    my $data = '';
+    for my $c (@chunks) {
+        my $body = $c->[1];
+        $data .= $guid{ $c->[0] } . pack('VV', 24 + length $body, 0) . $body;
+        $data .= "\0" x ( -length($body) % 8 );
+    }
+    $data = $guid{riff} . pack('VV', 40 + length $data, 0) . $guid{wave} . $data;
+
+    my $s = Audio::Scan->scan( _tmp( $data, '.w64' ) );
+    my $info = $s->{info};
+
+    is( $info->{audio_offset}, 224, 'Wave64 audio offset ok' );
+    is( $info->{audio_size}, 13514, 'Wave64 audio size ok' );
+    is( $info->{bitrate}, 8000, 'Wave64 bitrate ok' );
+    is( $info->{format}, 85, 'Wave64 format ok' );
+    is( $info->{song_length_ms}, 13811, 'Wave64 length from fact ok' );
+    is( $info->{file_size}, length $data, 'Wave64 file size ok' );
+
+    # Known chunks are skipped without warnings
+    my $err = File::Temp->new;
+    open my $olderr, '>&', \*STDERR;
+    open STDERR, '>', $err->filename;
+    Audio::Scan->scan( _tmp( $data, '.w64' ) );
+    open STDERR, '>&', $olderr;
+    is( -s $err->filename, 0, 'Wave64 list and junk GUIDs ok' );
+
+    my $w64 = _tmp( $data, '.w64' );
+    my $seek = Audio::Scan->find_frame_return_info( $w64, 5000 );
+    $s = Audio::Scan->scan( _seeked( $w64, $seek, '.w64' ) );
+
+    is( $seek->{seek_offset}, 224 + 5000, 'Wave64 seek_offset ok' );
+    is( $s->{info}->{audio_size}, 13514 - 5000, 'Wave64 seeked data size ok' );
+}
+
+# PCM analysis
+{
+    my $r = Audio::Scan->pcm_analysis( _f('wav32.wav') );
+
+    is( $r->{analyzed_frames}, 476, 'WAV analysis frames ok' );
+    is( $r->{sample_peak}->[0]->{position}, $r->{peak}->[0]->{position}, 'WAV analysis peak 1 matches PEAK chunk' );
+    is( $r->{sample_peak}->[1]->{value}, $r->{peak}->[1]->{value}, 'WAV analysis peak 2 matches PEAK chunk' );
+    like( $r->{rms}->[0], qr/^0.2147/, 'WAV analysis RMS ok' );
+    ok( !exists $r->{loudness}, 'WAV analysis no loudness for a file under 400ms' );
+
+    # EBU Tech 3341 case 1, 1kHz sine at -23 dBFS in both channels is -23 LUFS
+    my $rate = 48000;
+    my $amp = 10 ** (-23 / 20);
+    my @sine = map { $amp * sin( 2 * 3.14159265358979 * 1000 * $_ / $rate ) } 0 .. $rate * 5 - 1;
+
+    for my $test (
+        [ 's16', 1, 16, pack( 's<*', map { ( int( $_ * 32767.5 ), int( $_ * 32767.5 ) ) } @sine ) ],
+        [ 'f64', 3, 64, pack( 'd<*', map { ( $_, $_ ) } @sine ) ],
+    ) {
+        my ( $name, $format, $bits, $audio ) = @{$test};
+        my $align = 2 * $bits / 8;
+        my $fmt = 'fmt ' . pack( 'V', 16 ) . pack( 'vvVVvv', $format, 2, $rate, $rate * $align, $align, $bits );
+        my $data = 'RIFF' . pack( 'V', 4 + length($fmt) + 8 + length $audio ) . 'WAVE' . $fmt . 'data' . pack( 'V', length $audio ) . $audio;
+
+        $r = Audio::Scan->pcm_analysis( _tmp( $data, '.wav' ) );
+
+        ok( abs( $r->{loudness} + 23 ) < 0.1, "WAV $name analysis loudness ok" );
+        ok( abs( $r->{sample_peak}->[1]->{value} - $amp ) < 0.0001, "WAV $name analysis peak ok" );
+        ok( abs( $r->{rms}->[1] - $amp / sqrt(2) ) < 0.0001, "WAV $name analysis RMS ok" );
+    }
+
+    # Compressed audio can't be analyzed
+    $r = Audio::Scan->pcm_analysis( _f('8kmp38.wav') );
+
+    ok( !exists $r->{sample_peak}, 'WAV analysis skips MP3 in WAV' );
+
+    open my $fh, '<', _f('wav32.wav');
+    $r = Audio::Scan->pcm_analysis_fh( wav => $fh );
+    close $fh;
+    is( $r->{analyzed_frames}, 476, 'WAV analysis with filehandle ok' );
+
+    # Other formats are not handed to the WAV parser
+    $r = Audio::Scan->pcm_analysis( catfile( $FindBin::Bin, 'mp3', 'no-tags-mp1l2.mp3' ) );
+    ok( !defined $r, 'Analysis of an MP3 file returns undef' );
+}
+
+sub _chunks {
+    my $file = shift;
+
+    open my $fh, '<', $file or die "Cannot open $file: $!";
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    my @chunks;
+    my $pos = 12;
+    while ( $pos + 8 <= length $data ) {
+        my ($id, $size) = unpack 'a4V', substr $data, $pos, 8;
+        push @chunks, [ $id, substr $data, $pos + 8, $size ];
+        $pos += 8 + $size + ( $size % 2 );
+    }
+
+    return @chunks;
+}
+
+sub _tmp {
+    my ($data, $suffix) = @_;
+
+    my $tmp = File::Temp->new( SUFFIX => $suffix );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
+# Seeking, the header is rewritten for the remaining audio
+{
+    my $file = _f('wav32.wav');
+
+    is( Audio::Scan->find_frame( $file, 5 ), 1848, 'WAV find_frame ok' );
+    is( Audio::Scan->find_frame( $file, 20 ), -1, 'WAV find_frame past the end ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 5 );
+
+    is( $info->{seek_offset}, 1848, 'WAV seek_offset ok' );
+    is( length $info->{seek_header}, 88, 'WAV seek_header length ok' );
+
+    my $s = Audio::Scan->scan( _seeked( $file, $info, '.wav' ) );
+
+    is( $s->{info}->{audio_offset}, 88, 'WAV seeked audio_offset ok' );
+    is( $s->{info}->{audio_size}, 2048, 'WAV seeked audio_size ok' );
+    is( $s->{info}->{song_length_ms}, 5, 'WAV seeked fact duration ok' );
+    is( $s->{info}->{peak}->[0]->{position}, 284, 'WAV seeked chunks before data ok' );
+
+    # Compressed audio is rounded down to block_align
+    is( Audio::Scan->find_frame( _f('8kmp38.wav'), 5000 ), 70 + 5000, 'MP3 WAV find_frame ok' );
+}
+
+sub _seeked {
+    my ( $file, $info, $suffix ) = @_;
+
+    open my $fh, '<', $file or die "Cannot open $file: $!";
+    binmode $fh;
+    seek $fh, $info->{seek_offset}, 0;
+    my $data = $info->{seek_header} . do { local $/; <$fh> };
+    close $fh;
+
+    my $tmp = File::Temp->new( SUFFIX => $suffix );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'wav', shift );
 }
@@ -1,8 +1,9 @@
 use strict;
 
 use File::Spec::Functions;
+use File::Temp;
 use FindBin ();
-use Test::More tests => 79;
+use Test::More tests => 103;
 
 use Audio::Scan;
 
@@ -157,6 +158,122 @@ use Audio::Scan;
     is( $info->{total_samples}, 2947973120, 'v5-dsd total_samples ok' );
 }
 
+# Seeking
+{
+    my $file = _f('silence-44-s.wv');
+
+    is( Audio::Scan->find_frame( $file, 0 ), 0, 'Seek to start ok' );
+    is( Audio::Scan->find_frame( $file, 1000 ), 9474, 'Seek to 1000ms ok' );
+    is( Audio::Scan->find_frame( $file, 3400 ), 31512, 'Seek to last block ok' );
+    is( Audio::Scan->find_frame( $file, 5000 ), -1, 'Seek past end ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 1500 );
+    is( $info->{seek_offset}, 14150, 'find_frame_return_info seek_offset ok' );
+    is( $info->{seek_sample}, 66150, 'find_frame_return_info seek_sample ok' );
+    is( $info->{samplerate}, 44100, 'find_frame_return_info info ok' );
+
+    is( Audio::Scan->find_frame( _f('zero-first-block.wv'), 0 ), 78, 'Seek skips block without audio ok' );
+    is( Audio::Scan->find_frame( _f('win-executable.wv'), 0 ), 30720, 'Seek skips junk ok' );
+    is( Audio::Scan->find_frame( _f('v3.wv'), 0 ), -1, 'Seek in old version not supported ok' );
+
+    # DSD blocks count bytes of 8 samples
+    $info = Audio::Scan->find_frame_return_info( _f('v5-dsd.wv'), 300 );
+    is( $info->{seek_offset}, 398, 'DSD seek_offset ok' );
+    is( $info->{seek_sample}, 705600, 'DSD seek_sample ok' );
+}
+
+# Block index
+{
+    my $file = _f('silence-44-s.wv');
+
+    my $index = Audio::Scan->block_index( $file, { interval_ms => 0 } );
+    is( $index->{blocks}, 8, 'block_index blocks ok' );
+    is( $index->{seekpoints}, 8, 'block_index seekpoints ok' );
+    is( $index->{total_samples}, 162496, 'block_index total_samples ok' );
+    is_deeply(
+        [ unpack '(Q>Q>)*', $index->{seektable} ],
+        [ 0, 0, 22050, 4746, 44100, 9474, 66150, 14150, 88200, 18844, 110250, 23580, 132300, 28270, 147398, 31512 ],
+        'block_index seektable ok'
+    );
+
+    $index = Audio::Scan->block_index( $file, { interval_ms => 1000 } );
+    is( $index->{seekpoints}, 4, 'block_index interval_ms ok' );
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 3400, { seektable => $index->{seektable} } );
+    is( $info->{seek_offset}, 31512, 'Seek with seektable ok' );
+
+    open my $fh, '<', $file;
+    $index = Audio::Scan->block_index_fh( wv => $fh );
+    close $fh;
+    is( $index->{blocks}, 8, 'block_index_fh ok' );
+
+    # Other formats are not handed to the WavPack parser
+    $index = Audio::Scan->block_index( catfile( $FindBin::Bin, 'mp3', 'no-tags-mp1l2.mp3' ) );
+    ok( !defined $index, 'block_index on an MP3 file returns undef' );
+}
+
+# Junk shorter than a block header before the end of the file
+{
+    my $index = Audio::Scan->block_index( _tmp( 'x' x 33 ) );
+    ok( !$index->{blocks}, 'block_index on a file without blocks ok' );
+}
+
+# Larger file with multichannel groups, built from the blocks of the silence file:
+# each block is followed by a copy without the initial block flag, as for a second
+# pair of channels, and the blocks are repeated with increasing block_index
+{
+    open my $fh, '<', _f('silence-44-s.wv');
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    my @blocks;
+    my $pos = 0;
+    for ( 1..8 ) {
+        my $size = unpack( 'V', substr( $data, $pos + 4, 4 ) ) + 8;
+        push @blocks, substr( $data, $pos, $size );
+        $pos += $size;
+    }
+
+    my $total = 200 * 22050;
+    my $wv = '';
+    my @offsets;
+    for my $i ( 0..199 ) {
+        my $block = $blocks[ $i % 6 ];
+        substr( $block, 12, 4, pack( 'V', $total ) );
+        substr( $block, 16, 4, pack( 'V', $i * 22050 ) );
+
+        my $second = $block;
+        my $flags = unpack( 'V', substr( $second, 24, 4 ) );
+        substr( $second, 24, 4, pack( 'V', $flags & ~0x800 ) );
+
+        push @offsets, length($wv);
+        $wv .= $block . $second;
+    }
+
+    my $file = _tmp($wv);
+
+    my $info = Audio::Scan->find_frame_return_info( $file, 73_456 );
+    is( $info->{seek_sample}, 146 * 22050, 'Multichannel seek_sample ok' );
+    is( $info->{seek_offset}, $offsets[146], 'Multichannel seek_offset ok' );
+
+    my $index = Audio::Scan->block_index( $file );
+    is( $index->{blocks}, 200, 'Multichannel block_index blocks ok' );
+}
+
+sub _tmp {
+    my $data = shift;
+
+    my $tmp = File::Temp->new( SUFFIX => '.wv' );
+    binmode $tmp;
+    print $tmp $data;
+    close $tmp;
+
+    push our @tmp, $tmp;
+
+    return $tmp->filename;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'wavpack', shift );
 }